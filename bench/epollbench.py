@@ -0,0 +1,159 @@
+"""
+epollbench.py
+
+Local socket throughput and wakeup latency of lijy.NativeEpoll and
+lijy.NativeSocket (src/jyepoll.c) against Jython's socket and select
+modules, which emulate CPython's over Java NIO. Run by "make epollbench"
+with the launcher.
+
+Connections/sec: a client connects to a listening socket on 127.0.0.1,
+the server side waits for readiness, accepts, reads one byte, writes it
+back, and both sides close; CONNECTIONS times per round.
+
+Wakeup latency: one thread waits in a poll, another wakes it (eventfd
+for the natives, one byte over a connected socket pair for select) and
+the time from the wake to the return of the poll is measured; the median
+of WAKEUPS is reported in microseconds.
+"""
+
+import select
+import socket
+import threading
+import time
+
+import jarray
+from java.lang import System
+from lijy import NativeEpoll, NativeSocket
+
+CONNECTIONS = 2000
+ROUNDS = 5
+WAKEUPS = 2000
+
+
+def report(name, times, unit, scale):
+    times.sort()
+    print '%-36s %10.1f %s' % (name, scale(times[len(times) // 2]), unit)
+
+
+def native_connections(n):
+    ep = NativeEpoll.create()
+    server = NativeSocket.listen('127.0.0.1', 0, 128)
+    port = NativeSocket.port(server)
+    NativeEpoll.add(ep, server, NativeEpoll.IN)
+    fds, events = jarray.zeros(64, 'i'), jarray.zeros(64, 'i')
+    byte = jarray.zeros(1, 'b')
+    start = System.nanoTime()
+    for i in xrange(n):
+        client = NativeSocket.connect('127.0.0.1', port)
+        NativeEpoll.wait(ep, fds, events, 1000)
+        conn = NativeSocket.accept(server)
+        NativeSocket.write(client, byte, 0, 1)
+        NativeEpoll.add(ep, conn, NativeEpoll.IN)
+        NativeEpoll.wait(ep, fds, events, 1000)
+        NativeSocket.read(conn, byte, 0, 1)
+        NativeSocket.write(conn, byte, 0, 1)
+        NativeSocket.close(conn)
+        NativeSocket.close(client)
+    elapsed = System.nanoTime() - start
+    NativeSocket.close(server)
+    NativeSocket.close(ep)
+    return elapsed
+
+
+def jython_connections(n):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('127.0.0.1', 0))
+    server.listen(128)
+    server.setblocking(0)
+    address = server.getsockname()
+    start = System.nanoTime()
+    for i in xrange(n):
+        client = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        client.connect(address)
+        select.select([server], [], [], 1.0)
+        conn, peer = server.accept()
+        client.send('x')
+        select.select([conn], [], [], 1.0)
+        conn.send(conn.recv(1))
+        conn.close()
+        client.close()
+    elapsed = System.nanoTime() - start
+    server.close()
+    return elapsed
+
+
+def connections():
+    for name, run in (('NativeEpoll connections', native_connections),
+                      ('select.select connections', jython_connections)):
+        run(CONNECTIONS // 10)
+        times = [run(CONNECTIONS) for r in xrange(ROUNDS)]
+        report(name, times, 'conn/s', lambda t: CONNECTIONS * 1e9 / t)
+
+
+def native_wakeups(n):
+    ep = NativeEpoll.create()
+    efd = NativeEpoll.eventfd()
+    NativeEpoll.add(ep, efd, NativeEpoll.IN)
+    fds, events = jarray.zeros(4, 'i'), jarray.zeros(4, 'i')
+    buf = jarray.zeros(8, 'b')
+    sent = [0]
+    latencies = []
+
+    def waker():
+        for i in xrange(n):
+            time.sleep(0.0002)
+            sent[0] = System.nanoTime()
+            NativeEpoll.wake(efd)
+    t = threading.Thread(target=waker)
+    t.start()
+    for i in xrange(n):
+        while NativeEpoll.wait(ep, fds, events, 1000) == 0:
+            pass
+        latencies.append(System.nanoTime() - sent[0])
+        NativeSocket.read(efd, buf, 0, 8)
+    t.join()
+    NativeSocket.close(efd)
+    NativeSocket.close(ep)
+    return latencies
+
+
+def jython_wakeups(n):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.bind(('127.0.0.1', 0))
+    server.listen(1)
+    writer = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    writer.connect(server.getsockname())
+    reader, peer = server.accept()
+    reader.setblocking(0)
+    sent = [0]
+    latencies = []
+
+    def waker():
+        for i in xrange(n):
+            time.sleep(0.0002)
+            sent[0] = System.nanoTime()
+            writer.send('x')
+    t = threading.Thread(target=waker)
+    t.start()
+    for i in xrange(n):
+        while not select.select([reader], [], [], 1.0)[0]:
+            pass
+        latencies.append(System.nanoTime() - sent[0])
+        reader.recv(64)
+    t.join()
+    for s in reader, writer, server:
+        s.close()
+    return latencies
+
+
+def wakeups():
+    for name, run in (('NativeEpoll eventfd wakeup', native_wakeups),
+                      ('select.select socket wakeup', jython_wakeups)):
+        run(WAKEUPS // 10)
+        report(name, run(WAKEUPS), 'us', lambda t: t / 1e3)
+
+
+if __name__ == '__main__':
+    connections()
+    wakeups()
@@ -0,0 +1,97 @@
+"""
+ffibench.py
+
+Per-call latency of C calls from Jython, run by "make ffibench" with the
+launcher: lijy.NativeFFI (src/jyffi.c) against JNA, the usual way to call
+C from Jython. JNA is measured if its jar is on the class path, e.g.
+make ffibench JNA_JAR=/usr/share/java/jna.jar.
+
+Two functions are called: labs(3) from libc, which takes a long, and
+zlib's crc32 over a 64-byte array, the kind of small routine that is
+called millions of times. For each way of calling, the median of 7
+rounds of 200000 calls (after a warm-up round, so the JIT has compiled
+what it will) is reported in nanoseconds per call. java.util.zip.CRC32
+is listed for reference.
+"""
+
+import jarray
+from java.lang import Integer, Long, Object, System
+from lijy import NativeFFI
+
+CALLS = 200000
+ROUNDS = 7
+DATA = jarray.array([i & 0x7f for i in xrange(64)], 'b')
+
+
+def measure(name, loop):
+    loop(CALLS)
+    times = []
+    for r in xrange(ROUNDS):
+        start = System.nanoTime()
+        loop(CALLS)
+        times.append(System.nanoTime() - start)
+    times.sort()
+    print '%-36s %8.1f ns/call' % (name, float(times[ROUNDS // 2]) / CALLS)
+
+
+def nativeffi():
+    call, callBuffer = NativeFFI.call, NativeFFI.callBuffer
+    labs = NativeFFI.prepare(NativeFFI.symbol(NativeFFI.open(None), 'labs'), 'l(l)')
+    crc32 = NativeFFI.prepare(NativeFFI.symbol(NativeFFI.open('libz.so.1'), 'crc32'), 'l(lbi)')
+    invoke = NativeFFI.invoke
+    ints, doubles = jarray.array([-5], 'l'), jarray.zeros(0, 'd')
+
+    def labs_loop(n):
+        for i in xrange(n):
+            call(labs, -5)
+
+    def labs_invoke_loop(n):
+        for i in xrange(n):
+            invoke(labs, ints, doubles)
+
+    def crc_loop(n):
+        for i in xrange(n):
+            callBuffer(crc32, DATA, 0, 64)
+    measure('NativeFFI.call labs', labs_loop)
+    measure('NativeFFI.invoke labs', labs_invoke_loop)
+    measure('NativeFFI.callBuffer crc32', crc_loop)
+
+
+def jna():
+    try:
+        from com.sun.jna import NativeLibrary
+    except ImportError:
+        print '%-36s %8s' % ('JNA', 'no jar')
+        return
+    labs = NativeLibrary.getInstance('c').getFunction('labs')
+    crc32 = NativeLibrary.getInstance('libz.so.1').getFunction('crc32')
+    # built once, JNA gets boxed arguments as a Java caller would pass them
+    labsArgs = jarray.array([Long(-5)], Object)
+    crcArgs = jarray.array([Long(0), DATA, Integer(64)], Object)
+
+    def labs_loop(n):
+        for i in xrange(n):
+            labs.invokeLong(labsArgs)
+
+    def crc_loop(n):
+        for i in xrange(n):
+            crc32.invokeLong(crcArgs)
+    measure('JNA Function.invokeLong labs', labs_loop)
+    measure('JNA Function.invokeLong crc32', crc_loop)
+
+
+def java():
+    from java.util.zip import CRC32
+
+    def crc_loop(n):
+        for i in xrange(n):
+            c = CRC32()
+            c.update(DATA, 0, 64)
+            c.getValue()
+    measure('java.util.zip.CRC32 (reference)', crc_loop)
+
+
+if __name__ == '__main__':
+    nativeffi()
+    jna()
+    java()
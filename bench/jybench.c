@@ -0,0 +1,487 @@
+/*
+ * jybench.c
+ *
+ * End-to-end startup benchmark for the launcher, run by "make bench".
+ *
+ * Runs build/jython over a matrix of scenarios (--print, -c pass, a
+ * hello-world script, --boot, Jython homes with a small and with a large
+ * javalib, the plain java command that --print emits, and a few os calls
+ * made through jnr-posix and through lijy.NativePosix, see
+ * src/jyposix.c), each with warm and with simulated-cold page cache. For
+ * cold runs all files of the Jython home and of the JDK are evicted with
+ * posix_fadvise (POSIX_FADV_DONTNEED) before every repetition; pages
+ * that are mapped or dirty stay cached, so this approximates a cold
+ * start, it does not reproduce one.
+ *
+ * For every scenario it reports median/p90/p99 wall time, median CPU
+ * time (user + system) and median max RSS over all repetitions. With
+ * --save the results are written to the baseline file; otherwise they
+ * are compared against it and the exit status is 1 if the median or p90
+ * wall time of any scenario got slower than the threshold allows.
+ *
+ * Usage: jybench [options]
+ *   -j <path>        launcher to benchmark (default ./build/jython)
+ *   -H <dir>         Jython home (default $JYTHON_HOME)
+ *   -n <reps>        repetitions per scenario (default 30)
+ *   -b <file>        baseline file (default ./bench/baseline.json)
+ *   -t <percent>     allowed slowdown vs. baseline (default 10)
+ *   -J <count>       extra jars in the large javalib (default 200)
+ *   -s <substring>   only run scenarios whose name contains it
+ *   --save           write results as new baseline
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define maxArgs 512
+#define maxScenarios 32
+#define warmupRuns 3
+#define defaultReps 30
+#define defaultThreshold 10.0
+#define defaultExtraJars 200
+#define defaultBaseline "./bench/baseline.json"
+#define defaultLauncher "./build/jython"
+
+/*
+ * The same calls through Jython's os module (jnr-posix) and the launcher's
+ * natives. Both import os, so that os.py and posixpath are not counted as
+ * jnr-posix's cost.
+ */
+#define posixJnr "import os; os.stat('.'); os.listdir('.'); os.getpid(); os.umask(os.umask(0))"
+#define posixNative "import os; from lijy import NativePosix as p; p.stat('.', True); p.listdir('.'); " \
+		"p.getpid(); p.umask(p.umask(0))"
+
+typedef struct {
+	char name[64];
+	char* argv[maxArgs];  /* argv[0] is the executable */
+	const char* home;     /* JYTHON_HOME for the run, NULL: inherit */
+	int cold;
+	/* results */
+	int runs;
+	int failures;
+	double* wall;         /* ms */
+	double* cpu;          /* ms */
+	double* rss;          /* kB */
+	double wallMedian, wallP90, wallP99, cpuMedian, rssMedian;
+} Scenario;
+
+static Scenario scenarios[maxScenarios];
+static int scenarioCount = 0;
+static char tmpDir[PATH_MAX/2];
+static char jdkHome[PATH_MAX];
+static const char* jythonHome = NULL;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static void die(const char* msg) {
+	fprintf(stderr, "jybench: %s%s%s\n", msg, errno ? ": " : "", errno ? strerror(errno) : "");
+	exit(2);
+}
+
+static Scenario* addScenario(const char* name, const char* home, int cold, ...) {
+	/* varargs: argv entries, NULL-terminated */
+	Scenario* s;
+	va_list ap;
+	char* arg;
+	int i = 0;
+	if (scenarioCount == maxScenarios)
+		die("too many scenarios");
+	s = &scenarios[scenarioCount++];
+	memset(s, 0, sizeof(Scenario));
+	snprintf(s->name, sizeof(s->name), "%s%s", name, cold ? "/cold" : "");
+	s->home = home;
+	s->cold = cold;
+	va_start(ap, cold);
+	while ((arg = va_arg(ap, char*)) != NULL && i < maxArgs-1)
+		s->argv[i++] = arg;
+	va_end(ap);
+	return s;
+}
+
+/*
+ * Runs argv with stdout and stderr going to /dev/null (or to out, if
+ * given) and returns the exit status; wall/cpu/rss are filled from
+ * the clock and from wait4.
+ */
+static int runOnce(char** argv, const char* home, int out, double* wall, double* cpu, double* rss) {
+	struct rusage ru;
+	int status, devnull;
+	double start = now();
+	pid_t pid = fork();
+	if (pid < 0)
+		die("fork failed");
+	if (pid == 0) {
+		devnull = open("/dev/null", O_RDWR);
+		dup2(devnull, 0);
+		dup2(out >= 0 ? out : devnull, 1);
+		dup2(devnull, 2);
+		if (home != NULL)
+			setenv("JYTHON_HOME", home, 1);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0)
+		die("wait4 failed");
+	*wall = now()-start;
+	*cpu = ru.ru_utime.tv_sec*1000.0 + ru.ru_utime.tv_usec/1000.0
+			+ ru.ru_stime.tv_sec*1000.0 + ru.ru_stime.tv_usec/1000.0;
+	*rss = ru.ru_maxrss;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+}
+
+/* Runs argv and returns its stdout (first 64k), or NULL on failure. */
+static char* captureOutput(char** argv) {
+	static char buf[65536];
+	double wall, cpu, rss;
+	int fd[2], len = 0, n, status;
+	if (pipe(fd) < 0)
+		die("pipe failed");
+	/* --print output is one line, so the pipe buffer cannot fill up */
+	status = runOnce(argv, NULL, fd[1], &wall, &cpu, &rss);
+	close(fd[1]);
+	while (len < (int) sizeof(buf)-1 && (n = read(fd[0], buf+len, sizeof(buf)-1-len)) > 0)
+		len += n;
+	close(fd[0]);
+	buf[len] = 0;
+	return status == 0 && len > 0 ? buf : NULL;
+}
+
+/*
+ * Splits the command line printed by "jython --print" into argv.
+ * --print quotes option values containing spaces as name="value",
+ * so double quotes are the only quoting to handle.
+ */
+static int splitCommand(char* line, char** argv) {
+	int argc = 0;
+	char *src = line, *dst;
+	while (*src && argc < maxArgs-1) {
+		while (*src == ' ' || *src == '\n')
+			++src;
+		if (!*src)
+			break;
+		argv[argc++] = dst = src;
+		while (*src && *src != ' ' && *src != '\n') {
+			if (*src == '"') {
+				++src;
+				while (*src && *src != '"')
+					*dst++ = *src++;
+				if (*src) ++src;
+			} else {
+				*dst++ = *src++;
+			}
+		}
+		if (*src) ++src;
+		*dst = 0;
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+static int evictFile(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+	int fd;
+	if (flag == FTW_F && (fd = open(path, O_RDONLY)) >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+	return 0;
+}
+
+static void evictCaches(const char* launcher) {
+	struct stat st;
+	nftw(jythonHome, evictFile, 32, FTW_PHYS);
+	if (jdkHome[0])
+		nftw(jdkHome, evictFile, 32, FTW_PHYS);
+	if (stat(launcher, &st) == 0)
+		evictFile(launcher, &st, FTW_F, NULL);
+}
+
+static int removeFile(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+	remove(path);
+	return 0;
+}
+
+/*
+ * Creates <tmpDir>/<name> as a Jython home: symlinks to everything in
+ * the real home except javalib, which gets symlinks to the real jars
+ * plus extraJars empty jars.
+ */
+static char* makeHome(const char* name, int extraJars) {
+	static const char emptyZip[22] = {'P', 'K', 5, 6};
+	char *home = malloc(PATH_MAX), src[PATH_MAX], dst[PATH_MAX];
+	struct dirent* e;
+	DIR* dir;
+	FILE* fp;
+	int i;
+	snprintf(home, PATH_MAX, "%s/%s", tmpDir, name);
+	if (mkdir(home, 0755) < 0)
+		die("cannot create Jython home");
+	if ((dir = opendir(jythonHome)) == NULL)
+		die("cannot read Jython home");
+	while ((e = readdir(dir)) != NULL) {
+		if (e->d_name[0] == '.' || strcmp(e->d_name, "javalib") == 0)
+			continue;
+		snprintf(src, PATH_MAX, "%s/%s", jythonHome, e->d_name);
+		snprintf(dst, PATH_MAX, "%s/%s", home, e->d_name);
+		symlink(src, dst);
+	}
+	closedir(dir);
+	snprintf(dst, PATH_MAX, "%s/javalib", home);
+	mkdir(dst, 0755);
+	snprintf(src, PATH_MAX, "%s/javalib", jythonHome);
+	if ((dir = opendir(src)) != NULL) {
+		while ((e = readdir(dir)) != NULL) {
+			if (e->d_name[0] == '.')
+				continue;
+			snprintf(src, PATH_MAX, "%s/javalib/%s", jythonHome, e->d_name);
+			snprintf(dst, PATH_MAX, "%s/javalib/%s", home, e->d_name);
+			symlink(src, dst);
+		}
+		closedir(dir);
+	}
+	for (i = 0; i < extraJars; ++i) {
+		snprintf(dst, PATH_MAX, "%s/javalib/zz-bench-%04d.jar", home, i);
+		if ((fp = fopen(dst, "wb")) == NULL)
+			die("cannot create jar");
+		fwrite(emptyZip, 1, sizeof(emptyZip), fp);
+		fclose(fp);
+	}
+	return home;
+}
+
+static int compareDouble(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of a sorted array */
+static double percentile(double* v, int n, int p) {
+	int rank = (p*n + 99)/100;
+	return n == 0 ? 0 : v[rank < 1 ? 0 : rank-1];
+}
+
+static void runScenario(Scenario* s, int reps) {
+	double wall, cpu, rss;
+	int i;
+	s->wall = malloc(reps*sizeof(double));
+	s->cpu = malloc(reps*sizeof(double));
+	s->rss = malloc(reps*sizeof(double));
+	if (!s->cold) {
+		for (i = 0; i < warmupRuns; ++i)
+			runOnce(s->argv, s->home, -1, &wall, &cpu, &rss);
+	}
+	for (i = 0; i < reps; ++i) {
+		if (s->cold)
+			evictCaches(s->argv[0]);
+		if (runOnce(s->argv, s->home, -1, &s->wall[i], &s->cpu[i], &s->rss[i]) != 0)
+			++s->failures;
+	}
+	s->runs = reps;
+	qsort(s->wall, reps, sizeof(double), compareDouble);
+	qsort(s->cpu, reps, sizeof(double), compareDouble);
+	qsort(s->rss, reps, sizeof(double), compareDouble);
+	s->wallMedian = percentile(s->wall, reps, 50);
+	s->wallP90 = percentile(s->wall, reps, 90);
+	s->wallP99 = percentile(s->wall, reps, 99);
+	s->cpuMedian = percentile(s->cpu, reps, 50);
+	s->rssMedian = percentile(s->rss, reps, 50);
+}
+
+static Scenario* findScenario(const char* name) {
+	int i;
+	for (i = 0; i < scenarioCount; ++i) {
+		if (scenarios[i].runs > 0 && strcmp(scenarios[i].name, name) == 0)
+			return &scenarios[i];
+	}
+	return NULL;
+}
+
+/* one scenario per line, so that the baseline can be read back line-wise */
+static void saveBaseline(const char* path, int reps) {
+	int i, first = 1;
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL)
+		die("cannot write baseline");
+	fprintf(fp, "{\n\"reps\": %d,\n\"scenarios\": {\n", reps);
+	for (i = 0; i < scenarioCount; ++i) {
+		Scenario* s = &scenarios[i];
+		if (s->runs == 0)
+			continue;
+		fprintf(fp, "%s\"%s\": {\"wall_median_ms\": %.3f, \"wall_p90_ms\": %.3f, \"wall_p99_ms\": %.3f, "
+				"\"cpu_median_ms\": %.3f, \"rss_median_kb\": %.0f, \"failures\": %d}",
+				first ? "" : ",\n", s->name, s->wallMedian, s->wallP90, s->wallP99,
+				s->cpuMedian, s->rssMedian, s->failures);
+		first = 0;
+	}
+	fprintf(fp, "\n}\n}\n");
+	fclose(fp);
+	printf("\nBaseline written to %s\n", path);
+}
+
+/* Returns the number of regressions. */
+static int compareBaseline(const char* path, double threshold) {
+	char line[1024], name[64], *field;
+	double median, p90, p99, dMedian, dP90;
+	int regressions = 0, failures, regressed;
+	Scenario* s;
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("\nNo baseline at %s, run with --save to create one.\n", path);
+		return 0;
+	}
+	printf("\n%-24s %10s %10s %10s %10s\n", "vs. baseline", "median", "delta", "p90", "delta");
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " \"%63[^\"]\": {\"wall_median_ms\": %lf, \"wall_p90_ms\": %lf, \"wall_p99_ms\": %lf",
+				name, &median, &p90, &p99) != 4 || (s = findScenario(name)) == NULL)
+			continue;
+		field = strstr(line, "\"failures\": ");
+		failures = field != NULL ? atoi(field+12) : 0;
+		dMedian = 100.0*(s->wallMedian-median)/median;
+		dP90 = 100.0*(s->wallP90-p90)/p90;
+		/* a scenario that started failing is a regression, whatever its timing */
+		regressed = dMedian > threshold || dP90 > threshold || s->failures > failures;
+		printf("%-24s %8.2fms %+9.1f%% %8.2fms %+9.1f%%%s\n", name, median, dMedian, p90, dP90,
+				s->failures > failures ? "  FAILING" : regressed ? "  REGRESSION" : "");
+		regressions += regressed;
+	}
+	fclose(fp);
+	if (regressions)
+		printf("\n%d scenario(s) failing or slower than baseline by more than %.0f%%\n",
+				regressions, threshold);
+	return regressions;
+}
+
+int main(int argc, char** argv) {
+	const char* launcher = defaultLauncher;
+	const char* baseline = defaultBaseline;
+	const char* filter = NULL;
+	int reps = defaultReps, extraJars = defaultExtraJars, save = 0, i, cold;
+	double threshold = defaultThreshold;
+	char launcherPath[PATH_MAX], script[PATH_MAX], *javaCmd[maxArgs], *printed;
+	char *smallHome, *largeHome;
+	Scenario* direct;
+	FILE* fp;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--save") == 0) save = 1;
+		else if (i+1 == argc) break;
+		else if (strcmp(argv[i], "-j") == 0) launcher = argv[++i];
+		else if (strcmp(argv[i], "-H") == 0) jythonHome = argv[++i];
+		else if (strcmp(argv[i], "-n") == 0) reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-b") == 0) baseline = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0) threshold = atof(argv[++i]);
+		else if (strcmp(argv[i], "-J") == 0) extraJars = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0) filter = argv[++i];
+		else break;
+	}
+	if (i < argc) {
+		fprintf(stderr, "usage: jybench [-j launcher] [-H jythonhome] [-n reps] [-b baseline]"
+				" [-t percent] [-J jars] [-s filter] [--save]\n");
+		return 2;
+	}
+	if (jythonHome == NULL)
+		jythonHome = getenv("JYTHON_HOME");
+	errno = 0;
+	if (jythonHome == NULL || reps < 1)
+		die("need a Jython home (-H or JYTHON_HOME) and at least one repetition");
+	if (realpath(launcher, launcherPath) == NULL)
+		die("launcher not found");
+	setenv("JYTHON_HOME", jythonHome, 1);
+
+	snprintf(tmpDir, sizeof(tmpDir), "%s/jybench-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if (mkdtemp(tmpDir) == NULL)
+		die("cannot create temporary directory");
+	snprintf(script, sizeof(script), "%s/hello.py", tmpDir);
+	if ((fp = fopen(script, "w")) == NULL)
+		die("cannot write script");
+	fputs("print 'Hello World'\n", fp);
+	fclose(fp);
+	smallHome = makeHome("small", 0);
+	largeHome = makeHome("large", extraJars);
+
+	/* the java command the launcher would run, and the JDK it belongs to */
+	{
+		char* printArgv[] = {launcherPath, "--print", "-c", "pass", NULL};
+		printed = captureOutput(printArgv);
+		if (printed != NULL && splitCommand(printed, javaCmd) > 0) {
+			char* sl;
+			snprintf(jdkHome, sizeof(jdkHome), "%s", javaCmd[0]);
+			if ((sl = strrchr(jdkHome, '/')) != NULL) *sl = 0;  /* bin/java */
+			if ((sl = strrchr(jdkHome, '/')) != NULL) *sl = 0;  /* bin */
+		} else {
+			fprintf(stderr, "jybench: jython --print failed, skipping the java scenarios\n");
+			javaCmd[0] = NULL;
+		}
+	}
+
+	for (cold = 0; cold <= 1; ++cold) {
+		addScenario("print", NULL, cold, launcherPath, "--print", "-c", "pass", NULL);
+		addScenario("c_pass", NULL, cold, launcherPath, "-c", "pass", NULL);
+		addScenario("hello", NULL, cold, launcherPath, script, NULL);
+		addScenario("boot", NULL, cold, launcherPath, "--boot", "-c", "pass", NULL);
+		addScenario("javalib_small", smallHome, cold, launcherPath, "-c", "pass", NULL);
+		addScenario("javalib_large", largeHome, cold, launcherPath, "-c", "pass", NULL);
+		addScenario("posix_jnr", NULL, cold, launcherPath, "-S", "-c", posixJnr, NULL);
+		addScenario("posix_native", NULL, cold, launcherPath, "-S", "-c", posixNative, NULL);
+		if (javaCmd[0] != NULL) {
+			direct = addScenario("java_direct", NULL, cold, NULL);
+			memcpy(direct->argv, javaCmd, sizeof(javaCmd));
+		}
+	}
+
+	printf("%d repetitions per scenario, Jython home %s, JDK %s\n\n", reps, jythonHome,
+			jdkHome[0] ? jdkHome : "unknown");
+	printf("%-24s %5s %10s %10s %10s %10s %10s\n", "scenario", "fail", "median", "p90", "p99", "cpu", "rss");
+	for (i = 0; i < scenarioCount; ++i) {
+		Scenario* s = &scenarios[i];
+		if (filter != NULL && strstr(s->name, filter) == NULL)
+			continue;
+		runScenario(s, reps);
+		printf("%-24s %5d %8.2fms %8.2fms %8.2fms %8.2fms %8.0fkB\n", s->name, s->failures,
+				s->wallMedian, s->wallP90, s->wallP99, s->cpuMedian, s->rssMedian);
+		fflush(stdout);
+	}
+
+	/* launcher overhead: embedded launch vs. the java command --print emits */
+	for (cold = 0; cold <= 1; ++cold) {
+		Scenario* a = findScenario(cold ? "c_pass/cold" : "c_pass");
+		Scenario* b = findScenario(cold ? "java_direct/cold" : "java_direct");
+		if (a != NULL && b != NULL)
+			printf("%s launcher vs. java: %+.2fms median (%+.1f%%)\n", cold ? "cold" : "warm",
+					a->wallMedian-b->wallMedian, 100.0*(a->wallMedian-b->wallMedian)/b->wallMedian);
+	}
+	/* os calls without jnr-posix */
+	for (cold = 0; cold <= 1; ++cold) {
+		Scenario* a = findScenario(cold ? "posix_native/cold" : "posix_native");
+		Scenario* b = findScenario(cold ? "posix_jnr/cold" : "posix_jnr");
+		if (a != NULL && b != NULL)
+			printf("%s NativePosix vs. jnr-posix: %+.2fms median (%+.1f%%)\n", cold ? "cold" : "warm",
+					a->wallMedian-b->wallMedian, 100.0*(a->wallMedian-b->wallMedian)/b->wallMedian);
+	}
+
+	nftw(tmpDir, removeFile, 32, FTW_DEPTH | FTW_PHYS);
+	if (save) {
+		saveBaseline(baseline, reps);
+		return 0;
+	}
+	return compareBaseline(baseline, threshold) > 0;
+}
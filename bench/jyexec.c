@@ -0,0 +1,163 @@
+/*
+ * jyexec.c
+ *
+ * Compares the cost of getting launcher binaries from exec to main, run
+ * by "make execbench" for build/jython against build/release/jython.
+ *
+ * For every binary it runs "<binary> --print -c pass" repeatedly and
+ * reports medians of
+ *   - the dynamic loader's startup time, i.e. all work between exec and
+ *     main except for the kernel's part, and its relocation counts
+ *     (from glibc's LD_DEBUG=statistics),
+ *   - the wall time of the whole --print run (without LD_DEBUG, which
+ *     slows the loader down).
+ * Loader times are in TSC cycles as glibc reports them.
+ *
+ * Usage: jyexec [-n <reps>] <binary>...
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define defaultReps 50
+
+typedef struct {
+	double loaderCycles;
+	double relocations;
+	double relativeRelocations;
+	double wall; /* ms */
+} ExecSample;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+/* Runs binary once; with statsFile set, glibc writes statsFile.<pid>. */
+static pid_t run(const char* binary, const char* statsFile, double* wall) {
+	int status;
+	double start = now();
+	pid_t pid = fork();
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_RDWR);
+		dup2(devnull, 0);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		if (statsFile) {
+			setenv("LD_DEBUG", "statistics", 1);
+			setenv("LD_DEBUG_OUTPUT", statsFile, 1);
+		}
+		execl(binary, binary, "--print", "-c", "pass", (char*) NULL);
+		_exit(127);
+	}
+	waitpid(pid, &status, 0);
+	*wall = now()-start;
+	return pid;
+}
+
+/* Reads the first statistics block (startup) of a LD_DEBUG output file. */
+static void readStats(const char* path, ExecSample* sample) {
+	char line[256];
+	unsigned long long value;
+	int seen = 0;
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (seen < 3 && fgets(line, sizeof(line), fp)) {
+		char* text = strchr(line, ':');
+		if (!text)
+			continue;
+		++text;
+		if (sscanf(text, " total startup time in dynamic loader: %llu", &value) == 1) {
+			sample->loaderCycles = value;
+			++seen;
+		} else if (sscanf(text, " number of relocations: %llu", &value) == 1) {
+			sample->relocations = value;
+			++seen;
+		} else if (sscanf(text, " number of relative relocations: %llu", &value) == 1) {
+			sample->relativeRelocations = value;
+			++seen;
+		}
+	}
+	fclose(fp);
+	unlink(path);
+}
+
+static int compareDouble(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+static double median(double* values, int n) {
+	qsort(values, n, sizeof(double), compareDouble);
+	return n % 2 ? values[n/2] : (values[n/2-1]+values[n/2])/2;
+}
+
+static void measure(const char* binary, int reps, ExecSample* result) {
+	char statsBase[PATH_MAX], statsFile[PATH_MAX+16];
+	double cycles[reps], relocs[reps], relative[reps], wall[reps], ignored;
+	ExecSample sample;
+	pid_t pid;
+	int i;
+	snprintf(statsBase, sizeof(statsBase), "%s/jyexec-%d", getenv("TMPDIR") ?
+			getenv("TMPDIR") : "/tmp", (int) getpid());
+	for (i = 0; i < 3; ++i)
+		run(binary, NULL, &ignored);
+	for (i = 0; i < reps; ++i) {
+		memset(&sample, 0, sizeof(sample));
+		pid = run(binary, statsBase, &ignored);
+		snprintf(statsFile, sizeof(statsFile), "%s.%d", statsBase, (int) pid);
+		readStats(statsFile, &sample);
+		cycles[i] = sample.loaderCycles;
+		relocs[i] = sample.relocations;
+		relative[i] = sample.relativeRelocations;
+		run(binary, NULL, &wall[i]);
+	}
+	result->loaderCycles = median(cycles, reps);
+	result->relocations = median(relocs, reps);
+	result->relativeRelocations = median(relative, reps);
+	result->wall = median(wall, reps);
+}
+
+int main(int argc, char** argv) {
+	int reps = defaultReps, first = 1, i;
+	ExecSample base, sample;
+	struct stat st;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		reps = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc || reps < 1) {
+		fprintf(stderr, "usage: jyexec [-n reps] binary...\n");
+		return 2;
+	}
+	printf("%-28s %10s %14s %10s %10s %12s\n", "binary", "size", "loader cycles",
+			"relocs", "relative", "--print ms");
+	for (i = first; i < argc; ++i) {
+		if (stat(argv[i], &st) != 0) {
+			fprintf(stderr, "jyexec: %s not found\n", argv[i]);
+			return 2;
+		}
+		measure(argv[i], reps, &sample);
+		printf("%-28s %10ld %14.0f %10.0f %10.0f %12.3f", argv[i], (long) st.st_size,
+				sample.loaderCycles, sample.relocations, sample.relativeRelocations, sample.wall);
+		if (i == first)
+			base = sample;
+		else
+			printf("  (loader %+.1f%%, wall %+.1f%%)",
+					100.0*(sample.loaderCycles-base.loaderCycles)/base.loaderCycles,
+					100.0*(sample.wall-base.wall)/base.wall);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,440 @@
+/*
+ * jymicro.c
+ *
+ * Microbenchmarks for the launcher's internal routines, run by
+ * "make microbench". The binary links the launcher objects and drives
+ * each routine with synthetic inputs of growing size n:
+ *
+ *   getOPTS                      JAVA_OPTS-style variable with n options
+ *   parse_launcher_args          n launcher arguments
+ *   JLI_WildcardExpandClasspath  a javalib/* with n jars
+ *   ReadKnownVMs                 a jvm.cfg with n entries
+ *   AddOption                    n options from an empty option list
+ *   SetJavaCommandLineProp       n script arguments
+ *   prepareClasspath             a CLASSPATH with n entries
+ *
+ * For every n it reports ns per call, ns per element and the number of
+ * allocations and allocated bytes per call (counted by wrapping malloc
+ * and friends at link time, see the makefile). The exponent column is
+ * the slope of the cost curve from the previous size in log-log scale:
+ * ~1 means linear, ~2 quadratic.
+ * With -o <dir> the curves are written as <dir>/<routine>.dat together
+ * with <dir>/jymicro.gp, which gnuplot turns into jymicro.png.
+ *
+ * Usage: jymicro [-s <substring>] [-m <max n>] [-t <ms per size>] [-o <dir>]
+ */
+
+#define _GNU_SOURCE
+#include "jython.h"
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define defaultMinTime 20 /* ms of measured time per size */
+#define maxIterations 1000000
+
+typedef struct {
+	const char* name;
+	int maxSize;                  /* the size production inputs reach */
+	void (*setup)(int n);         /* once per size */
+	void (*before)(int n);        /* untimed, before every call */
+	void (*run)(int n);           /* the measured call */
+	void (*after)(int n);         /* untimed, after every call */
+	void (*teardown)(int n);      /* once per size */
+} Bench;
+
+/* allocation counting, see __wrap_malloc */
+static int counting = 0;
+static long allocCount = 0;
+static long allocBytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* s);
+
+void* __wrap_malloc(size_t size) {
+	if (counting) {
+		++allocCount;
+		allocBytes += size;
+	}
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+	if (counting) {
+		++allocCount;
+		allocBytes += nmemb*size;
+	}
+	return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+	if (counting) {
+		++allocCount;
+		allocBytes += size;
+	}
+	return __real_realloc(ptr, size);
+}
+
+char* __wrap_strdup(const char* s) {
+	if (counting) {
+		++allocCount;
+		allocBytes += strlen(s)+1;
+	}
+	return __real_strdup(s);
+}
+
+static double nanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static char tmpDir[PATH_MAX/2];
+static char path[PATH_MAX];
+static char** strings = NULL;   /* n synthetic arguments/options */
+static int stringCount = 0;
+
+static void makeStrings(int n, const char* format) {
+	int i;
+	char buf[64];
+	strings = malloc(n*sizeof(char*));
+	for (i = 0; i < n; ++i) {
+		snprintf(buf, sizeof(buf), format, i);
+		strings[i] = strdup(buf);
+	}
+	stringCount = n;
+}
+
+static void freeStrings(int n) {
+	int i;
+	for (i = 0; i < stringCount; ++i)
+		free(strings[i]);
+	free(strings);
+	strings = NULL;
+	stringCount = 0;
+}
+
+static void resetState(int n) {
+	ResetLaunchState();
+}
+
+/* getOPTS: tokenizes the variable in place, so it is set before every call */
+static char* optsValue = NULL;
+static int optsCount;
+static char** optsResult;
+
+static void optsSetup(int n) {
+	int i, len = 0;
+	makeStrings(n, "-Dbench.option%d=value");
+	for (i = 0; i < n; ++i)
+		len += strlen(strings[i])+1;
+	optsValue = malloc(len+1);
+	optsValue[0] = 0;
+	for (i = 0, len = 0; i < n; ++i)
+		len += sprintf(optsValue+len, "%s ", strings[i]);
+}
+
+static void optsBefore(int n) {
+	setenv("JYMICRO_OPTS", optsValue, 1);
+}
+
+static void optsRun(int n) {
+	getOPTS(&optsCount, &optsResult, "JYMICRO_OPTS");
+}
+
+static void optsAfter(int n) {
+	int i;
+	for (i = 0; i < optsCount; ++i)
+		free(optsResult[i]);
+	free(optsResult);
+}
+
+static void optsTeardown(int n) {
+	free(optsValue);
+	unsetenv("JYMICRO_OPTS");
+	freeStrings(n);
+}
+
+/* parse_launcher_args: a mix of properties, -J options and jython options */
+static char** parseArgs = NULL;
+static JySetup* parsed;
+
+static void parseSetup(int n) {
+	int i;
+	char buf[64];
+	parseArgs = malloc((n+3)*sizeof(char*));
+	parseArgs[0] = strdup("jython");
+	for (i = 0; i < n; ++i) {
+		switch (i % 3) {
+		case 0: snprintf(buf, sizeof(buf), "-Dbench.property%d=value", i); break;
+		case 1: snprintf(buf, sizeof(buf), "-J-Dbench.java%d=value", i); break;
+		default: snprintf(buf, sizeof(buf), "--bench-option%d", i);
+		}
+		parseArgs[i+1] = strdup(buf);
+	}
+	parseArgs[n+1] = strdup("-c");
+	parseArgs[n+2] = strdup("pass");
+}
+
+static void parseRun(int n) {
+	parsed = parse_launcher_args(n+3, parseArgs, 0, NULL, 0, NULL);
+}
+
+static void parseAfter(int n) {
+	freeSetup(parsed);
+}
+
+static void parseTeardown(int n) {
+	int i;
+	for (i = 0; i < n+3; ++i)
+		free(parseArgs[i]);
+	free(parseArgs);
+}
+
+/* JLI_WildcardExpandClasspath: a directory with n empty jars */
+static const char* expanded;
+
+static void wildcardSetup(int n) {
+	int i;
+	FILE* fp;
+	for (i = 0; i < n; ++i) {
+		snprintf(path, sizeof(path), "%s/bench-%05d.jar", tmpDir, i);
+		if ((fp = fopen(path, "w")) != NULL)
+			fclose(fp);
+	}
+	snprintf(path, sizeof(path), "%s/*", tmpDir);
+}
+
+static void wildcardRun(int n) {
+	expanded = JLI_WildcardExpandClasspath(path);
+}
+
+static void wildcardAfter(int n) {
+	if (expanded != path)
+		JLI_MemFree((char*) expanded);
+}
+
+static void wildcardTeardown(int n) {
+	int i;
+	char jar[PATH_MAX];
+	for (i = 0; i < n; ++i) {
+		snprintf(jar, sizeof(jar), "%s/bench-%05d.jar", tmpDir, i);
+		unlink(jar);
+	}
+}
+
+/* ReadKnownVMs: n entries, every fourth one an alias */
+static void jvmcfgSetup(int n) {
+	int i;
+	FILE* fp;
+	snprintf(path, sizeof(path), "%s/jvm.cfg", tmpDir);
+	if ((fp = fopen(path, "w")) == NULL)
+		return;
+	fputs("# synthetic jvm.cfg\n", fp);
+	for (i = 0; i < n; ++i) {
+		if (i % 4 == 3)
+			fprintf(fp, "-alias%d ALIASED_TO -vm%d\n", i, i-1);
+		else
+			fprintf(fp, "-vm%d KNOWN\n", i);
+	}
+	fclose(fp);
+}
+
+static void jvmcfgRun(int n) {
+	ReadKnownVMs(path, JNI_TRUE);
+}
+
+static void jvmcfgTeardown(int n) {
+	ResetLaunchState();
+	unlink(path);
+}
+
+/* AddOption: n options, starting from an empty list */
+static void optionSetup(int n) {
+	makeStrings(n, "-Dbench.option%d=value");
+}
+
+static void optionRun(int n) {
+	int i;
+	for (i = 0; i < n; ++i)
+		AddOption(strings[i], NULL);
+}
+
+static void optionTeardown(int n) {
+	ResetLaunchState();
+	freeStrings(n);
+}
+
+/*
+ * SetJavaCommandLineProp: n script arguments. The property string is
+ * only referenced from the option list, which ResetLaunchState does
+ * not free, so it leaks; that is bounded by the measured time.
+ */
+static void commandSetup(int n) {
+	makeStrings(n, "script-argument-%d");
+}
+
+static void commandRun(int n) {
+	SetJavaCommandLineProp("org.python.util.jython", n, strings);
+}
+
+/* prepareClasspath: CLASSPATH with n entries, no class-load profile */
+static JySetup cpSetup;
+static char* cpValue = NULL;
+
+static void classpathSetup(int n) {
+	int i, len = 0;
+	makeStrings(n, "/opt/bench/lib/library-%d.jar");
+	for (i = 0; i < n; ++i)
+		len += strlen(strings[i])+1;
+	cpValue = malloc(len+1);
+	cpValue[0] = 0;
+	for (i = 0, len = 0; i < n; ++i)
+		len += sprintf(cpValue+len, i ? ":%s" : "%s", strings[i]);
+	memset(&cpSetup, 0, sizeof(cpSetup));
+}
+
+static void classpathBefore(int n) {
+	cpSetup.cp = strdup(cpValue);
+}
+
+static void classpathRun(int n) {
+	prepareClasspath(&cpSetup, "/opt/jython", "/opt/jython/jython.jar", JNI_FALSE, JNI_TRUE);
+}
+
+static void classpathAfter(int n) {
+	free(cpSetup.cp);
+}
+
+static void classpathTeardown(int n) {
+	free(cpValue);
+	freeStrings(n);
+}
+
+static Bench benches[] = {
+	{"getOPTS", 10000, optsSetup, optsBefore, optsRun, optsAfter, optsTeardown},
+	{"parse_launcher_args", 10000, parseSetup, NULL, parseRun, parseAfter, parseTeardown},
+	{"JLI_WildcardExpandClasspath", 5000, wildcardSetup, NULL, wildcardRun, wildcardAfter, wildcardTeardown},
+	{"ReadKnownVMs", 10000, jvmcfgSetup, resetState, jvmcfgRun, NULL, jvmcfgTeardown},
+	{"AddOption", 10000, optionSetup, resetState, optionRun, NULL, optionTeardown},
+	{"SetJavaCommandLineProp", 10000, commandSetup, resetState, commandRun, NULL, optionTeardown},
+	{"prepareClasspath", 10000, classpathSetup, classpathBefore, classpathRun, classpathAfter, classpathTeardown},
+};
+
+/*
+ * Measures one size: calls run until minTime ms of measured time have
+ * passed (at least three times) and returns ns per call.
+ */
+static double measure(Bench* b, int n, double minTime, double* allocs, double* bytes) {
+	double total = 0, start;
+	long iterations = 0;
+	if (b->setup) b->setup(n);
+	allocCount = allocBytes = 0;
+	while ((total < minTime*1e6 || iterations < 3) && iterations < maxIterations) {
+		if (b->before) b->before(n);
+		counting = 1;
+		start = nanos();
+		b->run(n);
+		total += nanos()-start;
+		counting = 0;
+		if (b->after) b->after(n);
+		++iterations;
+	}
+	if (b->teardown) b->teardown(n);
+	*allocs = (double) allocCount/iterations;
+	*bytes = (double) allocBytes/iterations;
+	return total/iterations;
+}
+
+/* 10, 20, 50, 100, 200, 500, ... */
+static int nextSize(int n) {
+	int p = 1;
+	while (p*10 <= n)
+		p *= 10;
+	return n/p == 2 ? p*5 : n*2;
+}
+
+static void writePlotScript(const char* dir, const char* filter) {
+	int i, first = 1;
+	FILE* fp;
+	snprintf(path, sizeof(path), "%s/jymicro.gp", dir);
+	if ((fp = fopen(path, "w")) == NULL)
+		return;
+	fputs("set terminal png size 1000,700\nset output 'jymicro.png'\n"
+			"set logscale xy\nset xlabel 'n'\nset ylabel 'ns per call'\n"
+			"set key left top\nplot ", fp);
+	for (i = 0; i < sizeof(benches)/sizeof(Bench); ++i) {
+		if (filter != NULL && strstr(benches[i].name, filter) == NULL)
+			continue;
+		fprintf(fp, "%s'%s.dat' using 1:2 with linespoints title '%s'", first ? "" : ", \\\n\t",
+				benches[i].name, benches[i].name);
+		first = 0;
+	}
+	fputs("\n", fp);
+	fclose(fp);
+}
+
+int main(int argc, char** argv) {
+	const char* filter = NULL;
+	const char* outDir = NULL;
+	int maxSize = 0, i, n, lastN;
+	double minTime = defaultMinTime, ns, lastNs, allocs, bytes;
+	FILE* dat;
+
+	for (i = 1; i+1 < argc; i += 2) {
+		if (strcmp(argv[i], "-s") == 0) filter = argv[i+1];
+		else if (strcmp(argv[i], "-m") == 0) maxSize = atoi(argv[i+1]);
+		else if (strcmp(argv[i], "-t") == 0) minTime = atof(argv[i+1]);
+		else if (strcmp(argv[i], "-o") == 0) outDir = argv[i+1];
+		else break;
+	}
+	if (i < argc) {
+		fprintf(stderr, "usage: jymicro [-s substring] [-m max n] [-t ms per size] [-o dir]\n");
+		return 2;
+	}
+	snprintf(tmpDir, sizeof(tmpDir), "%s/jymicro-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if (mkdtemp(tmpDir) == NULL) {
+		perror("jymicro: cannot create temporary directory");
+		return 2;
+	}
+
+	printf("%-28s %7s %14s %12s %12s %14s %9s\n", "routine", "n", "ns/call", "ns/element",
+			"allocs/call", "bytes/call", "exponent");
+	for (i = 0; i < sizeof(benches)/sizeof(Bench); ++i) {
+		Bench* b = &benches[i];
+		if (filter != NULL && strstr(b->name, filter) == NULL)
+			continue;
+		dat = NULL;
+		if (outDir != NULL) {
+			snprintf(path, sizeof(path), "%s/%s.dat", outDir, b->name);
+			if ((dat = fopen(path, "w")) != NULL)
+				fputs("# n ns/call allocs/call bytes/call\n", dat);
+		}
+		lastN = 0;
+		lastNs = 0;
+		/* 1-2-5 steps up to the production size */
+		for (n = 10; n <= (maxSize > 0 ? maxSize : b->maxSize); ) {
+			ns = measure(b, n, minTime, &allocs, &bytes);
+			if (lastN > 0)
+				printf("%-28s %7d %14.0f %12.1f %12.1f %14.0f %9.2f\n", b->name, n, ns, ns/n,
+						allocs, bytes, log(ns/lastNs)/log((double) n/lastN));
+			else
+				printf("%-28s %7d %14.0f %12.1f %12.1f %14.0f %9s\n", b->name, n, ns, ns/n,
+						allocs, bytes, "");
+			fflush(stdout);
+			if (dat != NULL)
+				fprintf(dat, "%d %.0f %.1f %.0f\n", n, ns, allocs, bytes);
+			lastN = n;
+			lastNs = ns;
+			n = nextSize(n);
+		}
+		if (dat != NULL)
+			fclose(dat);
+	}
+	if (outDir != NULL)
+		writePlotScript(outDir, filter);
+	rmdir(tmpDir);
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * jysyscalls.c
+ *
+ * Syscall budget check for the launcher's discovery path, run by
+ * "make syscallbudget". Traces "<launcher> --print -c pass" with ptrace,
+ * which runs the whole discovery (exec name, Jython home, JRE, jvm.cfg,
+ * libjvm, JDK index, classpath) without creating a JVM, and counts
+ *   - all syscalls,
+ *   - filesystem probes: stat/access/open/readlink calls and friends,
+ *     i.e. the calls that are a network round trip each on NFS,
+ *   - repeated probes: probes of a path that was probed before.
+ * The exit status is 1 if a count exceeds its budget, so the target
+ * fails when a change adds probes to the launch.
+ *
+ * Usage: jysyscalls [-t <total budget>] [-p <probe budget>] [-v] <launcher>
+ *   -v lists every probe with its path and result.
+ *
+ * Only x86_64 is supported.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#define maxProbes 4096
+
+typedef struct {
+	long nr;
+	const char* name;
+	int pathArg; /* index of the path argument */
+} ProbeCall;
+
+static const ProbeCall probeCalls[] = {
+#ifdef __x86_64__
+	{SYS_stat, "stat", 0},
+	{SYS_lstat, "lstat", 0},
+	{SYS_access, "access", 0},
+	{SYS_open, "open", 0},
+	{SYS_readlink, "readlink", 0},
+	{SYS_newfstatat, "newfstatat", 1},
+	{SYS_faccessat, "faccessat", 1},
+#ifdef SYS_faccessat2
+	{SYS_faccessat2, "faccessat2", 1},
+#endif
+	{SYS_openat, "openat", 1},
+	{SYS_readlinkat, "readlinkat", 1},
+	{SYS_statx, "statx", 1},
+#endif
+	{-1, NULL, 0}
+};
+
+static char* probed[maxProbes];
+static int probedCount = 0;
+
+static const ProbeCall* findProbe(long nr) {
+	int i;
+	for (i = 0; probeCalls[i].name; ++i) {
+		if (probeCalls[i].nr == nr)
+			return &probeCalls[i];
+	}
+	return NULL;
+}
+
+/* Copies a string from the tracee. */
+static void readString(pid_t pid, unsigned long addr, char* buf, int size) {
+	int i = 0, j;
+	long word;
+	while (i < size-1) {
+		errno = 0;
+		word = ptrace(PTRACE_PEEKDATA, pid, addr+i, NULL);
+		if (errno)
+			break;
+		for (j = 0; j < (int) sizeof(long) && i < size-1; ++j, ++i) {
+			buf[i] = ((char*) &word)[j];
+			if (!buf[i])
+				return;
+		}
+	}
+	buf[i] = 0;
+}
+
+static int seenBefore(const char* call, const char* path) {
+	char key[PATH_MAX+64];
+	int i;
+	snprintf(key, sizeof(key), "%s %s", call, path);
+	for (i = 0; i < probedCount; ++i) {
+		if (strcmp(probed[i], key) == 0)
+			return 1;
+	}
+	if (probedCount < maxProbes)
+		probed[probedCount++] = strdup(key);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+#ifdef __x86_64__
+	long totalBudget = -1, probeBudget = -1, total = 0, probes = 0, repeated = 0;
+	int verbose = 0, status, inSyscall = 0, i;
+	const ProbeCall* pending = NULL;
+	char raw[PATH_MAX], path[PATH_MAX+32];
+	struct user_regs_struct regs;
+	pid_t pid;
+
+	for (i = 1; i < argc-1; ++i) {
+		if (strcmp(argv[i], "-t") == 0) totalBudget = atol(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0) probeBudget = atol(argv[++i]);
+		else if (strcmp(argv[i], "-v") == 0) verbose = 1;
+		else break;
+	}
+	if (i != argc-1) {
+		fprintf(stderr, "usage: jysyscalls [-t total budget] [-p probe budget] [-v] launcher\n");
+		return 2;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, 1);
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		execl(argv[i], argv[i], "--print", "-c", "pass", (char*) NULL);
+		_exit(127);
+	}
+	waitpid(pid, &status, 0);
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+	for (;;) {
+		ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+		if (waitpid(pid, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		if (!WIFSTOPPED(status) || WSTOPSIG(status) != (SIGTRAP | 0x80))
+			continue;
+		ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+		if (!inSyscall) {
+			++total;
+			pending = findProbe(regs.orig_rax);
+			if (pending) {
+				unsigned long arg = pending->pathArg == 0 ? regs.rdi : regs.rsi;
+				int dirfd = (int) regs.rdi;
+				readString(pid, arg, raw, sizeof(raw));
+				if (pending->pathArg == 1 && raw[0] && raw[0] != '/' && dirfd != AT_FDCWD) {
+					/* relative to a directory fd: keep probes in different directories apart */
+					snprintf(path, sizeof(path), "<fd %d>/%s", dirfd, raw);
+				} else {
+					snprintf(path, sizeof(path), "%s", raw);
+				}
+				if (!path[0]) {
+					/* AT_EMPTY_PATH, i.e. fstat on a descriptor */
+					pending = NULL;
+				} else {
+					++probes;
+					if (seenBefore(pending->name, path))
+						++repeated;
+				}
+			}
+		} else if (pending) {
+			if (verbose)
+				printf("%-12s %s = %lld\n", pending->name, path, (long long) regs.rax);
+			pending = NULL;
+		}
+		inSyscall = !inSyscall;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+		fprintf(stderr, "jysyscalls: %s --print exited with status %d\n", argv[i], WEXITSTATUS(status));
+
+	printf("syscalls: %ld", total);
+	if (totalBudget >= 0) printf(" (budget %ld)", totalBudget);
+	printf("\nfilesystem probes: %ld, %ld of them repeated", probes, repeated);
+	if (probeBudget >= 0) printf(" (budget %ld)", probeBudget);
+	printf("\n");
+	if ((totalBudget >= 0 && total > totalBudget) || (probeBudget >= 0 && probes > probeBudget)) {
+		printf("over budget\n");
+		return 1;
+	}
+	return 0;
+#else
+	fprintf(stderr, "jysyscalls: only x86_64 is supported\n");
+	return 2;
+#endif
+}
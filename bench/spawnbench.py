@@ -0,0 +1,79 @@
+"""
+spawnbench.py
+
+Spawn latency from Jython, run by "make spawnbench" with the launcher,
+once as is and once with --spawn-helper: lib/lijyspawn.py on
+lijy.NativeSpawn (src/jyspawn.c) against subprocess, which goes through
+java.lang.ProcessBuilder.
+
+Two commands are run to completion: /bin/true with all output discarded,
+the bare cost of a process, and "echo hello" with its output read
+through a pipe, the usual shape of an orchestration step. For each way
+of starting them, the median of 5 rounds of 500 processes (after a
+warm-up round) is reported in microseconds per process. The resident
+set of the JVM is printed as well: it is what ProcessBuilder's fork
+duplicates when the JDK forks, while the helper stays at the size of
+the launcher before the JVM existed.
+"""
+
+import subprocess
+import sys
+
+from java.lang import System
+from lijy import NativeSpawn
+
+sys.path.insert(0, 'lib')
+import lijyspawn
+
+PROCESSES = 500
+ROUNDS = 5
+
+
+def measure(name, start):
+    start(PROCESSES // 10)
+    times = []
+    for r in xrange(ROUNDS):
+        t = System.nanoTime()
+        start(PROCESSES)
+        times.append(System.nanoTime() - t)
+    times.sort()
+    print '%-36s %8.1f us/process' % (name, times[ROUNDS // 2] / 1e3 / PROCESSES)
+
+
+def subprocess_true(n):
+    devnull = open('/dev/null', 'w')
+    for i in xrange(n):
+        subprocess.call(['/bin/true'], stdout=devnull, stderr=devnull)
+    devnull.close()
+
+
+def subprocess_echo(n):
+    for i in xrange(n):
+        subprocess.check_output(['echo', 'hello'])
+
+
+def native_true(n):
+    DEVNULL = lijyspawn.DEVNULL
+    for i in xrange(n):
+        lijyspawn.call(['/bin/true'], stdout=DEVNULL, stderr=DEVNULL)
+
+
+def native_echo(n):
+    for i in xrange(n):
+        lijyspawn.check_output(['echo', 'hello'])
+
+
+def rss():
+    for line in open('/proc/self/status'):
+        if line.startswith('VmRSS:'):
+            return line.split(':')[1].strip()
+    return '?'
+
+
+if __name__ == '__main__':
+    mode = NativeSpawn.helper() and 'helper' or 'direct'
+    print 'NativeSpawn: %s, JVM resident set: %s' % (mode, rss())
+    measure('subprocess /bin/true', subprocess_true)
+    measure('lijyspawn /bin/true (%s)' % mode, native_true)
+    measure('subprocess echo, piped', subprocess_echo)
+    measure('lijyspawn echo, piped (%s)' % mode, native_echo)
@@ -0,0 +1,45 @@
+"""
+stdoutbench.py
+
+Output throughput of print from Jython, run by "make stdoutbench" with
+the launcher and its stdout piped to cat, so that the launcher buffers
+it in lijy.NativeStdout (src/jystdout.c). Against that, the same lines
+are printed to a file object set up the way Jython's sys.stdout is
+without the launcher: line-buffered, on a PrintStream with autoflush on
+descriptor 1, i.e. one write system call per line.
+
+Each way prints LINES short lines; the best of 3 rounds is reported on
+stderr in lines per second.
+"""
+
+import sys
+
+from java.io import BufferedOutputStream, FileDescriptor, FileOutputStream, PrintStream
+from java.lang import System
+from org.python.core import PyFile
+
+LINES = 200000
+ROUNDS = 3
+
+
+def measure(name, out):
+    best = None
+    for r in xrange(ROUNDS):
+        t = System.nanoTime()
+        for i in xrange(LINES):
+            print >> out, 'line', i
+        out.flush()
+        t = System.nanoTime() - t
+        if best is None or t < best:
+            best = t
+    print >> sys.stderr, '%-32s %12.0f lines/s' % (name, LINES / (best / 1e9))
+
+
+if __name__ == '__main__':
+    if sys.stdout.isatty():
+        print >> sys.stderr, 'stdout is a tty, pipe it for the launcher to buffer it'
+    line_buffered = PyFile(PrintStream(BufferedOutputStream(
+            FileOutputStream(FileDescriptor.out), 128), True),
+            '<stdout>', 'w', 1, False)
+    measure('line-buffered, write per line', line_buffered)
+    measure('sys.stdout on NativeStdout', sys.stdout)
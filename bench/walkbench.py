@@ -0,0 +1,50 @@
+"""
+walkbench.py
+
+Directory-walk throughput from Jython, run by "make walkbench" with the
+launcher: lib/lijywalk.py on lijy.NativeWalk (src/jywalk.c), with one
+walker thread and with one per processor, against os.walk.
+
+Each way walks the tree under the directory given as argument (default
+/usr) and counts its entries; the best of 3 rounds (after a warm-up
+walk, so all of them find the tree in the page cache) is reported in
+entries per second. The counts are printed as well and should agree.
+"""
+
+import os
+import sys
+
+from java.lang import Runtime, System
+
+sys.path.insert(0, 'lib')
+import lijywalk
+
+ROUNDS = 3
+
+
+def count(walk):
+    n = 0
+    for dirpath, dirnames, filenames in walk:
+        n += len(dirnames) + len(filenames)
+    return n
+
+
+def measure(name, walk):
+    count(walk())
+    best = None
+    for r in xrange(ROUNDS):
+        t = System.nanoTime()
+        n = count(walk())
+        t = System.nanoTime() - t
+        if best is None or t < best:
+            best = t
+    print '%-28s %9d entries %12.0f entries/s' % (name, n, n / (best / 1e9))
+
+
+if __name__ == '__main__':
+    root = len(sys.argv) > 1 and sys.argv[1] or '/usr'
+    cpus = Runtime.getRuntime().availableProcessors()
+    print 'walking %s, %d processors' % (root, cpus)
+    measure('os.walk', lambda: os.walk(root))
+    measure('lijywalk, 1 thread', lambda: lijywalk.walk(root, threads=1))
+    measure('lijywalk, %d threads' % cpus, lambda: lijywalk.walk(root))
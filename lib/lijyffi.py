@@ -0,0 +1,77 @@
+"""
+C functions for scripts started by LiJy-launch.
+
+The calls are made by the launcher's natives in lijy.NativeFFI (see
+src/jyffi.c); this module turns a library, a symbol and a signature into
+a Python callable. Copy it to a directory on python.path, e.g.
+Lib/site-packages.
+
+    import lijyffi
+    crc32 = lijyffi.function('libz.so.1', 'crc32', 'l(lbi)')
+    crc = crc32(0, data, len(data))     # data: a byte[] or direct ByteBuffer
+
+Signatures are the return type followed by the argument types in
+parentheses: i int, l long, p pointer, f float, d double, b byte[] or
+direct ByteBuffer, v void. Functions that only take i, l and p arguments
+are the cheapest to call; in hot loops, NativeFFI.call(descriptor, ...)
+saves the Python frame of the wrapper.
+"""
+
+import jarray
+from java.lang import Double, Float
+from lijy import NativeFFI
+
+_libraries = {}
+
+
+def library(path):
+    """dlopens a library once; None stands for the launcher itself."""
+    handle = _libraries.get(path)
+    if handle is None:
+        handle = _libraries[path] = NativeFFI.open(path)
+    return handle
+
+
+def descriptor(path, name, signature):
+    """Returns the NativeFFI descriptor of a C function."""
+    return NativeFFI.prepare(NativeFFI.symbol(library(path), name), signature)
+
+
+def function(path, name, signature):
+    """Returns a callable for the C function name in the library at path."""
+    d = descriptor(path, name, signature)
+    ret, args = signature[0], signature[2:-1]
+    if ret not in 'fd' and 'f' not in args and 'd' not in args:
+        if 'b' not in args:
+            call = NativeFFI.call
+            return {
+                0: lambda: call(d),
+                1: lambda a: call(d, a),
+                2: lambda a, b: call(d, a, b),
+                3: lambda a, b, c: call(d, a, b, c),
+                4: lambda a, b, c, e: call(d, a, b, c, e),
+                5: lambda a, b, c, e, f: call(d, a, b, c, e, f),
+                6: lambda a, b, c, e, f, g: call(d, a, b, c, e, f, g),
+            }[len(args)]
+        k = args.index('b')
+        callBuffer = NativeFFI.callBuffer
+
+        def call_buffer(*a):
+            return callBuffer(d, a[k], *(a[:k] + a[k+1:]))
+        return call_buffer
+    if 'b' in args:
+        raise ValueError('b arguments take only i, l and p besides, pass '
+                         'NativeFFI.address(buffer) as p instead')
+    invoke = NativeFFI.invoke
+    ints = [i for i, t in enumerate(args) if t in 'ilp']
+    floats = [i for i, t in enumerate(args) if t in 'fd']
+
+    def call_mixed(*a):
+        r = invoke(d, jarray.array([a[i] for i in ints], 'l'),
+                   jarray.array([a[i] for i in floats], 'd'))
+        if ret == 'd':
+            return Double.longBitsToDouble(r)
+        if ret == 'f':
+            return Float.intBitsToFloat(r)
+        return r
+    return call_mixed
@@ -0,0 +1,65 @@
+"""
+Native JSON for scripts started by LiJy-launch.
+
+Parsing and serializing are done by the launcher's natives in
+lijy.NativeJson (see src/jyjson.c). Copy this module to a directory on
+python.path, e.g. Lib/site-packages, and let the json module use it:
+
+    import lijyjson
+    lijyjson.install()
+
+After install(), json.loads, json.load, json.dumps and json.dump go to
+the natives; calls with further arguments (cls, object_hook, indent,
+sort_keys, ...) and objects the natives don't know, e.g. subclasses of
+dict or non-string keys, still take the json module's path, so results
+are the same either way. Putting the two lines into sitecustomize.py
+makes every script use the natives.
+"""
+
+import json as _json
+from lijy import NativeJson
+
+_loads = _json.loads
+_load = _json.load
+_dumps = _json.dumps
+_dump = _json.dump
+
+
+def loads(s, *args, **kw):
+    if args or kw or not isinstance(s, basestring):
+        return _loads(s, *args, **kw)
+    return NativeJson.loads(s, isinstance(s, str))
+
+
+def load(fp, *args, **kw):
+    if args or kw:
+        return _load(fp, *args, **kw)
+    return loads(fp.read())
+
+
+def parse(buffer, start=None, end=None):
+    """Parses the UTF-8 JSON in a ByteBuffer, e.g. from lijy.NativeMap.map."""
+    if start is None:
+        start = buffer.position()
+    if end is None:
+        end = buffer.limit()
+    return NativeJson.parse(buffer, start, end)
+
+
+def dumps(obj, *args, **kw):
+    if not args and not kw:
+        s = NativeJson.dumps(obj)
+        if s is not None:
+            return s
+    return _dumps(obj, *args, **kw)
+
+
+def dump(obj, fp, *args, **kw):
+    if args or kw:
+        return _dump(obj, fp, *args, **kw)
+    fp.write(dumps(obj))
+
+
+def install():
+    """Makes the json module's loads, load, dumps and dump use the natives."""
+    _json.loads, _json.load, _json.dumps, _json.dump = loads, load, dumps, dump
@@ -0,0 +1,144 @@
+"""
+POSIX calls for scripts started by LiJy-launch, without jnr-posix.
+
+The calls are made by the launcher's natives in lijy.NativePosix (see
+src/jyposix.c); this module gives them the signatures of the os module.
+Copy it to a directory on python.path, e.g. Lib/site-packages.
+
+    import lijyposix
+    st = lijyposix.stat('setup.py')
+    names = lijyposix.listdir('.')
+
+Scripts that only need these calls can use this module instead of os
+and skip jnr-posix's start-up. install() makes the os module use them as
+well, so later calls skip jnr-posix's per-call overhead; stat results
+are then lijyposix.stat_result tuples, which have the fields and the
+tuple layout of os.stat_result but are not instances of it.
+"""
+
+import sys
+from lijy import NativePosix
+
+F_OK = NativePosix.F_OK
+R_OK = NativePosix.R_OK
+W_OK = NativePosix.W_OK
+X_OK = NativePosix.X_OK
+
+_error = OSError
+
+
+class stat_result(tuple):
+    """os.stat_result's layout: ten fields, times as floats."""
+
+    __slots__ = ()
+    n_sequence_fields = 10
+    st_mode = property(lambda self: self[0])
+    st_ino = property(lambda self: self[1])
+    st_dev = property(lambda self: self[2])
+    st_nlink = property(lambda self: self[3])
+    st_uid = property(lambda self: self[4])
+    st_gid = property(lambda self: self[5])
+    st_size = property(lambda self: self[6])
+    st_atime = property(lambda self: self[7])
+    st_mtime = property(lambda self: self[8])
+    st_ctime = property(lambda self: self[9])
+
+    def __repr__(self):
+        return ('lijyposix.stat_result(st_mode=%d, st_ino=%d, st_dev=%d, '
+                'st_nlink=%d, st_uid=%d, st_gid=%d, st_size=%d, st_atime=%r, '
+                'st_mtime=%r, st_ctime=%r)' % self)
+
+
+def _path(path):
+    """Relative paths start at Jython's working directory, which
+    os.chdir moves without moving the process's."""
+    os = sys.modules.get('os')
+    if os is None or path[:1] == '/' or not path:
+        return path
+    return os.path.join(os.getcwd(), path)
+
+
+def _raise(filename=None):
+    code = NativePosix.errno()
+    if filename is None:
+        raise _error(code, NativePosix.strerror(code))
+    raise _error(code, NativePosix.strerror(code), filename)
+
+
+def _result(f):
+    return stat_result((f[0], f[1], f[2], f[3], f[4], f[5], f[6],
+                        f[7] + f[8] * 1e-9, f[9] + f[10] * 1e-9,
+                        f[11] + f[12] * 1e-9))
+
+
+def stat(path):
+    f = NativePosix.stat(_path(path), True)
+    if f is None:
+        _raise(path)
+    return _result(f)
+
+
+def lstat(path):
+    f = NativePosix.stat(_path(path), False)
+    if f is None:
+        _raise(path)
+    return _result(f)
+
+
+def fstat(fd):
+    f = NativePosix.fstat(fd)
+    if f is None:
+        _raise()
+    return _result(f)
+
+
+def _str(name):
+    try:
+        return str(name)
+    except UnicodeError:
+        return name
+
+
+def listdir(path):
+    names = NativePosix.listdir(_path(path))
+    if names is None:
+        _raise(path)
+    if isinstance(path, unicode):
+        return list(names)
+    return [_str(name) for name in names]
+
+
+def access(path, mode):
+    return NativePosix.access(_path(path), mode)
+
+
+def environ():
+    """The launcher's environment as a dict."""
+    result = {}
+    for entry in NativePosix.environ():
+        name, sep, value = entry.partition('=')
+        result[_str(name)] = _str(value)
+    return result
+
+
+def uname():
+    return tuple(_str(s) for s in NativePosix.uname())
+
+
+isatty = NativePosix.isatty
+umask = NativePosix.umask
+getpid = NativePosix.getpid
+getppid = NativePosix.getppid
+getuid = NativePosix.getuid
+geteuid = NativePosix.geteuid
+getgid = NativePosix.getgid
+getegid = NativePosix.getegid
+
+
+def install():
+    """Makes the os module's functions of the same names use the natives;
+    fstat and isatty stay, Jython passes them descriptor objects."""
+    import os
+    for name in ('stat', 'lstat', 'listdir', 'access', 'umask', 'getpid',
+                 'getppid', 'getuid', 'geteuid', 'getgid', 'getegid', 'uname'):
+        setattr(os, name, globals()[name])
@@ -0,0 +1,108 @@
+"""
+select.epoll for scripts started by LiJy-launch.
+
+The waiting is done by the launcher's natives in lijy.NativeEpoll, the
+sockets are lijy.NativeSocket descriptors (see src/jyepoll.c). Copy this
+module to a directory on python.path, e.g. Lib/site-packages.
+
+    import lijyselect
+    from lijy import NativeSocket
+    ep = lijyselect.epoll()
+    server = NativeSocket.listen('127.0.0.1', 8000, 128)
+    ep.register(server, lijyselect.EPOLLIN)
+    for fd, events in ep.poll(1.0):
+        ...
+
+The interface is CPython's select.epoll. Descriptors are the ints the
+natives return, or objects with a fileno() method returning one; Jython's
+own socket objects have no descriptor and cannot be registered.
+"""
+
+import jarray
+from lijy import NativeEpoll, NativeSocket
+
+EPOLLIN = NativeEpoll.IN
+EPOLLOUT = NativeEpoll.OUT
+EPOLLPRI = NativeEpoll.PRI
+EPOLLERR = NativeEpoll.ERR
+EPOLLHUP = NativeEpoll.HUP
+EPOLLRDHUP = NativeEpoll.RDHUP
+EPOLLET = NativeEpoll.ET
+EPOLLONESHOT = NativeEpoll.ONESHOT
+
+_maxevents = 1024
+
+
+def _fd(f):
+    if isinstance(f, (int, long)):
+        return f
+    return f.fileno()
+
+
+class epoll(object):
+
+    def __init__(self, sizehint=-1):
+        self._epfd = NativeEpoll.create()
+        self._fds = jarray.zeros(_maxevents, 'i')
+        self._events = jarray.zeros(_maxevents, 'i')
+
+    def fileno(self):
+        return self._epfd
+
+    @property
+    def closed(self):
+        return self._epfd < 0
+
+    def close(self):
+        if self._epfd >= 0:
+            NativeSocket.close(self._epfd)
+            self._epfd = -1
+
+    def register(self, fd, eventmask=EPOLLIN | EPOLLPRI | EPOLLOUT):
+        NativeEpoll.add(self._epfd, _fd(fd), eventmask)
+
+    def modify(self, fd, eventmask):
+        NativeEpoll.modify(self._epfd, _fd(fd), eventmask)
+
+    def unregister(self, fd):
+        NativeEpoll.remove(self._epfd, _fd(fd))
+
+    def poll(self, timeout=-1, maxevents=-1):
+        """Returns a list of (fd, events); timeout in seconds, -1 for none."""
+        if timeout is None or timeout < 0:
+            millis = -1
+        else:
+            millis = int(timeout * 1000)
+        fds, events = self._fds, self._events
+        if 0 < maxevents < len(fds):
+            fds = jarray.zeros(maxevents, 'i')
+            events = jarray.zeros(maxevents, 'i')
+        n = NativeEpoll.wait(self._epfd, fds, events, millis)
+        return [(fds[i], events[i]) for i in xrange(n)]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+class waker(object):
+    """An eventfd to register with an epoll; wake() ends its poll from
+    another thread, clear() reads the wakeups away."""
+
+    def __init__(self):
+        self._fd = NativeEpoll.eventfd()
+        self._buffer = jarray.zeros(8, 'b')
+
+    def fileno(self):
+        return self._fd
+
+    def wake(self):
+        NativeEpoll.wake(self._fd)
+
+    def clear(self):
+        NativeSocket.read(self._fd, self._buffer, 0, 8)
+
+    def close(self):
+        NativeSocket.close(self._fd)
@@ -0,0 +1,173 @@
+"""
+Processes for scripts started by LiJy-launch.
+
+Processes are started by the launcher's natives in lijy.NativeSpawn (see
+src/jyspawn.c) instead of java.lang.ProcessBuilder, and with the launcher
+option --spawn-helper by a helper forked before the JVM, so the JVM never
+forks. Copy this module to a directory on python.path, e.g.
+Lib/site-packages.
+
+    import lijyspawn
+    head = lijyspawn.check_output(['git', 'rev-parse', 'HEAD'])
+    p = lijyspawn.Process(['sort'], stdin=lijyspawn.PIPE, stdout=lijyspawn.PIPE)
+    out, err = p.communicate('b\na\n')
+
+Process follows subprocess.Popen for args, stdin, stdout, stderr, cwd
+and env; stdin, stdout and stderr of a Process are the descriptors of its
+pipes, for communicate() or for lijyselect and lijy.NativeSocket.
+"""
+
+import os
+import jarray
+from java.io import IOException
+from java.lang import String
+from subprocess import CalledProcessError
+from lijy import NativeEpoll, NativeSocket, NativeSpawn
+
+PIPE = NativeSpawn.PIPE
+STDOUT = NativeSpawn.STDOUT
+DEVNULL = NativeSpawn.DEVNULL
+
+_chunk = 65536
+
+
+def _descriptor(f):
+    if f is None:
+        return NativeSpawn.INHERIT
+    if not isinstance(f, (int, long)):
+        f = f.fileno()
+        if not isinstance(f, (int, long)):
+            raise TypeError('no descriptor: %r' % (f, ))
+    return f
+
+
+def _oserror(e):
+    message = e.getMessage()
+    i = message.find('error=')
+    if i < 0:
+        return OSError(message)
+    code = int(message[i+6:].split(',')[0])
+    return OSError(code, os.strerror(code))
+
+
+class Process(object):
+
+    def __init__(self, args, stdin=None, stdout=None, stderr=None,
+                 cwd=None, env=None):
+        if isinstance(args, basestring):
+            args = [args]
+        # Jython's os.chdir only moves its own working directory
+        if cwd is None:
+            cwd = os.getcwd()
+        if env is not None:
+            env = jarray.array(['%s=%s' % item for item in env.items()], String)
+        fds = jarray.array([_descriptor(stdin), _descriptor(stdout),
+                            _descriptor(stderr)], 'i')
+        try:
+            self.pid = NativeSpawn.spawn(jarray.array(args, String), env, cwd, fds)
+        except IOException, e:
+            raise _oserror(e)
+        self.args = args
+        self.stdin = fds[0] if stdin == PIPE else None
+        self.stdout = fds[1] if stdout == PIPE else None
+        self.stderr = fds[2] if stderr == PIPE else None
+        self.returncode = None
+
+    def poll(self):
+        if self.returncode is None:
+            code = NativeSpawn.waitFor(self.pid, False)
+            if code != NativeSpawn.RUNNING:
+                self.returncode = code
+        return self.returncode
+
+    def wait(self):
+        if self.returncode is None:
+            self.returncode = NativeSpawn.waitFor(self.pid, True)
+        return self.returncode
+
+    def send_signal(self, sig):
+        if self.returncode is None:
+            NativeSpawn.kill(self.pid, sig)
+
+    def terminate(self):
+        self.send_signal(NativeSpawn.SIGTERM)
+
+    def kill(self):
+        self.send_signal(NativeSpawn.SIGKILL)
+
+    def communicate(self, input=None):
+        """Writes input, reads stdout and stderr to EOF, and waits."""
+        ep = NativeEpoll.create()
+        chunks = {}
+        pending = input and String(input).getBytes('ISO-8859-1')
+        offset = 0
+        try:
+            if self.stdin is not None:
+                if pending:
+                    NativeEpoll.add(ep, self.stdin, NativeEpoll.OUT)
+                else:
+                    self._close('stdin')
+            for fd in self.stdout, self.stderr:
+                if fd is not None:
+                    chunks[fd] = []
+                    NativeEpoll.add(ep, fd, NativeEpoll.IN)
+            buf = jarray.zeros(_chunk, 'b')
+            fds, events = jarray.zeros(4, 'i'), jarray.zeros(4, 'i')
+            remaining = len(chunks) + (self.stdin is not None)
+            while remaining:
+                for i in xrange(NativeEpoll.wait(ep, fds, events, -1)):
+                    fd = fds[i]
+                    if fd == self.stdin:
+                        try:
+                            n = NativeSocket.write(fd, pending, offset,
+                                                   min(len(pending) - offset, 4096))
+                        except IOException:
+                            # the process does not read its input
+                            n, offset = 0, len(pending)
+                        offset += max(n, 0)
+                        if offset == len(pending):
+                            self._close('stdin')
+                            remaining -= 1
+                        continue
+                    n = NativeSocket.read(fd, buf, 0, _chunk)
+                    if n > 0:
+                        chunks[fd].append(buf[:n].tostring())
+                    elif n == 0:
+                        NativeEpoll.remove(ep, fd)
+                        remaining -= 1
+        finally:
+            NativeSocket.close(ep)
+        out = err = None
+        if self.stdout is not None:
+            out = ''.join(chunks[self.stdout])
+            self._close('stdout')
+        if self.stderr is not None:
+            err = ''.join(chunks[self.stderr])
+            self._close('stderr')
+        self.wait()
+        return out, err
+
+    def _close(self, name):
+        fd = getattr(self, name)
+        if fd is not None:
+            NativeSocket.close(fd)
+            setattr(self, name, None)
+
+
+def call(args, **kw):
+    return Process(args, **kw).wait()
+
+
+def check_call(args, **kw):
+    code = call(args, **kw)
+    if code:
+        raise CalledProcessError(code, args)
+    return 0
+
+
+def check_output(args, **kw):
+    p = Process(args, stdout=PIPE, **kw)
+    out, err = p.communicate()
+    if p.returncode:
+        raise CalledProcessError(p.returncode, args, output=out)
+    return out
@@ -0,0 +1,71 @@
+"""
+Directory-tree walking for scripts started by LiJy-launch.
+
+The directories are read by the launcher's natives in lijy.NativeWalk
+(see src/jywalk.c), on several threads at once; this module gives them
+the signature of os.walk. Copy it to a directory on python.path, e.g.
+Lib/site-packages.
+
+    import lijywalk
+    for dirpath, dirnames, filenames in lijywalk.walk('src'):
+        ...
+
+Unlike os.walk, directories come in no particular order, each as soon
+as a walker has read it, and dirnames cannot prune the walk: the
+walkers are ahead of the caller, so adding or removing names raises
+ValueError. Names are unicode strings. walk(top, topdown=False) needs
+the order, so it is os.walk.
+
+The walkers read ahead of the caller until walk is exhausted or closed.
+A caller that leaves the loop early should close it rather than leave
+that to the garbage collector:
+
+    from contextlib import closing
+    with closing(lijywalk.walk('src')) as tree:
+        for dirpath, dirnames, filenames in tree:
+            if 'setup.py' in filenames:
+                break
+"""
+
+import os
+from lijy import NativeWalk
+
+BATCH = 4096
+
+
+def walk(top, topdown=True, onerror=None, followlinks=False, threads=0):
+    """os.walk on threads walkers (0: one per processor).
+
+    Raises ValueError if the caller adds to or removes from dirnames,
+    which cannot prune the walk. close() stops the walkers.
+    """
+    if not topdown:
+        for entry in os.walk(top, topdown, onerror, followlinks):
+            yield entry
+        return
+    # relative to Jython's working directory, yielded relative as well
+    start = top
+    if top[:1] != '/':
+        start = os.path.join(os.getcwd(), top)
+    skip = len(start)
+    handle = NativeWalk.open(start, threads, followlinks)
+    try:
+        while True:
+            batch = NativeWalk.next(handle, BATCH)
+            if batch is None:
+                return
+            for i in xrange(0, len(batch), 3):
+                path = top + batch[i][skip:]
+                if batch[i+1] is None:
+                    if onerror is not None:
+                        code = batch[i+2]
+                        onerror(OSError(code, os.strerror(code), path))
+                    continue
+                dirnames = list(batch[i+1])
+                yield path, dirnames, list(batch[i+2])
+                # sorting them is fine, only the order is lost anyway
+                if set(dirnames) != set(batch[i+1]):
+                    raise ValueError('lijywalk.walk cannot prune the walk '
+                                     'by changing dirnames of %s' % path)
+    finally:
+        NativeWalk.close(handle)
@@ -0,0 +1,160 @@
+/*
+ * admission.c
+ *
+ * When many launchers start at once (e.g. cron jobs firing at the top
+ * of the hour), their JNI_CreateJavaVM calls all reserve heap and start
+ * GC and JIT threads at the same moment and the host thrashes.
+ *
+ * If JYTHON_LAUNCH_SLOTS is set, at most that many launchers on the
+ * host create their JVM concurrently; others queue on a System V
+ * semaphore. SEM_UNDO gives a slot back if its launcher dies while
+ * holding it. The slot count is fixed by the launcher that creates the
+ * semaphore; remove it with ipcrm to change it.
+ * Holding a slot, a launcher additionally waits (with exponential
+ * backoff) while MemAvailable is below its -Xmx. JYTHON_LAUNCH_TIMEOUT
+ * (seconds, default 60) bounds the whole wait; after that the JVM is
+ * created anyway. The slot is released as soon as the JVM is created.
+ */
+
+#define _GNU_SOURCE /* semtimedop */
+#include "java.h"
+#include "admission.h"
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <time.h>
+
+#define admissionKey ((key_t) 0x4c694a79) /* "LiJy" */
+#define defaultTimeout 60
+#define minBackoffMs 25
+#define maxBackoffMs 1000
+
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+
+static int semId = -1;
+static jboolean slotTaken = JNI_FALSE;
+
+/*
+ * Opens the host-wide semaphore, creating it with the given number of
+ * slots if needed. The creator posts the slots with semop, which sets
+ * sem_otime; others wait for that to avoid seeing a half-initialized
+ * semaphore.
+ */
+static int
+OpenSemaphore(int slots)
+{
+	struct sembuf op;
+	union semun arg;
+	struct semid_ds ds;
+	int i, id = semget(admissionKey, 1, IPC_CREAT | IPC_EXCL | 0666);
+	if (id >= 0) {
+		op.sem_num = 0;
+		op.sem_op = slots;
+		op.sem_flg = 0;
+		if (semop(id, &op, 1) < 0)
+			return -1;
+		JLI_TraceLauncher("admission: created semaphore with %d slots\n", slots);
+		return id;
+	}
+	if (errno != EEXIST || (id = semget(admissionKey, 1, 0)) < 0)
+		return -1;
+	arg.buf = &ds;
+	for (i = 0; i < 100; ++i) {
+		if (semctl(id, 0, IPC_STAT, arg) < 0)
+			return -1;
+		if (ds.sem_otime != 0)
+			return id;
+		usleep(10000);
+	}
+	return -1;
+}
+
+static void
+AcquireSlot(jlong deadline)
+{
+	struct sembuf op;
+	struct timespec timeout;
+	jlong remaining;
+	op.sem_num = 0;
+	op.sem_op = -1;
+	op.sem_flg = SEM_UNDO;
+	for (;;) {
+		remaining = deadline - CounterGet();
+		if (remaining <= 0)
+			break;
+		timeout.tv_sec = remaining / 1000000;
+		timeout.tv_nsec = (remaining % 1000000) * 1000;
+		if (semtimedop(semId, &op, 1, &timeout) == 0) {
+			slotTaken = JNI_TRUE;
+			return;
+		}
+		if (errno != EINTR)
+			break;
+	}
+	JLI_TraceLauncher("admission: no slot (%s), launching anyway\n",
+			errno == EAGAIN ? "timeout" : strerror(errno));
+}
+
+/* MemAvailable from /proc/meminfo in bytes, -1 if unknown */
+static jlong
+MemAvailable()
+{
+	char line[128];
+	long long kb = -1;
+	FILE *fp = fopen("/proc/meminfo", "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb < 0 ? -1 : (jlong) kb * 1024;
+}
+
+jlong
+AdmitLaunch(jlong maxHeapSize)
+{
+	const char *slotsEnv = getenv("JYTHON_LAUNCH_SLOTS");
+	const char *timeoutEnv = getenv("JYTHON_LAUNCH_TIMEOUT");
+	int slots = slotsEnv != NULL ? atoi(slotsEnv) : 0;
+	int backoff = minBackoffMs;
+	jlong start, deadline, remaining, available, waited;
+
+	if (slots <= 0)
+		return -1;
+	start = CounterGet();
+	deadline = start + (jlong) (timeoutEnv != NULL ? atoi(timeoutEnv) : defaultTimeout) * 1000000;
+	semId = OpenSemaphore(slots);
+	if (semId < 0) {
+		JLI_TraceLauncher("admission: no semaphore (%s), not queueing\n", strerror(errno));
+	} else {
+		AcquireSlot(deadline);
+	}
+	while (maxHeapSize > 0 && (available = MemAvailable()) >= 0
+			&& available < maxHeapSize && (remaining = deadline - CounterGet()) > 0) {
+		JLI_TraceLauncher("admission: %ld MB available, -Xmx is %ld MB, waiting %d ms\n",
+				(long) (available >> 20), (long) (maxHeapSize >> 20), backoff);
+		usleep(remaining < backoff * 1000 ? remaining : backoff * 1000);
+		backoff = 2*backoff > maxBackoffMs ? maxBackoffMs : 2*backoff;
+	}
+	waited = CounterGet() - start;
+	JLI_TraceLauncher("admission: waited %ld micro seconds for JVM creation\n", (long) waited);
+	return waited;
+}
+
+void
+ReleaseLaunchSlot()
+{
+	struct sembuf op;
+	if (!slotTaken)
+		return;
+	op.sem_num = 0;
+	op.sem_op = 1;
+	op.sem_flg = SEM_UNDO;
+	semop(semId, &op, 1);
+	slotTaken = JNI_FALSE;
+}
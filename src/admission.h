@@ -0,0 +1,23 @@
+/*
+ * admission.h
+ *
+ * Host-wide admission control for JVM creation, see admission.c.
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <jni.h>
+
+#define queueWaitOpt "-Dpython.launcher.queuewait="
+
+/*
+ * Blocks until this launcher may create its JVM. Returns the time
+ * waited in micro seconds, or -1 if admission control is disabled.
+ */
+jlong AdmitLaunch(jlong maxHeapSize);
+
+/* Gives the slot taken by AdmitLaunch back; no-op if none was taken. */
+void ReleaseLaunchSlot();
+
+#endif /* ADMISSION_H_ */
@@ -52,6 +52,11 @@
 
 
 #include "jython.h"
+#include "jdkindex.h"
+#include "jycache.h"
+#include "admission.h"
+#include "jypreload.h"
+#include "jynative.h"
 //#include "glob.h"
 
 /*
@@ -70,6 +75,8 @@ static jboolean showVersion = JNI_FALSE;  /* print but continue */
 static jboolean printUsage = JNI_FALSE;   /* print and exit*/
 static jboolean printXUsage = JNI_FALSE;  /* print and exit*/
 static char	 *showSettings = NULL;        /* print but continue */
+static const char *preloadList = NULL;    /* class list, see jypreload.c */
+static jboolean bufferStdout = JNI_FALSE; /* see jystdout.c */
 
 static const char *_program_name;
 static const char *_launcher_name;
@@ -98,6 +105,8 @@ static jclass LoadMainClass(JNIEnv *env, int mode, char *name);
 
 //static void TranslateApplicationArgs(int jargc, const char **jargv, int *pargc, char ***pargv);
 static jboolean AddApplicationOptions(int cpathc, const char **cpathv);
+static void AddPerformanceOptions(const JdkInfo *jdk, const char *jypath, JySetup* jysetup);
+static int EmbedJVM(InvocationFunctions *ifn, JySetup* jysetup);
 
 static void PrintJavaVersion(JNIEnv *env, jboolean extraLF);
 static void PrintUsage(JNIEnv* env, jboolean doXUsage);
@@ -198,6 +207,8 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 
 	InitLauncher(javaw);
 	DumpState();
+	//Warm the page cache with the files the script read last time, see jyprefetch.c
+	startPrefetch(jysetup);
 	int i;
 	if (JLI_IsTraceLauncher()) {
 //		int i;
@@ -300,6 +311,29 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 		SetClassPath(jysetup->cp, !jysetup->print_requested, JNI_FALSE);
 	}
 
+	preloadList = jysetup->preloadList;
+	bufferStdout = jysetup->bufferStdout && !jysetup->print_requested;
+
+	//Queue behind other launchers if JYTHON_LAUNCH_SLOTS is set, see admission.c
+	if (!jysetup->print_requested) {
+		static char queueWait[sizeof(queueWaitOpt)+24];
+		jlong waited = AdmitLaunch(maxHeapSize);
+		if (waited >= 0) {
+			JLI_Snprintf(queueWait, sizeof(queueWait), queueWaitOpt "%ld", (long) (waited/1000));
+			AddOption(queueWait, NULL);
+		}
+	}
+
+	//Fork while the process is still small, see jyspawn.c
+	if (jysetup->spawnHelper && !jysetup->print_requested) {
+		StartSpawnHelper();
+	}
+
+	//Discovery ends here, its directory fds must not stay open in the JVM.
+	const JdkInfo *jdk = GetJdkInfo(jrepath);
+	TraceProbeCache();
+	ProbeCacheClear();
+
 	ifn.CreateJavaVM = 0;
 	ifn.GetDefaultJavaVMInitArgs = 0;
 
@@ -400,6 +434,8 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 	/* set the -Dsun.java.launcher.* platform properties */
 	SetJavaLauncherPlatformProps();
 
+	AddPerformanceOptions(jdk, jypath, jysetup);
+
 	char* profileOpt = "-XX:-UseSplitVerifier";
 	char* profileOpt2 = NULL;
 	if (jysetup->profile) {
@@ -413,9 +449,18 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 //		puts(profileOpt2);
 //		printf("%i %i\n", sizeof(profileOptPre)
 //				+sizeof(profileOptPost)+(_jydir-jypath)-1, strlen(profileOpt2));
-		AddOption(profileOpt, NULL);
+		//JDK 8 dropped the split verifier flag and warns about it.
+		if (JdkSupportsFlag(jdk, JDK_FLAG_SPLIT_VERIFIER)) {
+			AddOption(profileOpt, NULL);
+		}
 		AddOption(profileOpt2, NULL);
 	}
+	//The agent is part of this launcher, so a plain java command
+	//printed by --print could not load it.
+	char* agentOpt = jysetup->print_requested ? NULL : prepareAgentOption(jysetup);
+	if (agentOpt) {
+		AddOption(agentOpt, NULL);
+	}
 //	puts("\nOptions:");
 ////	static JavaVMOption *options;
 ////	static int numOptions
@@ -431,10 +476,21 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 //	{
 //		printf("	argv[%2d] = '%s'\n", i, argv[i]);
 //	}
+	recordLaunch(jysetup, jrepath, jvmpath, options, numOptions);
+	if (jysetup->embedded)
+	{
+		//library use (see jylaunch.c): hand the JVM over instead of running Jython
+		int result = EmbedJVM(&ifn, jysetup);
+		if (profileOpt2) free(profileOpt2);
+		if (agentOpt) free(agentOpt);
+		return result;
+	}
 	if (jysetup->print_requested)
 	{
 		//yes, we destroy jrepath here, but it won't be needed again
-		jrepath[strrchr(jrepath, FILE_SEPARATOR)-jrepath] = NULL;
+		//(modular runtimes have no jre directory to strip)
+		if (!IsModularRuntime(jrepath))
+			jrepath[strrchr(jrepath, FILE_SEPARATOR)-jrepath] = NULL;
 		printf(jrepath);
 		printf(FILESEP);
 		printf("bin");
@@ -548,10 +604,15 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 		//this code prepares the new classpath:
 		numOptions = 2;
 		AddOption("-Xms8m", NULL);
-		int jdpCpLen = prepareJdbClasspathLen(jrepath);
-		char jdpCp[jdpCpLen];
-		prepareJdbClasspath(jrepath, &jdpCp);
-		SetClassPath(jdpCp, JNI_TRUE, JNI_FALSE); //maybe better use boot here
+		if (IsModularRuntime(jrepath)) {
+			//JDK 9+ has no tools.jar, the debugger lives in module jdk.jdi
+			AddOption(jdbModulesOpt, NULL);
+		} else {
+			int jdpCpLen = prepareJdbClasspathLen(jrepath);
+			char jdpCp[jdpCpLen];
+			prepareJdbClasspath(jrepath, &jdpCp);
+			SetClassPath(jdpCp, JNI_TRUE, JNI_FALSE); //maybe better use boot here
+		}
 		what = "com/sun/tools/example/debug/tty/TTY";
 //		puts("Debug options:");
 //		for (i = 0; i < numOptions; ++i) {
@@ -570,6 +631,7 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 			if (toFree[newArgc]) free(toFree[newArgc]);
 		}
 		if (profileOpt2) free(profileOpt2);
+		if (agentOpt) free(agentOpt);
 		return result;
 	}
 
@@ -577,6 +639,7 @@ JLI_Launch(int argc, char ** argv,             /* main argc, argc */
 			jysetup->jythonCount, jysetup->jython,// argc, argv,
 			mode, what, ret, jysetup->help);
 	if (profileOpt2) free(profileOpt2);
+	if (agentOpt) free(agentOpt);
 	return result;
 }
 
@@ -661,6 +724,11 @@ JavaMain(void * _args)
 		JLI_ReportErrorMessage(JVM_ERROR1);
 		exit(1);
 	}
+	ReleaseLaunchSlot();
+	if (preloadList != NULL && !args->printHelp) {
+		StartClassPreload(vm, preloadList);
+	}
+	RegisterLauncherNatives(env);
 	if (showSettings != NULL) {
 		ShowSettings(env, showSettings);
 		CHECK_EXCEPTION_LEAVE(1);
@@ -680,6 +748,9 @@ JavaMain(void * _args)
 	}
 //	puts("printUsage done");
 	FreeKnownVMs();  /* after last possible PrintUsage() */
+	if (bufferStdout && !args->printHelp) {
+		BufferStdout(env);
+	}
 //	puts("FreeKnownVMs done");
 	if (JLI_IsTraceLauncher()) {
 		end = CounterGet();
@@ -746,6 +817,8 @@ JavaMain(void * _args)
 		puts("\n");
 		print_help();
 	} else {
+		//startup ends here, the file profile covers only this, see jyprefetch.c
+		stopFileProfile();
 		(*env)->CallStaticVoidMethod(env, mainClass, mainID, mainArgs);
 	}
 
@@ -1352,6 +1425,51 @@ LoadMainClass(JNIEnv *env, int mode, char *name)
 //	*nargv = 0;
 //}
 
+/*
+ * Whether the user passed a VM option starting with prefix via -J.
+ */
+static jboolean
+HasJavaOption(JySetup* jysetup, const char *prefix)
+{
+	int i;
+	for (i = 0; i < jysetup->javaCount; ++i) {
+		if (JLI_StrNCmp(jysetup->java[i], prefix, JLI_StrLen(prefix)) == 0)
+			return JNI_TRUE;
+	}
+	return JNI_FALSE;
+}
+
+/*
+ * Adds startup related VM options the JDK is known to support (see
+ * jdkindex.c), unless the user configured them already:
+ * -Xshare:auto if the JDK ships a CDS archive, and with --cds-archive on
+ * JDKs that can create one a dynamic archive per JDK and jython.jar in
+ * the cache. --print creates no archive directory.
+ */
+static void
+AddPerformanceOptions(const JdkInfo *jdk, const char *jypath, JySetup* jysetup)
+{
+	static char archiveOpt[PATH_MAX+32];
+	char key[2*PATH_MAX+2];
+	if (jdk == NULL || HasJavaOption(jysetup, "-Xshare"))
+		return;
+	if (jdk->cds) {
+		AddOption("-Xshare:auto", NULL);
+	}
+	if (jysetup->cdsArchive && !jysetup->print_requested
+			&& JdkSupportsFlag(jdk, JDK_FLAG_AUTO_CREATE_SHARED_ARCHIVE)
+			&& !HasJavaOption(jysetup, "-XX:SharedArchiveFile")
+			&& !HasJavaOption(jysetup, "-XX:ArchiveClassesAtExit")) {
+		JLI_Snprintf(key, sizeof(key), "%s:%s", jdk->jre, jypath);
+		JLI_StrCpy(archiveOpt, "-XX:SharedArchiveFile=");
+		if (jyCachePath(archiveOpt+JLI_StrLen(archiveOpt),
+				sizeof(archiveOpt)-JLI_StrLen(archiveOpt), "cds", key, JNI_TRUE)) {
+			AddOption("-XX:+AutoCreateSharedArchive", NULL);
+			AddOption(archiveOpt, NULL);
+		}
+	}
+}
+
 /*
  * For our tools, we try to add 3 VM options:
  *	  -Denv.class.path=<envcp>
@@ -1819,6 +1937,78 @@ FreeKnownVMs()
 	JLI_MemFree(knownVMs);
 }
 
+/*
+ * Brings the launcher state back to what a fresh process has, so that
+ * a library host (see jylaunch.c) can run JLI_Launch more than once.
+ * Option strings are owned by their creators and not freed here.
+ */
+void
+ResetLaunchState()
+{
+	if (options != NULL) {
+		JLI_MemFree(options);
+	}
+	options = NULL;
+	numOptions = maxOptions = 0;
+	if (knownVMs != NULL) {
+		FreeKnownVMs();
+	}
+	knownVMs = NULL;
+	knownVMsCount = knownVMsLimit = 0;
+	printVersion = showVersion = printUsage = printXUsage = JNI_FALSE;
+	showSettings = NULL;
+	preloadList = NULL;
+	_program_name = _launcher_name = NULL;
+	threadStackSize = maxHeapSize = initialHeapSize = 0;
+	helperClass = NULL;
+	makePlatformStringMID = NULL;
+	ProbeCacheClear();
+}
+
+typedef struct {
+	InvocationFunctions *ifn;
+	JavaVM *vm;
+} EmbedArgs;
+
+static int JNICALL
+EmbedJVMContinuation(void *_args)
+{
+	EmbedArgs *args = (EmbedArgs *) _args;
+	JNIEnv *env = NULL;
+	if (!InitializeJVM(&args->vm, &env, args->ifn)) {
+		return 1;
+	}
+	RegisterLauncherNatives(env);
+	(*args->vm)->DetachCurrentThread(args->vm);
+	return 0;
+}
+
+/*
+ * Instead of running Jython, stores the JVM of this process in
+ * jysetup->vm. An existing JVM is reused; otherwise one is created from
+ * the prepared options in a new thread (like JVMInit does, to keep it
+ * off the host's primordial thread), which detaches again.
+ */
+static int
+EmbedJVM(InvocationFunctions *ifn, JySetup* jysetup)
+{
+	EmbedArgs args;
+	jsize count = 0;
+	args.ifn = ifn;
+	args.vm = NULL;
+	if (ifn->GetCreatedJavaVMs != NULL
+			&& ifn->GetCreatedJavaVMs(&args.vm, 1, &count) == JNI_OK && count > 0) {
+		JLI_TraceLauncher("Reusing the JVM of this process\n");
+	} else if (ContinueInNewThread0(EmbedJVMContinuation, threadStackSize, &args) != 0) {
+		ReleaseLaunchSlot();
+		JLI_ReportErrorMessage(JVM_ERROR1);
+		return 1;
+	}
+	ReleaseLaunchSlot();
+	jysetup->vm = args.vm;
+	return 0;
+}
+
 const char*
 GetProgramName()
 {
@@ -72,6 +72,7 @@ typedef struct JDK1_1InitArgs {
 //#include "manifest_info.h"
 //#include "version_comp.h"
 #include "wildcard.h"
+#include "jyprobe.h"
 
 # define KB (1024UL)
 # define MB (1024UL * KB)
@@ -133,6 +134,15 @@ GetJavaHome(char *buf, jint bufsize);
 jboolean
 GetJythonHome(char *buf, jint bufsize);
 
+jboolean
+IsModularRuntime(const char *jrepath);
+
+void
+ResetLaunchState();
+
+void
+GetJreLibPath(const char *jrepath, const char *arch, char *buf, jint bufsize);
+
 #define GetArch() GetArchPath(CURRENT_DATA_MODEL)
 
 /* Reports an error message to stderr or a window as appropriate. */
@@ -3,6 +3,7 @@
  * ORACLE PROPRIETARY/CONFIDENTIAL. Use is subject to license terms.
  */
 #include "java.h"
+#include "jdkindex.h"
 
 /*
  * If app is "/foo/bin/javac", or "/foo/bin/sparcv9/javac" then put
@@ -19,7 +20,8 @@ GetJavaHome(char *buf, jint bufsize)
 		JLI_Snprintf(buf, bufsize, "%s", javahome);
 		buf[bufsize-1] = '\0';
 	} else {
-		return JNI_FALSE;
+		/* no JAVA_HOME, look for an installed JDK (see jdkindex.c) */
+		return DiscoverJavaHome(buf, bufsize);
 	}
 	return JNI_TRUE;
 }
@@ -38,6 +40,34 @@ GetJythonHome(char *buf, jint bufsize)
 	return JNI_TRUE;
 }
 
+/*
+ * JDK 9 and later ship a modular runtime image: the classes are in
+ * lib/modules and the <arch> level below lib is gone, i.e. there is
+ * lib/libjava.so, lib/jvm.cfg and lib/server/libjvm.so.
+ */
+jboolean
+IsModularRuntime(const char *jrepath)
+{
+	char modules[MAXPATHLEN];
+	JLI_Snprintf(modules, sizeof(modules), "%s/lib/modules", jrepath);
+	return ProbeExists(modules);
+}
+
+/*
+ * Puts the directory containing libjava.so, jvm.cfg and the VM
+ * directories into buf, i.e. <jrepath>/lib/<arch> or, for modular
+ * runtimes, <jrepath>/lib.
+ */
+void
+GetJreLibPath(const char *jrepath, const char *arch, char *buf, jint bufsize)
+{
+	if (IsModularRuntime(jrepath)) {
+		JLI_Snprintf(buf, bufsize, "%s/lib", jrepath);
+	} else {
+		JLI_Snprintf(buf, bufsize, "%s/lib/%s", jrepath, arch);
+	}
+}
+
 jboolean
 GetApplicationHome(char *buf, jint bufsize)
 {
@@ -81,7 +111,7 @@ static int
 ProgramExists(char *name)
 {
 	struct stat sb;
-	if (stat(name, &sb) != 0) return 0;
+	if (ProbeStat(name, &sb) != 0) return 0;
 	if (S_ISDIR(sb.st_mode)) return 0;
 	return (sb.st_mode & S_IEXEC) != 0;
 }
@@ -98,7 +128,7 @@ Resolve(char *indir, char *cmd)
 	JLI_Snprintf(name, sizeof(name), "%s%c%s", indir, FILE_SEPARATOR, cmd);
 	if (!ProgramExists(name)) return 0;
 	real = JLI_MemAlloc(PATH_MAX + 2);
-	if (!realpath(name, real))
+	if (!ProbeRealpath(name, real))
 		JLI_StrCpy(real, name);
 	return real;
 }
@@ -203,7 +233,7 @@ CheckSanity(char *path, char *dir)
 		return (0);	 /* Silently reject "impossibly" long paths */
 
 	JLI_Snprintf(buffer, sizeof(buffer), "%s/%s/bin/java", path, dir);
-	return ((access(buffer, X_OK) == 0) ? 1 : 0);
+	return (ProbeAccess(buffer, X_OK) ? 1 : 0);
 }
 
 /*
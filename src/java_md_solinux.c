@@ -33,6 +33,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <link.h>
 #include "wildcard.h"
 
 
@@ -103,8 +107,15 @@
  *  a. if the LD_LIBRARY_PATH's first component is the the path to the desired
  *     libjvm.so
  *  b. if any other libjvm.so is found in any of the paths.
- * If case b is true, then the launcher will set the LD_LIBRARY_PATH to the
- * desired JRE and reexec, in order to propagate the environment.
+ * If case b is true, the launcher first tries to avoid the re-exec: it
+ * reads the DT_NEEDED entries of the desired libjvm.so and libjava.so,
+ * resolves those living in the JRE via their $ORIGIN based RUNPATH and
+ * dlopens them (and libjvm.so itself) by absolute path with RTLD_GLOBAL,
+ * see PreloadJvmLibraries. The runtime linker then matches the sonames
+ * against the already loaded objects instead of searching LD_LIBRARY_PATH.
+ * Only if that fails, the launcher will set the LD_LIBRARY_PATH to the
+ * desired JRE and reexec, in order to propagate the environment. Such a
+ * re-exec is counted and timed in the launcher trace (see TraceReexec).
  *
  *  Main
  *  (incoming argv)
@@ -194,6 +205,12 @@
 /* Store the name of the executable once computed */
 static char *execname = NULL;
 
+/* Marker passed to a re-exec'ed launcher: <count>:<exec time>:<time lost> */
+#define REEXEC_ENV "_JAVA_LAUNCHER_REEXEC"
+static int reexecCount = 0;
+static jlong reexecLost = 0;     /* micro seconds lost to earlier re-execs */
+static jlong launcherStart = 0;  /* CounterGet() at CreateExecutionEnvironment */
+
 /*
  * execname accessor from other parts of platform dependent logic
  */
@@ -223,14 +240,15 @@ JvmExists(const char *path) {
     char tmp[PATH_MAX + 1];
     struct stat statbuf;
     JLI_Snprintf(tmp, PATH_MAX, "%s/%s", path, JVM_DLL);
-    if (stat(tmp, &statbuf) == 0) {
+    if (ProbeStat(tmp, &statbuf) == 0) {
         return JNI_TRUE;
     }
     return JNI_FALSE;
 }
 
 /*
- * contains a lib/$LIBARCH/{server,client}/libjvm.so ?
+ * contains a lib/$LIBARCH/{server,client}/libjvm.so or, for modular
+ * runtimes, a lib/{server,client}/libjvm.so ?
  */
 static jboolean
 ContainsLibJVM(int wanted, const char *env) {
@@ -240,6 +258,7 @@ ContainsLibJVM(int wanted, const char *env) {
     char *path;
     jboolean clientPatternFound;
     jboolean serverPatternFound;
+    jboolean modularPatternFound;
 
     /* fastest path */
     if (env == NULL) {
@@ -253,7 +272,10 @@ ContainsLibJVM(int wanted, const char *env) {
     /* to optimize for time, test if any of our usual suspects are present. */
     clientPatternFound = JLI_StrStr(env, clientPattern) != NULL;
     serverPatternFound = JLI_StrStr(env, serverPattern) != NULL;
-    if (clientPatternFound == JNI_FALSE && serverPatternFound == JNI_FALSE) {
+    modularPatternFound = JLI_StrStr(env, "lib/client") != NULL
+            || JLI_StrStr(env, "lib/server") != NULL;
+    if (clientPatternFound == JNI_FALSE && serverPatternFound == JNI_FALSE
+            && modularPatternFound == JNI_FALSE) {
         return JNI_FALSE;
     }
 
@@ -274,6 +296,13 @@ ContainsLibJVM(int wanted, const char *env) {
                 return JNI_TRUE;
             }
         }
+        if (modularPatternFound && (JLI_StrStr(path, "lib/client") != NULL
+                || JLI_StrStr(path, "lib/server") != NULL)) {
+            if (JvmExists(path)) {
+                JLI_MemFree(envpath);
+                return JNI_TRUE;
+            }
+        }
     }
     JLI_MemFree(envpath);
     return JNI_FALSE;
@@ -345,8 +374,243 @@ RequiresSetenv(int wanted, const char *jvmpath) {
     }
     return JNI_FALSE;
 }
+
+#define MAX_NEEDED 32
+#define MAX_PRELOAD_DEPTH 4
+
+static ElfW(Off)
+ElfVaddrToOffset(ElfW(Phdr) *phdr, int phnum, ElfW(Addr) vaddr)
+{
+    int i;
+    for (i = 0; i < phnum; i++) {
+        if (phdr[i].p_type == PT_LOAD && vaddr >= phdr[i].p_vaddr
+                && vaddr < phdr[i].p_vaddr + phdr[i].p_filesz) {
+            return vaddr - phdr[i].p_vaddr + phdr[i].p_offset;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads the DT_NEEDED entries and the DT_RUNPATH (or DT_RPATH) of the
+ * shared object at path. Returns the number of needed libraries or -1
+ * if path is not an ELF object of our data model.
+ */
+static int
+ReadElfNeeded(const char *path, char needed[][NAME_MAX + 1], int maxNeeded,
+              char *runpath, size_t runpathsize)
+{
+    struct stat st;
+    unsigned char *data;
+    ElfW(Ehdr) *ehdr;
+    ElfW(Phdr) *phdr;
+    ElfW(Dyn) *dyn = NULL;
+    ElfW(Off) strtab = 0;
+    size_t dynCount = 0, i;
+    int count = -1;
+    int fd = open(path, O_RDONLY);
+
+    runpath[0] = '\0';
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    ehdr = (ElfW(Ehdr) *) data;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+            || ehdr->e_ident[EI_CLASS] != (__ELF_NATIVE_CLASS == 64 ? ELFCLASS64 : ELFCLASS32)
+            || ehdr->e_phoff + ehdr->e_phnum * sizeof(ElfW(Phdr)) > (size_t) st.st_size) {
+        goto done;
+    }
+    phdr = (ElfW(Phdr) *) (data + ehdr->e_phoff);
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type == PT_DYNAMIC
+                && phdr[i].p_offset + phdr[i].p_filesz <= (size_t) st.st_size) {
+            dyn = (ElfW(Dyn) *) (data + phdr[i].p_offset);
+            dynCount = phdr[i].p_filesz / sizeof(ElfW(Dyn));
+        }
+    }
+    for (i = 0; i < dynCount && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_STRTAB) {
+            strtab = ElfVaddrToOffset(phdr, ehdr->e_phnum, dyn[i].d_un.d_ptr);
+        }
+    }
+    if (strtab == 0) {
+        goto done;
+    }
+    count = 0;
+    for (i = 0; i < dynCount && dyn[i].d_tag != DT_NULL; i++) {
+        const char *str;
+        if (strtab + dyn[i].d_un.d_val >= (size_t) st.st_size) {
+            continue;
+        }
+        str = (const char *) data + strtab + dyn[i].d_un.d_val;
+        if (dyn[i].d_tag == DT_NEEDED && count < maxNeeded) {
+            JLI_Snprintf(needed[count++], NAME_MAX + 1, "%s", str);
+        } else if (dyn[i].d_tag == DT_RUNPATH
+                || (dyn[i].d_tag == DT_RPATH && runpath[0] == '\0')) {
+            JLI_Snprintf(runpath, runpathsize, "%s", str);
+        }
+    }
+done:
+    munmap(data, st.st_size);
+    return count;
+}
+
+/*
+ * Looks for a needed library in the RUNPATH directories (with $ORIGIN
+ * substituted) and next to the object that needs it. Libraries found
+ * there belong to the JRE; others are left to the runtime linker.
+ */
+static jboolean
+ResolveNeeded(const char *name, const char *runpath, const char *origin,
+              char *resolved, size_t resolvedsize)
+{
+    char *dirs = JLI_StringDup(runpath);
+    char *dir, *rest;
+    char path[PATH_MAX];
+    jboolean found = JNI_FALSE;
+
+    for (dir = JLI_StrTok(dirs, ":"); dir != NULL && !found; dir = JLI_StrTok(NULL, ":")) {
+        if (JLI_StrNCmp(dir, "$ORIGIN", 7) == 0) {
+            rest = dir + 7;
+        } else if (JLI_StrNCmp(dir, "${ORIGIN}", 9) == 0) {
+            rest = dir + 9;
+        } else {
+            continue;
+        }
+        JLI_Snprintf(path, sizeof(path), "%s%s/%s", origin, rest, name);
+        found = ProbeExists(path);
+    }
+    JLI_MemFree(dirs);
+    if (!found) {
+        JLI_Snprintf(path, sizeof(path), "%s/%s", origin, name);
+        found = ProbeExists(path);
+    }
+    if (found) {
+        JLI_Snprintf(resolved, resolvedsize, "%s", path);
+    }
+    return found;
+}
+
+/*
+ * dlopens the JRE-local dependencies of the object at path (depth
+ * first), but not the object itself.
+ */
+static jboolean
+PreloadDependencies(const char *path, int depth)
+{
+    char needed[MAX_NEEDED][NAME_MAX + 1];
+    char runpath[PATH_MAX];
+    char origin[PATH_MAX];
+    char resolved[PATH_MAX];
+    char *lastslash;
+    void *handle;
+    int i, count;
+
+    count = ReadElfNeeded(path, needed, MAX_NEEDED, runpath, sizeof(runpath));
+    if (count < 0) {
+        return JNI_FALSE;
+    }
+    JLI_Snprintf(origin, sizeof(origin), "%s", path);
+    lastslash = JLI_StrRChr(origin, '/');
+    if (lastslash != NULL) {
+        *lastslash = '\0';
+    }
+    for (i = 0; i < count; i++) {
+        if (!ResolveNeeded(needed[i], runpath, origin, resolved, sizeof(resolved))) {
+            continue;
+        }
+        handle = dlopen(resolved, RTLD_NOW | RTLD_GLOBAL | RTLD_NOLOAD);
+        if (handle != NULL) {
+            continue;
+        }
+        if (depth > 0 && !PreloadDependencies(resolved, depth - 1)) {
+            return JNI_FALSE;
+        }
+        if (dlopen(resolved, RTLD_NOW | RTLD_GLOBAL) == NULL) {
+            JLI_TraceLauncher("preloading %s failed: %s\n", resolved, dlerror());
+            return JNI_FALSE;
+        }
+        JLI_TraceLauncher("preloaded %s\n", resolved);
+    }
+    return JNI_TRUE;
+}
+
+/*
+ * Loads libjvm.so and the JRE-local dependencies of libjvm.so and
+ * libjava.so by absolute path, so that a foreign JRE on LD_LIBRARY_PATH
+ * cannot shadow them and the launcher need not re-exec.
+ */
+static jboolean
+PreloadJvmLibraries(const char *jrepath, const char *jvmpath, const char *arch)
+{
+    char libjava[MAXPATHLEN];
+    jlong start = 0;
+    jboolean result;
+
+    if (JLI_IsTraceLauncher()) {
+        start = CounterGet();
+    }
+    GetJreLibPath(jrepath, arch, libjava, sizeof(libjava));
+    JLI_StrCat(libjava, "/" JAVA_DLL);
+    result = PreloadDependencies(jvmpath, MAX_PRELOAD_DEPTH)
+            && dlopen(jvmpath, RTLD_NOW | RTLD_GLOBAL) != NULL
+            && PreloadDependencies(libjava, MAX_PRELOAD_DEPTH);
+    if (JLI_IsTraceLauncher()) {
+        JLI_TraceLauncher("%ld micro seconds to preload JVM libraries\n",
+                (long)(CounterGet() - start));
+    }
+    return result;
+}
 #endif /* SETENV_REQUIRED */
 
+/*
+ * Reports and clears the marker of a previous re-exec, keeping its
+ * count and lost time in case this launcher has to re-exec again.
+ */
+static void
+TraceReexec()
+{
+    const char *marker = getenv(REEXEC_ENV);
+    long long execTime, lost;
+
+    launcherStart = CounterGet();
+    if (marker == NULL) {
+        return;
+    }
+    if (sscanf(marker, "%d:%lld:%lld", &reexecCount, &execTime, &lost) == 3) {
+        reexecLost = lost + (launcherStart - execTime);
+        JLI_TraceLauncher("re-exec #%d: %ld micro seconds to re-enter, "
+                "%ld micro seconds lost to re-execs in total\n", reexecCount,
+                (long)(launcherStart - execTime), (long) reexecLost);
+    }
+    UnsetEnv(REEXEC_ENV);
+}
+
+/*
+ * Passes count and lost time to the re-exec'ed launcher. The time
+ * spent in this launcher so far will be spent again after the exec.
+ */
+static void
+MarkReexec()
+{
+    static char marker[sizeof(REEXEC_ENV) + 64];
+    jlong now = CounterGet();
+    JLI_Snprintf(marker, sizeof(marker), REEXEC_ENV "=%d:%lld:%lld", reexecCount + 1,
+            (long long) now, (long long) (reexecLost + now - launcherStart));
+    JLI_TraceLauncher("re-exec #%d after %ld micro seconds\n", reexecCount + 1,
+            (long)(now - launcherStart));
+    putenv(marker);
+}
+
 void
 CreateExecutionEnvironment(int *pargc, char ***pargv,
                            char jrepath[], jint so_jrepath,
@@ -365,6 +629,8 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
    */
     //jboolean jvmpathExists;
 
+    TraceReexec();
+
     /* Compute/set the name of the executable */
     SetExecname(jysetup->progName);//*pargv);
 
@@ -466,8 +732,8 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
 		}
 //		puts("GetJyPath result:");
 //		puts(jypath);
-        JLI_Snprintf(jvmcfg, so_jvmcfg, "%s%slib%s%s%sjvm.cfg",
-                     jrepath, FILESEP, FILESEP,  arch, FILESEP);
+        GetJreLibPath(jrepath, arch, jvmcfg, so_jvmcfg);
+        JLI_StrCat(jvmcfg, FILESEP "jvm.cfg");
         /* Find the specified JVM type */
         if (ReadKnownVMs(jvmcfg, JNI_FALSE) < 1) {
           JLI_ReportErrorMessage(CFG_ERROR7);
@@ -493,6 +759,16 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
         mustsetenv = RequiresSetenv(wanted, jvmpath);
         JLI_TraceLauncher("mustsetenv: %s\n", mustsetenv ? "TRUE" : "FALSE");
 
+        if (mustsetenv && PreloadJvmLibraries(jrepath, jvmpath, arch)) {
+            JLI_TraceLauncher("LD_LIBRARY_PATH re-exec avoided by preloading\n");
+            mustsetenv = JNI_FALSE;
+        }
+        if (mustsetenv && jysetup->embedded) {
+            /* never exec the host process of the library (see jylaunch.c) */
+            JLI_TraceLauncher("embedded: leaving LD_LIBRARY_PATH as is\n");
+            mustsetenv = JNI_FALSE;
+        }
+
         if (mustsetenv == JNI_FALSE) {
             JLI_MemFree(newargv);
             return;
@@ -510,8 +786,8 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
             JLI_ReportErrorMessage(JRE_ERROR2, wanted);
             exit(1);
           }
-          JLI_Snprintf(jvmcfg, so_jvmcfg, "%s%slib%s%s%sjvm.cfg",
-                       jrepath, FILESEP, FILESEP, GetArchPath(wanted), FILESEP);
+          GetJreLibPath(jrepath, GetArchPath(wanted), jvmcfg, so_jvmcfg);
+          JLI_StrCat(jvmcfg, FILESEP "jvm.cfg");
           /*
            * Read in jvm.cfg for target data model and process vm
            * selection options.
@@ -635,6 +911,9 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
              * Create desired LD_LIBRARY_PATH value for target data model.
              */
             {
+                /* modular runtimes keep their libraries directly in lib */
+                const char *libarch = IsModularRuntime(jrepath) ? "" : arch;
+
                 /* remove the name of the .so from the JVM path */
                 lastslash = JLI_StrRChr(jvmpath, '/');
                 if (lastslash)
@@ -652,11 +931,11 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
                         jrepath, GetArchPath(wanted),
                         jrepath, GetArchPath(wanted)
 #else /* !DUAL_MODE */
-                        jrepath, arch,
+                        jrepath, libarch,
 #ifdef AIX
-                        jrepath, arch,
+                        jrepath, libarch,
 #endif
-                        jrepath, arch
+                        jrepath, libarch
 #endif /* DUAL_MODE */
                         );
 
@@ -744,11 +1023,13 @@ CreateExecutionEnvironment(int *pargc, char ***pargv,
                 argv[0] = newexec;
             }
 #endif /* DUAL_MODE */
+            MarkReexec();
             JLI_TraceLauncher("TRACER_MARKER:About to EXEC\n");
             (void) fflush(stdout);
             (void) fflush(stderr);
 #ifdef SETENV_REQUIRED
             if (mustsetenv) {
+                newenvp = environ; /* putenv may have moved it */
                 execve(newexec, argv, newenvp);
             } else {
                 execv(newexec, argv);
@@ -786,16 +1067,18 @@ GetJVMPath(const char *jrepath, const char *jvmtype,
            char *jvmpath, jint jvmpathsize, const char * arch, int bitsWanted)
 {
     struct stat s;
+    char libpath[MAXPATHLEN];
 
     if (JLI_StrChr(jvmtype, '/')) {
         JLI_Snprintf(jvmpath, jvmpathsize, "%s/" JVM_DLL, jvmtype);
     } else {
-        JLI_Snprintf(jvmpath, jvmpathsize, "%s/lib/%s/%s/" JVM_DLL, jrepath, arch, jvmtype);
+        GetJreLibPath(jrepath, arch, libpath, sizeof(libpath));
+        JLI_Snprintf(jvmpath, jvmpathsize, "%s/%s/" JVM_DLL, libpath, jvmtype);
     }
 
     JLI_TraceLauncher("Does `%s' exist ... ", jvmpath);
 
-    if (stat(jvmpath, &s) == 0) {
+    if (ProbeStat(jvmpath, &s) == 0) {
         JLI_TraceLauncher("yes.\n");
         return JNI_TRUE;
     } else {
@@ -815,17 +1098,23 @@ GetJREPath(char *path, jint pathsize, const char * arch, jboolean speculative)
     if (GetJavaHome(path, pathsize)) {
         /* Is JRE co-located with the application? */
         JLI_Snprintf(libjava, sizeof(libjava), "%s/lib/%s/" JAVA_DLL, path, arch);
-        if (access(libjava, F_OK) == 0) {
+        if (ProbeExists(libjava)) {
             JLI_TraceLauncher("JRE path is %s\n", path);
             return JNI_TRUE;
         }
         /* Does the app ship a private JRE in <apphome>/jre directory? */
         JLI_Snprintf(libjava, sizeof(libjava), "%s/jre/lib/%s/" JAVA_DLL, path, arch);
-        if (access(libjava, F_OK) == 0) {
+        if (ProbeExists(libjava)) {
             JLI_StrCat(path, "/jre");
             JLI_TraceLauncher("JRE path is %s\n", path);
             return JNI_TRUE;
         }
+        /* A modular runtime image (JDK 9+) has no jre and no <arch> directory */
+        JLI_Snprintf(libjava, sizeof(libjava), "%s/lib/" JAVA_DLL, path);
+        if (ProbeExists(libjava) && IsModularRuntime(path)) {
+            JLI_TraceLauncher("JRE path is %s (modular runtime)\n", path);
+            return JNI_TRUE;
+        }
     }
 
     if (!speculative)
@@ -861,6 +1150,10 @@ GetJyPath(char *path, jint pathsize, const char * arch, jboolean speculative)
 		strcpy(sloff, "/jython-standalone.jar\0");
 		if (exists(path)) return JNI_TRUE;
 		path[pathsize-1] = '\0';
+	} else if (path[0] && path[JLI_StrLen(path)-1] != '/'
+			&& JLI_StrLen(path)+1 < pathsize) {
+		/* JYTHON_HOME names the directory, the jar is searched inside */
+		JLI_StrCat(path, "/");
 	}
 	sloff = JLI_StrRChr(path, '/');
 	if (!sloff) return JNI_FALSE;
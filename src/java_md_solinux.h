@@ -33,6 +33,20 @@
 #include <sys/time.h>
 #define CounterGet()              (gethrtime()/1000)
 #define Counter2Micros(counts)    (counts)
+#elif defined(__linux__)
+/*
+ * Without gethrtime, interval timing uses the monotonic clock,
+ * so that launcher traces show actual times.
+ */
+#include <time.h>
+static inline jlong
+CounterGet()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (jlong) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#define Counter2Micros(counts)    (counts)
 #else  /* ! HAVE_GETHRTIME */
 #define CounterGet()              (0)
 #define Counter2Micros(counts)    (1)
@@ -0,0 +1,548 @@
+/*
+ * jdkindex.c
+ *
+ * If JAVA_HOME is not set, GetJavaHome asks DiscoverJavaHome for a JDK.
+ * Candidates are the subdirectories of the usual install locations
+ * (see jdkRoots), sdkman's java candidates and the JDK of the java
+ * found on PATH. Each JDK is probed once for its version, VM types,
+ * default CDS archive and supported VM flags. The results are kept in
+ * an index in the launcher cache (see jycache.c). An install location
+ * is only rescanned if its mtime changed, an indexed JDK is only
+ * probed again if its libjvm changed.
+ *
+ * Which JDK is chosen is steered by environment variables:
+ * JYTHON_JDK_POLICY: newest (default) or lts, i.e. newest LTS release
+ * JYTHON_JDK_MIN:    minimal feature version, e.g. 11
+ * Among equally suited JDKs the newest update and then one with a CDS
+ * archive wins.
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include "java.h"
+#include "jdkindex.h"
+#include "jycache.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#ifndef JVM_DLL
+#define JVM_DLL "libjvm.so"
+#endif
+#ifndef JAVA_DLL
+#define JAVA_DLL "libjava.so"
+#endif
+
+#define jdkIndexName "jdks"
+#define jdkIndexHeader "# LiJy JDK index v1\n"
+#define MAX_JDK_ROOTS 8
+
+static const char *jdkRoots[] = {
+	"/usr/lib/jvm",
+	"/usr/java",
+	"/usr/local/java",
+	"/opt",
+	"/opt/java",
+	NULL
+};
+
+/* Probed as "\0<name>\0" in libjvm's flag table, see enum jdk_flag. */
+static const char *jdkFlagNames[JDK_FLAG_COUNT] = {
+	"UseSerialGC",
+	"UseParallelGC",
+	"UseG1GC",
+	"UseZGC",
+	"UseShenandoahGC",
+	"TieredStopAtLevel",
+	"SharedArchiveFile",
+	"AutoCreateSharedArchive",
+	"UseSplitVerifier"
+};
+
+/*
+ * Feature versions in which each flag is a valid product flag, the end
+ * exclusive (0: open). HotSpot keeps the names of obsolete and removed
+ * flags in its tables too, so the scan alone cannot tell; e.g.
+ * UseSplitVerifier is found in libjvm of JDK 8 and later, which reject
+ * or warn about it.
+ */
+static const struct {
+	int since, until;
+} jdkFlagVersions[JDK_FLAG_COUNT] = {
+	{0, 0},   /* UseSerialGC */
+	{0, 0},   /* UseParallelGC */
+	{7, 0},   /* UseG1GC */
+	{15, 0},  /* UseZGC, experimental before */
+	{15, 0},  /* UseShenandoahGC, experimental before */
+	{7, 0},   /* TieredStopAtLevel */
+	{10, 0},  /* SharedArchiveFile, diagnostic before */
+	{19, 0},  /* AutoCreateSharedArchive */
+	{0, 8}    /* UseSplitVerifier */
+};
+
+typedef struct {
+	char path[PATH_MAX];
+	time_t mtime;
+} JdkRoot;
+
+static JdkInfo *jdks = NULL;
+static int jdkCount = 0, maxJdks = 0;
+static JdkRoot roots[MAX_JDK_ROOTS];
+static int rootCount = 0;
+static jboolean indexLoaded = JNI_FALSE;
+static jboolean indexDirty = JNI_FALSE;
+
+static time_t
+MTime(const char *path)
+{
+	struct stat st;
+	return ProbeStat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+/* 8 for "1.8.0_25", 17 for "17.0.2" */
+static int
+FeatureVersion(const char *version)
+{
+	if (JLI_StrNCmp(version, "1.", 2) == 0)
+		version += 2;
+	return atoi(version);
+}
+
+static jboolean
+IsLts(int feature)
+{
+	return feature == 8 || feature == 11 || (feature >= 17 && (feature-17) % 4 == 0);
+}
+
+/* Compares version strings number by number, e.g. 1.8.0_292 > 1.8.0_25 */
+static int
+CompareVersion(const char *a, const char *b)
+{
+	while (*a || *b) {
+		while (*a && (*a < '0' || *a > '9')) a++;
+		while (*b && (*b < '0' || *b > '9')) b++;
+		long na = strtol(a, (char **) &a, 10);
+		long nb = strtol(b, (char **) &b, 10);
+		if (na != nb)
+			return na < nb ? -1 : 1;
+	}
+	return 0;
+}
+
+static void
+ReadRelease(const char *home, JdkInfo *info)
+{
+	char path[PATH_MAX];
+	char line[256];
+	FILE *fp;
+	JLI_Snprintf(path, sizeof(path), "%s/release", home);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		/* a JRE inside a JDK has the release file in the parent */
+		JLI_Snprintf(path, sizeof(path), "%s/../release", home);
+		fp = fopen(path, "r");
+	}
+	if (fp == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (JLI_StrNCmp(line, "JAVA_VERSION=", 13) == 0) {
+			char *v = line+13;
+			if (*v == '"') v++;
+			v[JLI_StrCSpn(v, "\"\n")] = '\0';
+			JLI_Snprintf(info->version, sizeof(info->version), "%s", v);
+			info->feature = FeatureVersion(v);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/* Collects the KNOWN VM types of jvm.cfg, the first one is the default. */
+static void
+ReadVMTypes(const char *jvmcfg, JdkInfo *info)
+{
+	char line[256];
+	char name[64], flag[64];
+	FILE *fp = fopen(jvmcfg, "r");
+	info->vmtypes[0] = '\0';
+	if (fp == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] != '-' || sscanf(line, "-%63s %63s", name, flag) != 2)
+			continue;
+		if (JLI_StrCmp(flag, "KNOWN") != 0)
+			continue;
+		if (JLI_StrLen(info->vmtypes)+JLI_StrLen(name)+2 > sizeof(info->vmtypes))
+			break;
+		if (info->vmtypes[0])
+			JLI_StrCat(info->vmtypes, ",");
+		JLI_StrCat(info->vmtypes, name);
+	}
+	fclose(fp);
+}
+
+/*
+ * HotSpot keeps the names of its flags as plain strings in libjvm, so a
+ * flag is considered known if its name occurs there; JdkSupportsFlag
+ * checks the version on top.
+ */
+static unsigned int
+ScanFlags(const char *libjvm)
+{
+	struct stat st;
+	unsigned int result = 0;
+	int i, fd = open(libjvm, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			for (i = 0; i < JDK_FLAG_COUNT; ++i) {
+				char pattern[64];
+				int len = JLI_StrLen(jdkFlagNames[i]);
+				pattern[0] = '\0';
+				JLI_StrCpy(pattern+1, jdkFlagNames[i]);
+				if (memmem(data, st.st_size, pattern, len+2) != NULL)
+					result |= 1u << i;
+			}
+			munmap(data, st.st_size);
+		}
+	}
+	close(fd);
+	return result;
+}
+
+/*
+ * Probes the JDK or JRE at dir. Supported are modular runtime images
+ * (JDK 9+, lib/libjava.so) and the classic layout with
+ * lib/<arch>/libjava.so (JRE) or jre/lib/<arch>/libjava.so (JDK).
+ */
+static jboolean
+ProbeJdk(const char *dir, JdkInfo *info)
+{
+	char path[PATH_MAX];
+	char libdir[PATH_MAX];
+	char first[64];
+	memset(info, 0, sizeof(JdkInfo));
+	if (ProbeRealpath(dir, info->home) == NULL)
+		return JNI_FALSE;
+	JLI_Snprintf(path, sizeof(path), "%s/jre/lib/%s/" JAVA_DLL, info->home, LIBARCHNAME);
+	if (ProbeExists(path)) {
+		JLI_Snprintf(info->jre, sizeof(info->jre), "%s/jre", info->home);
+	} else {
+		JLI_Snprintf(info->jre, sizeof(info->jre), "%s", info->home);
+	}
+	GetJreLibPath(info->jre, LIBARCHNAME, libdir, sizeof(libdir));
+	JLI_Snprintf(path, sizeof(path), "%s/" JAVA_DLL, libdir);
+	if (!ProbeExists(path))
+		return JNI_FALSE;
+	JLI_Snprintf(path, sizeof(path), "%s/jvm.cfg", libdir);
+	ReadVMTypes(path, info);
+	if (info->vmtypes[0] == '\0')
+		return JNI_FALSE;
+	JLI_Snprintf(first, sizeof(first), "%.*s",
+			(int) JLI_StrCSpn(info->vmtypes, ","), info->vmtypes);
+	JLI_Snprintf(info->libjvm, sizeof(info->libjvm), "%s/%s/" JVM_DLL, libdir, first);
+	info->stamp = MTime(info->libjvm);
+	if (info->stamp == 0)
+		return JNI_FALSE;
+	JLI_Snprintf(path, sizeof(path), "%s/%s/classes.jsa", libdir, first);
+	info->cds = ProbeExists(path);
+	ReadRelease(info->home, info);
+	info->flags = ScanFlags(info->libjvm);
+	JLI_TraceLauncher("JDK probed: %s, version %s, VMs %s, CDS %s, flags %x\n",
+			info->home, info->version[0] ? info->version : "unknown",
+			info->vmtypes, info->cds ? "yes" : "no", info->flags);
+	return JNI_TRUE;
+}
+
+static JdkInfo *
+FindIndexed(const char *path)
+{
+	int i;
+	for (i = 0; i < jdkCount; ++i) {
+		if (JLI_StrCmp(jdks[i].home, path) == 0 || JLI_StrCmp(jdks[i].jre, path) == 0)
+			return &jdks[i];
+	}
+	return NULL;
+}
+
+static JdkInfo *
+AddIndexed(const JdkInfo *info)
+{
+	JdkInfo *known = FindIndexed(info->home);
+	if (known == NULL) {
+		if (jdkCount == maxJdks) {
+			maxJdks = maxJdks == 0 ? 8 : 2*maxJdks;
+			jdks = JLI_MemRealloc(jdks, maxJdks*sizeof(JdkInfo));
+		}
+		known = &jdks[jdkCount++];
+	}
+	memcpy(known, info, sizeof(JdkInfo));
+	indexDirty = JNI_TRUE;
+	return known;
+}
+
+/* Probes dir unless it is indexed already and its libjvm did not change. */
+static JdkInfo *
+IndexJdk(const char *dir)
+{
+	char real[PATH_MAX];
+	JdkInfo info;
+	JdkInfo *known;
+	if (ProbeRealpath(dir, real) == NULL)
+		return NULL;
+	known = FindIndexed(real);
+	if (known != NULL && MTime(known->libjvm) == known->stamp)
+		return known;
+	if (!ProbeJdk(real, &info))
+		return NULL;
+	return AddIndexed(&info);
+}
+
+static void
+InitRoots()
+{
+	const char *sdkman = getenv("SDKMAN_DIR");
+	const char *home = getenv("HOME");
+	int i;
+	for (i = 0; jdkRoots[i] != NULL; ++i) {
+		JLI_Snprintf(roots[rootCount++].path, PATH_MAX, "%s", jdkRoots[i]);
+	}
+	if (sdkman != NULL) {
+		JLI_Snprintf(roots[rootCount++].path, PATH_MAX, "%s/candidates/java", sdkman);
+	} else if (home != NULL) {
+		JLI_Snprintf(roots[rootCount++].path, PATH_MAX, "%s/.sdkman/candidates/java", home);
+	}
+}
+
+static jboolean
+IndexPath(char *buf, int bufsize)
+{
+	return jyCacheDir(buf, bufsize-sizeof(jdkIndexName)-1, JNI_FALSE)
+			&& JLI_StrCat(buf, "/" jdkIndexName) != NULL;
+}
+
+/*
+ * Index format, tab separated:
+ * root <mtime> <path>
+ * jdk <stamp> <feature> <version> <flags> <cds> <vmtypes> <home> <jre> <libjvm>
+ */
+static void
+LoadIndex()
+{
+	char path[PATH_MAX];
+	char line[4*PATH_MAX];
+	FILE *fp;
+	int i;
+	if (indexLoaded)
+		return;
+	indexLoaded = JNI_TRUE;
+	InitRoots();
+	if (!IndexPath(path, sizeof(path)) || (fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		char *field[10];
+		int n = 0;
+		char *tok;
+		line[JLI_StrCSpn(line, "\n")] = '\0';
+		for (tok = JLI_StrTok(line, "\t"); tok != NULL && n < 10; tok = JLI_StrTok(NULL, "\t"))
+			field[n++] = tok;
+		if (n == 3 && JLI_StrCmp(field[0], "root") == 0) {
+			for (i = 0; i < rootCount; ++i) {
+				if (JLI_StrCmp(roots[i].path, field[2]) == 0)
+					roots[i].mtime = (time_t) atol(field[1]);
+			}
+		} else if (n == 10 && JLI_StrCmp(field[0], "jdk") == 0) {
+			JdkInfo info;
+			memset(&info, 0, sizeof(JdkInfo));
+			info.stamp = (time_t) atol(field[1]);
+			info.feature = atoi(field[2]);
+			JLI_Snprintf(info.version, sizeof(info.version), "%s",
+					JLI_StrCmp(field[3], "-") == 0 ? "" : field[3]);
+			info.flags = (unsigned int) strtoul(field[4], NULL, 16);
+			info.cds = field[5][0] == '1';
+			JLI_Snprintf(info.vmtypes, sizeof(info.vmtypes), "%s", field[6]);
+			JLI_Snprintf(info.home, sizeof(info.home), "%s", field[7]);
+			JLI_Snprintf(info.jre, sizeof(info.jre), "%s", field[8]);
+			JLI_Snprintf(info.libjvm, sizeof(info.libjvm), "%s", field[9]);
+			AddIndexed(&info);
+		}
+	}
+	fclose(fp);
+	indexDirty = JNI_FALSE;
+}
+
+static void
+SaveIndex()
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX+24];
+	FILE *fp;
+	int i;
+	if (!indexDirty || !jyCacheDir(path, sizeof(path), JNI_TRUE) || !IndexPath(path, sizeof(path)))
+		return;
+	JLI_Snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return;
+	fputs(jdkIndexHeader, fp);
+	for (i = 0; i < rootCount; ++i) {
+		if (roots[i].mtime != 0)
+			fprintf(fp, "root\t%ld\t%s\n", (long) roots[i].mtime, roots[i].path);
+	}
+	for (i = 0; i < jdkCount; ++i) {
+		JdkInfo *j = &jdks[i];
+		fprintf(fp, "jdk\t%ld\t%d\t%s\t%x\t%d\t%s\t%s\t%s\t%s\n", (long) j->stamp,
+				j->feature, j->version[0] ? j->version : "-", j->flags, j->cds ? 1 : 0,
+				j->vmtypes, j->home, j->jre, j->libjvm);
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) != 0)
+		unlink(tmp);
+	indexDirty = JNI_FALSE;
+}
+
+static void
+ScanRoot(JdkRoot *root)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	time_t mtime = MTime(root->path);
+	DIR *dir;
+	if (mtime == 0 || mtime == root->mtime)
+		return;
+	JLI_TraceLauncher("JDK discovery: scanning %s\n", root->path);
+	root->mtime = mtime;
+	indexDirty = JNI_TRUE;
+	if ((dir = opendir(root->path)) == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		JLI_Snprintf(path, sizeof(path), "%s/%s", root->path, entry->d_name);
+		IndexJdk(path);
+	}
+	closedir(dir);
+}
+
+/* Indexes the JDK of the first java on PATH, i.e. <home>[/jre]/bin/java. */
+static void
+IndexPathJava()
+{
+	char *path = getenv("PATH");
+	char candidate[PATH_MAX];
+	char real[PATH_MAX];
+	char *dir, *p;
+	if (path == NULL)
+		return;
+	path = JLI_StringDup(path);
+	for (dir = JLI_StrTok(path, ":"); dir != NULL; dir = JLI_StrTok(NULL, ":")) {
+		JLI_Snprintf(candidate, sizeof(candidate), "%s/java", dir);
+		if (!ProbeAccess(candidate, X_OK) || ProbeRealpath(candidate, real) == NULL)
+			continue;
+		p = JLI_StrRChr(real, '/');
+		*p = '\0';
+		p = JLI_StrRChr(real, '/');
+		if (p == NULL || JLI_StrCmp(p, "/bin") != 0)
+			break;
+		*p = '\0';
+		p = JLI_StrRChr(real, '/');
+		if (p != NULL && JLI_StrCmp(p, "/jre") == 0)
+			*p = '\0';
+		IndexJdk(real);
+		break;
+	}
+	JLI_MemFree(path);
+}
+
+/* Whether a is to be preferred over b. */
+static jboolean
+BetterJdk(const JdkInfo *a, const JdkInfo *b)
+{
+	int cmp;
+	if (a->feature != b->feature)
+		return a->feature > b->feature;
+	cmp = CompareVersion(a->version, b->version);
+	if (cmp != 0)
+		return cmp > 0;
+	return a->cds && !b->cds;
+}
+
+jboolean
+DiscoverJavaHome(char *buf, jint bufsize)
+{
+	const char *policy = getenv("JYTHON_JDK_POLICY");
+	const char *minEnv = getenv("JYTHON_JDK_MIN");
+	jboolean lts = policy != NULL && JLI_StrCmp(policy, "lts") == 0;
+	int min = minEnv != NULL ? atoi(minEnv) : 0;
+	const JdkInfo *best = NULL;
+	int i;
+
+	LoadIndex();
+	for (i = 0; i < rootCount; ++i)
+		ScanRoot(&roots[i]);
+	IndexPathJava();
+	for (i = 0; i < jdkCount; ++i) {
+		JdkInfo *j = &jdks[i];
+		if (MTime(j->libjvm) != j->stamp) {
+			/* removed or updated in place */
+			JdkInfo *probed = IndexJdk(j->home);
+			if (probed == NULL) {
+				memmove(j, j+1, (jdkCount-i-1)*sizeof(JdkInfo));
+				jdkCount--;
+				indexDirty = JNI_TRUE;
+				i--;
+				continue;
+			}
+		}
+		if (j->feature < min || (lts && !IsLts(j->feature)))
+			continue;
+		if (best == NULL || BetterJdk(j, best))
+			best = j;
+	}
+	SaveIndex();
+	if (best == NULL) {
+		JLI_TraceLauncher("JDK discovery: no eligible JDK among %d\n", jdkCount);
+		return JNI_FALSE;
+	}
+	JLI_TraceLauncher("JDK discovery: chose %s (version %s, policy %s, min %d)\n",
+			best->home, best->version, lts ? "lts" : "newest", min);
+	JLI_Snprintf(buf, bufsize, "%s", best->home);
+	return JNI_TRUE;
+}
+
+/*
+ * Returns what is known about the JRE at jrepath, probing and indexing
+ * it if needed (e.g. if it was given via JAVA_HOME).
+ */
+const JdkInfo *
+GetJdkInfo(const char *jrepath)
+{
+	char real[PATH_MAX];
+	JdkInfo *result;
+	LoadIndex();
+	if (ProbeRealpath(jrepath, real) == NULL)
+		return NULL;
+	result = FindIndexed(real);
+	if (result == NULL || MTime(result->libjvm) != result->stamp) {
+		JdkInfo info;
+		if (!ProbeJdk(real, &info))
+			return NULL;
+		result = AddIndexed(&info);
+		SaveIndex();
+	}
+	return result;
+}
+
+/*
+ * Whether libjvm knows the flag and the JDK's version accepts it. If the
+ * version is unknown, flags that were removed at some version are not
+ * trusted.
+ */
+jboolean
+JdkSupportsFlag(const JdkInfo *jdk, int flag)
+{
+	if (jdk == NULL || (jdk->flags & (1u << flag)) == 0)
+		return JNI_FALSE;
+	if (jdk->feature == 0)
+		return jdkFlagVersions[flag].until == 0;
+	return jdk->feature >= jdkFlagVersions[flag].since
+			&& (jdkFlagVersions[flag].until == 0 || jdk->feature < jdkFlagVersions[flag].until);
+}
@@ -0,0 +1,47 @@
+/*
+ * jdkindex.h
+ *
+ * Discovery of installed JDKs, see jdkindex.c.
+ */
+
+#ifndef JDKINDEX_H_
+#define JDKINDEX_H_
+
+#include <jni.h>
+#include <limits.h>
+#include <time.h>
+
+/*
+ * VM flags that are probed per JDK. The launcher only passes
+ * performance flags the chosen VM is known to accept.
+ */
+enum jdk_flag {
+	JDK_FLAG_SERIAL_GC,
+	JDK_FLAG_PARALLEL_GC,
+	JDK_FLAG_G1_GC,
+	JDK_FLAG_Z_GC,
+	JDK_FLAG_SHENANDOAH_GC,
+	JDK_FLAG_TIERED_STOP_AT_LEVEL,
+	JDK_FLAG_SHARED_ARCHIVE_FILE,
+	JDK_FLAG_AUTO_CREATE_SHARED_ARCHIVE,
+	JDK_FLAG_SPLIT_VERIFIER,
+	JDK_FLAG_COUNT
+};
+
+typedef struct {
+	char home[PATH_MAX];    /* what JAVA_HOME would be */
+	char jre[PATH_MAX];     /* what GetJREPath yields */
+	char libjvm[PATH_MAX];  /* libjvm.so of the default VM type */
+	char version[32];       /* JAVA_VERSION from the release file */
+	int feature;            /* e.g. 8 for 1.8.0_25, 17 for 17.0.2; 0 if unknown */
+	char vmtypes[64];       /* KNOWN types from jvm.cfg, e.g. "server,client" */
+	jboolean cds;           /* default CDS archive exists */
+	unsigned int flags;     /* 1 << JDK_FLAG_* for supported flags */
+	time_t stamp;           /* mtime of libjvm when probed */
+} JdkInfo;
+
+jboolean DiscoverJavaHome(char *buf, jint bufsize);
+const JdkInfo *GetJdkInfo(const char *jrepath);
+jboolean JdkSupportsFlag(const JdkInfo *jdk, int flag);
+
+#endif /* JDKINDEX_H_ */
@@ -0,0 +1,897 @@
+/*
+ * jyagent.c
+ *
+ * This file contains a JVMTI agent that is linked into the launcher
+ * itself. Since JDK 8 the VM looks up Agent_OnLoad_<name> in the
+ * executable before it searches for lib<name>.so (JEP 178), so
+ * -agentlib:lijy=... works without shipping a separate library.
+ * The launcher is linked with --export-dynamic for this purpose.
+ *
+ * Feature "exceptions[=file]" (launcher option --exceptions):
+ * Jython uses Java exceptions for Python-level control flow
+ * (StopIteration, AttributeError-fallbacks, hasattr misses, ...).
+ * Filling in the stack trace of such an exception costs time
+ * proportional to the stack depth. The agent counts thrown and caught
+ * exceptions per Python call site and exception type. A call site is
+ * the innermost frame that belongs to compiled Python code, i.e. to a
+ * class named <module>$py. The cost of capturing a stack is estimated
+ * from the stack depth at the throw and a per-frame cost that is
+ * calibrated by timing stack walks on sampled throws.
+ * Python-level exceptions are all thrown as org.python.core.PyException;
+ * for these the type is the Python type, i.e. the __name__ of the
+ * exception's type field.
+ * The report is written at VM death to the given file or to stderr.
+ *
+ * Feature "classes=file" (launcher option --profile-classes):
+ * Attributes each class load to the classpath entry it came from, i.e.
+ * to the location of its ProtectionDomain's CodeSource, and measures
+ * the time spent defining it. That is the time from ClassFileLoadHook
+ * to ClassLoad minus the time spent defining other classes meanwhile
+ * (e.g. super classes). At VM death the per-entry counts are written
+ * to the given file; see classProfile in jython.c for how the launcher
+ * uses it. Classes without a ProtectionDomain (e.g. those on the boot
+ * classpath) are attributed to "<boot>", classes without a code source
+ * location (e.g. compiled Python modules) to "<no location>".
+ *
+ * Feature "classlist=file" (alone or with "classes", see jypreload.c):
+ * Writes the names of the classes that were loaded from a classpath
+ * entry, in load order, to the given file at VM death. Classes without
+ * a code source location are left out, they cannot be loaded by name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <jvmti.h>
+#include "jyagent.h"
+
+/* Frames searched for a Python call site. */
+#define SITE_SEARCH_DEPTH 64
+/* Every n-th throw the stack walk is timed to calibrate costs. */
+#define CALIBRATION_INTERVAL 64
+/* Depth cap that is assessed as -XX:MaxJavaStackTraceDepth suggestion. */
+#define SUGGESTED_MAX_DEPTH 64
+/* Number of sites listed in the report. */
+#define REPORT_SITES 40
+/* Nesting depth of class definitions that is tracked per thread. */
+#define LOAD_STACK_DEPTH 32
+#define bootEntry "<boot>"
+#define noLocationEntry "<no location>"
+
+typedef struct {
+	char* name;       /* dotted class name */
+	char* source;     /* SourceFile attribute, NULL if absent */
+	jboolean python;  /* compiled Python code, i.e. <module>$py */
+	int pyException;  /* PyException or a subclass of it, -1 if unknown */
+} ClassInfo;
+
+typedef struct {
+	jmethodID method;    /* NULL if no frame was found */
+	jlocation location;
+	int type;            /* ClassInfo-index of exception class or Python type */
+	jlong thrown;
+	jlong caught;
+	jlong frames;        /* sum of stack depths at throw */
+	jlong excessFrames;  /* frames beyond SUGGESTED_MAX_DEPTH */
+	jint line;           /* resolved for the report */
+	int frameClass;      /* ClassInfo-index, resolved for the report */
+} ExceptionSite;
+
+typedef struct {
+	char* path;
+	jlong classes;
+	jlong nanos;  /* self time spent defining classes */
+} ClasspathEntry;
+
+typedef struct {
+	unsigned long long name;  /* hash of internal class name */
+	int entry;
+	jlong start;
+	jlong childNanos;
+} LoadFrame;
+
+static jvmtiEnv* jvmti = NULL;
+static jrawMonitorID lock;
+static jboolean profileExceptions = JNI_FALSE;
+static char* exceptionReport = NULL;
+static jlong vmInitTime = 0;
+
+static ClassInfo* classes = NULL;
+static int classCount = 0, maxClasses = 0;
+
+static ExceptionSite* sites = NULL;
+static int siteCount = 0, maxSites = 0;
+/* open addressing, entries are site-index+1 */
+static int* siteTable = NULL;
+static int siteTableSize = 0;
+static jfieldID pyExceptionType = NULL;
+static jmethodID pyGetAttr = NULL, toString = NULL;
+
+static jboolean profileClasses = JNI_FALSE;
+static char* classProfile = NULL;
+static ClasspathEntry* entries = NULL;
+static int entryCount = 0, maxEntries = 0;
+static char* classList = NULL;
+static char** listedClasses = NULL;
+static int listedCount = 0, maxListed = 0;
+static jmethodID getCodeSource = NULL, getLocation = NULL, getPath = NULL;
+static __thread LoadFrame loadStack[LOAD_STACK_DEPTH];
+static __thread int loadDepth = 0;
+static __thread jboolean resolving = JNI_FALSE;
+
+static jlong throwCount = 0;
+static jlong calibrationNanos = 0;
+static jlong calibrationFrames = 0;
+static int calibrationSamples = 0;
+
+static void* growArray(void* array, int* max, size_t elemSize) {
+	*max = *max == 0 ? 64 : 2 * *max;
+	void* result = realloc(array, *max * elemSize);
+	if (!result) {
+		fputs("lijy agent: out of memory\n", stderr);
+		exit(1);
+	}
+	return result;
+}
+
+static char* agentStrDup(const char* s) {
+	return s ? strdup(s) : NULL;
+}
+
+/*
+ * Returns the ClassInfo-index of klass. Classes are tagged with
+ * index+1 so that repeated lookups are cheap.
+ * Must be called while holding lock.
+ */
+static int classInfo(jclass klass) {
+	jlong tag = 0;
+	(*jvmti)->GetTag(jvmti, klass, &tag);
+	if (tag > 0)
+		return (int) tag-1;
+	char* signature = NULL;
+	char* source = NULL;
+	if ((*jvmti)->GetClassSignature(jvmti, klass, &signature, NULL)
+			!= JVMTI_ERROR_NONE)
+		return -1;
+	if ((*jvmti)->GetSourceFileName(jvmti, klass, &source) != JVMTI_ERROR_NONE)
+		source = NULL;
+	if (classCount == maxClasses)
+		classes = growArray(classes, &maxClasses, sizeof(ClassInfo));
+	ClassInfo* ci = &classes[classCount];
+	//signature has the form Lpkg/Name;
+	int len = strlen(signature);
+	if (signature[0] == 'L' && signature[len-1] == ';') {
+		ci->name = malloc(len-1);
+		strncpy(ci->name, signature+1, len-2);
+		ci->name[len-2] = 0;
+	} else {
+		ci->name = strdup(signature);
+	}
+	char* p = ci->name;
+	for ( ; *p; ++p) if (*p == '/') *p = '.';
+	len = strlen(ci->name);
+	ci->python = len > 3 && strcmp(ci->name+len-3, "$py") == 0;
+	ci->pyException = -1;
+	ci->source = agentStrDup(source);
+	(*jvmti)->Deallocate(jvmti, (unsigned char*) signature);
+	if (source) (*jvmti)->Deallocate(jvmti, (unsigned char*) source);
+	(*jvmti)->SetTag(jvmti, klass, ++classCount);
+	return classCount-1;
+}
+
+/* Whether klass is org.python.core.PyException or a subclass of it. */
+static int isPyException(JNIEnv* env, jclass klass) {
+	int result = 0;
+	jclass c = (*env)->NewLocalRef(env, klass);
+	while (c && !result) {
+		char* signature = NULL;
+		if ((*jvmti)->GetClassSignature(jvmti, c, &signature, NULL)
+				== JVMTI_ERROR_NONE) {
+			result = strcmp(signature, "Lorg/python/core/PyException;") == 0;
+			(*jvmti)->Deallocate(jvmti, (unsigned char*) signature);
+		}
+		jclass super = (*env)->GetSuperclass(env, c);
+		(*env)->DeleteLocalRef(env, c);
+		c = super;
+	}
+	if (c) (*env)->DeleteLocalRef(env, c);
+	return result;
+}
+
+/*
+ * Returns the ClassInfo-index of the Python type of a PyException, named
+ * by type.__name__, or -1 if it cannot be resolved. Type objects are
+ * tagged with index+1 like classes.
+ */
+static int pythonType(JNIEnv* env, jobject exception) {
+	jlong tag = 0;
+	int result = -1;
+	char* name = NULL;
+	if (!pyExceptionType && !resolving) {
+		resolving = JNI_TRUE;
+		jclass exClass = (*env)->GetObjectClass(env, exception);
+		pyExceptionType = (*env)->GetFieldID(env, exClass,
+				"type", "Lorg/python/core/PyObject;");
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+			pyExceptionType = NULL;
+		}
+		(*env)->DeleteLocalRef(env, exClass);
+		resolving = JNI_FALSE;
+	}
+	if (!pyExceptionType) return -1;
+	jobject type = (*env)->GetObjectField(env, exception, pyExceptionType);
+	if (!type) return -1;
+	(*jvmti)->GetTag(jvmti, type, &tag);
+	if (tag > 0) {
+		(*env)->DeleteLocalRef(env, type);
+		return (int) tag-1;
+	}
+	//__name__ may run Python code, whose exceptions must not recurse here.
+	if (!resolving && toString) {
+		resolving = JNI_TRUE;
+		if (!pyGetAttr) {
+			jclass typeClass = (*env)->GetObjectClass(env, type);
+			pyGetAttr = (*env)->GetMethodID(env, typeClass, "__getattr__",
+					"(Ljava/lang/String;)Lorg/python/core/PyObject;");
+			(*env)->DeleteLocalRef(env, typeClass);
+		}
+		jstring attr = pyGetAttr && !(*env)->ExceptionCheck(env) ?
+				(*env)->NewStringUTF(env, "__name__") : NULL;
+		jobject value = attr ?
+				(*env)->CallObjectMethod(env, type, pyGetAttr, attr) : NULL;
+		jstring jname = value && !(*env)->ExceptionCheck(env) ?
+				(*env)->CallObjectMethod(env, value, toString) : NULL;
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+			jname = NULL;
+		}
+		if (jname) {
+			const char* utf = (*env)->GetStringUTFChars(env, jname, NULL);
+			name = utf ? strdup(utf) : NULL;
+			if (utf) (*env)->ReleaseStringUTFChars(env, jname, utf);
+			(*env)->DeleteLocalRef(env, jname);
+		}
+		if (value) (*env)->DeleteLocalRef(env, value);
+		if (attr) (*env)->DeleteLocalRef(env, attr);
+		resolving = JNI_FALSE;
+	}
+	if (name) {
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		//another thread may have resolved the type meanwhile
+		(*jvmti)->GetTag(jvmti, type, &tag);
+		if (tag > 0) {
+			free(name);
+			result = (int) tag-1;
+		} else {
+			if (classCount == maxClasses)
+				classes = growArray(classes, &maxClasses, sizeof(ClassInfo));
+			ClassInfo* ci = &classes[classCount];
+			ci->name = name;
+			ci->source = NULL;
+			ci->python = JNI_FALSE;
+			ci->pyException = 0;
+			(*jvmti)->SetTag(jvmti, type, ++classCount);
+			result = classCount-1;
+		}
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+	}
+	(*env)->DeleteLocalRef(env, type);
+	return result;
+}
+
+static unsigned int siteHash(jmethodID method, jlocation location, int type) {
+	uint64_t h = (uint64_t) (uintptr_t) method;
+	h = h*31 + (uint64_t) location;
+	h = h*31 + (uint64_t) type;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	return (unsigned int) (h ^ (h >> 32));
+}
+
+static void rehashSites() {
+	int i;
+	free(siteTable);
+	siteTableSize = siteTableSize == 0 ? 256 : 2*siteTableSize;
+	siteTable = calloc(siteTableSize, sizeof(int));
+	for (i = 0; i < siteCount; ++i) {
+		unsigned int pos = siteHash(sites[i].method, sites[i].location,
+				sites[i].type) & (siteTableSize-1);
+		while (siteTable[pos]) pos = (pos+1) & (siteTableSize-1);
+		siteTable[pos] = i+1;
+	}
+}
+
+/* Must be called while holding lock. */
+static int findSite(jmethodID method, jlocation location, int type) {
+	if (2*(siteCount+1) > siteTableSize)
+		rehashSites();
+	unsigned int pos = siteHash(method, location, type) & (siteTableSize-1);
+	while (siteTable[pos]) {
+		ExceptionSite* s = &sites[siteTable[pos]-1];
+		if (s->method == method && s->location == location && s->type == type)
+			return siteTable[pos]-1;
+		pos = (pos+1) & (siteTableSize-1);
+	}
+	if (siteCount == maxSites)
+		sites = growArray(sites, &maxSites, sizeof(ExceptionSite));
+	ExceptionSite* s = &sites[siteCount];
+	memset(s, 0, sizeof(ExceptionSite));
+	s->method = method;
+	s->location = location;
+	s->type = type;
+	s->line = -1;
+	s->frameClass = -1;
+	siteTable[pos] = ++siteCount;
+	return siteCount-1;
+}
+
+/*
+ * Times a stack walk of the given depth. This does roughly the work
+ * Throwable.fillInStackTrace does, i.e. it visits each frame and
+ * records method and bci.
+ */
+static void calibrate(jthread thread, jint depth) {
+	jvmtiFrameInfo* frames = malloc(depth*sizeof(jvmtiFrameInfo));
+	jint count = 0;
+	jlong start, end;
+	if (!frames) return;
+	(*jvmti)->GetTime(jvmti, &start);
+	(*jvmti)->GetStackTrace(jvmti, thread, 0, depth, frames, &count);
+	(*jvmti)->GetTime(jvmti, &end);
+	free(frames);
+	(*jvmti)->RawMonitorEnter(jvmti, lock);
+	calibrationNanos += end-start;
+	calibrationFrames += count;
+	calibrationSamples++;
+	(*jvmti)->RawMonitorExit(jvmti, lock);
+}
+
+static void JNICALL
+onException(jvmtiEnv *jvmti_env, JNIEnv* env, jthread thread,
+		jmethodID method, jlocation location, jobject exception,
+		jmethodID catch_method, jlocation catch_location)
+{
+	jlong tag = 0;
+	(*jvmti)->GetTag(jvmti, exception, &tag);
+	if (tag != 0) {
+		//rethrow of an exception that was already counted
+		return;
+	}
+	jvmtiFrameInfo frames[SITE_SEARCH_DEPTH];
+	jint count = 0, depth = 0, i;
+	(*jvmti)->GetFrameCount(jvmti, thread, &depth);
+	(*jvmti)->GetStackTrace(jvmti, thread, 0, SITE_SEARCH_DEPTH, frames, &count);
+	jclass exClass = (*env)->GetObjectClass(env, exception);
+	jclass frameClasses[SITE_SEARCH_DEPTH];
+	for (i = 0; i < count; ++i) {
+		frameClasses[i] = NULL;
+		(*jvmti)->GetMethodDeclaringClass(jvmti, frames[i].method, &frameClasses[i]);
+	}
+
+	(*jvmti)->RawMonitorEnter(jvmti, lock);
+	int type = classInfo(exClass);
+	int pyException = type >= 0 ? classes[type].pyException : 0;
+	(*jvmti)->RawMonitorExit(jvmti, lock);
+	if (pyException < 0) {
+		pyException = isPyException(env, exClass);
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		classes[type].pyException = pyException;
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+	}
+	if (pyException) {
+		int pyType = pythonType(env, exception);
+		if (pyType >= 0) type = pyType;
+	}
+
+	(*jvmti)->RawMonitorEnter(jvmti, lock);
+	//Innermost Python frame, or the throwing frame if there is none.
+	jmethodID siteMethod = count > 0 ? frames[0].method : method;
+	jlocation siteLocation = count > 0 ? frames[0].location : location;
+	for (i = 0; i < count; ++i) {
+		if (!frameClasses[i]) continue;
+		int ci = classInfo(frameClasses[i]);
+		if (ci >= 0 && classes[ci].python) {
+			siteMethod = frames[i].method;
+			siteLocation = frames[i].location;
+			break;
+		}
+	}
+	int idx = findSite(siteMethod, siteLocation, type);
+	ExceptionSite* s = &sites[idx];
+	jboolean sample = s->thrown == 0 || throwCount % CALIBRATION_INTERVAL == 0;
+	s->thrown++;
+	s->frames += depth;
+	if (depth > SUGGESTED_MAX_DEPTH)
+		s->excessFrames += depth-SUGGESTED_MAX_DEPTH;
+	throwCount++;
+	(*jvmti)->RawMonitorExit(jvmti, lock);
+
+	(*jvmti)->SetTag(jvmti, exception, idx+1);
+	(*env)->DeleteLocalRef(env, exClass);
+	for (i = 0; i < count; ++i) {
+		if (frameClasses[i]) (*env)->DeleteLocalRef(env, frameClasses[i]);
+	}
+	if (sample && depth > 0)
+		calibrate(thread, depth);
+}
+
+static void JNICALL
+onExceptionCatch(jvmtiEnv *jvmti_env, JNIEnv* env, jthread thread,
+		jmethodID method, jlocation location, jobject exception)
+{
+	jlong tag = 0;
+	(*jvmti)->GetTag(jvmti, exception, &tag);
+	if (tag > 0) {
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		sites[tag-1].caught++;
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+		//negative tag: counted as caught, ignore further catches
+		(*jvmti)->SetTag(jvmti, exception, -tag);
+	}
+}
+
+static void resolveSite(ExceptionSite* s) {
+	jclass klass = NULL;
+	jint entryCount = 0, i;
+	jvmtiLineNumberEntry* table = NULL;
+	if (!s->method) return;
+	if ((*jvmti)->GetMethodDeclaringClass(jvmti, s->method, &klass)
+			== JVMTI_ERROR_NONE)
+		s->frameClass = classInfo(klass);
+	if ((*jvmti)->GetLineNumberTable(jvmti, s->method, &entryCount, &table)
+			== JVMTI_ERROR_NONE) {
+		for (i = 0; i < entryCount; ++i) {
+			if (table[i].start_location > s->location) break;
+			s->line = table[i].line_number;
+		}
+		(*jvmti)->Deallocate(jvmti, (unsigned char*) table);
+	}
+}
+
+static double nanosPerFrame() {
+	return calibrationFrames > 0 ?
+			(double) calibrationNanos / calibrationFrames : 0.0;
+}
+
+static int compareSiteCost(const void* a, const void* b) {
+	jlong fa = (*(ExceptionSite**) a)->frames;
+	jlong fb = (*(ExceptionSite**) b)->frames;
+	return fa < fb ? 1 : (fa > fb ? -1 : 0);
+}
+
+static void printSiteName(FILE* out, ExceptionSite* s) {
+	char* name = NULL;
+	if (!s->method || s->frameClass < 0) {
+		fputs("<unknown>", out);
+		return;
+	}
+	ClassInfo* ci = &classes[s->frameClass];
+	(*jvmti)->GetMethodName(jvmti, s->method, &name, NULL, NULL);
+	if (ci->python) {
+		//Jython names code objects <name>$<n>; f$0 is module level.
+		char* dollar = name ? strrchr(name, '$') : NULL;
+		int len = dollar ? dollar-name : (name ? strlen(name) : 0);
+		fprintf(out, "%s:%d (", ci->source ? ci->source : ci->name, s->line);
+		if (name && strcmp(name, "f$0") == 0)
+			fputs("<module>", out);
+		else
+			fprintf(out, "%.*s", len, name ? name : "?");
+		fputs(")", out);
+	} else {
+		fprintf(out, "%s.%s", ci->name, name ? name : "?");
+		if (s->line >= 0) fprintf(out, ":%d", s->line);
+		fputs(" [no Python frame]", out);
+	}
+	if (name) (*jvmti)->Deallocate(jvmti, (unsigned char*) name);
+}
+
+static void writeExceptionReport() {
+	int i;
+	FILE* out = stderr;
+	if (exceptionReport && exceptionReport[0]) {
+		out = fopen(exceptionReport, "w");
+		if (!out) {
+			fprintf(stderr, "lijy agent: cannot write %s\n", exceptionReport);
+			return;
+		}
+	}
+	jlong now = 0, thrown = 0, caught = 0, frames = 0, excess = 0;
+	(*jvmti)->GetTime(jvmti, &now);
+	ExceptionSite** sorted = malloc((siteCount+1)*sizeof(ExceptionSite*));
+	for (i = 0; i < siteCount; ++i) {
+		sorted[i] = &sites[i];
+		resolveSite(&sites[i]);
+		thrown += sites[i].thrown;
+		caught += sites[i].caught;
+		frames += sites[i].frames;
+		excess += sites[i].excessFrames;
+	}
+	qsort(sorted, siteCount, sizeof(ExceptionSite*), compareSiteCost);
+	double npf = nanosPerFrame();
+	double totalMs = frames*npf/1e6;
+	double runMs = (now-vmInitTime)/1e6;
+	fprintf(out, "LiJy exception profile: %lld thrown, %lld caught, %d sites\n",
+			(long long) thrown, (long long) caught, siteCount);
+	fprintf(out, "stack capture: %.1f ns/frame (%d samples), %lld frames, "
+			"~%.2f ms of %.2f ms run time (%.1f%%)\n",
+			npf, calibrationSamples, (long long) frames,
+			totalMs, runMs, runMs > 0 ? 100.0*totalMs/runMs : 0.0);
+	fprintf(out, "  -XX:-StackTraceInThrowable would save ~%.2f ms\n", totalMs);
+	fprintf(out, "  -XX:MaxJavaStackTraceDepth=%d would save ~%.2f ms\n\n",
+			SUGGESTED_MAX_DEPTH, excess*npf/1e6);
+	fprintf(out, "%9s %9s %9s %9s  %s\n",
+			"thrown", "caught", "avg.depth", "est.ms", "exception at site");
+	for (i = 0; i < siteCount && i < REPORT_SITES; ++i) {
+		ExceptionSite* s = sorted[i];
+		fprintf(out, "%9lld %9lld %9.1f %9.3f  %s at ",
+				(long long) s->thrown, (long long) s->caught,
+				(double) s->frames/s->thrown, s->frames*npf/1e6,
+				s->type >= 0 ? classes[s->type].name : "?");
+		printSiteName(out, s);
+		fputs("\n", out);
+	}
+	if (siteCount > REPORT_SITES)
+		fprintf(out, "... %d more sites\n", siteCount-REPORT_SITES);
+	free(sorted);
+	if (out != stderr) fclose(out);
+	else fflush(out);
+}
+
+/* 64 bit FNV-1a over len chars (or up to 0 if len < 0) */
+static unsigned long long nameHash(const char* s, int len) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for ( ; len != 0 && *s; ++s, --len) {
+		h ^= (unsigned char) *s;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Must be called while holding lock. */
+static int classpathEntry(const char* path) {
+	int i;
+	for (i = 0; i < entryCount; ++i) {
+		if (strcmp(entries[i].path, path) == 0)
+			return i;
+	}
+	if (entryCount == maxEntries)
+		entries = growArray(entries, &maxEntries, sizeof(ClasspathEntry));
+	entries[entryCount].path = strdup(path);
+	entries[entryCount].classes = 0;
+	entries[entryCount].nanos = 0;
+	return entryCount++;
+}
+
+/* Decodes %XX-escapes of a URL path in place. */
+static void urlDecode(char* s) {
+	char* d = s;
+	for ( ; *s; ++s, ++d) {
+		unsigned int c;
+		if (s[0] == '%' && s[1] && s[2] && sscanf(s+1, "%2x", &c) == 1) {
+			*d = (char) c;
+			s += 2;
+		} else {
+			*d = *s;
+		}
+	}
+	*d = 0;
+}
+
+/*
+ * Returns the classpath entry of a protection domain, i.e. the path of
+ * pd.getCodeSource().getLocation(). Each protection domain is resolved
+ * once and then tagged with entry-index+1.
+ */
+static int protectionDomainEntry(JNIEnv* env, jobject loader, jobject pd) {
+	jlong tag = 0;
+	int result;
+	if (!pd) {
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		result = classpathEntry(loader ? noLocationEntry : bootEntry);
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+		return result;
+	}
+	(*jvmti)->GetTag(jvmti, pd, &tag);
+	if (tag > 0)
+		return (int) tag-1;
+	char* path = NULL;
+	const char* utf = NULL;
+	jstring jpath = NULL;
+	//Calling into Java might load classes, which must not recurse here.
+	if (!resolving && getCodeSource) {
+		resolving = JNI_TRUE;
+		jobject cs = (*env)->CallObjectMethod(env, pd, getCodeSource);
+		jobject url = cs && !(*env)->ExceptionCheck(env) ?
+				(*env)->CallObjectMethod(env, cs, getLocation) : NULL;
+		jpath = url && !(*env)->ExceptionCheck(env) ?
+				(*env)->CallObjectMethod(env, url, getPath) : NULL;
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+			jpath = NULL;
+		}
+		if (jpath) {
+			utf = (*env)->GetStringUTFChars(env, jpath, NULL);
+			path = utf ? strdup(utf) : NULL;
+			if (utf) (*env)->ReleaseStringUTFChars(env, jpath, utf);
+		}
+		resolving = JNI_FALSE;
+	}
+	if (path) {
+		urlDecode(path);
+		//directories have a trailing slash in URLs, but not on classpaths
+		int len = strlen(path);
+		if (len > 1 && path[len-1] == '/') path[len-1] = 0;
+	}
+	(*jvmti)->RawMonitorEnter(jvmti, lock);
+	result = classpathEntry(path ? path : noLocationEntry);
+	(*jvmti)->RawMonitorExit(jvmti, lock);
+	free(path);
+	(*jvmti)->SetTag(jvmti, pd, result+1);
+	return result;
+}
+
+static void JNICALL
+onClassFileLoadHook(jvmtiEnv *jvmti_env, JNIEnv* env,
+		jclass class_being_redefined, jobject loader, const char* name,
+		jobject protection_domain, jint class_data_len,
+		const unsigned char* class_data, jint* new_class_data_len,
+		unsigned char** new_class_data)
+{
+	if (class_being_redefined || !name)
+		return;
+	int entry = protectionDomainEntry(env, loader, protection_domain);
+	if (classList) {
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		if (strcmp(entries[entry].path, noLocationEntry) != 0) {
+			if (listedCount == maxListed)
+				listedClasses = growArray(listedClasses, &maxListed, sizeof(char*));
+			listedClasses[listedCount++] = strdup(name);
+		}
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+	}
+	if (loadDepth < LOAD_STACK_DEPTH) {
+		LoadFrame* f = &loadStack[loadDepth];
+		f->name = nameHash(name, -1);
+		f->entry = entry;
+		f->childNanos = 0;
+		(*jvmti)->GetTime(jvmti, &f->start);
+	}
+	loadDepth++;
+}
+
+static void JNICALL
+onClassLoad(jvmtiEnv *jvmti_env, JNIEnv* env, jthread thread, jclass klass)
+{
+	char* signature = NULL;
+	jlong now;
+	int i;
+	if (loadDepth == 0)
+		return;
+	(*jvmti)->GetTime(jvmti, &now);
+	if ((*jvmti)->GetClassSignature(jvmti, klass, &signature, NULL)
+			!= JVMTI_ERROR_NONE)
+		return;
+	//signature has the form Lpkg/Name;
+	unsigned long long name = nameHash(signature+1, strlen(signature)-2);
+	(*jvmti)->Deallocate(jvmti, (unsigned char*) signature);
+	if (loadDepth > LOAD_STACK_DEPTH) {
+		loadDepth--;
+		return;
+	}
+	//Frames above a match belong to definitions that failed.
+	for (i = loadDepth-1; i >= 0 && loadStack[i].name != name; --i);
+	if (i < 0)
+		return;
+	loadDepth = i;
+	LoadFrame* f = &loadStack[i];
+	jlong elapsed = now-f->start;
+	if (i > 0)
+		loadStack[i-1].childNanos += elapsed;
+	(*jvmti)->RawMonitorEnter(jvmti, lock);
+	entries[f->entry].classes++;
+	entries[f->entry].nanos += elapsed-f->childNanos;
+	(*jvmti)->RawMonitorExit(jvmti, lock);
+}
+
+static int compareEntryClasses(const void* a, const void* b) {
+	jlong ca = ((ClasspathEntry*) a)->classes;
+	jlong cb = ((ClasspathEntry*) b)->classes;
+	return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+/*
+ * Writes the class-load profile. Entries of java.class.path that did
+ * not define any class are listed with count 0, so that the launcher
+ * can tell them apart from entries added after profiling.
+ */
+static void writeClassProfile() {
+	char* cp = NULL;
+	int i;
+	if ((*jvmti)->GetSystemProperty(jvmti, "java.class.path", &cp)
+			== JVMTI_ERROR_NONE && cp) {
+		char* token = strtok(cp, ":");
+		while (token) {
+			classpathEntry(token);
+			token = strtok(NULL, ":");
+		}
+		(*jvmti)->Deallocate(jvmti, (unsigned char*) cp);
+	}
+	qsort(entries, entryCount, sizeof(ClasspathEntry), compareEntryClasses);
+	//write to a temporary file first, concurrent runs may race here
+	int len = strlen(classProfile)+24;
+	char tmp[len];
+	snprintf(tmp, len, "%s.%ld", classProfile, (long) getpid());
+	FILE* out = fopen(tmp, "w");
+	if (!out) {
+		fprintf(stderr, "lijy agent: cannot write %s\n", tmp);
+		return;
+	}
+	fputs("# LiJy class-load profile\n", out);
+	fputs("# classes  define-ms  classpath-entry\n", out);
+	for (i = 0; i < entryCount; ++i) {
+		fprintf(out, "%9lld %10.3f  %s\n", (long long) entries[i].classes,
+				entries[i].nanos/1e6, entries[i].path);
+	}
+	fclose(out);
+	if (rename(tmp, classProfile) != 0)
+		unlink(tmp);
+}
+
+/* Writes the class list with binary names, i.e. pkg.Name. */
+static void writeClassList() {
+	int i;
+	char* p;
+	int len = strlen(classList)+24;
+	char tmp[len];
+	snprintf(tmp, len, "%s.%ld", classList, (long) getpid());
+	FILE* out = fopen(tmp, "w");
+	if (!out) {
+		fprintf(stderr, "lijy agent: cannot write %s\n", tmp);
+		return;
+	}
+	fputs("# LiJy class list, classes in load order\n", out);
+	for (i = 0; i < listedCount; ++i) {
+		for (p = listedClasses[i]; *p; ++p)
+			if (*p == '/') *p = '.';
+		fprintf(out, "%s\n", listedClasses[i]);
+	}
+	fclose(out);
+	if (rename(tmp, classList) != 0)
+		unlink(tmp);
+}
+
+static void JNICALL
+onVMInit(jvmtiEnv *jvmti_env, JNIEnv* env, jthread thread)
+{
+	(*jvmti)->GetTime(jvmti, &vmInitTime);
+	if (profileExceptions) {
+		jclass objectClass = (*env)->FindClass(env, "java/lang/Object");
+		if (objectClass) {
+			toString = (*env)->GetMethodID(env, objectClass,
+					"toString", "()Ljava/lang/String;");
+			(*env)->DeleteLocalRef(env, objectClass);
+		}
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+			toString = NULL;
+		}
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
+				JVMTI_EVENT_EXCEPTION, NULL);
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
+				JVMTI_EVENT_EXCEPTION_CATCH, NULL);
+	}
+	if (profileClasses) {
+		jclass pdClass = (*env)->FindClass(env, "java/security/ProtectionDomain");
+		jclass csClass = (*env)->FindClass(env, "java/security/CodeSource");
+		jclass urlClass = (*env)->FindClass(env, "java/net/URL");
+		if (pdClass && csClass && urlClass) {
+			getLocation = (*env)->GetMethodID(env, csClass,
+					"getLocation", "()Ljava/net/URL;");
+			getPath = (*env)->GetMethodID(env, urlClass,
+					"getPath", "()Ljava/lang/String;");
+			getCodeSource = (*env)->GetMethodID(env, pdClass,
+					"getCodeSource", "()Ljava/security/CodeSource;");
+		}
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+			getCodeSource = NULL;
+		}
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
+				JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, NULL);
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE,
+				JVMTI_EVENT_CLASS_LOAD, NULL);
+	}
+}
+
+static void JNICALL
+onVMDeath(jvmtiEnv *jvmti_env, JNIEnv* env)
+{
+	if (profileExceptions) {
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE,
+				JVMTI_EVENT_EXCEPTION, NULL);
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE,
+				JVMTI_EVENT_EXCEPTION_CATCH, NULL);
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		writeExceptionReport();
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+	}
+	if (profileClasses) {
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE,
+				JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, NULL);
+		(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE,
+				JVMTI_EVENT_CLASS_LOAD, NULL);
+		(*jvmti)->RawMonitorEnter(jvmti, lock);
+		if (classProfile)
+			writeClassProfile();
+		if (classList)
+			writeClassList();
+		(*jvmti)->RawMonitorExit(jvmti, lock);
+	}
+}
+
+/*
+ * Parses <feature>[=<value>] tokens separated by commas.
+ * Note that values must not contain commas.
+ */
+static jboolean parseAgentOptions(char* options) {
+	char* token = options ? strtok(options, ",") : NULL;
+	while (token) {
+		char* value = strchr(token, '=');
+		if (value) *value++ = 0;
+		if (strcmp(token, agentExceptions) == 0) {
+			profileExceptions = JNI_TRUE;
+			exceptionReport = agentStrDup(value);
+		} else if (strcmp(token, agentClasses) == 0 && value && value[0]) {
+			profileClasses = JNI_TRUE;
+			classProfile = agentStrDup(value);
+		} else if (strcmp(token, agentClassList) == 0 && value && value[0]) {
+			//needs the class load events of "classes"
+			profileClasses = JNI_TRUE;
+			classList = agentStrDup(value);
+		} else {
+			fprintf(stderr, "lijy agent: unknown option %s\n", token);
+			return JNI_FALSE;
+		}
+		token = strtok(NULL, ",");
+	}
+	return JNI_TRUE;
+}
+
+JNIEXPORT jint JNICALL
+Agent_OnLoad_lijy(JavaVM *vm, char *options, void *reserved)
+{
+	jvmtiCapabilities caps;
+	jvmtiEventCallbacks callbacks;
+
+	if (!parseAgentOptions(options))
+		return JNI_ERR;
+	if ((*vm)->GetEnv(vm, (void**) &jvmti, JVMTI_VERSION_1_2) != JNI_OK) {
+		fputs("lijy agent: JVMTI 1.2 not available\n", stderr);
+		return JNI_ERR;
+	}
+	memset(&caps, 0, sizeof(caps));
+	caps.can_tag_objects = 1;
+	caps.can_get_source_file_name = 1;
+	caps.can_get_line_numbers = 1;
+	if (profileExceptions)
+		caps.can_generate_exception_events = 1;
+	if ((*jvmti)->AddCapabilities(jvmti, &caps) != JVMTI_ERROR_NONE) {
+		fputs("lijy agent: required JVMTI capabilities not available\n", stderr);
+		return JNI_ERR;
+	}
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.VMInit = &onVMInit;
+	callbacks.VMDeath = &onVMDeath;
+	callbacks.Exception = &onException;
+	callbacks.ExceptionCatch = &onExceptionCatch;
+	callbacks.ClassFileLoadHook = &onClassFileLoadHook;
+	callbacks.ClassLoad = &onClassLoad;
+	(*jvmti)->SetEventCallbacks(jvmti, &callbacks, sizeof(callbacks));
+	(*jvmti)->CreateRawMonitor(jvmti, "lijy agent", &lock);
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, NULL);
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, NULL);
+	return JNI_OK;
+}
@@ -0,0 +1,26 @@
+/*
+ * jyagent.h
+ *
+ * Interface of the JVMTI agent that is built into the launcher,
+ * see jyagent.c.
+ */
+
+#ifndef JYAGENT_H_
+#define JYAGENT_H_
+
+#include <jni.h>
+
+/*
+ * The VM resolves -agentlib:lijy=<options> to Agent_OnLoad_lijy in
+ * the launcher executable (JDK 8+, statically linked agents).
+ * <options> is a comma-separated list of <feature>[=<value>].
+ */
+#define agentName "lijy"
+#define agentOptPre "-agentlib:" agentName "="
+#define agentExceptions "exceptions"
+#define agentClasses "classes"
+#define agentClassList "classlist"
+
+JNIEXPORT jint JNICALL Agent_OnLoad_lijy(JavaVM *vm, char *options, void *reserved);
+
+#endif /* JYAGENT_H_ */
@@ -0,0 +1,72 @@
+/*
+ * jycache.c
+ *
+ * The launcher keeps data that it learns about earlier runs, e.g.
+ * class-load profiles of scripts, in a per-user cache directory:
+ * $XDG_CACHE_HOME/lijy-launch or ~/.cache/lijy-launch.
+ * Entries are files named <kind>-<hash of key>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "jycache.h"
+
+/* 64 bit FNV-1a */
+unsigned long long jyHash(const char* s) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for ( ; *s; ++s) {
+		h ^= (unsigned char) *s;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Writes the cache directory to dest. If create is JNI_TRUE the
+ * directory is created if it does not exist yet.
+ * Returns JNI_FALSE if no cache directory is available.
+ */
+jboolean jyCacheDir(char* dest, int size, jboolean create) {
+	char* base = getenv("XDG_CACHE_HOME");
+	int len;
+	if (base && base[0] == '/') {
+		len = snprintf(dest, size, "%s/%s", base, cacheDirName);
+	} else {
+		base = getenv("HOME");
+		if (!base || !base[0])
+			return JNI_FALSE;
+		len = snprintf(dest, size, "%s/.cache/%s", base, cacheDirName);
+	}
+	if (len >= size)
+		return JNI_FALSE;
+	if (create) {
+		//create parent (~/.cache) too, if needed
+		char* sep = strrchr(dest, '/');
+		*sep = 0;
+		if (mkdir(dest, 0700) != 0 && errno != EEXIST) {
+			*sep = '/';
+			return JNI_FALSE;
+		}
+		*sep = '/';
+		if (mkdir(dest, 0700) != 0 && errno != EEXIST)
+			return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
+/*
+ * Writes the path of the cache entry <kind>-<hash of key> to dest.
+ * Whether the entry exists is up to the caller to find out.
+ */
+jboolean jyCachePath(char* dest, int size, const char* kind,
+		const char* key, jboolean create) {
+	if (!jyCacheDir(dest, size, create))
+		return JNI_FALSE;
+	int len = strlen(dest);
+	return snprintf(dest+len, size-len, "/%s-%016llx", kind, jyHash(key))
+			< size-len;
+}
@@ -0,0 +1,19 @@
+/*
+ * jycache.h
+ *
+ * Per-user cache of the launcher, see jycache.c.
+ */
+
+#ifndef JYCACHE_H_
+#define JYCACHE_H_
+
+#include <jni.h>
+
+#define cacheDirName "lijy-launch"
+
+unsigned long long jyHash(const char* s);
+jboolean jyCacheDir(char* dest, int size, jboolean create);
+jboolean jyCachePath(char* dest, int size, const char* kind,
+		const char* key, jboolean create);
+
+#endif /* JYCACHE_H_ */
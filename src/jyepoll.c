@@ -0,0 +1,368 @@
+/*
+ * jyepoll.c
+ *
+ * Natives of lijy.NativeEpoll and lijy.NativeSocket (see jynative.c):
+ * an event loop backend for scripts that serve many local connections.
+ * Jython's select and asyncore are emulated over Java NIO selectors
+ * (and Netty), with selected-key sets and wrapper objects allocated on
+ * every poll. Here sockets are plain file descriptors, epoll(7) watches
+ * them, and a poll fills two int arrays the caller allocated once.
+ * lib/lijyselect.py offers this as CPython's select.epoll.
+ *
+ * NativeEpoll:
+ *   int create()
+ *   void add(int epfd, int fd, int events), modify(...), remove(epfd, fd)
+ *   int wait(int epfd, int[] fds, int[] events, int timeoutMillis)
+ *     Stores up to min(fds.length, events.length) ready descriptors and
+ *     their events; returns their number, 0 on timeout or EINTR.
+ *     timeoutMillis -1 waits without limit.
+ *   int eventfd(), void wake(int fd)
+ *     A descriptor to add to an epoll set, readable after wake, which
+ *     other threads call to end a wait. NativeSocket.read clears it.
+ *   IN, OUT, PRI, ERR, HUP, RDHUP, ET, ONESHOT: the EPOLL* flags.
+ *
+ * NativeSocket, all descriptors non-blocking and close-on-exec:
+ *   int listen(String host, int port, int backlog)   host null: any
+ *   int port(int fd)                                 the bound port
+ *   int accept(int fd)                               -1 if none waits
+ *   int connect(String host, int port)               in progress
+ *   void finishConnect(int fd)                       throws if it failed
+ *   int read(int fd, byte[] b, int off, int len)     0 at EOF, -1 if none
+ *   int write(int fd, byte[] b, int off, int len)    -1 if it would block
+ *   void setNoDelay(int fd, boolean on)
+ *   void close(int fd)
+ * Errors throw IOException.
+ */
+
+#define _GNU_SOURCE /* accept4 */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define maxEvents 1024
+
+static void
+ThrowErrno(JNIEnv *env, const char *what)
+{
+	char message[256];
+	JLI_Snprintf(message, sizeof(message), "%s: %s", what, strerror(errno));
+	ThrowNative(env, "java/io/IOException", message);
+}
+
+static jint JNICALL
+NativeEpoll_create(JNIEnv *env, jclass cls)
+{
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0)
+		ThrowErrno(env, "epoll_create1");
+	return fd;
+}
+
+static void
+Control(JNIEnv *env, jint epfd, int op, jint fd, jint events)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = (uint32_t) events;
+	event.data.fd = fd;
+	if (epoll_ctl(epfd, op, fd, &event) != 0)
+		ThrowErrno(env, "epoll_ctl");
+}
+
+static void JNICALL
+NativeEpoll_add(JNIEnv *env, jclass cls, jint epfd, jint fd, jint events)
+{
+	Control(env, epfd, EPOLL_CTL_ADD, fd, events);
+}
+
+static void JNICALL
+NativeEpoll_modify(JNIEnv *env, jclass cls, jint epfd, jint fd, jint events)
+{
+	Control(env, epfd, EPOLL_CTL_MOD, fd, events);
+}
+
+static void JNICALL
+NativeEpoll_remove(JNIEnv *env, jclass cls, jint epfd, jint fd)
+{
+	Control(env, epfd, EPOLL_CTL_DEL, fd, 0);
+}
+
+static jint JNICALL
+NativeEpoll_wait(JNIEnv *env, jclass cls, jint epfd, jintArray jfds, jintArray jevents, jint timeout)
+{
+	struct epoll_event events[maxEvents];
+	jint fds[maxEvents], flags[maxEvents];
+	jint max, n, i;
+	if (jfds == NULL || jevents == NULL) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeEpoll.wait: no arrays");
+		return 0;
+	}
+	max = (*env)->GetArrayLength(env, jfds);
+	if ((*env)->GetArrayLength(env, jevents) < max)
+		max = (*env)->GetArrayLength(env, jevents);
+	if (max > maxEvents)
+		max = maxEvents;
+	if (max == 0)
+		return 0;
+	/* blocks in native code, the JVM does not wait for this thread */
+	n = epoll_wait(epfd, events, max, timeout);
+	if (n < 0) {
+		if (errno != EINTR)
+			ThrowErrno(env, "epoll_wait");
+		return 0;
+	}
+	for (i = 0; i < n; ++i) {
+		fds[i] = events[i].data.fd;
+		flags[i] = (jint) events[i].events;
+	}
+	(*env)->SetIntArrayRegion(env, jfds, 0, n, fds);
+	(*env)->SetIntArrayRegion(env, jevents, 0, n, flags);
+	return n;
+}
+
+static jint JNICALL
+NativeEpoll_eventfd(JNIEnv *env, jclass cls)
+{
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		ThrowErrno(env, "eventfd");
+	return fd;
+}
+
+static void JNICALL
+NativeEpoll_wake(JNIEnv *env, jclass cls, jint fd)
+{
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		ThrowErrno(env, "eventfd write");
+}
+
+static const JNINativeMethod nativeEpollMethods[] = {
+	{"create", "()I", (void *) NativeEpoll_create},
+	{"add", "(III)V", (void *) NativeEpoll_add},
+	{"modify", "(III)V", (void *) NativeEpoll_modify},
+	{"remove", "(II)V", (void *) NativeEpoll_remove},
+	{"wait", "(I[I[II)I", (void *) NativeEpoll_wait},
+	{"eventfd", "()I", (void *) NativeEpoll_eventfd},
+	{"wake", "(I)V", (void *) NativeEpoll_wake}
+};
+
+static const NativeConstant nativeEpollConstants[] = {
+	{"IN", EPOLLIN},
+	{"OUT", EPOLLOUT},
+	{"PRI", EPOLLPRI},
+	{"ERR", EPOLLERR},
+	{"HUP", EPOLLHUP},
+	{"RDHUP", EPOLLRDHUP},
+	{"ET", (jint) EPOLLET},
+	{"ONESHOT", EPOLLONESHOT}
+};
+
+const NativeClass nativeEpollClass = {
+	"lijy/NativeEpoll",
+	nativeEpollMethods, sizeof(nativeEpollMethods)/sizeof(nativeEpollMethods[0]),
+	nativeEpollConstants, sizeof(nativeEpollConstants)/sizeof(nativeEpollConstants[0])
+};
+
+/*
+ * Resolves host and port, passive for listen. Returns NULL with an
+ * exception pending if that fails.
+ */
+static struct addrinfo *
+Resolve(JNIEnv *env, jstring jhost, jint port, jboolean passive)
+{
+	struct addrinfo hints, *result = NULL;
+	const char *host = jhost == NULL ? NULL : (*env)->GetStringUTFChars(env, jhost, NULL);
+	char service[16];
+	int status;
+	if (jhost != NULL && host == NULL)
+		return NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+	JLI_Snprintf(service, sizeof(service), "%d", (int) port);
+	status = getaddrinfo(host, service, &hints, &result);
+	if (status != 0) {
+		char message[256];
+		JLI_Snprintf(message, sizeof(message), "cannot resolve %s: %s",
+				host == NULL ? "*" : host, gai_strerror(status));
+		ThrowNative(env, "java/io/IOException", message);
+		result = NULL;
+	}
+	if (host != NULL)
+		(*env)->ReleaseStringUTFChars(env, jhost, host);
+	return result;
+}
+
+static jint JNICALL
+NativeSocket_listen(JNIEnv *env, jclass cls, jstring host, jint port, jint backlog)
+{
+	struct addrinfo *addresses = Resolve(env, host, port, JNI_TRUE), *a;
+	int fd = -1, on = 1;
+	if (addresses == NULL)
+		return -1;
+	for (a = addresses; a != NULL; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, backlog) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		ThrowErrno(env, "listen");
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+static jint JNICALL
+NativeSocket_port(JNIEnv *env, jclass cls, jint fd)
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (getsockname(fd, (struct sockaddr *) &address, &length) != 0) {
+		ThrowErrno(env, "getsockname");
+		return -1;
+	}
+	return ntohs(address.ss_family == AF_INET6
+			? ((struct sockaddr_in6 *) &address)->sin6_port
+			: ((struct sockaddr_in *) &address)->sin_port);
+}
+
+static jint JNICALL
+NativeSocket_accept(JNIEnv *env, jclass cls, jint fd)
+{
+	int client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+			&& errno != ECONNABORTED)
+		ThrowErrno(env, "accept");
+	return client < 0 ? -1 : client;
+}
+
+static jint JNICALL
+NativeSocket_connect(JNIEnv *env, jclass cls, jstring host, jint port)
+{
+	struct addrinfo *addresses = Resolve(env, host, port, JNI_FALSE), *a;
+	int fd = -1;
+	if (addresses == NULL)
+		return -1;
+	for (a = addresses; a != NULL; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, a->ai_addr, a->ai_addrlen) == 0 || errno == EINPROGRESS)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		ThrowErrno(env, "connect");
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+static void JNICALL
+NativeSocket_finishConnect(JNIEnv *env, jclass cls, jint fd)
+{
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+		if (error != 0)
+			errno = error;
+		ThrowErrno(env, "connect");
+	}
+}
+
+/*
+ * Reads or writes with the array pinned; the descriptor is non-blocking,
+ * so the garbage collector is held up for one copy at most.
+ */
+static jint
+Transfer(JNIEnv *env, jint fd, jbyteArray array, jint off, jint len, jboolean reading)
+{
+	char *bytes;
+	ssize_t n;
+	if (array == NULL || off < 0 || len < 0 || off > (*env)->GetArrayLength(env, array) - len) {
+		ThrowNative(env, "java/lang/IndexOutOfBoundsException", "NativeSocket: bad array range");
+		return -1;
+	}
+	bytes = (*env)->GetPrimitiveArrayCritical(env, array, NULL);
+	if (bytes == NULL)
+		return -1;
+	do {
+		n = reading ? read(fd, bytes+off, len) : write(fd, bytes+off, len);
+	} while (n < 0 && errno == EINTR);
+	(*env)->ReleasePrimitiveArrayCritical(env, array, bytes, reading ? 0 : JNI_ABORT);
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		ThrowErrno(env, reading ? "read" : "write");
+		return -1;
+	}
+	return n < 0 ? -1 : (jint) n;
+}
+
+static jint JNICALL
+NativeSocket_read(JNIEnv *env, jclass cls, jint fd, jbyteArray array, jint off, jint len)
+{
+	return Transfer(env, fd, array, off, len, JNI_TRUE);
+}
+
+static jint JNICALL
+NativeSocket_write(JNIEnv *env, jclass cls, jint fd, jbyteArray array, jint off, jint len)
+{
+	return Transfer(env, fd, array, off, len, JNI_FALSE);
+}
+
+static void JNICALL
+NativeSocket_setNoDelay(JNIEnv *env, jclass cls, jint fd, jboolean on)
+{
+	int value = on ? 1 : 0;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) != 0)
+		ThrowErrno(env, "setsockopt");
+}
+
+static void JNICALL
+NativeSocket_close(JNIEnv *env, jclass cls, jint fd)
+{
+	/* Linux releases the descriptor even if close fails */
+	if (close(fd) != 0 && errno != EINTR)
+		ThrowErrno(env, "close");
+}
+
+static const JNINativeMethod nativeSocketMethods[] = {
+	{"listen", "(Ljava/lang/String;II)I", (void *) NativeSocket_listen},
+	{"port", "(I)I", (void *) NativeSocket_port},
+	{"accept", "(I)I", (void *) NativeSocket_accept},
+	{"connect", "(Ljava/lang/String;I)I", (void *) NativeSocket_connect},
+	{"finishConnect", "(I)V", (void *) NativeSocket_finishConnect},
+	{"read", "(I[BII)I", (void *) NativeSocket_read},
+	{"write", "(I[BII)I", (void *) NativeSocket_write},
+	{"setNoDelay", "(IZ)V", (void *) NativeSocket_setNoDelay},
+	{"close", "(I)V", (void *) NativeSocket_close}
+};
+
+const NativeClass nativeSocketClass = {
+	"lijy/NativeSocket",
+	nativeSocketMethods, sizeof(nativeSocketMethods)/sizeof(nativeSocketMethods[0]),
+	NULL, 0
+};
+
+#else
+
+/* defined without methods, so scripts can still import them */
+const NativeClass nativeEpollClass = {"lijy/NativeEpoll", NULL, 0, NULL, 0};
+const NativeClass nativeSocketClass = {"lijy/NativeSocket", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
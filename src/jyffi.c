@@ -0,0 +1,530 @@
+/*
+ * jyffi.c
+ *
+ * Natives of lijy.NativeFFI (see jynative.c): calling C functions from
+ * scripts. JNA and jnr-ffi describe every call by reflection on the
+ * arguments and take long to initialize; here a function's signature is
+ * parsed once into a descriptor, and calls pass primitives straight to
+ * the function. lib/lijyffi.py wraps this into Python callables.
+ *
+ *   long open(String path)
+ *     dlopen(3)s a library, null for the launcher and what it has loaded.
+ *   long symbol(long library, String name)
+ *     dlsym(3).
+ *   int prepare(long function, String signature)
+ *     Returns a descriptor for calls of function. Descriptors live as
+ *     long as the process, preparing the same function and signature
+ *     again returns the same one; up to maxDescriptors functions or
+ *     signatures can be prepared. The signature is the
+ *     return type and the argument types in parentheses, e.g. "l(lbi)"
+ *     for zlib's crc32: i int, l long, p pointer (as long), f float,
+ *     d double, b a byte[] or direct ByteBuffer passed as pointer to its
+ *     first byte, v void (return only). At most 6 arguments of types
+ *     i, l, p and b and 8 of types f and d are supported.
+ *   long call(int descriptor, long... up to 6 arguments)
+ *     Calls a function whose arguments are all i, l or p.
+ *   long callBuffer(int descriptor, Object buffer, long... up to 5)
+ *     Calls a function with one b argument and otherwise i, l or p; the
+ *     longs fill the other arguments in order. A byte[] stays pinned
+ *     during the call, so the garbage collector waits for it.
+ *   long invoke(int descriptor, long[] ints, double[] doubles)
+ *     Calls any prepared function: ints holds the i, l and p arguments
+ *     in order, doubles the f and d arguments.
+ *   long address(ByteBuffer buffer)
+ *     The address of a direct buffer, e.g. for p arguments of invoke.
+ *
+ * The calls return i results as int, l and p as long, v as 0, and f
+ * and d as their raw bits (Float.intBitsToFloat, Double.longBitsToDouble).
+ *
+ * Without libffi, calls go through one function pointer type with six
+ * integer and eight floating point parameters. On x86-64 and AArch64
+ * these are all passed in registers, integer and floating point ones
+ * independently of their order, so a function with fewer parameters of
+ * each kind reads just its own. A float is passed in the low half of a
+ * double register. Variadic functions and structs by value are not
+ * supported. On other platforms prepare throws.
+ */
+
+#include "java.h"
+#include "jynative.h"
+#include <dlfcn.h>
+#include <pthread.h>
+
+#define maxIntArgs 6
+#define maxFloatArgs 8
+#define maxDescriptors 4096
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define FFI_REGISTER_CALLS
+#endif
+
+typedef struct {
+	void *function;
+	char returnType;
+	int argc;
+	int intCount;
+	int floatCount;
+	int buffer;                     /* index of the b argument or -1 */
+	jboolean integral;              /* only i, l and p arguments */
+	char types[maxIntArgs+maxFloatArgs];
+} CallDescriptor;
+
+/* Written under the lock, read without it: entries never change. */
+static CallDescriptor *descriptors[maxDescriptors];
+static int descriptorCount = 0;
+static pthread_mutex_t descriptorLock = PTHREAD_MUTEX_INITIALIZER;
+static jclass byteArrayClass = NULL;
+
+typedef jlong (*IntCall)(jlong, jlong, jlong, jlong, jlong, jlong,
+		double, double, double, double, double, double, double, double);
+typedef double (*DoubleCall)(jlong, jlong, jlong, jlong, jlong, jlong,
+		double, double, double, double, double, double, double, double);
+typedef float (*FloatCall)(jlong, jlong, jlong, jlong, jlong, jlong,
+		double, double, double, double, double, double, double, double);
+
+static const CallDescriptor *
+Descriptor(JNIEnv *env, jint id)
+{
+	int count = __atomic_load_n(&descriptorCount, __ATOMIC_ACQUIRE);
+	if (id < 0 || id >= count) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeFFI: no such descriptor");
+		return NULL;
+	}
+	return descriptors[id];
+}
+
+/*
+ * Calls cd->function with the integer arguments ints and the floating
+ * point arguments floats, each in the order of the signature.
+ */
+static jlong
+Invoke(const CallDescriptor *cd, const jlong *ints, const double *floats)
+{
+#ifdef FFI_REGISTER_CALLS
+	jlong i[maxIntArgs] = {0, 0, 0, 0, 0, 0};
+	double d[maxFloatArgs] = {0, 0, 0, 0, 0, 0, 0, 0};
+	int k, n = 0, m = 0;
+	for (k = 0; k < cd->argc; ++k) {
+		switch (cd->types[k]) {
+		case 'i':
+			i[n] = (jint) ints[n];
+			++n;
+			break;
+		case 'f': {
+			/* the callee reads the low 32 bits of the register */
+			union { double d; float f; } u;
+			u.d = 0;
+			u.f = (float) floats[m];
+			d[m++] = u.d;
+			break;
+		}
+		case 'd':
+			d[m] = floats[m];
+			++m;
+			break;
+		default:
+			i[n] = ints[n];
+			++n;
+		}
+	}
+	switch (cd->returnType) {
+	case 'd': {
+		double r = ((DoubleCall) cd->function)(i[0], i[1], i[2], i[3], i[4], i[5],
+				d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+		jlong bits;
+		memcpy(&bits, &r, sizeof(bits));
+		return bits;
+	}
+	case 'f': {
+		float r = ((FloatCall) cd->function)(i[0], i[1], i[2], i[3], i[4], i[5],
+				d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+		jint bits;
+		memcpy(&bits, &r, sizeof(bits));
+		return bits;
+	}
+	case 'i':
+		return (jint) ((IntCall) cd->function)(i[0], i[1], i[2], i[3], i[4], i[5],
+				d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+	case 'v':
+		((IntCall) cd->function)(i[0], i[1], i[2], i[3], i[4], i[5],
+				d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+		return 0;
+	default:
+		return ((IntCall) cd->function)(i[0], i[1], i[2], i[3], i[4], i[5],
+				d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+	}
+#else
+	return 0;
+#endif
+}
+
+static jlong JNICALL
+NativeFFI_open(JNIEnv *env, jclass cls, jstring jpath)
+{
+	char *path = GetStringUtf8(env, jpath);
+	void *library = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
+	if (library == NULL)
+		ThrowNative(env, "java/lang/UnsatisfiedLinkError", dlerror());
+	JLI_MemFree(path);
+	return (jlong) (size_t) library;
+}
+
+static jlong JNICALL
+NativeFFI_symbol(JNIEnv *env, jclass cls, jlong library, jstring jname)
+{
+	const char *name = jname == NULL ? NULL : (*env)->GetStringUTFChars(env, jname, NULL);
+	void *function;
+	if (name == NULL || library == 0) {
+		if (name != NULL)
+			(*env)->ReleaseStringUTFChars(env, jname, name);
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeFFI.symbol: no library or name");
+		return 0;
+	}
+	dlerror();
+	function = dlsym((void *) (size_t) library, name);
+	if (function == NULL)
+		ThrowNative(env, "java/lang/UnsatisfiedLinkError", dlerror());
+	(*env)->ReleaseStringUTFChars(env, jname, name);
+	return (jlong) (size_t) function;
+}
+
+/* Parses "r(a...)" into cd, returns an error message or NULL. */
+static const char *
+ParseSignature(const char *s, CallDescriptor *cd)
+{
+	cd->returnType = s[0];
+	if (s[0] == '\0' || strchr("ilpfdv", s[0]) == NULL)
+		return "bad return type";
+	if (s[1] != '(')
+		return "expected '(' after the return type";
+	cd->argc = cd->intCount = cd->floatCount = 0;
+	cd->buffer = -1;
+	cd->integral = JNI_TRUE;
+	for (s += 2; *s != ')'; ++s) {
+		if (*s == '\0' || strchr("ilpfdb", *s) == NULL)
+			return "bad argument type";
+		if (*s == 'f' || *s == 'd') {
+			if (++cd->floatCount > maxFloatArgs)
+				return "more than 8 f and d arguments";
+			cd->integral = JNI_FALSE;
+		} else {
+			if (++cd->intCount > maxIntArgs)
+				return "more than 6 i, l, p and b arguments";
+			if (*s == 'b') {
+				if (cd->buffer >= 0)
+					return "more than one b argument";
+				cd->buffer = cd->argc;
+				cd->integral = JNI_FALSE;
+			}
+		}
+		cd->types[cd->argc++] = *s;
+	}
+	return s[1] == '\0' ? NULL : "trailing characters";
+}
+
+/* Whether a and b describe the same function and signature. */
+static jboolean
+SameDescriptor(const CallDescriptor *a, const CallDescriptor *b)
+{
+	return a->function == b->function && a->returnType == b->returnType
+			&& a->argc == b->argc && memcmp(a->types, b->types, a->argc) == 0;
+}
+
+static jint JNICALL
+NativeFFI_prepare(JNIEnv *env, jclass cls, jlong function, jstring jsignature)
+{
+	CallDescriptor cd, *copy;
+	const char *signature, *error;
+	jint id = -1;
+#ifndef FFI_REGISTER_CALLS
+	ThrowNative(env, "java/lang/UnsupportedOperationException",
+			"NativeFFI: calls are implemented for x86-64 and AArch64 Linux only");
+	return -1;
+#endif
+	if (function == 0 || jsignature == NULL) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeFFI.prepare: no function or signature");
+		return -1;
+	}
+	signature = (*env)->GetStringUTFChars(env, jsignature, NULL);
+	if (signature == NULL)
+		return -1;
+	error = ParseSignature(signature, &cd);
+	if (error != NULL) {
+		char message[256];
+		JLI_Snprintf(message, sizeof(message), "NativeFFI.prepare: %s in \"%s\"", error, signature);
+		(*env)->ReleaseStringUTFChars(env, jsignature, signature);
+		ThrowNative(env, "java/lang/IllegalArgumentException", message);
+		return -1;
+	}
+	(*env)->ReleaseStringUTFChars(env, jsignature, signature);
+	cd.function = (void *) (size_t) function;
+	if (cd.buffer >= 0 && byteArrayClass == NULL) {
+		jclass local = (*env)->FindClass(env, "[B");
+		if (local == NULL)
+			return -1;
+		/* a race only leaks one global ref */
+		byteArrayClass = (*env)->NewGlobalRef(env, local);
+		(*env)->DeleteLocalRef(env, local);
+	}
+	pthread_mutex_lock(&descriptorLock);
+	/* reuse the descriptor if it was prepared before, e.g. for a callable created again */
+	for (id = 0; id < descriptorCount && !SameDescriptor(descriptors[id], &cd); ++id);
+	if (id == maxDescriptors) {
+		id = -1;
+	} else if (id == descriptorCount) {
+		copy = JLI_MemAlloc(sizeof(CallDescriptor));
+		*copy = cd;
+		descriptors[descriptorCount] = copy;
+		__atomic_store_n(&descriptorCount, descriptorCount+1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&descriptorLock);
+	if (id < 0)
+		ThrowNative(env, "java/lang/IllegalStateException", "NativeFFI.prepare: too many descriptors");
+	return id;
+}
+
+/* The descriptor id for a call with argc i, l and p arguments. */
+static const CallDescriptor *
+IntegralDescriptor(JNIEnv *env, jint id, int argc)
+{
+	const CallDescriptor *cd = Descriptor(env, id);
+	if (cd != NULL && (!cd->integral || cd->argc != argc)) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeFFI.call: arguments don't match the signature, use callBuffer or invoke");
+		return NULL;
+	}
+	return cd;
+}
+
+static jlong JNICALL
+NativeFFI_call0(JNIEnv *env, jclass cls, jint id)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 0);
+	return cd == NULL ? 0 : Invoke(cd, NULL, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call1(JNIEnv *env, jclass cls, jint id, jlong a)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 1);
+	jlong args[1];
+	args[0] = a;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call2(JNIEnv *env, jclass cls, jint id, jlong a, jlong b)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 2);
+	jlong args[2];
+	args[0] = a;
+	args[1] = b;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call3(JNIEnv *env, jclass cls, jint id, jlong a, jlong b, jlong c)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 3);
+	jlong args[3];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call4(JNIEnv *env, jclass cls, jint id, jlong a, jlong b, jlong c, jlong d)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 4);
+	jlong args[4];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call5(JNIEnv *env, jclass cls, jint id, jlong a, jlong b, jlong c, jlong d, jlong e)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 5);
+	jlong args[5];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+	args[4] = e;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+static jlong JNICALL
+NativeFFI_call6(JNIEnv *env, jclass cls, jint id, jlong a, jlong b, jlong c, jlong d, jlong e, jlong f)
+{
+	const CallDescriptor *cd = IntegralDescriptor(env, id, 6);
+	jlong args[6];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+	args[4] = e;
+	args[5] = f;
+	return cd == NULL ? 0 : Invoke(cd, args, NULL);
+}
+
+/*
+ * Calls with the buffer at its position in the signature and the argc
+ * longs in args around it.
+ */
+static jlong
+CallBuffer(JNIEnv *env, jint id, jobject buffer, const jlong *args, int argc)
+{
+	const CallDescriptor *cd = Descriptor(env, id);
+	jlong ints[maxIntArgs];
+	void *critical = NULL;
+	jlong address, result;
+	int k;
+	if (cd == NULL)
+		return 0;
+	if (cd->buffer < 0 || cd->floatCount > 0 || cd->argc != argc+1) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeFFI.callBuffer: arguments don't match the signature");
+		return 0;
+	}
+	address = buffer == NULL ? 0 : (jlong) (size_t) (*env)->GetDirectBufferAddress(env, buffer);
+	if (address == 0 && buffer != NULL && (*env)->IsInstanceOf(env, buffer, byteArrayClass)) {
+		critical = (*env)->GetPrimitiveArrayCritical(env, buffer, NULL);
+		if (critical == NULL)
+			return 0;
+		address = (jlong) (size_t) critical;
+	}
+	if (address == 0) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeFFI.callBuffer: not a byte[] or direct ByteBuffer");
+		return 0;
+	}
+	for (k = 0; k < cd->buffer; ++k)
+		ints[k] = args[k];
+	ints[cd->buffer] = address;
+	for (k = cd->buffer; k < argc; ++k)
+		ints[k+1] = args[k];
+	result = Invoke(cd, ints, NULL);
+	if (critical != NULL)
+		(*env)->ReleasePrimitiveArrayCritical(env, buffer, critical, 0);
+	return result;
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer0(JNIEnv *env, jclass cls, jint id, jobject buffer)
+{
+	return CallBuffer(env, id, buffer, NULL, 0);
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer1(JNIEnv *env, jclass cls, jint id, jobject buffer, jlong a)
+{
+	jlong args[1];
+	args[0] = a;
+	return CallBuffer(env, id, buffer, args, 1);
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer2(JNIEnv *env, jclass cls, jint id, jobject buffer, jlong a, jlong b)
+{
+	jlong args[2];
+	args[0] = a;
+	args[1] = b;
+	return CallBuffer(env, id, buffer, args, 2);
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer3(JNIEnv *env, jclass cls, jint id, jobject buffer, jlong a, jlong b, jlong c)
+{
+	jlong args[3];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	return CallBuffer(env, id, buffer, args, 3);
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer4(JNIEnv *env, jclass cls, jint id, jobject buffer, jlong a, jlong b, jlong c, jlong d)
+{
+	jlong args[4];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+	return CallBuffer(env, id, buffer, args, 4);
+}
+
+static jlong JNICALL
+NativeFFI_callBuffer5(JNIEnv *env, jclass cls, jint id, jobject buffer,
+		jlong a, jlong b, jlong c, jlong d, jlong e)
+{
+	jlong args[5];
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+	args[4] = e;
+	return CallBuffer(env, id, buffer, args, 5);
+}
+
+static jlong JNICALL
+NativeFFI_invoke(JNIEnv *env, jclass cls, jint id, jlongArray jints, jdoubleArray jdoubles)
+{
+	const CallDescriptor *cd = Descriptor(env, id);
+	jlong ints[maxIntArgs];
+	double floats[maxFloatArgs];
+	if (cd == NULL)
+		return 0;
+	if (cd->buffer >= 0
+			|| (jints == NULL ? 0 : (*env)->GetArrayLength(env, jints)) != cd->intCount
+			|| (jdoubles == NULL ? 0 : (*env)->GetArrayLength(env, jdoubles)) != cd->floatCount) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeFFI.invoke: arguments don't match the signature (b takes callBuffer)");
+		return 0;
+	}
+	if (cd->intCount > 0)
+		(*env)->GetLongArrayRegion(env, jints, 0, cd->intCount, ints);
+	if (cd->floatCount > 0)
+		(*env)->GetDoubleArrayRegion(env, jdoubles, 0, cd->floatCount, floats);
+	return Invoke(cd, ints, floats);
+}
+
+static jlong JNICALL
+NativeFFI_address(JNIEnv *env, jclass cls, jobject buffer)
+{
+	void *address = buffer == NULL ? NULL : (*env)->GetDirectBufferAddress(env, buffer);
+	if (address == NULL)
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeFFI.address: not a direct buffer");
+	return (jlong) (size_t) address;
+}
+
+static const JNINativeMethod nativeFFIMethods[] = {
+	{"open", "(Ljava/lang/String;)J", (void *) NativeFFI_open},
+	{"symbol", "(JLjava/lang/String;)J", (void *) NativeFFI_symbol},
+	{"prepare", "(JLjava/lang/String;)I", (void *) NativeFFI_prepare},
+	{"call", "(I)J", (void *) NativeFFI_call0},
+	{"call", "(IJ)J", (void *) NativeFFI_call1},
+	{"call", "(IJJ)J", (void *) NativeFFI_call2},
+	{"call", "(IJJJ)J", (void *) NativeFFI_call3},
+	{"call", "(IJJJJ)J", (void *) NativeFFI_call4},
+	{"call", "(IJJJJJ)J", (void *) NativeFFI_call5},
+	{"call", "(IJJJJJJ)J", (void *) NativeFFI_call6},
+	{"callBuffer", "(ILjava/lang/Object;)J", (void *) NativeFFI_callBuffer0},
+	{"callBuffer", "(ILjava/lang/Object;J)J", (void *) NativeFFI_callBuffer1},
+	{"callBuffer", "(ILjava/lang/Object;JJ)J", (void *) NativeFFI_callBuffer2},
+	{"callBuffer", "(ILjava/lang/Object;JJJ)J", (void *) NativeFFI_callBuffer3},
+	{"callBuffer", "(ILjava/lang/Object;JJJJ)J", (void *) NativeFFI_callBuffer4},
+	{"callBuffer", "(ILjava/lang/Object;JJJJJ)J", (void *) NativeFFI_callBuffer5},
+	{"invoke", "(I[J[D)J", (void *) NativeFFI_invoke},
+	{"address", "(Ljava/nio/ByteBuffer;)J", (void *) NativeFFI_address}
+};
+
+const NativeClass nativeFFIClass = {
+	"lijy/NativeFFI",
+	nativeFFIMethods, sizeof(nativeFFIMethods)/sizeof(nativeFFIMethods[0]),
+	NULL, 0
+};
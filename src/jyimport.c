@@ -0,0 +1,206 @@
+/*
+ * jyimport.c
+ *
+ * Import-time tracing (launcher option --importtime), the Jython
+ * equivalent of CPython's -X importtime.
+ *
+ * The launcher writes a small Python hook to the cache (see jycache.c)
+ * and prepends that directory to python.path. Its site.py shim is then
+ * imported by PySystemState's initialization in place of the real site
+ * module, i.e. before org.python.util.jython imports anything. The shim
+ * wraps __builtin__.__import__ and then runs the real site module, so
+ * that the imports of site are traced too. Note that this consequently
+ * does not work together with Jython's -S option.
+ */
+
+#include "jython.h"
+#include "jycache.h"
+
+#define importTimeDir "/importtime"
+#define pythonPathOpt "-Dpython.path="
+
+static const char* importTimeHook =
+	"# Generated by LiJy-launch for --importtime, do not edit.\n"
+	"# Prints a tree of module import times to stderr in the format of\n"
+	"# CPython's -X importtime, so existing visualizers can read it.\n"
+	"# At exit, lines starting with '#' list the modules that were compiled\n"
+	"# from source rather than loaded from a cached $py.class.\n"
+	"# A module is attributed to the __import__ call that loaded it. If one\n"
+	"# call loads several modules (e.g. a package and its submodule), its\n"
+	"# time goes to the requested (innermost) one.\n"
+	"import sys\n"
+	"import __builtin__\n"
+	"import imp\n"
+	"from java.lang import System\n"
+	"from java.io import File\n"
+	"\n"
+	"_import = __builtin__.__import__\n"
+	"_modules = sys.modules\n"
+	"_here = __file__.rpartition('/')[0]\n"
+	"_known = set()\n"
+	"_count = [0]\n"
+	"_stack = []\n"
+	"_source = []\n"
+	"_cached = []\n"
+	"\n"
+	"def _kind(mod, start):\n"
+	"    f = getattr(mod, '__file__', None)\n"
+	"    if not f:\n"
+	"        return None\n"
+	"    if f.endswith('$py.class'):\n"
+	"        base = f[:-9]\n"
+	"    elif f.endswith('.py'):\n"
+	"        base = f[:-3]\n"
+	"    else:\n"
+	"        return None\n"
+	"    source = File(base + '.py')\n"
+	"    compiled = File(base + '$py.class')\n"
+	"    if not source.exists():\n"
+	"        # e.g. inside a jar, which is out of scope here\n"
+	"        return _cached if compiled.exists() else None\n"
+	"    if compiled.exists() and compiled.lastModified() < start:\n"
+	"        return _cached\n"
+	"    return _source\n"
+	"\n"
+	"def _claim():\n"
+	"    # Modules appear in sys.modules as soon as their loading starts.\n"
+	"    # New ones belong to the innermost pending import.\n"
+	"    if len(_modules) == _count[0]:\n"
+	"        return []\n"
+	"    _count[0] = len(_modules)\n"
+	"    new = [k for k in _modules.keys() if k not in _known]\n"
+	"    _known.update(new)\n"
+	"    return [k for k in new if _modules[k] is not None]\n"
+	"\n"
+	"def _finish(start, elapsed, children, new):\n"
+	"    if not new:\n"
+	"        return\n"
+	"    new.sort(key=len)\n"
+	"    indent = '  ' * len(_stack)\n"
+	"    for k in new:\n"
+	"        if k is new[-1]:\n"
+	"            self_us, cum_us = (elapsed - children) // 1000, elapsed // 1000\n"
+	"        else:\n"
+	"            self_us, cum_us = 0, 0\n"
+	"        sys.stderr.write('import time: %9d | %10d | %s%s\\n'\n"
+	"                % (self_us, cum_us, indent, k))\n"
+	"        kind = _kind(_modules.get(k), start)\n"
+	"        if kind is not None:\n"
+	"            kind.append(k)\n"
+	"\n"
+	"def _timed(func, *args):\n"
+	"    if _stack:\n"
+	"        _stack[-1][1].extend(_claim())\n"
+	"    start = System.currentTimeMillis()\n"
+	"    t0 = System.nanoTime()\n"
+	"    _stack.append([0, []])\n"
+	"    try:\n"
+	"        return func(*args)\n"
+	"    finally:\n"
+	"        elapsed = System.nanoTime() - t0\n"
+	"        children, new = _stack.pop()\n"
+	"        if _stack:\n"
+	"            _stack[-1][0] += elapsed\n"
+	"        _finish(start, elapsed, children, new + _claim())\n"
+	"\n"
+	"def _timed_import(name, globals=None, locals=None, fromlist=None, level=-1):\n"
+	"    if not fromlist and name in _modules:\n"
+	"        return _import(name, globals, locals, fromlist, level)\n"
+	"    return _timed(_import, name, globals, locals, fromlist, level)\n"
+	"\n"
+	"def _summary():\n"
+	"    sys.stderr.write('# lijy importtime: %d modules compiled from source, '\n"
+	"            '%d loaded from cached $py.class\\n' % (len(_source), len(_cached)))\n"
+	"    for k in _source:\n"
+	"        sys.stderr.write('# compiled from source: %s\\n' % k)\n"
+	"\n"
+	"def _load_site():\n"
+	"    path = [p for p in sys.path if p != _here]\n"
+	"    f, p, d = imp.find_module('site', path)\n"
+	"    try:\n"
+	"        imp.load_module('site', f, p, d)\n"
+	"    finally:\n"
+	"        if f:\n"
+	"            f.close()\n"
+	"\n"
+	"def run_site():\n"
+	"    import atexit\n"
+	"    atexit.register(_summary)\n"
+	"    sys.stderr.write('import time: self [us] | cumulative | imported package\\n')\n"
+	"    # the real site module replaces this shim in sys.modules\n"
+	"    del _modules['site']\n"
+	"    _known.update(_modules.keys())\n"
+	"    _count[0] = len(_modules)\n"
+	"    __builtin__.__import__ = _timed_import\n"
+	"    _timed(_load_site)\n"
+	"    if _here in sys.path:\n"
+	"        sys.path.remove(_here)\n";
+
+static const char* importTimeSite =
+	"# Generated by LiJy-launch for --importtime, do not edit.\n"
+	"import lijy_importtime\n"
+	"lijy_importtime.run_site()\n";
+
+/*
+ * Writes content to dir/name unless the file already has this content.
+ * Rewriting it would force Jython to recompile it on every launch.
+ */
+static jboolean writeIfChanged(char* dir, char* name, const char* content) {
+	int len = strlen(content);
+	char path[strlen(dir)+strlen(name)+2];
+	sprintf(path, "%s/%s", dir, name);
+	FILE* fp = fopen(path, "r");
+	if (fp) {
+		char old[len+1];
+		int oldLen = fread(old, 1, len+1, fp);
+		fclose(fp);
+		if (oldLen == len && memcmp(old, content, len) == 0)
+			return JNI_TRUE;
+	}
+	fp = fopen(path, "w");
+	if (!fp)
+		return JNI_FALSE;
+	jboolean result = fwrite(content, 1, len, fp) == len;
+	return fclose(fp) == 0 && result;
+}
+
+/*
+ * Installs the hook and prepends its directory to python.path, i.e. to
+ * a -Dpython.path given by the user or else to JYTHONPATH.
+ */
+jboolean prepareImportTime(JySetup* setup) {
+	char dir[PATH_MAX];
+	int i;
+	if (!jyCacheDir(dir, sizeof(dir)-sizeof(importTimeDir), JNI_TRUE))
+		return JNI_FALSE;
+	strcat(dir, importTimeDir);
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+		return JNI_FALSE;
+	if (!writeIfChanged(dir, "lijy_importtime.py", importTimeHook)
+			|| !writeIfChanged(dir, "site.py", importTimeSite))
+		return JNI_FALSE;
+	for (i = 0; i < setup->propCount; ++i) {
+		if (strncmp(setup->properties[i], pythonPathOpt,
+				sizeof(pythonPathOpt)-1) == 0)
+			break;
+	}
+	char* old = i < setup->propCount ?
+			setup->properties[i]+sizeof(pythonPathOpt)-1 : getenv("JYTHONPATH");
+	char* opt = malloc(sizeof(pythonPathOpt)+strlen(dir)+(old ? strlen(old)+1 : 0));
+	strcpy(opt, pythonPathOpt);
+	strcat(opt, dir);
+	if (old && old[0]) {
+		char sep[2] = {PATH_SEPARATOR, 0};
+		strcat(opt, sep);
+		strcat(opt, old);
+	}
+	if (i < setup->propCount) {
+		free(setup->properties[i]);
+	} else {
+		setup->properties = realloc(setup->properties,
+				(setup->propCount+1)*sizeof(char*));
+		setup->propCount++;
+	}
+	setup->properties[i] = opt;
+	return JNI_TRUE;
+}
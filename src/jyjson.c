@@ -0,0 +1,1136 @@
+/*
+ * jyjson.c
+ *
+ * Natives of lijy.NativeJson (see jynative.c): json.loads and json.dumps
+ * for scripts. Jython's json module parses in Python, a few interpreter
+ * dispatches per input byte, and API clients spend most of their time
+ * there. lib/lijyjson.py makes the json module use these natives.
+ *
+ *   PyObject loads(String s, boolean bytes)
+ *     Parses a JSON document. bytes says that s holds a str, one char per
+ *     byte, to be decoded as UTF-8, rather than a unicode.
+ *
+ *   PyObject parse(ByteBuffer buffer, int start, int end)
+ *     Parses the UTF-8 document in [start, end) of a buffer, direct (e.g.
+ *     from NativeMap.map) or backed by an array.
+ *
+ *   PyObject dumps(PyObject obj)
+ *     Returns json.dumps(obj) with the default arguments as a str, or None
+ *     if obj holds anything but dict, list, tuple, str, unicode, int,
+ *     long, float, bool and None (exact types, string keys), so the caller
+ *     falls back to the json module.
+ *
+ * Parsing follows simdjson. A first pass scans the input 64 bytes at a
+ * time with SSE2 or, if the CPU has it, AVX2, and indexes the quotes
+ * that are not escaped and the structural characters outside strings;
+ * a cheap pass over the index counts the elements of each container.
+ * The second pass walks the index and builds the objects: the elements
+ * of a container go to a PyObject[] of the right size, from which the
+ * PyList or PyDictionary is constructed in one call, and keys that
+ * repeat (as in arrays of records) are created once. Results match
+ * json.loads: unicode strings, int or long, float, NaN and Infinity
+ * accepted, ValueError for malformed documents. Invalid UTF-8 becomes
+ * U+FFFD.
+ */
+
+#define _GNU_SOURCE /* uselocale */
+
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include "java.h"
+#include "jynative.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define JSON_X86
+#include <immintrin.h>
+#endif
+
+#define blockSize 64
+#define maxDepth 1000       /* like Python's recursion limit */
+#define keyCacheSize 256    /* a power of 2 */
+#define keyCacheLength 32   /* longer keys are not cached */
+
+/* Bits of the quotes, backslashes and {}[]:, in a block. */
+typedef struct {
+	unsigned long long quote, backslash, op;
+} JsonMasks;
+
+typedef void (*JsonScanBlock)(const unsigned char *p, JsonMasks *m);
+
+static JsonScanBlock jsonScanBlock = NULL;
+
+#ifndef JSON_X86
+static void
+JsonScanScalar(const unsigned char *p, JsonMasks *m)
+{
+	int i;
+	m->quote = m->backslash = m->op = 0;
+	for (i = 0; i < blockSize; ++i) {
+		unsigned char c = p[i] | 0x20;
+		if (p[i] == '"')
+			m->quote |= 1ULL << i;
+		else if (p[i] == '\\')
+			m->backslash |= 1ULL << i;
+		else if (c == '{' || c == '}' || p[i] == ':' || p[i] == ',')
+			m->op |= 1ULL << i;
+	}
+}
+#else
+/* '[' | 0x20 is '{' and ']' | 0x20 is '}', nothing else maps to them */
+static void
+JsonScanSSE2(const unsigned char *p, JsonMasks *m)
+{
+	__m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+	__m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+	__m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+	__m128i lower = _mm_set1_epi8(0x20);
+	int i;
+	m->quote = m->backslash = m->op = 0;
+	for (i = 0; i < blockSize; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p+i));
+		__m128i l = _mm_or_si128(v, lower);
+		__m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l, open), _mm_cmpeq_epi8(l, close)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+		m->quote |= (unsigned long long) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+		m->backslash |= (unsigned long long) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << i;
+		m->op |= (unsigned long long) (unsigned) _mm_movemask_epi8(op) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+JsonScanAVX2(const unsigned char *p, JsonMasks *m)
+{
+	__m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+	__m256i open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}');
+	__m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+	__m256i lower = _mm256_set1_epi8(0x20);
+	int i;
+	m->quote = m->backslash = m->op = 0;
+	for (i = 0; i < blockSize; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p+i));
+		__m256i l = _mm256_or_si256(v, lower);
+		__m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(l, open), _mm256_cmpeq_epi8(l, close)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+		m->quote |= (unsigned long long) (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i;
+		m->backslash |= (unsigned long long) (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << i;
+		m->op |= (unsigned long long) (unsigned) _mm256_movemask_epi8(op) << i;
+	}
+}
+#endif
+
+static void
+ChooseJsonScanner()
+{
+#ifdef JSON_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		jsonScanBlock = JsonScanAVX2;
+		JLI_TraceLauncher("json: AVX2\n");
+	} else {
+		jsonScanBlock = JsonScanSSE2;
+		JLI_TraceLauncher("json: SSE2\n");
+	}
+#else
+	jsonScanBlock = JsonScanScalar;
+#endif
+}
+
+/*
+ * Returns the bits of the characters escaped by an odd run of
+ * backslashes; *carry tells whether the previous block ended in one.
+ */
+static unsigned long long
+Escaped(unsigned long long backslash, unsigned long long *carry)
+{
+	const unsigned long long even = 0x5555555555555555ULL, odd = ~even;
+	unsigned long long starts = backslash & ~(backslash << 1);
+	unsigned long long evenStartMask = even ^ *carry;
+	unsigned long long evenCarries = backslash + (starts & evenStartMask);
+	unsigned long long oddCarries;
+	int overflow = __builtin_uaddll_overflow(backslash, starts & ~evenStartMask, &oddCarries);
+	oddCarries |= *carry;
+	*carry = overflow ? 1 : 0;
+	return (evenCarries & ~backslash & odd) | (oddCarries & ~backslash & even);
+}
+
+/* Bit i is the parity of the bits 0..i of x. */
+static unsigned long long
+PrefixXor(unsigned long long x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/*
+ * Indexes the quotes that are not escaped and the {}[]:, outside strings
+ * of s[0..length). Returns the positions, to be freed by the caller.
+ */
+static jint *
+StructuralIndex(const unsigned char *s, jint length, jint *count)
+{
+	jint cap = length/8 + blockSize, n = 0, pos;
+	jint *index = JLI_MemAlloc(cap*sizeof(jint));
+	unsigned long long escapeCarry = 0, inString = 0;
+	for (pos = 0; pos < length; pos += blockSize) {
+		JsonMasks m;
+		unsigned long long quotes, bits;
+		if (length-pos >= blockSize) {
+			jsonScanBlock(s+pos, &m);
+		} else {
+			unsigned char block[blockSize];
+			memcpy(block, s+pos, length-pos);
+			memset(block+length-pos, ' ', blockSize-(length-pos));
+			jsonScanBlock(block, &m);
+		}
+		quotes = m.quote & ~Escaped(m.backslash, &escapeCarry);
+		/* from an opening quote up to but excluding the closing one */
+		inString = PrefixXor(quotes) ^ inString;
+		bits = (m.op & ~inString) | quotes;
+		inString = 0ULL - (inString >> 63);
+		if (n + blockSize > cap) {
+			cap *= 2;
+			index = JLI_MemRealloc(index, cap*sizeof(jint));
+		}
+		for (; bits; bits &= bits-1)
+			index[n++] = pos + __builtin_ctzll(bits);
+	}
+	*count = n;
+	return index;
+}
+
+/* The Jython classes and members the parser and serializer use. */
+static struct {
+	jboolean ready;
+	jclass py, pyObject, pyString, pyUnicode, pyInteger, pyLong, pyFloat, pyBoolean,
+			pyNone, pyList, pyTuple, pyDictionary, bigInteger;
+	jmethodID newInteger, newString, valueError;    /* static in Py */
+	jmethodID unicodeInit, longInit, floatInit, listInit, dictionaryInit, bigIntegerInit;
+	jmethodID getString, intValue, longValue, floatValue, listArray, tupleArray, items, bigToString;
+	jobject none, pyTrue, pyFalse;
+	locale_t cLocale;
+} jy;
+
+static jclass
+GlobalClass(JNIEnv *env, const char *name)
+{
+	jclass local = (*env)->FindClass(env, name);
+	jclass global = local == NULL ? NULL : (*env)->NewGlobalRef(env, local);
+	if (local != NULL)
+		(*env)->DeleteLocalRef(env, local);
+	return global;
+}
+
+static jobject
+GlobalStatic(JNIEnv *env, jclass cls, const char *name, const char *sig)
+{
+	jfieldID field = (*env)->GetStaticFieldID(env, cls, name, sig);
+	jobject local = field == NULL ? NULL : (*env)->GetStaticObjectField(env, cls, field);
+	jobject global = local == NULL ? NULL : (*env)->NewGlobalRef(env, local);
+	if (local != NULL)
+		(*env)->DeleteLocalRef(env, local);
+	return global;
+}
+
+/*
+ * Looks up the Jython members at the first call; they come from the
+ * loader of lijy.NativeJson, i.e. the class path Jython runs from.
+ * Returns JNI_FALSE if Jython is not there.
+ */
+static jboolean
+InitJython(JNIEnv *env)
+{
+	if (jy.ready)
+		return JNI_TRUE;
+	if (jsonScanBlock == NULL)
+		ChooseJsonScanner();
+	if ((jy.py = GlobalClass(env, "org/python/core/Py")) == NULL
+			|| (jy.pyObject = GlobalClass(env, "org/python/core/PyObject")) == NULL
+			|| (jy.pyString = GlobalClass(env, "org/python/core/PyString")) == NULL
+			|| (jy.pyUnicode = GlobalClass(env, "org/python/core/PyUnicode")) == NULL
+			|| (jy.pyInteger = GlobalClass(env, "org/python/core/PyInteger")) == NULL
+			|| (jy.pyLong = GlobalClass(env, "org/python/core/PyLong")) == NULL
+			|| (jy.pyFloat = GlobalClass(env, "org/python/core/PyFloat")) == NULL
+			|| (jy.pyBoolean = GlobalClass(env, "org/python/core/PyBoolean")) == NULL
+			|| (jy.pyNone = GlobalClass(env, "org/python/core/PyNone")) == NULL
+			|| (jy.pyList = GlobalClass(env, "org/python/core/PyList")) == NULL
+			|| (jy.pyTuple = GlobalClass(env, "org/python/core/PyTuple")) == NULL
+			|| (jy.pyDictionary = GlobalClass(env, "org/python/core/PyDictionary")) == NULL
+			|| (jy.bigInteger = GlobalClass(env, "java/math/BigInteger")) == NULL)
+		goto fail;
+	jy.newInteger = (*env)->GetStaticMethodID(env, jy.py, "newInteger", "(J)Lorg/python/core/PyObject;");
+	jy.newString = (*env)->GetStaticMethodID(env, jy.py, "newString",
+			"(Ljava/lang/String;)Lorg/python/core/PyString;");
+	jy.valueError = (*env)->GetStaticMethodID(env, jy.py, "ValueError",
+			"(Ljava/lang/String;)Lorg/python/core/PyException;");
+	jy.unicodeInit = (*env)->GetMethodID(env, jy.pyUnicode, "<init>", "(Ljava/lang/String;)V");
+	jy.longInit = (*env)->GetMethodID(env, jy.pyLong, "<init>", "(Ljava/math/BigInteger;)V");
+	jy.floatInit = (*env)->GetMethodID(env, jy.pyFloat, "<init>", "(D)V");
+	jy.listInit = (*env)->GetMethodID(env, jy.pyList, "<init>", "([Lorg/python/core/PyObject;)V");
+	jy.dictionaryInit = (*env)->GetMethodID(env, jy.pyDictionary, "<init>", "([Lorg/python/core/PyObject;)V");
+	jy.bigIntegerInit = (*env)->GetMethodID(env, jy.bigInteger, "<init>", "(Ljava/lang/String;)V");
+	jy.getString = (*env)->GetMethodID(env, jy.pyString, "getString", "()Ljava/lang/String;");
+	jy.intValue = (*env)->GetMethodID(env, jy.pyInteger, "getValue", "()I");
+	jy.longValue = (*env)->GetMethodID(env, jy.pyLong, "getValue", "()Ljava/math/BigInteger;");
+	jy.floatValue = (*env)->GetMethodID(env, jy.pyFloat, "getValue", "()D");
+	jy.listArray = (*env)->GetMethodID(env, jy.pyList, "getArray", "()[Lorg/python/core/PyObject;");
+	jy.tupleArray = (*env)->GetMethodID(env, jy.pyTuple, "getArray", "()[Lorg/python/core/PyObject;");
+	jy.items = (*env)->GetMethodID(env, jy.pyDictionary, "items", "()Lorg/python/core/PyList;");
+	jy.bigToString = (*env)->GetMethodID(env, jy.bigInteger, "toString", "()Ljava/lang/String;");
+	jy.none = GlobalStatic(env, jy.py, "None", "Lorg/python/core/PyObject;");
+	jy.pyTrue = GlobalStatic(env, jy.py, "True", "Lorg/python/core/PyBoolean;");
+	jy.pyFalse = GlobalStatic(env, jy.py, "False", "Lorg/python/core/PyBoolean;");
+	if (jy.newInteger == NULL || jy.newString == NULL || jy.valueError == NULL
+			|| jy.unicodeInit == NULL || jy.longInit == NULL || jy.floatInit == NULL
+			|| jy.listInit == NULL || jy.dictionaryInit == NULL || jy.bigIntegerInit == NULL
+			|| jy.getString == NULL || jy.intValue == NULL || jy.longValue == NULL
+			|| jy.floatValue == NULL || jy.listArray == NULL || jy.tupleArray == NULL
+			|| jy.items == NULL || jy.bigToString == NULL
+			|| jy.none == NULL || jy.pyTrue == NULL || jy.pyFalse == NULL)
+		goto fail;
+	/* numbers are read and written with '.', whatever LC_NUMERIC says */
+	jy.cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+	if (jy.cLocale == (locale_t) 0)
+		goto fail;
+	jy.ready = JNI_TRUE;
+	return JNI_TRUE;
+fail:
+	/* the global refs taken so far stay, the next call looks up again */
+	(*env)->ExceptionClear(env);
+	JLI_TraceLauncher("json: Jython classes not found\n");
+	ThrowNative(env, "java/lang/IllegalStateException", "NativeJson: Jython classes not found");
+	return JNI_FALSE;
+}
+
+/* Raises a Python ValueError. */
+static void
+ThrowValueError(JNIEnv *env, const char *message)
+{
+	jstring s = (*env)->NewStringUTF(env, message);
+	jobject e = s == NULL ? NULL : (*env)->CallStaticObjectMethod(env, jy.py, jy.valueError, s);
+	if (e != NULL)
+		(*env)->Throw(env, e);
+	else if (!(*env)->ExceptionCheck(env))
+		ThrowNative(env, "java/lang/IllegalArgumentException", message);
+}
+
+typedef struct {
+	jint length;
+	unsigned char bytes[keyCacheLength];
+	jobject key;                    /* global ref of the PyUnicode */
+} CachedKey;
+
+typedef struct {
+	JNIEnv *env;
+	const unsigned char *s;
+	jint length;
+	jint *index;                    /* see StructuralIndex */
+	jint *counts;                   /* elements of the container opened at index[k] */
+	jint tokens;
+	jint next;                      /* next entry of index */
+	jint pos;                       /* the byte after the last value */
+	jchar *chars;                   /* a decoded string */
+	const char *error;
+	jint errorPos;
+	CachedKey keys[keyCacheSize];
+} JsonParser;
+
+static jobject
+Fail(JsonParser *p, const char *error, jint pos)
+{
+	if (p->error == NULL) {
+		p->error = error;
+		p->errorPos = pos;
+	}
+	return NULL;
+}
+
+static jint
+SkipSpace(JsonParser *p, jint pos)
+{
+	while (pos < p->length && (p->s[pos] == ' ' || p->s[pos] == '\n'
+			|| p->s[pos] == '\r' || p->s[pos] == '\t'))
+		++pos;
+	return pos;
+}
+
+/* Whether index[next] is the character c at pos. */
+static jboolean
+TokenAt(JsonParser *p, jint pos, unsigned char c)
+{
+	return p->next < p->tokens && p->index[p->next] == pos && p->s[pos] == c;
+}
+
+/*
+ * Counts the elements of each container: a comma at its depth adds one,
+ * and so does the closing bracket unless the container is empty. The
+ * parser checks the structure; malformed input gives wrong counts only.
+ */
+static jboolean
+CountElements(JsonParser *p)
+{
+	jint open[maxDepth];
+	jint depth = 0, k;
+	for (k = 0; k < p->tokens; ++k) {
+		jint pos = p->index[k];
+		switch (p->s[pos]) {
+		case '{':
+		case '[':
+			if (depth == maxDepth) {
+				Fail(p, "Nested too deeply", pos);
+				return JNI_FALSE;
+			}
+			open[depth++] = k;
+			p->counts[k] = 0;
+			break;
+		case '}':
+		case ']':
+			if (depth > 0) {
+				jint o = open[--depth];
+				if (k-1 != o || SkipSpace(p, p->index[o]+1) != pos)
+					++p->counts[o];
+			}
+			break;
+		case ',':
+			if (depth > 0)
+				++p->counts[open[depth-1]];
+			break;
+		}
+	}
+	return JNI_TRUE;
+}
+
+static jobject ParseValue(JsonParser *p, jint from, int depth);
+
+static jint
+HexDigit(unsigned char c)
+{
+	return c >= '0' && c <= '9' ? c-'0' : (c|0x20) >= 'a' && (c|0x20) <= 'f' ? (c|0x20)-'a'+10 : -1;
+}
+
+/* Decodes the string whose opening quote is index[next] to p->chars. */
+static jint
+DecodeString(JsonParser *p, jint *units)
+{
+	const unsigned char *s = p->s;
+	jint quote = p->index[p->next], i, end, n = 0;
+	if (p->next+1 >= p->tokens || s[p->index[p->next+1]] != '"') {
+		Fail(p, "Unterminated string starting at", quote);
+		return -1;
+	}
+	end = p->index[p->next+1];
+	p->next += 2;
+	p->pos = end+1;
+	for (i = quote+1; i < end; ) {
+		jint run = i, d, k;
+		unsigned int u = 0;
+		while (i < end && s[i] != '\\' && s[i] >= 0x20)
+			++i;
+		n += DecodeUtf8((const char *) s+run, i-run, p->chars+n);
+		if (i == end)
+			break;
+		if (s[i] < 0x20) {
+			Fail(p, "Invalid control character at", i);
+			return -1;
+		}
+		switch (s[i+1]) {
+		case '"': case '\\': case '/':
+			p->chars[n++] = s[i+1];
+			break;
+		case 'b': p->chars[n++] = '\b'; break;
+		case 'f': p->chars[n++] = '\f'; break;
+		case 'n': p->chars[n++] = '\n'; break;
+		case 'r': p->chars[n++] = '\r'; break;
+		case 't': p->chars[n++] = '\t'; break;
+		case 'u':
+			for (k = 2; k < 6; ++k) {
+				if (i+k >= end || (d = HexDigit(s[i+k])) < 0) {
+					Fail(p, "Invalid \\uXXXX escape", i);
+					return -1;
+				}
+				u = (u << 4) | d;
+			}
+			/* surrogate pairs stay two units, as in Java strings */
+			p->chars[n++] = (jchar) u;
+			i += 4;
+			break;
+		default:
+			Fail(p, "Invalid \\escape", i);
+			return -1;
+		}
+		i += 2;
+	}
+	*units = n;
+	return quote;
+}
+
+/* Returns a new PyUnicode of the string at index[next]. */
+static jobject
+ParseString(JsonParser *p)
+{
+	JNIEnv *env = p->env;
+	jint n;
+	jstring s;
+	jobject result;
+	if (DecodeString(p, &n) < 0 || (s = (*env)->NewString(env, p->chars, n)) == NULL)
+		return NULL;
+	result = (*env)->NewObject(env, jy.pyUnicode, jy.unicodeInit, s);
+	(*env)->DeleteLocalRef(env, s);
+	return result;
+}
+
+/* Like ParseString, for keys: short ones are created once per document. */
+static jobject
+ParseKey(JsonParser *p)
+{
+	JNIEnv *env = p->env;
+	jint start = p->index[p->next]+1, length, i;
+	unsigned int hash = 2166136261u;
+	CachedKey *cached;
+	jobject key;
+	if (p->next+1 >= p->tokens || (length = p->index[p->next+1]-start) > keyCacheLength)
+		return ParseString(p);
+	for (i = 0; i < length; ++i)
+		hash = (hash ^ p->s[start+i]) * 16777619u;
+	cached = &p->keys[hash & (keyCacheSize-1)];
+	if (cached->key != NULL && cached->length == length
+			&& memcmp(cached->bytes, p->s+start, length) == 0) {
+		p->next += 2;
+		p->pos = start+length+1;
+		return (*env)->NewLocalRef(env, cached->key);
+	}
+	key = ParseString(p);
+	if (key != NULL) {
+		if (cached->key != NULL)
+			(*env)->DeleteGlobalRef(env, cached->key);
+		cached->key = (*env)->NewGlobalRef(env, key);
+		cached->length = length;
+		memcpy(cached->bytes, p->s+start, length);
+	}
+	return key;
+}
+
+static jboolean
+Literal(JsonParser *p, jint pos, const char *word)
+{
+	jint n = (jint) JLI_StrLen(word);
+	if (p->length-pos < n || memcmp(p->s+pos, word, n) != 0)
+		return JNI_FALSE;
+	p->pos = pos+n;
+	return JNI_TRUE;
+}
+
+/* Returns a new float for a number or NaN, Infinity, -Infinity at pos. */
+static jobject
+NewFloat(JsonParser *p, jint pos, jint end)
+{
+	JNIEnv *env = p->env;
+	char small[64], *text = end-pos < (jint) sizeof(small) ? small : JLI_MemAlloc(end-pos+1);
+	double value;
+	memcpy(text, p->s+pos, end-pos);
+	text[end-pos] = '\0';
+	value = strtod(text, NULL);
+	if (text != small)
+		JLI_MemFree(text);
+	p->pos = end;
+	return (*env)->NewObject(env, jy.pyFloat, jy.floatInit, value);
+}
+
+/* Returns a new int or long for the digits at pos. */
+static jobject
+NewInteger(JsonParser *p, jint pos, jint end)
+{
+	JNIEnv *env = p->env;
+	jboolean negative = p->s[pos] == '-';
+	jint i = negative ? pos+1 : pos;
+	p->pos = end;
+	if (end-i <= 18) {
+		jlong value = 0;
+		for (; i < end; ++i)
+			value = value*10 + (p->s[i]-'0');
+		return (*env)->CallStaticObjectMethod(env, jy.py, jy.newInteger, negative ? -value : value);
+	} else {
+		char *text = JLI_MemAlloc(end-pos+1);
+		jstring digits;
+		jobject big = NULL, result = NULL;
+		memcpy(text, p->s+pos, end-pos);
+		text[end-pos] = '\0';
+		digits = (*env)->NewStringUTF(env, text);
+		JLI_MemFree(text);
+		if (digits != NULL)
+			big = (*env)->NewObject(env, jy.bigInteger, jy.bigIntegerInit, digits);
+		if (big != NULL)
+			result = (*env)->NewObject(env, jy.pyLong, jy.longInit, big);
+		if (digits != NULL)
+			(*env)->DeleteLocalRef(env, digits);
+		if (big != NULL)
+			(*env)->DeleteLocalRef(env, big);
+		return result;
+	}
+}
+
+/* Parses the number, true, false, null, NaN or (-)Infinity at pos. */
+static jobject
+ParseScalar(JsonParser *p, jint pos)
+{
+	JNIEnv *env = p->env;
+	const unsigned char *s = p->s;
+	jint i = pos, end = p->length;
+	jboolean integer = JNI_TRUE;
+	switch (s[pos]) {
+	case 't':
+		if (Literal(p, pos, "true"))
+			return (*env)->NewLocalRef(env, jy.pyTrue);
+		break;
+	case 'f':
+		if (Literal(p, pos, "false"))
+			return (*env)->NewLocalRef(env, jy.pyFalse);
+		break;
+	case 'n':
+		if (Literal(p, pos, "null"))
+			return (*env)->NewLocalRef(env, jy.none);
+		break;
+	case 'N':
+		if (Literal(p, pos, "NaN"))
+			return NewFloat(p, pos, pos+3);
+		break;
+	case 'I':
+		if (Literal(p, pos, "Infinity"))
+			return NewFloat(p, pos, pos+8);
+		break;
+	case '-':
+		if (Literal(p, pos+1, "Infinity"))
+			return NewFloat(p, pos, pos+9);
+		/* fall through */
+	default:
+		/* -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? */
+		if (i < end && s[i] == '-')
+			++i;
+		if (i < end && s[i] == '0')
+			++i;
+		else if (i < end && s[i] >= '1' && s[i] <= '9')
+			while (i < end && s[i] >= '0' && s[i] <= '9')
+				++i;
+		else
+			break;
+		if (i+1 < end && s[i] == '.' && s[i+1] >= '0' && s[i+1] <= '9') {
+			integer = JNI_FALSE;
+			for (i += 2; i < end && s[i] >= '0' && s[i] <= '9'; ++i);
+		}
+		if (i < end && (s[i] | 0x20) == 'e') {
+			jint e = i+1;
+			if (e < end && (s[e] == '+' || s[e] == '-'))
+				++e;
+			if (e < end && s[e] >= '0' && s[e] <= '9') {
+				integer = JNI_FALSE;
+				for (i = e; i < end && s[i] >= '0' && s[i] <= '9'; ++i);
+			}
+		}
+		return integer ? NewInteger(p, pos, i) : NewFloat(p, pos, i);
+	}
+	return Fail(p, "Expecting value", pos);
+}
+
+/*
+ * Parses an array or object opened at index[next]. Objects fill their
+ * PyObject[] with keys and values alternately, as PyDictionary expects.
+ */
+static jobject
+ParseContainer(JsonParser *p, jboolean object, int depth)
+{
+	JNIEnv *env = p->env;
+	jint opener = p->index[p->next], count = p->counts[p->next], i, pos;
+	unsigned char close = object ? '}' : ']';
+	jobjectArray elements;
+	jobject result = NULL;
+	++p->next;
+	elements = (*env)->NewObjectArray(env, object ? 2*count : count, jy.pyObject, NULL);
+	if (elements == NULL)
+		return NULL;
+	pos = SkipSpace(p, opener+1);
+	if (count == 0) {
+		if (!TokenAt(p, pos, close)) {
+			Fail(p, object ? "Expecting property name enclosed in double quotes" : "Expecting value", pos);
+			goto done;
+		}
+		++p->next;
+		p->pos = pos+1;
+	}
+	for (i = 0; i < count; ++i) {
+		jobject value;
+		if (object) {
+			jobject key;
+			if (!TokenAt(p, pos, '"')) {
+				Fail(p, "Expecting property name enclosed in double quotes", pos);
+				goto done;
+			}
+			if ((key = ParseKey(p)) == NULL)
+				goto done;
+			(*env)->SetObjectArrayElement(env, elements, 2*i, key);
+			(*env)->DeleteLocalRef(env, key);
+			pos = SkipSpace(p, p->pos);
+			if (!TokenAt(p, pos, ':')) {
+				Fail(p, "Expecting : delimiter", pos);
+				goto done;
+			}
+			++p->next;
+			++pos;
+		}
+		if ((value = ParseValue(p, pos, depth+1)) == NULL)
+			goto done;
+		(*env)->SetObjectArrayElement(env, elements, object ? 2*i+1 : i, value);
+		(*env)->DeleteLocalRef(env, value);
+		pos = SkipSpace(p, p->pos);
+		if (!TokenAt(p, pos, i+1 < count ? ',' : close)) {
+			Fail(p, "Expecting , delimiter", pos);
+			goto done;
+		}
+		++p->next;
+		p->pos = ++pos;
+		if (object)
+			pos = SkipSpace(p, pos);
+	}
+	result = (*env)->NewObject(env, object ? jy.pyDictionary : jy.pyList,
+			object ? jy.dictionaryInit : jy.listInit, elements);
+done:
+	(*env)->DeleteLocalRef(env, elements);
+	return result;
+}
+
+/* Parses the value after the whitespace at from, sets p->pos after it. */
+static jobject
+ParseValue(JsonParser *p, jint from, int depth)
+{
+	jint pos = SkipSpace(p, from);
+	if (pos >= p->length)
+		return Fail(p, "Expecting value", pos);
+	if (p->next < p->tokens && p->index[p->next] == pos) {
+		switch (p->s[pos]) {
+		case '"':
+			return ParseString(p);
+		case '{':
+			return ParseContainer(p, JNI_TRUE, depth);
+		case '[':
+			return ParseContainer(p, JNI_FALSE, depth);
+		default:
+			return Fail(p, "Expecting value", pos);
+		}
+	}
+	return ParseScalar(p, pos);
+}
+
+/* Parses the document s[0..length), raises ValueError if malformed. */
+static jobject
+Parse(JNIEnv *env, const unsigned char *s, jint length)
+{
+	JsonParser *p = JLI_MemAlloc(sizeof(JsonParser));
+	jobject result = NULL;
+	locale_t locale;
+	int i;
+	memset(p, 0, sizeof(JsonParser));
+	p->env = env;
+	p->s = s;
+	p->length = length;
+	p->index = StructuralIndex(s, length, &p->tokens);
+	p->counts = JLI_MemAlloc((p->tokens+1)*sizeof(jint));
+	p->chars = JLI_MemAlloc((length+1)*sizeof(jchar));
+	locale = uselocale(jy.cLocale);
+	if (CountElements(p)) {
+		result = ParseValue(p, 0, 0);
+		if (result != NULL && SkipSpace(p, p->pos) != length) {
+			(*env)->DeleteLocalRef(env, result);
+			result = Fail(p, "Extra data", SkipSpace(p, p->pos));
+		}
+	}
+	uselocale(locale);
+	if (p->error != NULL && !(*env)->ExceptionCheck(env)) {
+		/* the format of json.decoder.errmsg, with byte offsets */
+		char message[160];
+		jint line = 1, column = 1, k;
+		for (k = 0; k < p->errorPos && k < length; ++k) {
+			column = s[k] == '\n' ? 1 : column+1;
+			line += s[k] == '\n';
+		}
+		JLI_Snprintf(message, sizeof(message), "%s: line %d column %d (char %d)",
+				p->error, (int) line, (int) column, (int) p->errorPos);
+		ThrowValueError(env, message);
+	}
+	for (i = 0; i < keyCacheSize; ++i)
+		if (p->keys[i].key != NULL)
+			(*env)->DeleteGlobalRef(env, p->keys[i].key);
+	JLI_MemFree(p->chars);
+	JLI_MemFree(p->counts);
+	JLI_MemFree(p->index);
+	JLI_MemFree(p);
+	return result;
+}
+
+static jobject JNICALL
+NativeJson_loads(JNIEnv *env, jclass cls, jstring text, jboolean bytes)
+{
+	jsize length, i;
+	jchar *chars;
+	unsigned char *s;
+	size_t n;
+	jobject result;
+	if (text == NULL) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeJson.loads: no document");
+		return NULL;
+	}
+	if (!InitJython(env))
+		return NULL;
+	length = (*env)->GetStringLength(env, text);
+	chars = JLI_MemAlloc((length+1)*sizeof(jchar));
+	s = JLI_MemAlloc(bytes ? length+1 : 3*(size_t) length+1);
+	(*env)->GetStringRegion(env, text, 0, length, chars);
+	if (bytes) {
+		for (i = 0; i < length; ++i)
+			s[i] = (unsigned char) chars[i];
+		n = length;
+	} else {
+		n = EncodeUtf8(chars, length, (char *) s);
+	}
+	JLI_MemFree(chars);
+	if (n > INT_MAX) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeJson.loads: document too large");
+		result = NULL;
+	} else {
+		result = Parse(env, s, (jint) n);
+	}
+	JLI_MemFree(s);
+	return result;
+}
+
+static jobject JNICALL
+NativeJson_parse(JNIEnv *env, jclass cls, jobject buffer, jint start, jint end)
+{
+	const unsigned char *address = NULL;
+	unsigned char *copy = NULL;
+	jlong capacity = -1;
+	jobject result;
+	if (!InitJython(env))
+		return NULL;
+	if (buffer != NULL) {
+		address = (*env)->GetDirectBufferAddress(env, buffer);
+		capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+	}
+	if (address == NULL && buffer != NULL && start >= 0 && start <= end) {
+		/* a heap buffer: copied, the parser calls into Java */
+		jclass bufferClass = (*env)->FindClass(env, "java/nio/ByteBuffer");
+		jmethodID getArray = (*env)->GetMethodID(env, bufferClass, "array", "()[B");
+		jmethodID getOffset = (*env)->GetMethodID(env, bufferClass, "arrayOffset", "()I");
+		jbyteArray array;
+		jint offset;
+		(*env)->DeleteLocalRef(env, bufferClass);
+		array = (*env)->CallObjectMethod(env, buffer, getArray);
+		/* array() throws for a read-only heap buffer */
+		if (!(*env)->ExceptionCheck(env) && array != NULL)
+			offset = (*env)->CallIntMethod(env, buffer, getOffset);
+		if ((*env)->ExceptionCheck(env) || array == NULL) {
+			(*env)->ExceptionClear(env);
+			if (array != NULL)
+				(*env)->DeleteLocalRef(env, array);
+		} else {
+			capacity = (*env)->GetArrayLength(env, array) - offset;
+			if (end <= capacity) {
+				copy = JLI_MemAlloc(end-start+1);
+				(*env)->GetByteArrayRegion(env, array, offset+start, end-start, (jbyte *) copy);
+				address = copy - start;
+			}
+			(*env)->DeleteLocalRef(env, array);
+		}
+	}
+	if (address == NULL || start < 0 || start > end || end > capacity) {
+		JLI_MemFree(copy);
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeJson.parse: no byte buffer with an accessible array, or bad range");
+		return NULL;
+	}
+	result = Parse(env, address+start, end-start);
+	JLI_MemFree(copy);
+	return result;
+}
+
+typedef struct {
+	JNIEnv *env;
+	char *data;
+	size_t length, size;
+} JsonOutput;
+
+static char *
+Reserve(JsonOutput *o, size_t n)
+{
+	if (o->length+n > o->size) {
+		while (o->length+n > o->size)
+			o->size *= 2;
+		o->data = JLI_MemRealloc(o->data, o->size);
+	}
+	return o->data + o->length;
+}
+
+static void
+Put(JsonOutput *o, const char *s, size_t n)
+{
+	memcpy(Reserve(o, n), s, n);
+	o->length += n;
+}
+
+/* Writes like json.encoder.encode_basestring_ascii. */
+static jboolean
+DumpString(JsonOutput *o, jstring text, jboolean bytes)
+{
+	static const char hex[] = "0123456789abcdef";
+	JNIEnv *env = o->env;
+	jchar buf[1024];
+	jsize length = (*env)->GetStringLength(env, text), start, n, i;
+	Put(o, "\"", 1);
+	for (start = 0; start < length; start += n) {
+		char *out;
+		n = length-start < 1024 ? length-start : 1024;
+		(*env)->GetStringRegion(env, text, start, n, buf);
+		out = Reserve(o, 6*(size_t) n);
+		for (i = 0; i < n; ++i) {
+			jchar c = buf[i];
+			if (c >= ' ' && c <= '~' && c != '"' && c != '\\') {
+				*out++ = (char) c;
+				continue;
+			}
+			if (c >= 0x80 && bytes)
+				return JNI_FALSE;  /* a str to be decoded first */
+			*out++ = '\\';
+			switch (c) {
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '\n': *out++ = 'n'; break;
+			case '\r': *out++ = 'r'; break;
+			case '\t': *out++ = 't'; break;
+			case '\b': *out++ = 'b'; break;
+			case '\f': *out++ = 'f'; break;
+			default:
+				*out++ = 'u';
+				*out++ = hex[c >> 12];
+				*out++ = hex[(c >> 8) & 15];
+				*out++ = hex[(c >> 4) & 15];
+				*out++ = hex[c & 15];
+			}
+		}
+		o->length = out - o->data;
+	}
+	Put(o, "\"", 1);
+	return JNI_TRUE;
+}
+
+/* Formats like float.__repr__: the shortest digits that read back as d. */
+static void
+FormatFloat(double d, char *out)
+{
+	char digits[32], *e;
+	int precision, exponent, n, i;
+	if (isnan(d)) {
+		strcpy(out, "NaN");
+		return;
+	}
+	if (isinf(d)) {
+		strcpy(out, d > 0 ? "Infinity" : "-Infinity");
+		return;
+	}
+	for (precision = 1; precision < 17; ++precision) {
+		JLI_Snprintf(digits, sizeof(digits), "%.*e", precision-1, d);
+		if (strtod(digits, NULL) == d)
+			break;
+	}
+	JLI_Snprintf(digits, sizeof(digits), "%.*e", precision-1, d);
+	e = strchr(digits, 'e');
+	exponent = atoi(e+1);
+	*e = '\0';
+	if (digits[0] == '-')
+		*out++ = '-';
+	/* the significant digits, without sign and point */
+	for (n = 0, i = digits[0] == '-'; digits[i] != '\0'; ++i)
+		if (digits[i] != '.')
+			digits[n++] = digits[i];
+	digits[n] = '\0';
+	if (exponent < -4 || exponent >= 16) {
+		*out++ = digits[0];
+		if (n > 1) {
+			*out++ = '.';
+			memcpy(out, digits+1, n-1);
+			out += n-1;
+		}
+		sprintf(out, "e%c%02d", exponent < 0 ? '-' : '+', exponent < 0 ? -exponent : exponent);
+	} else if (exponent < 0) {
+		*out++ = '0';
+		*out++ = '.';
+		for (i = -1; i > exponent; --i)
+			*out++ = '0';
+		strcpy(out, digits);
+	} else {
+		for (i = 0; i <= exponent; ++i)
+			*out++ = i < n ? digits[i] : '0';
+		*out++ = '.';
+		strcpy(out, n > exponent+1 ? digits+exponent+1 : "0");
+	}
+}
+
+static jboolean Dump(JsonOutput *o, jobject obj, int depth);
+
+/* Writes the elements of a list or tuple, or the items of a dict. */
+static jboolean
+DumpArray(JsonOutput *o, jobjectArray array, jboolean items, int depth)
+{
+	JNIEnv *env = o->env;
+	jsize n = (*env)->GetArrayLength(env, array), i;
+	jboolean ok = JNI_TRUE;
+	Put(o, items ? "{" : "[", 1);
+	for (i = 0; i < n && ok; ++i) {
+		jobject element = (*env)->GetObjectArrayElement(env, array, i);
+		if (i > 0)
+			Put(o, ", ", 2);
+		if (items) {
+			jobjectArray pair = (*env)->CallObjectMethod(env, element, jy.tupleArray);
+			jobject key = pair == NULL ? NULL : (*env)->GetObjectArrayElement(env, pair, 0);
+			jobject value = pair == NULL ? NULL : (*env)->GetObjectArrayElement(env, pair, 1);
+			jclass cls = key == NULL ? NULL : (*env)->GetObjectClass(env, key);
+			jboolean unicode = cls != NULL && (*env)->IsSameObject(env, cls, jy.pyUnicode);
+			if (cls == NULL || (!unicode && !(*env)->IsSameObject(env, cls, jy.pyString))) {
+				ok = JNI_FALSE;
+			} else {
+				jstring s = (*env)->CallObjectMethod(env, key, jy.getString);
+				ok = s != NULL && DumpString(o, s, !unicode);
+				if (s != NULL)
+					(*env)->DeleteLocalRef(env, s);
+				if (ok) {
+					Put(o, ": ", 2);
+					ok = Dump(o, value, depth+1);
+				}
+			}
+			if (cls != NULL)
+				(*env)->DeleteLocalRef(env, cls);
+			if (key != NULL)
+				(*env)->DeleteLocalRef(env, key);
+			if (value != NULL)
+				(*env)->DeleteLocalRef(env, value);
+			if (pair != NULL)
+				(*env)->DeleteLocalRef(env, pair);
+		} else {
+			ok = Dump(o, element, depth+1);
+		}
+		if (element != NULL)
+			(*env)->DeleteLocalRef(env, element);
+	}
+	Put(o, items ? "}" : "]", 1);
+	return ok;
+}
+
+/* Writes obj, returns JNI_FALSE if the json module has to do it. */
+static jboolean
+Dump(JsonOutput *o, jobject obj, int depth)
+{
+	JNIEnv *env = o->env;
+	jclass cls;
+	jboolean ok = JNI_TRUE;
+	/* deeper means a cycle, most likely, which json.dumps reports */
+	if (obj == NULL || depth > maxDepth || (*env)->ExceptionCheck(env))
+		return JNI_FALSE;
+	cls = (*env)->GetObjectClass(env, obj);
+	if ((*env)->IsSameObject(env, cls, jy.pyNone)) {
+		Put(o, "null", 4);
+	} else if ((*env)->IsSameObject(env, cls, jy.pyBoolean)) {
+		if ((*env)->IsSameObject(env, obj, jy.pyTrue))
+			Put(o, "true", 4);
+		else
+			Put(o, "false", 5);
+	} else if ((*env)->IsSameObject(env, cls, jy.pyInteger)) {
+		char number[16];
+		Put(o, number, JLI_Snprintf(number, sizeof(number), "%d",
+				(int) (*env)->CallIntMethod(env, obj, jy.intValue)));
+	} else if ((*env)->IsSameObject(env, cls, jy.pyFloat)) {
+		char number[40];
+		FormatFloat((*env)->CallDoubleMethod(env, obj, jy.floatValue), number);
+		Put(o, number, JLI_StrLen(number));
+	} else if ((*env)->IsSameObject(env, cls, jy.pyLong)) {
+		jobject big = (*env)->CallObjectMethod(env, obj, jy.longValue);
+		jstring s = big == NULL ? NULL : (*env)->CallObjectMethod(env, big, jy.bigToString);
+		const char *digits = s == NULL ? NULL : (*env)->GetStringUTFChars(env, s, NULL);
+		ok = digits != NULL;
+		if (digits != NULL) {
+			Put(o, digits, JLI_StrLen(digits));
+			(*env)->ReleaseStringUTFChars(env, s, digits);
+		}
+		if (s != NULL)
+			(*env)->DeleteLocalRef(env, s);
+		if (big != NULL)
+			(*env)->DeleteLocalRef(env, big);
+	} else if ((*env)->IsSameObject(env, cls, jy.pyUnicode)
+			|| (*env)->IsSameObject(env, cls, jy.pyString)) {
+		jstring s = (*env)->CallObjectMethod(env, obj, jy.getString);
+		ok = s != NULL && DumpString(o, s, !(*env)->IsSameObject(env, cls, jy.pyUnicode));
+		if (s != NULL)
+			(*env)->DeleteLocalRef(env, s);
+	} else if ((*env)->IsSameObject(env, cls, jy.pyList)
+			|| (*env)->IsSameObject(env, cls, jy.pyTuple)
+			|| (*env)->IsSameObject(env, cls, jy.pyDictionary)) {
+		jboolean dict = (*env)->IsSameObject(env, cls, jy.pyDictionary);
+		jobject items = dict ? (*env)->CallObjectMethod(env, obj, jy.items) : NULL;
+		jobjectArray array = dict ? (items == NULL ? NULL : (*env)->CallObjectMethod(env, items, jy.listArray))
+				: (*env)->CallObjectMethod(env, obj, (*env)->IsSameObject(env, cls, jy.pyList)
+						? jy.listArray : jy.tupleArray);
+		ok = array != NULL && DumpArray(o, array, dict, depth);
+		if (array != NULL)
+			(*env)->DeleteLocalRef(env, array);
+		if (items != NULL)
+			(*env)->DeleteLocalRef(env, items);
+	} else {
+		ok = JNI_FALSE;
+	}
+	(*env)->DeleteLocalRef(env, cls);
+	return ok && !(*env)->ExceptionCheck(env);
+}
+
+static jobject JNICALL
+NativeJson_dumps(JNIEnv *env, jclass cls, jobject obj)
+{
+	JsonOutput o;
+	jobject result = NULL;
+	locale_t locale;
+	jboolean ok;
+	if (!InitJython(env))
+		return NULL;
+	o.env = env;
+	o.length = 0;
+	o.size = 4096;
+	o.data = JLI_MemAlloc(o.size);
+	locale = uselocale(jy.cLocale);
+	ok = Dump(&o, obj, 0);
+	uselocale(locale);
+	if (ok) {
+		jstring s;
+		Put(&o, "", 1);
+		/* ASCII only, so modified UTF-8 is UTF-8 */
+		s = (*env)->NewStringUTF(env, o.data);
+		if (s != NULL) {
+			result = (*env)->CallStaticObjectMethod(env, jy.py, jy.newString, s);
+			(*env)->DeleteLocalRef(env, s);
+		}
+	}
+	JLI_MemFree(o.data);
+	return result;
+}
+
+static const JNINativeMethod nativeJsonMethods[] = {
+	{"loads", "(Ljava/lang/String;Z)Lorg/python/core/PyObject;", (void *) NativeJson_loads},
+	{"parse", "(Ljava/nio/ByteBuffer;II)Lorg/python/core/PyObject;", (void *) NativeJson_parse},
+	{"dumps", "(Lorg/python/core/PyObject;)Lorg/python/core/PyObject;", (void *) NativeJson_dumps}
+};
+
+const NativeClass nativeJsonClass = {
+	"lijy/NativeJson",
+	nativeJsonMethods, sizeof(nativeJsonMethods)/sizeof(nativeJsonMethods[0]),
+	NULL, 0
+};
@@ -0,0 +1,387 @@
+/*
+ * jylaunch.c
+ *
+ * Implementation of libjylaunch.so (see jylaunch.h). JyLaunch_Init
+ * obtains the JVM through Jython_Embed, i.e. the same discovery and
+ * option processing as the jython command, or reuses the JVM the
+ * process already has. Jobs are queued and run by worker threads that
+ * are attached to the JVM as daemons. Each worker has its own
+ * PySystemState, so sys.argv and sys.modules are not shared between
+ * concurrently running jobs; each job gets fresh globals.
+ *
+ * Jobs are run by jobRunner below, which reports status and result
+ * back through the interpreter variables _jylaunch_status and
+ * _jylaunch_result.
+ */
+
+#define _GNU_SOURCE /* RTLD_DEFAULT */
+#include "java.h"
+#include "jython.h"
+#include "jylaunch.h"
+#include <pthread.h>
+
+static const char* jobRunner = "\
+import sys, traceback\n\
+def _jylaunch_run(kind, target, args):\n\
+    if kind == 'script':\n\
+        sys.argv = [target] + args\n\
+        execfile(target, {'__name__': '__main__', '__file__': target})\n\
+    elif kind == 'code':\n\
+        sys.argv = ['-c'] + args\n\
+        exec compile(target, '<string>', 'exec') in {'__name__': '__main__'}\n\
+    else:\n\
+        module, _, name = target.rpartition('.')\n\
+        return getattr(__import__(module, fromlist=[name]), name)(*args)\n\
+try:\n\
+    _jylaunch_status = 0\n\
+    _r = _jylaunch_run(_jylaunch_kind, _jylaunch_target, list(_jylaunch_args))\n\
+    if _r is not None:\n\
+        _jylaunch_result = unicode(_r)\n\
+except SystemExit as e:\n\
+    if isinstance(e.code, int):\n\
+        _jylaunch_status = e.code\n\
+    elif e.code is not None:\n\
+        _jylaunch_status = 1\n\
+        _jylaunch_result = unicode(e.code)\n\
+except:\n\
+    _jylaunch_status = 1\n\
+    _jylaunch_result = traceback.format_exc()\n\
+finally:\n\
+    sys.stdout.flush()\n\
+    sys.stderr.flush()\n\
+";
+
+#define jobScript "script"
+#define jobCode "code"
+#define jobCall "call"
+
+struct JyJob {
+	const char* kind;
+	char* target;
+	int argc;
+	char** argv;
+	JyJobCallback callback;
+	void* userData;
+	int status;
+	char* result;
+	jboolean done;
+	jboolean detached;
+	struct JyJob* next;
+};
+
+static JavaVM* jvm = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobsPending = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobsDone = PTHREAD_COND_INITIALIZER;
+static JyJob* queueHead = NULL;
+static JyJob* queueTail = NULL;
+static pthread_t* workers = NULL;
+static int workerCount = 0;
+static jboolean shuttingDown = JNI_FALSE;
+
+static jclass stringClass;
+static jclass interpClass;
+static jclass sysStateClass;
+static jmethodID interpInit;
+static jmethodID interpCompile;
+static jmethodID interpExec;
+static jmethodID interpSet;
+static jmethodID interpGet;
+static jmethodID sysStateInit;
+static jmethodID asInt;
+static jmethodID toString;
+
+static char* stringCopy(JNIEnv* env, jobject obj) {
+	jstring str = (*env)->CallObjectMethod(env, obj, toString);
+	if ((*env)->ExceptionCheck(env) || str == NULL) {
+		(*env)->ExceptionClear(env);
+		return strdup("<unprintable>");
+	}
+	const char* chars = (*env)->GetStringUTFChars(env, str, NULL);
+	char* result = strdup(chars);
+	(*env)->ReleaseStringUTFChars(env, str, chars);
+	(*env)->DeleteLocalRef(env, str);
+	return result;
+}
+
+static char* exceptionText(JNIEnv* env) {
+	jthrowable t = (*env)->ExceptionOccurred(env);
+	(*env)->ExceptionClear(env);
+	return t ? stringCopy(env, t) : NULL;
+}
+
+static jclass globalClass(JNIEnv* env, const char* name) {
+	jclass cls = (*env)->FindClass(env, name);
+	if (cls == NULL) return NULL;
+	jclass result = (*env)->NewGlobalRef(env, cls);
+	(*env)->DeleteLocalRef(env, cls);
+	return result;
+}
+
+/*
+ * Looks up the Jython API and initializes Jython with the system
+ * properties the launcher set (python.home etc.).
+ */
+static jboolean initJython(JNIEnv* env) {
+	stringClass = globalClass(env, "java/lang/String");
+	interpClass = globalClass(env, "org/python/util/PythonInterpreter");
+	sysStateClass = globalClass(env, "org/python/core/PySystemState");
+	jclass pyObject = (*env)->FindClass(env, "org/python/core/PyObject");
+	jclass object = (*env)->FindClass(env, "java/lang/Object");
+	jclass system = (*env)->FindClass(env, "java/lang/System");
+	if (!stringClass || !interpClass || !sysStateClass || !pyObject || !object || !system)
+		return JNI_FALSE;
+	interpInit = (*env)->GetMethodID(env, interpClass, "<init>",
+			"(Lorg/python/core/PyObject;Lorg/python/core/PySystemState;)V");
+	interpCompile = (*env)->GetMethodID(env, interpClass, "compile",
+			"(Ljava/lang/String;)Lorg/python/core/PyCode;");
+	interpExec = (*env)->GetMethodID(env, interpClass, "exec",
+			"(Lorg/python/core/PyObject;)V");
+	interpSet = (*env)->GetMethodID(env, interpClass, "set",
+			"(Ljava/lang/String;Ljava/lang/Object;)V");
+	interpGet = (*env)->GetMethodID(env, interpClass, "get",
+			"(Ljava/lang/String;)Lorg/python/core/PyObject;");
+	sysStateInit = (*env)->GetMethodID(env, sysStateClass, "<init>", "()V");
+	asInt = (*env)->GetMethodID(env, pyObject, "asInt", "()I");
+	toString = (*env)->GetMethodID(env, object, "toString", "()Ljava/lang/String;");
+	jmethodID getProperties = (*env)->GetStaticMethodID(env, system, "getProperties",
+			"()Ljava/util/Properties;");
+	jmethodID initialize = (*env)->GetStaticMethodID(env, interpClass, "initialize",
+			"(Ljava/util/Properties;Ljava/util/Properties;[Ljava/lang/String;)V");
+	if ((*env)->ExceptionCheck(env))
+		return JNI_FALSE;
+	jobject props = (*env)->CallStaticObjectMethod(env, system, getProperties);
+	jobjectArray argv = (*env)->NewObjectArray(env, 0, stringClass, NULL);
+	(*env)->CallStaticVoidMethod(env, interpClass, initialize, props, NULL, argv);
+	return !(*env)->ExceptionCheck(env);
+}
+
+static void setVariable(JNIEnv* env, jobject interp, const char* name, jobject value) {
+	jstring jname = (*env)->NewStringUTF(env, name);
+	(*env)->CallVoidMethod(env, interp, interpSet, jname, value);
+}
+
+static void runJob(JNIEnv* env, jobject sysState, jobject runner, JyJob* job) {
+	int i;
+	(*env)->PushLocalFrame(env, 16 + job->argc);
+	jobject interp = (*env)->NewObject(env, interpClass, interpInit, NULL, sysState);
+	if (interp != NULL) {
+		jobjectArray args = (*env)->NewObjectArray(env, job->argc, stringClass, NULL);
+		for (i = 0; i < job->argc; ++i) {
+			(*env)->SetObjectArrayElement(env, args, i,
+					(*env)->NewStringUTF(env, job->argv[i]));
+		}
+		setVariable(env, interp, "_jylaunch_kind", (*env)->NewStringUTF(env, job->kind));
+		setVariable(env, interp, "_jylaunch_target", (*env)->NewStringUTF(env, job->target));
+		setVariable(env, interp, "_jylaunch_args", args);
+		if (!(*env)->ExceptionCheck(env))
+			(*env)->CallVoidMethod(env, interp, interpExec, runner);
+	}
+	if ((*env)->ExceptionCheck(env)) {
+		job->status = 1;
+		job->result = exceptionText(env);
+	} else {
+		jstring name = (*env)->NewStringUTF(env, "_jylaunch_status");
+		jobject status = (*env)->CallObjectMethod(env, interp, interpGet, name);
+		job->status = status ? (*env)->CallIntMethod(env, status, asInt) : 1;
+		name = (*env)->NewStringUTF(env, "_jylaunch_result");
+		jobject result = (*env)->CallObjectMethod(env, interp, interpGet, name);
+		job->result = result ? stringCopy(env, result) : NULL;
+		if ((*env)->ExceptionCheck(env)) {
+			job->status = 1;
+			job->result = exceptionText(env);
+		}
+	}
+	(*env)->PopLocalFrame(env, NULL);
+}
+
+static void freeJob(JyJob* job) {
+	int i;
+	for (i = 0; i < job->argc; ++i)
+		free(job->argv[i]);
+	free(job->argv);
+	free(job->target);
+	free(job->result);
+	free(job);
+}
+
+static void finishJob(JyJob* job) {
+	if (job->callback)
+		job->callback(job, job->status, job->result, job->userData);
+	pthread_mutex_lock(&lock);
+	job->done = JNI_TRUE;
+	if (job->detached) {
+		freeJob(job);
+	} else {
+		pthread_cond_broadcast(&jobsDone);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static void* worker(void* arg) {
+	JNIEnv* env;
+	jobject sysState = NULL;
+	jobject runner = NULL;
+	char* failure = NULL;
+	if ((*jvm)->AttachCurrentThreadAsDaemon(jvm, (void**) &env, NULL) != JNI_OK)
+		return NULL;
+	sysState = (*env)->NewObject(env, sysStateClass, sysStateInit);
+	if (sysState != NULL) {
+		jobject interp = (*env)->NewObject(env, interpClass, interpInit, NULL, sysState);
+		jstring src = (*env)->NewStringUTF(env, jobRunner);
+		if (interp != NULL && src != NULL)
+			runner = (*env)->CallObjectMethod(env, interp, interpCompile, src);
+	}
+	if ((*env)->ExceptionCheck(env) || runner == NULL)
+		failure = exceptionText(env);
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (queueHead == NULL && !shuttingDown)
+			pthread_cond_wait(&jobsPending, &lock);
+		JyJob* job = queueHead;
+		if (job == NULL) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		queueHead = job->next;
+		if (queueHead == NULL) queueTail = NULL;
+		pthread_mutex_unlock(&lock);
+		if (failure) {
+			job->status = 1;
+			job->result = strdup(failure);
+		} else {
+			runJob(env, sysState, runner, job);
+		}
+		finishJob(job);
+	}
+	free(failure);
+	(*jvm)->DetachCurrentThread(jvm);
+	return NULL;
+}
+
+int JyLaunch_Init(const char* jythonHome, int argc, const char** argv, int threads) {
+	JNIEnv* env;
+	jsize count = 0;
+	int i, result;
+	jboolean attached = JNI_FALSE;
+	if (workerCount > 0)
+		return 0;
+	if (jvm == NULL) {
+		//A JVM loaded by the host or by an earlier Init is reused as is.
+		GetCreatedJavaVMs_t getCreated = (GetCreatedJavaVMs_t)
+				dlsym(RTLD_DEFAULT, "JNI_GetCreatedJavaVMs");
+		if (getCreated == NULL || getCreated(&jvm, 1, &count) != JNI_OK || count == 0)
+			jvm = NULL;
+	}
+	if (jvm == NULL) {
+		char** args = malloc((argc+2)*sizeof(char*));
+		args[0] = "jython";
+		for (i = 0; i < argc; ++i)
+			args[i+1] = (char*) argv[i];
+		args[argc+1] = NULL;
+		if (jythonHome)
+			setenv("JYTHON_HOME", jythonHome, 1);
+		result = Jython_Embed(argc+1, args, &jvm);
+		free(args);
+		if (result != 0 || jvm == NULL)
+			return result ? result : 1;
+	}
+	if ((*jvm)->GetEnv(jvm, (void**) &env, JNI_VERSION_1_2) == JNI_EDETACHED) {
+		if ((*jvm)->AttachCurrentThread(jvm, (void**) &env, NULL) != JNI_OK)
+			return 1;
+		attached = JNI_TRUE;
+	}
+	if (!initJython(env)) {
+		char* msg = exceptionText(env);
+		JLI_ReportErrorMessage("Error: Could not initialize Jython: %s",
+				msg ? msg : "jython.jar not on the classpath?");
+		free(msg);
+		if (attached) (*jvm)->DetachCurrentThread(jvm);
+		return 1;
+	}
+	if (attached) (*jvm)->DetachCurrentThread(jvm);
+	if (threads < 1) threads = 1;
+	workers = malloc(threads*sizeof(pthread_t));
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&workers[workerCount], NULL, worker, NULL) == 0)
+			workerCount++;
+	}
+	JLI_TraceLauncher("jylaunch: %d worker threads\n", workerCount);
+	return workerCount > 0 ? 0 : 1;
+}
+
+static JyJob* submit(const char* kind, const char* target, int argc, const char** argv,
+		JyJobCallback callback, void* userData) {
+	int i;
+	if (workerCount == 0 || target == NULL)
+		return NULL;
+	JyJob* job = calloc(1, sizeof(JyJob));
+	job->kind = kind;
+	job->target = strdup(target);
+	job->argc = argc;
+	job->argv = malloc((argc > 0 ? argc : 1)*sizeof(char*));
+	for (i = 0; i < argc; ++i)
+		job->argv[i] = strdup(argv[i]);
+	job->callback = callback;
+	job->userData = userData;
+	pthread_mutex_lock(&lock);
+	if (queueTail) queueTail->next = job;
+	else queueHead = job;
+	queueTail = job;
+	pthread_cond_signal(&jobsPending);
+	pthread_mutex_unlock(&lock);
+	return job;
+}
+
+JyJob* JyLaunch_SubmitScript(const char* path, int argc, const char** argv,
+		JyJobCallback callback, void* userData) {
+	return submit(jobScript, path, argc, argv, callback, userData);
+}
+
+JyJob* JyLaunch_SubmitCode(const char* code,
+		JyJobCallback callback, void* userData) {
+	return submit(jobCode, code, 0, NULL, callback, userData);
+}
+
+JyJob* JyLaunch_SubmitCall(const char* function, int argc, const char** argv,
+		JyJobCallback callback, void* userData) {
+	return submit(jobCall, function, argc, argv, callback, userData);
+}
+
+int JyLaunch_Wait(JyJob* job, char** result) {
+	pthread_mutex_lock(&lock);
+	while (!job->done)
+		pthread_cond_wait(&jobsDone, &lock);
+	pthread_mutex_unlock(&lock);
+	int status = job->status;
+	if (result) {
+		*result = job->result;
+		job->result = NULL;
+	}
+	freeJob(job);
+	return status;
+}
+
+void JyLaunch_Detach(JyJob* job) {
+	pthread_mutex_lock(&lock);
+	if (job->done) {
+		freeJob(job);
+	} else {
+		job->detached = JNI_TRUE;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void JyLaunch_Shutdown() {
+	int i;
+	pthread_mutex_lock(&lock);
+	shuttingDown = JNI_TRUE;
+	pthread_cond_broadcast(&jobsPending);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < workerCount; ++i)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	workers = NULL;
+	workerCount = 0;
+	shuttingDown = JNI_FALSE;
+}
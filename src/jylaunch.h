@@ -0,0 +1,68 @@
+/*
+ * jylaunch.h
+ *
+ * Public interface of libjylaunch.so: lets C and C++ programs run
+ * Jython scripts and callables in-process on a pool of JVM threads
+ * instead of forking a jython process per job. See jylaunch.c.
+ */
+
+#ifndef JYLAUNCH_H_
+#define JYLAUNCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct JyJob JyJob;
+
+/*
+ * Called on the worker thread when a job has finished.
+ * status: 0 on success, the code given to sys.exit, or 1 for an
+ *         uncaught exception.
+ * result: str() of a callable's return value (NULL for None, scripts
+ *         and code), the traceback for exceptions; only valid during
+ *         the call.
+ */
+typedef void (*JyJobCallback)(JyJob *job, int status, const char *result, void *userData);
+
+/*
+ * Prepares Jython and starts the worker pool. jythonHome may be NULL to
+ * use $JYTHON_HOME. argv holds jython launcher options such as
+ * "-J-Xmx1g" or "-Dpython.path=..." (no program name). If the process
+ * already has a JVM, it is reused, provided jython.jar is on its
+ * classpath. The JVM outlives JyLaunch_Shutdown, so Init may be called
+ * again later. Configuration errors are reported like the jython
+ * command does, which may terminate the process.
+ * Returns 0 on success.
+ */
+int JyLaunch_Init(const char *jythonHome, int argc, const char **argv, int threads);
+
+/* Runs a script file as __main__ with sys.argv = [path] + argv. */
+JyJob *JyLaunch_SubmitScript(const char *path, int argc, const char **argv,
+		JyJobCallback callback, void *userData);
+
+/* Runs Python source code as __main__, like jython -c. */
+JyJob *JyLaunch_SubmitCode(const char *code,
+		JyJobCallback callback, void *userData);
+
+/* Calls "package.module.function" with the strings of argv as arguments. */
+JyJob *JyLaunch_SubmitCall(const char *function, int argc, const char **argv,
+		JyJobCallback callback, void *userData);
+
+/*
+ * Waits for the job and releases it. Returns its status; if result is
+ * not NULL, it receives the result (to be freed by the caller) or NULL.
+ */
+int JyLaunch_Wait(JyJob *job, char **result);
+
+/* Releases the job without waiting; its callback still runs. */
+void JyLaunch_Detach(JyJob *job);
+
+/* Finishes the queued jobs and stops the workers. */
+void JyLaunch_Shutdown();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JYLAUNCH_H_ */
@@ -0,0 +1,259 @@
+/*
+ * jymmap.c
+ *
+ * Natives of lijy.NativeMap (see jynative.c): memory-mapped file access
+ * for scripts. Java's FileChannel.map does the same, but leaves the
+ * mapping in place until the buffer is garbage collected and offers no
+ * access hints, which hurts scripts that scan many or large files.
+ *
+ *   buf = NativeMap.map(path, offset, length, NativeMap.SEQUENTIAL)
+ *   ...
+ *   NativeMap.unmap(buf)
+ *
+ * map returns a read-only direct ByteBuffer over the file, read straight
+ * from the page cache without a copy. length -1 maps up to the end of
+ * the file, as do lengths past it (pages past the end of a file would
+ * raise SIGBUS); a mapping is at most 2 GiB - 1, larger files are mapped
+ * in windows. unmap releases the mapping at once; the buffer must not be
+ * used afterwards. advise passes one of the advice constants to
+ * madvise(2) for a buffer returned by map. Both only accept the buffers
+ * map returned (or their duplicates), which are kept in a registry.
+ */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ADVICE_NORMAL 0
+#define ADVICE_SEQUENTIAL 1
+#define ADVICE_RANDOM 2
+#define ADVICE_WILLNEED 3
+#define ADVICE_DONTNEED 4
+
+static char emptyMapping;
+
+/* The live mappings by buffer address and capacity. */
+typedef struct {
+	char *address;
+	jlong capacity;
+} MapEntry;
+
+static MapEntry *mappings = NULL;
+static int mappingCount = 0, mappingCapacity = 0;
+static pthread_mutex_t mappingLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+AddMapping(char *address, jlong capacity)
+{
+	pthread_mutex_lock(&mappingLock);
+	if (mappingCount == mappingCapacity) {
+		mappingCapacity = mappingCapacity ? 2*mappingCapacity : 64;
+		mappings = JLI_MemRealloc(mappings, mappingCapacity*sizeof(MapEntry));
+	}
+	mappings[mappingCount].address = address;
+	mappings[mappingCount++].capacity = capacity;
+	pthread_mutex_unlock(&mappingLock);
+}
+
+/* Whether address and capacity are a live mapping; take removes it. */
+static jboolean
+FindMapping(char *address, jlong capacity, jboolean take)
+{
+	jboolean found = JNI_FALSE;
+	int i;
+	pthread_mutex_lock(&mappingLock);
+	for (i = 0; i < mappingCount; ++i) {
+		if (mappings[i].address == address && mappings[i].capacity == capacity) {
+			found = JNI_TRUE;
+			if (take)
+				mappings[i] = mappings[--mappingCount];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mappingLock);
+	return found;
+}
+
+static const int madvices[] = {
+	MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED
+};
+
+static void
+ThrowIOException(JNIEnv *env, const char *what, const char *path)
+{
+	char message[PATH_MAX+128];
+	JLI_Snprintf(message, sizeof(message), "%s %s: %s", what, path, strerror(errno));
+	ThrowNative(env, "java/io/IOException", message);
+}
+
+/* Page offset of a mapping at file offset offset. */
+static jlong
+PageOffset(jlong offset)
+{
+	return offset % sysconf(_SC_PAGESIZE);
+}
+
+/* Returns buffer.asReadOnlyBuffer(), deleting buffer. */
+static jobject
+ReadOnly(JNIEnv *env, jobject buffer)
+{
+	jobject result = NULL;
+	jclass cls = (*env)->FindClass(env, "java/nio/ByteBuffer");
+	jmethodID asReadOnly = cls == NULL ? NULL : (*env)->GetMethodID(env, cls,
+			"asReadOnlyBuffer", "()Ljava/nio/ByteBuffer;");
+	if (asReadOnly != NULL)
+		result = (*env)->CallObjectMethod(env, buffer, asReadOnly);
+	if (cls != NULL)
+		(*env)->DeleteLocalRef(env, cls);
+	(*env)->DeleteLocalRef(env, buffer);
+	return result;
+}
+
+static jobject JNICALL
+NativeMap_map(JNIEnv *env, jclass cls, jstring jpath, jlong offset, jlong length, jint advice)
+{
+	char *path;
+	struct stat st;
+	jlong pageOffset;
+	void *base;
+	int fd;
+	jobject buffer = NULL;
+	if (jpath == NULL || offset < 0 || length < -1 || advice < 0 || advice > ADVICE_DONTNEED) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeMap.map");
+		return NULL;
+	}
+	path = GetStringUtf8(env, jpath);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		ThrowIOException(env, "cannot open", path);
+		goto done;
+	}
+	if (length == -1 || length > st.st_size - offset)
+		length = st.st_size > offset ? st.st_size - offset : 0;
+	if (length > INT_MAX) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeMap.map: mappings are limited to 2 GiB, map the file in windows");
+		goto done;
+	}
+	if (length == 0) {
+		/* mmap rejects empty mappings; unmap knows capacity 0 */
+		buffer = (*env)->NewDirectByteBuffer(env, &emptyMapping, 0);
+		goto done;
+	}
+	pageOffset = PageOffset(offset);
+	base = mmap(NULL, (size_t) (length + pageOffset), PROT_READ, MAP_SHARED, fd,
+			(off_t) (offset - pageOffset));
+	if (base == MAP_FAILED) {
+		ThrowIOException(env, "cannot map", path);
+		goto done;
+	}
+	if (advice != ADVICE_NORMAL)
+		madvise(base, (size_t) (length + pageOffset), madvices[advice]);
+	buffer = (*env)->NewDirectByteBuffer(env, (char *) base + pageOffset, length);
+	if (buffer == NULL)
+		munmap(base, (size_t) (length + pageOffset));
+	else
+		AddMapping((char *) base + pageOffset, length);
+done:
+	if (fd >= 0)
+		close(fd);
+	JLI_MemFree(path);
+	return buffer == NULL ? NULL : ReadOnly(env, buffer);
+}
+
+/*
+ * Finds the mapping of a buffer returned by map; take (for unmap) removes
+ * it from the registry. Returns 0 for empty buffers and -1 (with an
+ * exception pending) for buffers map did not return or that are unmapped.
+ */
+static int
+Mapping(JNIEnv *env, jobject buffer, jboolean take, void **base, size_t *length)
+{
+	char *address = buffer == NULL ? NULL : (*env)->GetDirectBufferAddress(env, buffer);
+	jlong capacity = buffer == NULL ? -1 : (*env)->GetDirectBufferCapacity(env, buffer);
+	jlong pageOffset;
+	if (address == &emptyMapping && capacity == 0)
+		return 0;
+	if (address == NULL || capacity <= 0 || !FindMapping(address, capacity, take)) {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeMap: not a buffer returned by map");
+		return -1;
+	}
+	pageOffset = (jlong) ((size_t) address % sysconf(_SC_PAGESIZE));
+	*base = address - pageOffset;
+	*length = (size_t) (capacity + pageOffset);
+	return 1;
+}
+
+static void JNICALL
+NativeMap_unmap(JNIEnv *env, jclass cls, jobject buffer)
+{
+	void *base;
+	size_t length;
+	if (Mapping(env, buffer, JNI_TRUE, &base, &length) > 0 && munmap(base, length) != 0)
+		ThrowIOException(env, "cannot unmap", "buffer");
+}
+
+static void JNICALL
+NativeMap_advise(JNIEnv *env, jclass cls, jobject buffer, jint advice)
+{
+	void *base;
+	size_t length;
+	if (advice < 0 || advice > ADVICE_DONTNEED) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeMap.advise");
+		return;
+	}
+	if (Mapping(env, buffer, JNI_FALSE, &base, &length) > 0 && madvise(base, length, madvices[advice]) != 0)
+		ThrowIOException(env, "cannot advise", "buffer");
+}
+
+static jlong JNICALL
+NativeMap_size(JNIEnv *env, jclass cls, jstring jpath)
+{
+	struct stat st;
+	jlong size = -1;
+	char *path = GetStringUtf8(env, jpath);
+	if (path == NULL)
+		return -1;
+	if (stat(path, &st) != 0)
+		ThrowIOException(env, "cannot stat", path);
+	else
+		size = (jlong) st.st_size;
+	JLI_MemFree(path);
+	return size;
+}
+
+static const JNINativeMethod nativeMapMethods[] = {
+	{"map", "(Ljava/lang/String;JJI)Ljava/nio/ByteBuffer;", (void *) NativeMap_map},
+	{"unmap", "(Ljava/nio/ByteBuffer;)V", (void *) NativeMap_unmap},
+	{"advise", "(Ljava/nio/ByteBuffer;I)V", (void *) NativeMap_advise},
+	{"size", "(Ljava/lang/String;)J", (void *) NativeMap_size}
+};
+
+static const NativeConstant nativeMapConstants[] = {
+	{"NORMAL", ADVICE_NORMAL},
+	{"SEQUENTIAL", ADVICE_SEQUENTIAL},
+	{"RANDOM", ADVICE_RANDOM},
+	{"WILLNEED", ADVICE_WILLNEED},
+	{"DONTNEED", ADVICE_DONTNEED}
+};
+
+const NativeClass nativeMapClass = {
+	"lijy/NativeMap",
+	nativeMapMethods, sizeof(nativeMapMethods)/sizeof(nativeMapMethods[0]),
+	nativeMapConstants, sizeof(nativeMapConstants)/sizeof(nativeMapConstants[0])
+};
+
+#else
+
+/* defined without methods, so scripts can still import it */
+const NativeClass nativeMapClass = {"lijy/NativeMap", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
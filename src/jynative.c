@@ -0,0 +1,350 @@
+/*
+ * jynative.c
+ *
+ * The launcher holds a JNIEnv before it calls Jython's main, so it can
+ * offer scripts native functionality without a JNI library of its own:
+ * it defines small helper classes whose methods are all public static
+ * native (or, in a subclass such as an OutputStream, public native), and
+ * binds those to functions in the launcher with RegisterNatives.
+ * Scripts use them like any Java class, e.g.
+ *
+ *   from lijy import NativeMap
+ *
+ * No class files are shipped. A class without method bodies needs
+ * little more than a constant pool, so ClassFile builds the class file
+ * from the NativeClass description at launch.
+ */
+
+#include "java.h"
+#include "jynative.h"
+
+#define classFileMajor 49 /* Java 5, no stack maps needed */
+#define ACC_PUBLIC 0x0001
+#define ACC_STATIC 0x0008
+#define ACC_FINAL 0x0010
+#define ACC_SUPER 0x0020
+#define ACC_NATIVE 0x0100
+#define CONSTANT_Utf8 1
+#define CONSTANT_Integer 3
+#define CONSTANT_Class 7
+#define CONSTANT_Methodref 10
+#define CONSTANT_NameAndType 12
+#define ALOAD_0 0x2a
+#define INVOKESPECIAL 0xb7
+#define RETURN 0xb1
+
+static const NativeClass *nativeClasses[] = {
+	&nativeMapClass,
+	&nativePipeClass,
+	&nativeTokenizerClass,
+	&nativeJsonClass,
+	&nativeFFIClass,
+	&nativeEpollClass,
+	&nativeSocketClass,
+	&nativeSpawnClass,
+	&nativePosixClass,
+	&nativeWalkClass,
+	&nativeStdoutClass,
+	NULL
+};
+
+typedef struct {
+	unsigned char *data;
+	int length;
+} ClassBuffer;
+
+static void
+PutU1(ClassBuffer *buf, int value)
+{
+	buf->data[buf->length++] = (unsigned char) value;
+}
+
+static void
+PutU2(ClassBuffer *buf, int value)
+{
+	PutU1(buf, value >> 8);
+	PutU1(buf, value);
+}
+
+static void
+PutU4(ClassBuffer *buf, jint value)
+{
+	PutU2(buf, (value >> 16) & 0xffff);
+	PutU2(buf, value & 0xffff);
+}
+
+/* Adds a CONSTANT_Utf8 entry, returns its index. */
+static int
+PutUtf8(ClassBuffer *buf, int *index, const char *s)
+{
+	int len = (int) JLI_StrLen(s);
+	PutU1(buf, CONSTANT_Utf8);
+	PutU2(buf, len);
+	memcpy(buf->data + buf->length, s, len);
+	buf->length += len;
+	return (*index)++;
+}
+
+/*
+ * Builds the class file of cls: public final, extends Object (or
+ * superName), with a ConstantValue field per constant and a public
+ * native method per method, static unless there is a superName. A
+ * subclass gets a constructor that calls super(). Returns the length;
+ * *data must be freed by the caller.
+ */
+static int
+ClassFile(const NativeClass *cls, unsigned char **data)
+{
+	ClassBuffer buf;
+	int size = 128, index = 1, i; /* header, Object, ConstantValue, I, counts */
+	int thisClass, superClass, constantValue = 0, intDesc = 0;
+	int init = 0, voidDesc = 0, superInit = 0, code = 0;
+	int methodFlags = ACC_PUBLIC | ACC_NATIVE;
+	int *methodNames, *fieldNames, *fieldValues;
+	const char *superName = cls->superName != NULL ? cls->superName : "java/lang/Object";
+	size += (int) (JLI_StrLen(cls->className) + JLI_StrLen(superName)) + 8;
+	if (cls->superName != NULL)
+		size += 64; /* constructor */
+	else
+		methodFlags |= ACC_STATIC;
+	for (i = 0; i < cls->methodCount; ++i)
+		size += (int) (JLI_StrLen(cls->methods[i].name) + JLI_StrLen(cls->methods[i].signature)) + 24;
+	for (i = 0; i < cls->constantCount; ++i)
+		size += (int) JLI_StrLen(cls->constants[i].name) + 32;
+	buf.data = JLI_MemAlloc(size);
+	buf.length = 0;
+	methodNames = JLI_MemAlloc((cls->methodCount*2 + cls->constantCount*2 + 1)*sizeof(int));
+	fieldNames = methodNames + cls->methodCount*2;
+	fieldValues = fieldNames + cls->constantCount;
+
+	PutU4(&buf, (jint) 0xCAFEBABE);
+	PutU2(&buf, 0);
+	PutU2(&buf, classFileMajor);
+	/*
+	 * constant pool: 2 per class, 2 per method, 2 per field, I and
+	 * ConstantValue, <init>, ()V, its NameAndType and Methodref and Code
+	 */
+	PutU2(&buf, 1 + 4 + 2*cls->methodCount + 2*cls->constantCount
+			+ (cls->constantCount > 0 ? 2 : 0) + (cls->superName != NULL ? 5 : 0));
+	thisClass = PutUtf8(&buf, &index, cls->className);
+	PutU1(&buf, CONSTANT_Class);
+	PutU2(&buf, thisClass);
+	thisClass = index++;
+	superClass = PutUtf8(&buf, &index, superName);
+	PutU1(&buf, CONSTANT_Class);
+	PutU2(&buf, superClass);
+	superClass = index++;
+	for (i = 0; i < cls->methodCount; ++i) {
+		methodNames[2*i] = PutUtf8(&buf, &index, cls->methods[i].name);
+		methodNames[2*i+1] = PutUtf8(&buf, &index, cls->methods[i].signature);
+	}
+	if (cls->constantCount > 0) {
+		constantValue = PutUtf8(&buf, &index, "ConstantValue");
+		intDesc = PutUtf8(&buf, &index, "I");
+	}
+	for (i = 0; i < cls->constantCount; ++i) {
+		fieldNames[i] = PutUtf8(&buf, &index, cls->constants[i].name);
+		PutU1(&buf, CONSTANT_Integer);
+		PutU4(&buf, cls->constants[i].value);
+		fieldValues[i] = index++;
+	}
+	if (cls->superName != NULL) {
+		init = PutUtf8(&buf, &index, "<init>");
+		voidDesc = PutUtf8(&buf, &index, "()V");
+		code = PutUtf8(&buf, &index, "Code");
+		PutU1(&buf, CONSTANT_NameAndType);
+		PutU2(&buf, init);
+		PutU2(&buf, voidDesc);
+		PutU1(&buf, CONSTANT_Methodref);
+		PutU2(&buf, superClass);
+		PutU2(&buf, index++);
+		superInit = index++;
+	}
+
+	PutU2(&buf, ACC_PUBLIC | ACC_FINAL | ACC_SUPER);
+	PutU2(&buf, thisClass);
+	PutU2(&buf, superClass);
+	PutU2(&buf, 0); /* interfaces */
+	PutU2(&buf, cls->constantCount);
+	for (i = 0; i < cls->constantCount; ++i) {
+		PutU2(&buf, ACC_PUBLIC | ACC_STATIC | ACC_FINAL);
+		PutU2(&buf, fieldNames[i]);
+		PutU2(&buf, intDesc);
+		PutU2(&buf, 1);
+		PutU2(&buf, constantValue);
+		PutU4(&buf, 2);
+		PutU2(&buf, fieldValues[i]);
+	}
+	PutU2(&buf, cls->methodCount + (cls->superName != NULL ? 1 : 0));
+	if (cls->superName != NULL) {
+		/* public <init>() { super(); } */
+		PutU2(&buf, ACC_PUBLIC);
+		PutU2(&buf, init);
+		PutU2(&buf, voidDesc);
+		PutU2(&buf, 1);
+		PutU2(&buf, code);
+		PutU4(&buf, 17);
+		PutU2(&buf, 1); /* max_stack */
+		PutU2(&buf, 1); /* max_locals */
+		PutU4(&buf, 5);
+		PutU1(&buf, ALOAD_0);
+		PutU1(&buf, INVOKESPECIAL);
+		PutU2(&buf, superInit);
+		PutU1(&buf, RETURN);
+		PutU2(&buf, 0); /* exception table */
+		PutU2(&buf, 0); /* attributes */
+	}
+	for (i = 0; i < cls->methodCount; ++i) {
+		PutU2(&buf, methodFlags);
+		PutU2(&buf, methodNames[2*i]);
+		PutU2(&buf, methodNames[2*i+1]);
+		PutU2(&buf, 0);
+	}
+	PutU2(&buf, 0); /* class attributes */
+	JLI_MemFree(methodNames);
+	*data = buf.data;
+	return buf.length;
+}
+
+jsize
+DecodeUtf8(const char *s, size_t len, jchar *chars)
+{
+	size_t i;
+	jsize n = 0;
+	for (i = 0; i < len; ) {
+		unsigned char c = s[i];
+		unsigned int cp = 0xFFFD;
+		int extra = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+		if (extra == 0) {
+			cp = c;
+		} else if (extra > 0 && i+extra < len) {
+			int k;
+			cp = c & (0x3F >> extra);
+			for (k = 1; k <= extra && (s[i+k] & 0xC0) == 0x80; ++k)
+				cp = (cp << 6) | (s[i+k] & 0x3F);
+			if (k <= extra || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)
+					|| cp < (extra == 1 ? 0x80 : extra == 2 ? 0x800 : 0x10000))
+				cp = 0xFFFD, extra = 0;
+		} else {
+			extra = 0;
+		}
+		i += extra+1;
+		if (cp >= 0x10000) {
+			chars[n++] = 0xD800 + ((cp-0x10000) >> 10);
+			chars[n++] = 0xDC00 + ((cp-0x10000) & 0x3FF);
+		} else {
+			chars[n++] = cp;
+		}
+	}
+	return n;
+}
+
+size_t
+EncodeUtf8(const jchar *chars, jsize n, char *out)
+{
+	unsigned char *o = (unsigned char *) out;
+	jsize i;
+	for (i = 0; i < n; ++i) {
+		unsigned int c = chars[i];
+		if (c >= 0xD800 && c < 0xDC00 && i+1 < n && chars[i+1] >= 0xDC00 && chars[i+1] < 0xE000)
+			c = 0x10000 + ((c-0xD800) << 10) + (chars[++i]-0xDC00);
+		if (c < 0x80) {
+			*o++ = c;
+		} else if (c < 0x800) {
+			*o++ = 0xC0 | (c >> 6);
+			*o++ = 0x80 | (c & 0x3F);
+		} else if (c < 0x10000) {
+			*o++ = 0xE0 | (c >> 12);
+			*o++ = 0x80 | ((c >> 6) & 0x3F);
+			*o++ = 0x80 | (c & 0x3F);
+		} else {
+			*o++ = 0xF0 | (c >> 18);
+			*o++ = 0x80 | ((c >> 12) & 0x3F);
+			*o++ = 0x80 | ((c >> 6) & 0x3F);
+			*o++ = 0x80 | (c & 0x3F);
+		}
+	}
+	return o - (unsigned char *) out;
+}
+
+jstring
+NewStringUtf8(JNIEnv *env, const char *s, size_t len)
+{
+	jchar stackChars[256], *chars = stackChars;
+	jstring result;
+	jsize n;
+	if (len > sizeof(stackChars) / sizeof(jchar))
+		chars = JLI_MemAlloc(len * sizeof(jchar));
+	n = DecodeUtf8(s, len, chars);
+	result = (*env)->NewString(env, chars, n);
+	if (chars != stackChars)
+		JLI_MemFree(chars);
+	return result;
+}
+
+char *
+GetStringUtf8(JNIEnv *env, jstring str)
+{
+	jchar stackChars[256], *chars = stackChars;
+	char *result;
+	jsize n;
+	if (str == NULL)
+		return NULL;
+	n = (*env)->GetStringLength(env, str);
+	if (n > (jsize) (sizeof(stackChars) / sizeof(jchar)))
+		chars = JLI_MemAlloc(n * sizeof(jchar));
+	(*env)->GetStringRegion(env, str, 0, n, chars);
+	result = JLI_MemAlloc(3*n + 1);
+	result[EncodeUtf8(chars, n, result)] = 0;
+	if (chars != stackChars)
+		JLI_MemFree(chars);
+	return result;
+}
+
+void
+ThrowNative(JNIEnv *env, const char *className, const char *message)
+{
+	jclass cls = (*env)->FindClass(env, className);
+	if (cls != NULL) {
+		(*env)->ThrowNew(env, cls, message);
+		(*env)->DeleteLocalRef(env, cls);
+	}
+}
+
+void
+RegisterLauncherNatives(JNIEnv *env)
+{
+	jclass loaderClass;
+	jmethodID getSystemLoader;
+	jobject loader = NULL;
+	int i;
+	loaderClass = (*env)->FindClass(env, "java/lang/ClassLoader");
+	if (loaderClass != NULL) {
+		getSystemLoader = (*env)->GetStaticMethodID(env, loaderClass,
+				"getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+		if (getSystemLoader != NULL)
+			loader = (*env)->CallStaticObjectMethod(env, loaderClass, getSystemLoader);
+	}
+	if ((*env)->ExceptionCheck(env) || loader == NULL) {
+		(*env)->ExceptionClear(env);
+		JLI_TraceLauncher("launcher natives: no system class loader\n");
+		return;
+	}
+	for (i = 0; nativeClasses[i] != NULL; ++i) {
+		const NativeClass *nc = nativeClasses[i];
+		unsigned char *data;
+		int length = ClassFile(nc, &data);
+		jclass cls = (*env)->DefineClass(env, nc->className, loader, (const jbyte *) data, length);
+		JLI_MemFree(data);
+		if (cls == NULL || (*env)->RegisterNatives(env, cls, nc->methods, nc->methodCount) != 0) {
+			(*env)->ExceptionClear(env);
+			JLI_TraceLauncher("launcher natives: cannot define %s\n", nc->className);
+		} else {
+			JLI_TraceLauncher("launcher natives: defined %s\n", nc->className);
+		}
+		if (cls != NULL)
+			(*env)->DeleteLocalRef(env, cls);
+	}
+	(*env)->DeleteLocalRef(env, loader);
+	(*env)->DeleteLocalRef(env, loaderClass);
+}
@@ -0,0 +1,102 @@
+/*
+ * jynative.h
+ *
+ * Helper classes with native methods that the launcher defines in the
+ * JVM it creates, see jynative.c.
+ */
+
+#ifndef JYNATIVE_H_
+#define JYNATIVE_H_
+
+#include <jni.h>
+
+/* A public static final int field of a helper class. */
+typedef struct {
+	const char *name;
+	jint value;
+} NativeConstant;
+
+typedef struct {
+	const char *className;          /* internal name, e.g. lijy/NativeMap */
+	const JNINativeMethod *methods; /* all public static native */
+	int methodCount;
+	const NativeConstant *constants;
+	int constantCount;
+	/*
+	 * NULL for java/lang/Object. Otherwise the methods are instance
+	 * methods instead, and the class gets a public constructor without
+	 * arguments that calls the superclass's.
+	 */
+	const char *superName;
+} NativeClass;
+
+/* jymmap.c */
+extern const NativeClass nativeMapClass;
+/* jypipe.c */
+extern const NativeClass nativePipeClass;
+/* jytokenize.c */
+extern const NativeClass nativeTokenizerClass;
+/* jyjson.c */
+extern const NativeClass nativeJsonClass;
+/* jyffi.c */
+extern const NativeClass nativeFFIClass;
+/* jyepoll.c */
+extern const NativeClass nativeEpollClass;
+extern const NativeClass nativeSocketClass;
+/* jyspawn.c */
+extern const NativeClass nativeSpawnClass;
+/*
+ * Forks the helper that starts the processes of lijy.NativeSpawn; called
+ * before the JVM is created, so the helper stays small. Failures are
+ * traced, NativeSpawn then starts processes itself.
+ */
+void StartSpawnHelper(void);
+/* jyposix.c */
+extern const NativeClass nativePosixClass;
+/* jywalk.c */
+extern const NativeClass nativeWalkClass;
+/* jystdout.c */
+extern const NativeClass nativeStdoutClass;
+/*
+ * Makes System.out a PrintStream on lijy.NativeStdout, so that output is
+ * written in large blocks; called before Jython's main when stdout is no
+ * tty. The buffer is flushed at exit. Failures are traced, System.out
+ * then stays as it is.
+ */
+void BufferStdout(JNIEnv *env);
+
+/*
+ * Defines the helper classes in the system class loader and registers
+ * their natives. Failures are traced and otherwise ignored.
+ */
+void RegisterLauncherNatives(JNIEnv *env);
+
+/*
+ * Decodes UTF-8 to UTF-16, invalid bytes become U+FFFD. chars must have
+ * room for len units. Returns the number of units.
+ */
+jsize DecodeUtf8(const char *s, size_t len, jchar *chars);
+
+/*
+ * Encodes UTF-16 as UTF-8, lone surrogates as three bytes each. out must
+ * have room for 3*n bytes. Returns the number of bytes.
+ */
+size_t EncodeUtf8(const jchar *chars, jsize n, char *out);
+
+/*
+ * A String of the UTF-8 bytes s[0..len), decoded as DecodeUtf8 does;
+ * NULL with an OutOfMemoryError pending.
+ */
+jstring NewStringUtf8(JNIEnv *env, const char *s, size_t len);
+
+/*
+ * str as NUL-terminated UTF-8, for paths passed to the system (unlike
+ * GetStringUTFChars, which yields modified UTF-8); free it with
+ * JLI_MemFree. NULL if str is null.
+ */
+char *GetStringUtf8(JNIEnv *env, jstring str);
+
+/* Throws a new exception of the given class, e.g. java/io/IOException. */
+void ThrowNative(JNIEnv *env, const char *className, const char *message);
+
+#endif /* JYNATIVE_H_ */
@@ -0,0 +1,482 @@
+/*
+ * jypipe.c
+ *
+ * Record-stream mode (launcher option --pipe module:function).
+ *
+ * Iterating over sys.stdin line by line costs Jython a codec call, a
+ * PyUnicode and an interpreter round trip per line, which keeps typical
+ * filter scripts far below disk bandwidth. With --pipe the launcher runs
+ * a small driver (see pipeDriver) instead of a script. It reads the
+ * input through lijy.NativePipe, whose natives are registered by the
+ * launcher (see jynative.c): the launcher reads stdin, or the files
+ * given as arguments, in blocks of pipeBlock bytes and splits them into
+ * lines itself. Each read() returns a batch of up to pipeBatch lines
+ * (without the line terminator) as a String[] and the driver calls
+ *
+ *   function(batch)
+ *
+ * once per batch. If the function returns a sequence of strings, these
+ * are written as lines to stdout through a buffered native writer, one
+ * JNI call per batch. Output the function prints to sys.stdout itself is
+ * not ordered with respect to it.
+ *
+ * gzip'ed input files (and stdin) are decompressed transparently. zlib is
+ * loaded with dlopen on the first gzip stream, so that other launches
+ * don't pay for loading it.
+ */
+
+#include "jython.h"
+#include "jynative.h"
+#include <ctype.h>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define pipeBlock (1024*1024)
+#define pipeBatch 4096
+#define pipeZlib "libz.so.1"
+
+static const char* pipeDriverCode =
+	"import sys\n"
+	"from lijy import NativePipe as _pipe\n"
+	"from %s import %s as _pipe_function\n"
+	"def _pipe_run():\n"
+	"    _pipe.open(sys.argv[1:])\n"
+	"    try:\n"
+	"        while True:\n"
+	"            batch = _pipe.read()\n"
+	"            if batch is None:\n"
+	"                break\n"
+	"            out = _pipe_function(batch)\n"
+	"            if out is not None:\n"
+	"                out = list(out)\n"
+	"                if out:\n"
+	"                    _pipe.write(u'\\n'.join(out) + u'\\n')\n"
+	"    finally:\n"
+	"        _pipe.close()\n"
+	"_pipe_run()\n";
+
+typedef struct {
+	int (*init)(z_streamp, int, const char*, int);
+	int (*inflate)(z_streamp, int);
+	int (*end)(z_streamp);
+} ZlibFunctions;
+
+static ZlibFunctions* zlib = NULL;
+
+static char** inputs = NULL;
+static int inputCount = 0, nextInput = 0;
+static int inputFd = -1;
+static jboolean gzipped = JNI_FALSE;
+static jboolean streamEnded = JNI_FALSE;
+static z_stream zstream;
+static unsigned char* raw = NULL;      /* compressed input */
+static char* data = NULL;              /* lines, NUL-terminated on demand */
+static size_t dataSize = 0, dataStart = 0, dataEnd = 0;
+static jchar* chars = NULL;            /* UTF-16 of a non-ASCII line */
+static size_t charsSize = 0;
+static char* out = NULL;
+static size_t outEnd = 0;
+static jclass stringClass = NULL;
+
+static void throwIO(JNIEnv* env, const char* what, const char* path) {
+	char message[PATH_MAX+128];
+	snprintf(message, sizeof(message), "%s %s: %s", what, path, strerror(errno));
+	ThrowNative(env, "java/io/IOException", message);
+}
+
+static jboolean loadZlib() {
+	void* lib;
+	if (zlib != NULL)
+		return JNI_TRUE;
+	lib = dlopen(pipeZlib, RTLD_NOW | RTLD_LOCAL);
+	if (lib == NULL)
+		return JNI_FALSE;
+	zlib = malloc(sizeof(ZlibFunctions));
+	zlib->init = dlsym(lib, "inflateInit2_");
+	zlib->inflate = dlsym(lib, "inflate");
+	zlib->end = dlsym(lib, "inflateEnd");
+	if (!zlib->init || !zlib->inflate || !zlib->end) {
+		free(zlib);
+		zlib = NULL;
+		return JNI_FALSE;
+	}
+	JLI_TraceLauncher("pipe: loaded %s\n", pipeZlib);
+	return JNI_TRUE;
+}
+
+static void closeInput() {
+	if (inputFd > 0)
+		close(inputFd);
+	if (gzipped)
+		zlib->end(&zstream);
+	inputFd = -1;
+	gzipped = JNI_FALSE;
+}
+
+/*
+ * Opens the next input, checking for the gzip magic. Returns JNI_FALSE
+ * if there is none left or on errors (then with an exception pending).
+ */
+static jboolean openInput(JNIEnv* env) {
+	const char* path;
+	ssize_t n;
+	if (nextInput == (inputCount ? inputCount : 1))
+		return JNI_FALSE;
+	path = inputCount ? inputs[nextInput] : "-";
+	++nextInput;
+	if (strcmp(path, "-") == 0) {
+		inputFd = 0;
+	} else {
+		inputFd = open(path, O_RDONLY | O_CLOEXEC);
+		if (inputFd < 0) {
+			throwIO(env, "cannot open", path);
+			return JNI_FALSE;
+		}
+		posix_fadvise(inputFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	/* the magic is peeked into raw, it goes to zlib or to data below */
+	if (raw == NULL)
+		raw = malloc(pipeBlock);
+	/* pipes may return the two bytes one at a time */
+	for (n = 0; n < 2; ) {
+		ssize_t r = read(inputFd, raw+n, 2-n);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		n += r;
+	}
+	if (n == 2 && raw[0] == 0x1f && raw[1] == 0x8b) {
+		if (!loadZlib()) {
+			errno = ENOSYS;
+			throwIO(env, "cannot load " pipeZlib " to decompress", path);
+			closeInput();
+			return JNI_FALSE;
+		}
+		memset(&zstream, 0, sizeof(zstream));
+		zstream.next_in = raw;
+		zstream.avail_in = 2;
+		zlib->init(&zstream, 16+MAX_WBITS, ZLIB_VERSION, sizeof(z_stream));
+		gzipped = JNI_TRUE;
+		streamEnded = JNI_FALSE;
+	} else if (n > 0) {
+		memcpy(data+dataEnd, raw, n);
+		dataEnd += n;
+	}
+	return JNI_TRUE;
+}
+
+static const char* inputName() {
+	return inputCount ? inputs[nextInput-1] : "stdin";
+}
+
+/*
+ * Decompresses gzip input to data[dataEnd..dataSize). Returns the number
+ * of bytes, 0 at the end of the input, -1 on errors.
+ */
+static ssize_t inflateInput(JNIEnv* env) {
+	for (;;) {
+		int status;
+		size_t n;
+		if (zstream.avail_in == 0) {
+			ssize_t r = read(inputFd, raw, pipeBlock);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				throwIO(env, "cannot read", inputName());
+				return -1;
+			}
+			if (r == 0) {
+				errno = EINVAL;
+				throwIO(env, "truncated gzip data in", inputName());
+				return -1;
+			}
+			zstream.next_in = raw;
+			zstream.avail_in = r;
+		}
+		zstream.next_out = (unsigned char*) data+dataEnd;
+		zstream.avail_out = dataSize-dataEnd;
+		status = zlib->inflate(&zstream, Z_NO_FLUSH);
+		n = (dataSize-dataEnd) - zstream.avail_out;
+		if (status == Z_STREAM_END) {
+			/* concatenated members, as gzip writes them for gzip -c a b >c */
+			ssize_t r = zstream.avail_in;
+			unsigned char* next = zstream.next_in;
+			if (r == 0) {
+				while ((r = read(inputFd, raw, pipeBlock)) < 0 && errno == EINTR);
+				next = raw;
+			}
+			if (r <= 0) {
+				streamEnded = JNI_TRUE;
+				return n;
+			}
+			zlib->end(&zstream);
+			memset(&zstream, 0, sizeof(zstream));
+			zlib->init(&zstream, 16+MAX_WBITS, ZLIB_VERSION, sizeof(z_stream));
+			zstream.next_in = next;
+			zstream.avail_in = r;
+		} else if (status != Z_OK && status != Z_BUF_ERROR) {
+			errno = EINVAL;
+			throwIO(env, "corrupt gzip data in", inputName());
+			return -1;
+		}
+		if (n > 0)
+			return n;
+	}
+}
+
+/*
+ * Appends input to data[dataEnd..dataSize). Returns the number of bytes
+ * appended, 0 at the end of all inputs, -1 on errors.
+ */
+static ssize_t fill(JNIEnv* env) {
+	ssize_t n;
+	size_t before = dataEnd;
+	while (inputFd >= 0 || openInput(env)) {
+		if (dataEnd > before)
+			return dataEnd-before;  /* the magic of a plain file */
+		if (gzipped) {
+			n = streamEnded ? 0 : inflateInput(env);
+		} else {
+			while ((n = read(inputFd, data+dataEnd, dataSize-dataEnd)) < 0 && errno == EINTR);
+			if (n < 0)
+				throwIO(env, "cannot read", inputName());
+		}
+		if (n < 0)
+			return -1;
+		if (n > 0) {
+			dataEnd += n;
+			return n;
+		}
+		closeInput();
+		if (dataEnd > 0 && data[dataEnd-1] != '\n') {
+			/* don't join the last line of an input with the first of the next */
+			data[dataEnd++] = '\n';
+			return 1;
+		}
+	}
+	return (*env)->ExceptionCheck(env) ? -1 : 0;
+}
+
+/* A String of the UTF-8 line s[0..len), invalid bytes become U+FFFD. */
+static jstring lineString(JNIEnv* env, char* s, size_t len) {
+	size_t i;
+	jsize n;
+	for (i = 0; i < len && !(s[i] & 0x80) && s[i]; ++i);
+	if (i == len) {
+		char c = s[len];
+		jstring result;
+		s[len] = 0;
+		result = (*env)->NewStringUTF(env, s);
+		s[len] = c;
+		return result;
+	}
+	if (charsSize < len) {
+		charsSize = len;
+		chars = realloc(chars, charsSize*sizeof(jchar));
+	}
+	n = DecodeUtf8(s, len, chars);
+	return (*env)->NewString(env, chars, n);
+}
+
+static void JNICALL pipeOpen(JNIEnv* env, jclass cls, jobjectArray files) {
+	int i;
+	inputCount = files ? (*env)->GetArrayLength(env, files) : 0;
+	inputs = malloc((inputCount+1)*sizeof(char*));
+	for (i = 0; i < inputCount; ++i) {
+		jstring file = (*env)->GetObjectArrayElement(env, files, i);
+		char* path = GetStringUtf8(env, file);
+		if (path == NULL) {
+			//stop with the exception pending, close is not called then
+			if (!(*env)->ExceptionCheck(env))
+				ThrowNative(env, "java/lang/NullPointerException", "NativePipe.open: null file name");
+			while (--i >= 0)
+				JLI_MemFree(inputs[i]);
+			free(inputs);
+			inputs = NULL;
+			inputCount = 0;
+			return;
+		}
+		inputs[i] = path;
+		(*env)->DeleteLocalRef(env, file);
+	}
+	nextInput = 0;
+	dataSize = pipeBlock;
+	data = malloc(dataSize+1);
+	dataStart = dataEnd = 0;
+	out = malloc(pipeBlock);
+	outEnd = 0;
+	if (stringClass == NULL) {
+		jclass local = (*env)->FindClass(env, "java/lang/String");
+		stringClass = (*env)->NewGlobalRef(env, local);
+		(*env)->DeleteLocalRef(env, local);
+	}
+}
+
+/* Returns the next batch of lines, null at the end of the input. */
+static jobjectArray JNICALL pipeRead(JNIEnv* env, jclass cls) {
+	size_t offsets[pipeBatch], lengths[pipeBatch];
+	size_t pos;
+	int count = 0, i;
+	jboolean ended = JNI_FALSE;
+	jobjectArray batch;
+	if (data == NULL) {
+		ThrowNative(env, "java/lang/IllegalStateException", "NativePipe.open was not called");
+		return NULL;
+	}
+	while (count == 0 && !ended) {
+		char* nl = memchr(data+dataStart, '\n', dataEnd-dataStart);
+		if (nl == NULL) {
+			ssize_t n;
+			if (dataStart > 0) {
+				memmove(data, data+dataStart, dataEnd-dataStart);
+				dataEnd -= dataStart;
+				dataStart = 0;
+			}
+			if (dataSize-dataEnd < 2) {
+				/* a line longer than the buffer; 2 for the gzip magic */
+				dataSize *= 2;
+				data = realloc(data, dataSize+1);
+			}
+			n = fill(env);
+			if (n < 0)
+				return NULL;
+			ended = n == 0;
+			if (!ended)
+				continue;
+		}
+		/* all complete lines in the buffer, and the last one at the end */
+		for (pos = dataStart; count < pipeBatch && pos < dataEnd; ++count) {
+			nl = memchr(data+pos, '\n', dataEnd-pos);
+			if (nl == NULL && !ended)
+				break;
+			offsets[count] = pos;
+			lengths[count] = (nl ? nl-data : dataEnd) - pos;
+			pos += lengths[count] + (nl ? 1 : 0);
+		}
+		dataStart = pos;
+	}
+	if (count == 0)
+		return NULL;
+	batch = (*env)->NewObjectArray(env, count, stringClass, NULL);
+	for (i = 0; batch != NULL && i < count; ++i) {
+		jstring line = lineString(env, data+offsets[i], lengths[i]);
+		if (line == NULL)
+			return NULL;
+		(*env)->SetObjectArrayElement(env, batch, i, line);
+		(*env)->DeleteLocalRef(env, line);
+	}
+	return batch;
+}
+
+static jboolean flushOut(JNIEnv* env) {
+	size_t done = 0;
+	while (done < outEnd) {
+		ssize_t n = write(1, out+done, outEnd-done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			outEnd = 0;
+			throwIO(env, "cannot write", "stdout");
+			return JNI_FALSE;
+		}
+		done += n;
+	}
+	outEnd = 0;
+	return JNI_TRUE;
+}
+
+/* Appends text as UTF-8 to the output buffer. */
+static void JNICALL pipeWrite(JNIEnv* env, jclass cls, jstring text) {
+	jchar buf[4096];
+	jsize length, start, n;
+	if (text == NULL || out == NULL)
+		return;
+	length = (*env)->GetStringLength(env, text);
+	for (start = 0; start < length; start += n) {
+		n = length-start < 4096 ? length-start : 4096;
+		(*env)->GetStringRegion(env, text, start, n, buf);
+		if (n > 1 && buf[n-1] >= 0xD800 && buf[n-1] < 0xDC00)
+			--n;  /* keep surrogate pairs together */
+		if (outEnd+3*n > pipeBlock && !flushOut(env))
+			return;
+		outEnd += EncodeUtf8(buf, n, out+outEnd);
+	}
+}
+
+/* Flushes the output and releases the input. */
+static void JNICALL pipeClose(JNIEnv* env, jclass cls) {
+	int i;
+	if (out != NULL)
+		flushOut(env);
+	if (inputFd >= 0)
+		closeInput();
+	for (i = 0; i < inputCount; ++i)
+		JLI_MemFree(inputs[i]);
+	free(inputs);
+	free(data);
+	free(out);
+	free(raw);
+	inputs = NULL;
+	data = out = NULL;
+	raw = NULL;
+	inputCount = 0;
+}
+
+static const JNINativeMethod nativePipeMethods[] = {
+	{"open", "([Ljava/lang/String;)V", (void*) pipeOpen},
+	{"read", "()[Ljava/lang/String;", (void*) pipeRead},
+	{"write", "(Ljava/lang/String;)V", (void*) pipeWrite},
+	{"close", "()V", (void*) pipeClose}
+};
+
+const NativeClass nativePipeClass = {
+	"lijy/NativePipe",
+	nativePipeMethods, sizeof(nativePipeMethods)/sizeof(nativePipeMethods[0]),
+	NULL, 0
+};
+
+#else
+
+static const char* pipeDriverCode =
+	"import sys\n"
+	"from %s import %s as _pipe_function\n"
+	"for line in sys.stdin:\n"
+	"    out = _pipe_function([line.rstrip('\\n')])\n"
+	"    if out is not None:\n"
+	"        for o in out:\n"
+	"            sys.stdout.write(o + '\\n')\n";
+
+const NativeClass nativePipeClass = {"lijy/NativePipe", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
+
+/*
+ * Returns the -c code that runs --pipe spec, i.e. module:function.
+ * Caller is responsible to call free on return value.
+ */
+char* pipeDriver(const char* spec) {
+	const char* colon = strchr(spec, ':');
+	size_t i;
+	char* result;
+	if (colon == NULL || colon == spec || colon[1] == 0)
+		bad_option("Argument for --pipe must be module:function\n");
+	for (i = 0; spec[i]; ++i) {
+		if (!isalnum((unsigned char) spec[i]) && spec[i] != '_'
+				&& (spec[i] != '.' || spec+i > colon) && spec+i != colon)
+			bad_option("Argument for --pipe must be module:function\n");
+	}
+	result = malloc(strlen(pipeDriverCode)+strlen(spec));
+	{
+		char module[colon-spec+1];
+		memcpy(module, spec, colon-spec);
+		module[colon-spec] = 0;
+		sprintf(result, pipeDriverCode, module, colon+1);
+	}
+	return result;
+}
@@ -0,0 +1,310 @@
+/*
+ * jyposix.c
+ *
+ * Natives of lijy.NativePosix (see jynative.c): the POSIX calls scripts
+ * make most, without jnr-posix. Jython's os module goes through
+ * jnr-posix, which on its first use loads jnr-ffi and generates and
+ * links the stubs for libc, a noticeable part of a short script's run.
+ * These natives are plain calls into the launcher's libc.
+ * lib/lijyposix.py offers them as os-style functions.
+ *
+ * Calls that can fail return null (or -1, or false for access) and
+ * leave the error in errno(), of the calling thread, for the caller to
+ * raise OSError with; no Java exception is created.
+ *
+ *   long[] stat(String path, boolean follow)   null on errors
+ *   long[] fstat(int fd)
+ *     mode, ino, dev, nlink, uid, gid, size, then seconds and
+ *     nanoseconds of atime, mtime and ctime: STAT_LENGTH longs.
+ *   String[] listdir(String path)              without . and ..
+ *   String[] environ()                         "NAME=value"
+ *   String[] uname()                           sysname ... machine
+ *   boolean access(String path, int mode)
+ *   boolean isatty(int fd)
+ *   int umask(int mask)
+ *   int getpid(), getppid(), getuid(), geteuid(), getgid(), getegid()
+ *   int errno()
+ *   String strerror(int errno)
+ * Paths are passed as UTF-8, file names are decoded from UTF-8 and
+ * undecodable bytes become U+FFFD.
+ */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#define statLength 13
+
+extern char **environ;
+
+static __thread int lastErrno = 0;
+
+static jlongArray
+StatArray(JNIEnv *env, const struct stat *st)
+{
+	jlong fields[statLength];
+	jlongArray result;
+	fields[0] = st->st_mode;
+	fields[1] = st->st_ino;
+	fields[2] = st->st_dev;
+	fields[3] = st->st_nlink;
+	fields[4] = st->st_uid;
+	fields[5] = st->st_gid;
+	fields[6] = st->st_size;
+	fields[7] = st->st_atim.tv_sec;
+	fields[8] = st->st_atim.tv_nsec;
+	fields[9] = st->st_mtim.tv_sec;
+	fields[10] = st->st_mtim.tv_nsec;
+	fields[11] = st->st_ctim.tv_sec;
+	fields[12] = st->st_ctim.tv_nsec;
+	result = (*env)->NewLongArray(env, statLength);
+	if (result != NULL)
+		(*env)->SetLongArrayRegion(env, result, 0, statLength, fields);
+	return result;
+}
+
+/* A String[] of count NUL-terminated strings packed at s. */
+static jobjectArray
+NewStringArray(JNIEnv *env, const char *s, int count)
+{
+	jclass stringClass = (*env)->FindClass(env, "java/lang/String");
+	jobjectArray result;
+	int i;
+	if (stringClass == NULL)
+		return NULL;
+	result = (*env)->NewObjectArray(env, count, stringClass, NULL);
+	(*env)->DeleteLocalRef(env, stringClass);
+	for (i = 0; result != NULL && i < count; ++i) {
+		size_t len = JLI_StrLen(s);
+		jstring str = NewStringUtf8(env, s, len);
+		if (str == NULL)
+			return NULL;
+		(*env)->SetObjectArrayElement(env, result, i, str);
+		(*env)->DeleteLocalRef(env, str);
+		s += len + 1;
+	}
+	return result;
+}
+
+static jlongArray JNICALL
+NativePosix_stat(JNIEnv *env, jclass cls, jstring path, jboolean follow)
+{
+	struct stat st;
+	char *p;
+	int rc;
+	if ((p = GetStringUtf8(env, path)) == NULL) {
+		lastErrno = EFAULT;
+		return NULL;
+	}
+	rc = follow ? stat(p, &st) : lstat(p, &st);
+	lastErrno = errno;
+	JLI_MemFree(p);
+	return rc == 0 ? StatArray(env, &st) : NULL;
+}
+
+static jlongArray JNICALL
+NativePosix_fstat(JNIEnv *env, jclass cls, jint fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		lastErrno = errno;
+		return NULL;
+	}
+	return StatArray(env, &st);
+}
+
+static jobjectArray JNICALL
+NativePosix_listdir(JNIEnv *env, jclass cls, jstring path)
+{
+	char *p;
+	char *names = NULL;
+	size_t length = 0, capacity = 0;
+	int count = 0;
+	struct dirent *entry;
+	jobjectArray result;
+	DIR *dir;
+
+	if ((p = GetStringUtf8(env, path)) == NULL) {
+		lastErrno = EFAULT;
+		return NULL;
+	}
+	dir = opendir(p);
+	lastErrno = errno;
+	JLI_MemFree(p);
+	if (dir == NULL)
+		return NULL;
+	errno = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = JLI_StrLen(entry->d_name) + 1;
+		if (entry->d_name[0] == '.' && (entry->d_name[1] == 0
+				|| (entry->d_name[1] == '.' && entry->d_name[2] == 0)))
+			continue;
+		if (length + len > capacity) {
+			capacity = capacity ? 2*capacity + len : 4096;
+			names = JLI_MemRealloc(names, capacity);
+		}
+		memcpy(names + length, entry->d_name, len);
+		length += len;
+		++count;
+	}
+	lastErrno = errno;
+	closedir(dir);
+	result = lastErrno == 0 ? NewStringArray(env, names, count) : NULL;
+	if (names != NULL)
+		JLI_MemFree(names);
+	return result;
+}
+
+static jobjectArray JNICALL
+NativePosix_environ(JNIEnv *env, jclass cls)
+{
+	size_t length = 0;
+	char *packed, *s;
+	jobjectArray result;
+	int count;
+	for (count = 0; environ[count] != NULL; ++count)
+		length += JLI_StrLen(environ[count]) + 1;
+	packed = JLI_MemAlloc(length + 1);
+	for (count = 0, s = packed; environ[count] != NULL; ++count)
+		s = stpcpy(s, environ[count]) + 1;
+	result = NewStringArray(env, packed, count);
+	JLI_MemFree(packed);
+	return result;
+}
+
+static jobjectArray JNICALL
+NativePosix_uname(JNIEnv *env, jclass cls)
+{
+	struct utsname u;
+	char packed[sizeof(u)], *s = packed;
+	if (uname(&u) != 0) {
+		lastErrno = errno;
+		return NULL;
+	}
+	s = stpcpy(s, u.sysname) + 1;
+	s = stpcpy(s, u.nodename) + 1;
+	s = stpcpy(s, u.release) + 1;
+	s = stpcpy(s, u.version) + 1;
+	stpcpy(s, u.machine);
+	return NewStringArray(env, packed, 5);
+}
+
+static jboolean JNICALL
+NativePosix_access(JNIEnv *env, jclass cls, jstring path, jint mode)
+{
+	char *p;
+	int rc;
+	if ((p = GetStringUtf8(env, path)) == NULL) {
+		lastErrno = EFAULT;
+		return JNI_FALSE;
+	}
+	rc = access(p, mode);
+	lastErrno = errno;
+	JLI_MemFree(p);
+	return rc == 0 ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean JNICALL
+NativePosix_isatty(JNIEnv *env, jclass cls, jint fd)
+{
+	return isatty(fd) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jint JNICALL
+NativePosix_umask(JNIEnv *env, jclass cls, jint mask)
+{
+	return (jint) umask((mode_t) mask);
+}
+
+static jint JNICALL
+NativePosix_getpid(JNIEnv *env, jclass cls)
+{
+	return (jint) getpid();
+}
+
+static jint JNICALL
+NativePosix_getppid(JNIEnv *env, jclass cls)
+{
+	return (jint) getppid();
+}
+
+static jint JNICALL
+NativePosix_getuid(JNIEnv *env, jclass cls)
+{
+	return (jint) getuid();
+}
+
+static jint JNICALL
+NativePosix_geteuid(JNIEnv *env, jclass cls)
+{
+	return (jint) geteuid();
+}
+
+static jint JNICALL
+NativePosix_getgid(JNIEnv *env, jclass cls)
+{
+	return (jint) getgid();
+}
+
+static jint JNICALL
+NativePosix_getegid(JNIEnv *env, jclass cls)
+{
+	return (jint) getegid();
+}
+
+static jint JNICALL
+NativePosix_errno(JNIEnv *env, jclass cls)
+{
+	return lastErrno;
+}
+
+static jstring JNICALL
+NativePosix_strerror(JNIEnv *env, jclass cls, jint code)
+{
+	return (*env)->NewStringUTF(env, strerror(code));
+}
+
+static const JNINativeMethod nativePosixMethods[] = {
+	{"stat", "(Ljava/lang/String;Z)[J", (void *) NativePosix_stat},
+	{"fstat", "(I)[J", (void *) NativePosix_fstat},
+	{"listdir", "(Ljava/lang/String;)[Ljava/lang/String;", (void *) NativePosix_listdir},
+	{"environ", "()[Ljava/lang/String;", (void *) NativePosix_environ},
+	{"uname", "()[Ljava/lang/String;", (void *) NativePosix_uname},
+	{"access", "(Ljava/lang/String;I)Z", (void *) NativePosix_access},
+	{"isatty", "(I)Z", (void *) NativePosix_isatty},
+	{"umask", "(I)I", (void *) NativePosix_umask},
+	{"getpid", "()I", (void *) NativePosix_getpid},
+	{"getppid", "()I", (void *) NativePosix_getppid},
+	{"getuid", "()I", (void *) NativePosix_getuid},
+	{"geteuid", "()I", (void *) NativePosix_geteuid},
+	{"getgid", "()I", (void *) NativePosix_getgid},
+	{"getegid", "()I", (void *) NativePosix_getegid},
+	{"errno", "()I", (void *) NativePosix_errno},
+	{"strerror", "(I)Ljava/lang/String;", (void *) NativePosix_strerror}
+};
+
+static const NativeConstant nativePosixConstants[] = {
+	{"STAT_LENGTH", statLength},
+	{"F_OK", F_OK},
+	{"R_OK", R_OK},
+	{"W_OK", W_OK},
+	{"X_OK", X_OK}
+};
+
+const NativeClass nativePosixClass = {
+	"lijy/NativePosix",
+	nativePosixMethods, sizeof(nativePosixMethods) / sizeof(nativePosixMethods[0]),
+	nativePosixConstants, sizeof(nativePosixConstants) / sizeof(nativePosixConstants[0])
+};
+
+#else
+
+const NativeClass nativePosixClass = {"lijy/NativePosix", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
@@ -0,0 +1,367 @@
+/*
+ * jyprefetch.c
+ *
+ * Learned prefetch lists per script (launcher option --profile-files).
+ *
+ * Besides the files the launcher knows about, a Jython application
+ * reads hundreds of others while it starts: jars, stdlib .py and
+ * $py.class files, site-packages, the registry. With --profile-files
+ * the launcher records which of them are read while it starts, i.e.
+ * until JavaMain calls Jython's main (see stopFileProfile), and at which
+ * offsets, into the script's file profile in the launcher cache (see
+ * jycache.c). Later launches of the script read the profile at
+ * JLI_Launch entry and have prefetchThreads threads pull the recorded
+ * ranges into the page cache with readahead(2), in parallel to
+ * discovery and JVM creation, like a boot prefetcher does for the
+ * system.
+ *
+ * Recording works by interposition: the launcher is linked with
+ * --export-dynamic (for the built-in agent, see jyagent.c), so the
+ * open and read functions defined here take precedence over libc's for
+ * libjvm, libjava and libzip. Outside of a recording they pass straight
+ * through. libjylaunch.so is built without them (JYLAUNCH_LIBRARY, see
+ * the makefile): they must not take over the I/O of a host program, so
+ * the library only prefetches. Reads are recorded in chunks of
+ * profileChunk bytes; mmap'ed files (e.g. lib/modules) are not
+ * recorded, the JVM maps far more of them than it touches.
+ *
+ * The profile has a line "<offset> <length> <path>" per range.
+ */
+
+#define _GNU_SOURCE /* RTLD_NEXT, readahead */
+/* the fortified read and open are inline wrappers that clash with the definitions below */
+#undef _FORTIFY_SOURCE
+#include "jython.h"
+#include "jycache.h"
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#define profileHeader "# LiJy file profile v1: <offset> <length> <path>\n"
+#define profileChunk (64*1024)
+#define maxProfileFiles 4096
+#define maxProfileFds 4096
+#define prefetchThreads 4
+
+typedef struct {
+	char* path;
+	unsigned long long hash;
+	unsigned char* chunks;  /* bitmap of read chunks */
+	long chunkCount;        /* bits in chunks */
+} ProfiledFile;
+
+typedef struct {
+	char* path;
+	off_t offset;
+	size_t length;
+} PrefetchRange;
+
+static PrefetchRange* ranges = NULL;
+static int rangeCount = 0, nextRange = 0;
+
+#ifndef JYLAUNCH_LIBRARY
+
+static volatile int recording = 0;
+static char* profilePath = NULL;
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static ProfiledFile* files = NULL;
+static int fileCount = 0;
+static int fdFiles[maxProfileFds]; /* fd -> index in files + 1, 0 if untracked */
+
+static int (*realOpen)(const char *, int, ...) = NULL;
+static int (*realOpenat)(int, const char *, int, ...) = NULL;
+static ssize_t (*realRead)(int, void *, size_t) = NULL;
+static ssize_t (*realPread)(int, void *, size_t, off_t) = NULL;
+static int (*realClose)(int) = NULL;
+
+static void resolveReal() {
+	if (realRead == NULL) {
+		realOpen = dlsym(RTLD_NEXT, "open64");
+		realOpenat = dlsym(RTLD_NEXT, "openat64");
+		realPread = dlsym(RTLD_NEXT, "pread64");
+		realClose = dlsym(RTLD_NEXT, "close");
+		realRead = dlsym(RTLD_NEXT, "read");
+	}
+}
+
+/* Starts tracking fd as path. Called with profileLock held. */
+static void trackOpen(int fd, const char* path) {
+	struct stat st;
+	unsigned long long hash;
+	int i;
+	if (fd < 0 || fd >= maxProfileFds || path[0] != '/'
+			|| strncmp(path, "/proc/", 6) == 0 || strncmp(path, "/sys/", 5) == 0
+			|| strncmp(path, "/dev/", 5) == 0
+			|| fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return;
+	hash = jyHash(path);
+	for (i = 0; i < fileCount; ++i) {
+		if (files[i].hash == hash && strcmp(files[i].path, path) == 0)
+			break;
+	}
+	if (i == fileCount) {
+		if (fileCount == maxProfileFiles)
+			return;
+		if (fileCount % 64 == 0)
+			files = realloc(files, (fileCount+64)*sizeof(ProfiledFile));
+		files[i].path = strdup(path);
+		files[i].hash = hash;
+		files[i].chunks = NULL;
+		files[i].chunkCount = 0;
+		++fileCount;
+	}
+	fdFiles[fd] = i+1;
+}
+
+/* Marks the chunks of [offset, offset+length) as read. */
+static void trackRead(int fd, off_t offset, ssize_t length) {
+	ProfiledFile* file;
+	long first, last, c;
+	if (fd < 0 || fd >= maxProfileFds || length <= 0 || offset < 0)
+		return;
+	pthread_mutex_lock(&profileLock);
+	if (fdFiles[fd]) {
+		file = &files[fdFiles[fd]-1];
+		first = offset/profileChunk;
+		last = (offset+length-1)/profileChunk;
+		if (last >= file->chunkCount) {
+			long count = (last/64+1)*64;
+			file->chunks = realloc(file->chunks, count/8);
+			memset(file->chunks+file->chunkCount/8, 0, (count-file->chunkCount)/8);
+			file->chunkCount = count;
+		}
+		for (c = first; c <= last; ++c)
+			file->chunks[c/8] |= 1 << (c%8);
+	}
+	pthread_mutex_unlock(&profileLock);
+}
+
+static int interposedOpen(int dirfd, const char* path, int flags, mode_t mode) {
+	int fd;
+	resolveReal();
+	fd = dirfd == AT_FDCWD ? realOpen(path, flags, mode) : realOpenat(dirfd, path, flags, mode);
+	if (recording && fd >= 0 && (flags & O_ACCMODE) == O_RDONLY) {
+		pthread_mutex_lock(&profileLock);
+		trackOpen(fd, path);
+		pthread_mutex_unlock(&profileLock);
+	}
+	return fd;
+}
+
+/* O_TMPFILE includes O_DIRECTORY, so it is tested like glibc does */
+#define modeArg(flags, mode) \
+	if (((flags) & O_CREAT) || ((flags) & O_TMPFILE) == O_TMPFILE) { \
+		va_list ap; \
+		va_start(ap, flags); \
+		mode = va_arg(ap, int); \
+		va_end(ap); \
+	}
+
+JNIEXPORT int open(const char* path, int flags, ...) {
+	mode_t mode = 0;
+	modeArg(flags, mode);
+	return interposedOpen(AT_FDCWD, path, flags, mode);
+}
+
+JNIEXPORT int open64(const char* path, int flags, ...) {
+	mode_t mode = 0;
+	modeArg(flags, mode);
+	return interposedOpen(AT_FDCWD, path, flags, mode);
+}
+
+JNIEXPORT int openat(int dirfd, const char* path, int flags, ...) {
+	mode_t mode = 0;
+	modeArg(flags, mode);
+	return interposedOpen(dirfd, path, flags, mode);
+}
+
+JNIEXPORT int openat64(int dirfd, const char* path, int flags, ...) {
+	mode_t mode = 0;
+	modeArg(flags, mode);
+	return interposedOpen(dirfd, path, flags, mode);
+}
+
+JNIEXPORT ssize_t read(int fd, void* buf, size_t count) {
+	off_t offset = -1;
+	ssize_t result;
+	resolveReal();
+	if (!recording)
+		return realRead(fd, buf, count);
+	if (fd >= 0 && fd < maxProfileFds && fdFiles[fd])
+		offset = lseek(fd, 0, SEEK_CUR);
+	result = realRead(fd, buf, count);
+	if (offset >= 0)
+		trackRead(fd, offset, result);
+	return result;
+}
+
+JNIEXPORT ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+	ssize_t result;
+	resolveReal();
+	result = realPread(fd, buf, count, offset);
+	if (recording)
+		trackRead(fd, offset, result);
+	return result;
+}
+
+JNIEXPORT ssize_t pread64(int fd, void* buf, size_t count, off64_t offset) {
+	return pread(fd, buf, count, offset);
+}
+
+JNIEXPORT int close(int fd) {
+	resolveReal();
+	if (recording && fd >= 0 && fd < maxProfileFds)
+		fdFiles[fd] = 0;
+	return realClose(fd);
+}
+
+/*
+ * Writes the file profile, to a temporary file first: a concurrent launch
+ * of the script may be reading it.
+ */
+static void writeFileProfile() {
+	FILE* fp;
+	long c, start;
+	int i, written = 0;
+	int len = strlen(profilePath)+24;
+	char tmp[len];
+	snprintf(tmp, len, "%s.%ld", profilePath, (long) getpid());
+	pthread_mutex_lock(&profileLock);
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		pthread_mutex_unlock(&profileLock);
+		return;
+	}
+	fputs(profileHeader, fp);
+	for (i = 0; i < fileCount; ++i) {
+		ProfiledFile* file = &files[i];
+		if (file->chunkCount == 0) {
+			/* opened, but not read: the inode and first page are still worth it */
+			fprintf(fp, "0 0 %s\n", file->path);
+			++written;
+			continue;
+		}
+		for (c = 0; c < file->chunkCount; ) {
+			if (!(file->chunks[c/8] & (1 << (c%8)))) {
+				++c;
+				continue;
+			}
+			for (start = c; c < file->chunkCount && (file->chunks[c/8] & (1 << (c%8))); ++c);
+			fprintf(fp, "%ld %ld %s\n", start*profileChunk, (c-start)*profileChunk, file->path);
+			++written;
+		}
+	}
+	if (fclose(fp) != 0 || rename(tmp, profilePath) != 0)
+		unlink(tmp);
+	pthread_mutex_unlock(&profileLock);
+	JLI_TraceLauncher("file profile %s: %d ranges of %d files recorded\n",
+			profilePath, written, fileCount);
+}
+
+/*
+ * Ends the recording and writes the profile. Called by JavaMain before it
+ * calls Jython's main, and at exit for launches that end before.
+ */
+void stopFileProfile() {
+	if (!recording)
+		return;
+	recording = 0;
+	writeFileProfile();
+}
+
+#else
+
+void stopFileProfile() {
+}
+
+#endif /* JYLAUNCH_LIBRARY */
+
+static void* prefetchWorker(void* unused) {
+	int i, fd;
+	while ((i = __sync_fetch_and_add(&nextRange, 1)) < rangeCount) {
+		fd = open(ranges[i].path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		readahead(fd, ranges[i].offset, ranges[i].length ? ranges[i].length : 4096);
+		close(fd);
+	}
+	return NULL;
+}
+
+/* Reads the profile and starts the workers, on a thread of its own. */
+static void* prefetchMain(void* arg) {
+	char* path = arg;
+	char line[PATH_MAX+64];
+	long long offset, length;
+	int off, i;
+	pthread_t worker;
+	pthread_attr_t attr;
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL) {
+		free(path);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || sscanf(line, "%lld %lld %n", &offset, &length, &off) != 2)
+			continue;
+		line[strcspn(line, "\n")] = 0;
+		if (rangeCount % 256 == 0)
+			ranges = realloc(ranges, (rangeCount+256)*sizeof(PrefetchRange));
+		ranges[rangeCount].path = strdup(line+off);
+		ranges[rangeCount].offset = (off_t) offset;
+		ranges[rangeCount++].length = (size_t) length;
+	}
+	fclose(fp);
+	JLI_TraceLauncher("file profile %s: prefetching %d ranges\n", path, rangeCount);
+	free(path);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 1; i < prefetchThreads; ++i)
+		pthread_create(&worker, &attr, prefetchWorker, NULL);
+	pthread_attr_destroy(&attr);
+	prefetchWorker(NULL);
+	return NULL;
+}
+
+/*
+ * Called at JLI_Launch entry: starts recording the script's file profile
+ * if --profile-files was given, otherwise starts prefetching the files of
+ * an existing profile in the background.
+ */
+void startPrefetch(JySetup* setup) {
+	pthread_t thread;
+	pthread_attr_t attr;
+	if (!setup->fileProfile || setup->print_requested || setup->help)
+		return;
+	if (setup->profileFiles) {
+#ifndef JYLAUNCH_LIBRARY
+		resolveReal();
+		profilePath = strdup(setup->fileProfile);
+		recording = 1;
+		atexit(stopFileProfile);
+#else
+		JLI_TraceLauncher("file profile: not recorded by libjylaunch\n");
+#endif
+		return;
+	}
+	if (access(setup->fileProfile, R_OK) != 0)
+		return;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&thread, &attr, prefetchMain, strdup(setup->fileProfile));
+	pthread_attr_destroy(&attr);
+}
+
+#else
+
+void startPrefetch(JySetup* setup) {
+}
+
+void stopFileProfile() {
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,138 @@
+/*
+ * jypreload.c
+ *
+ * Once the JVM is created, JavaMain loads the main class and runs the
+ * Jython bootstrap on a single thread, although most cores are idle
+ * then. With --preload-classes the launcher starts daemon threads,
+ * attached to the JVM, that load the classes of a class list while the
+ * main thread goes on. When the main thread gets to a class, it is
+ * defined already (or being defined, then it waits for it instead of
+ * defining it a second time).
+ *
+ * The list is either given as --preload-classes=<file> or learned: runs
+ * with --profile-classes, and runs with --preload-classes while there is
+ * no list yet, have the built-in agent (see jyagent.c) write the names
+ * of the classes loaded from the classpath, in load order, to the
+ * script's class list in the launcher cache.
+ *
+ * Classes are loaded with Class.forName(name, false, system loader),
+ * i.e. not initialized. Jython's static initializers depend on each
+ * other in cycles (PyObject, PyType, ...), and initializing them on
+ * several threads in another order than the main thread risks a class
+ * initialization deadlock. Loading, i.e. reading, parsing and defining,
+ * is the bulk of the work anyway.
+ *
+ * The number of threads is taken from JYTHON_PRELOAD_THREADS, default
+ * is one less than the online cores, at most maxPreloadThreads.
+ * The list file has one binary class name (e.g. org.python.core.Py)
+ * per line; lines starting with # are ignored.
+ */
+
+#include "java.h"
+#include "jypreload.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define maxPreloadThreads 8
+#define maxPreloadClasses 65536
+
+static JavaVM *preloadVM = NULL;
+static char **classNames = NULL;
+static int classCount = 0;
+static int nextClass = 0;
+
+/* Reads the class list, returns the number of classes. */
+static int
+ReadClassList(const char *list)
+{
+	char line[1024];
+	int max = 0;
+	FILE *fp = fopen(list, "r");
+	if (fp == NULL)
+		return 0;
+	while (classCount < maxPreloadClasses && fgets(line, sizeof(line), fp)) {
+		line[JLI_StrCSpn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+		if (classCount == max) {
+			max = max == 0 ? 512 : 2*max;
+			classNames = JLI_MemRealloc(classNames, max*sizeof(char *));
+		}
+		classNames[classCount++] = JLI_StringDup(line);
+	}
+	fclose(fp);
+	return classCount;
+}
+
+static int
+PreloadThreadCount()
+{
+	char *env = getenv(preloadThreadsEnv);
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int count = env != NULL ? atoi(env) : (int) (cores-1);
+	if (count > maxPreloadThreads)
+		count = maxPreloadThreads;
+	return count;
+}
+
+static void *
+PreloadClasses(void *unused)
+{
+	JNIEnv *env;
+	jclass classClass, loaderClass;
+	jmethodID forName, getSystemLoader;
+	jobject loader;
+	int i;
+	if ((*preloadVM)->AttachCurrentThreadAsDaemon(preloadVM, (void **) &env, NULL) != JNI_OK)
+		return NULL;
+	classClass = (*env)->FindClass(env, "java/lang/Class");
+	loaderClass = (*env)->FindClass(env, "java/lang/ClassLoader");
+	if (classClass == NULL || loaderClass == NULL)
+		goto done;
+	forName = (*env)->GetStaticMethodID(env, classClass, "forName",
+			"(Ljava/lang/String;ZLjava/lang/ClassLoader;)Ljava/lang/Class;");
+	getSystemLoader = (*env)->GetStaticMethodID(env, loaderClass,
+			"getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+	if (forName == NULL || getSystemLoader == NULL)
+		goto done;
+	loader = (*env)->CallStaticObjectMethod(env, loaderClass, getSystemLoader);
+	if ((*env)->ExceptionCheck(env))
+		goto done;
+	while ((i = __sync_fetch_and_add(&nextClass, 1)) < classCount) {
+		jstring name = (*env)->NewStringUTF(env, classNames[i]);
+		jobject cls = name == NULL ? NULL : (*env)->CallStaticObjectMethod(env,
+				classClass, forName, name, JNI_FALSE, loader);
+		if ((*env)->ExceptionCheck(env)) {
+			/* e.g. a class that was generated at runtime and is not on the classpath */
+			(*env)->ExceptionClear(env);
+		}
+		if (cls != NULL)
+			(*env)->DeleteLocalRef(env, cls);
+		if (name != NULL)
+			(*env)->DeleteLocalRef(env, name);
+	}
+done:
+	(*env)->ExceptionClear(env);
+	(*preloadVM)->DetachCurrentThread(preloadVM);
+	return NULL;
+}
+
+void
+StartClassPreload(JavaVM *vm, const char *list)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int threads = PreloadThreadCount(), i, started = 0;
+	if (threads < 1 || preloadVM != NULL || ReadClassList(list) == 0)
+		return;
+	preloadVM = vm;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&thread, &attr, PreloadClasses, NULL) == 0)
+			++started;
+	}
+	pthread_attr_destroy(&attr);
+	JLI_TraceLauncher("preloading %d classes from %s on %d threads\n",
+			classCount, list, started);
+}
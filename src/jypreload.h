@@ -0,0 +1,20 @@
+/*
+ * jypreload.h
+ *
+ * Concurrent class preloading, see jypreload.c.
+ */
+
+#ifndef JYPRELOAD_H_
+#define JYPRELOAD_H_
+
+#include <jni.h>
+
+#define preloadThreadsEnv "JYTHON_PRELOAD_THREADS"
+
+/*
+ * Starts background threads that load the classes listed in the file
+ * list while the caller goes on. Does nothing if list is unreadable.
+ */
+void StartClassPreload(JavaVM *vm, const char *list);
+
+#endif /* JYPRELOAD_H_ */
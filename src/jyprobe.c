@@ -0,0 +1,267 @@
+/*
+ * jyprobe.c
+ *
+ * Discovery asks the filesystem the same questions more than once:
+ * GetJREPath, GetJreLibPath and the JDK index all check lib/modules,
+ * GetJVMPath and the JDK index both stat libjvm, and so on. On NFS or
+ * in a container overlay every one of these is a round trip, so the
+ * launcher routes its probes through a small cache that lives for one
+ * launch. Failures are cached just like successes.
+ *
+ * Probes in the same directory add up, too, e.g. when a JDK is indexed
+ * (libjava, libjvm, classes.jsa and the layout checks). Once
+ * dirFdThreshold probes went to one directory, it is opened with O_PATH
+ * and further probes there are relative to that fd, so the kernel does
+ * not walk the whole path again. If the directory turns out not to
+ * exist, the remaining probes in it are answered without a syscall.
+ * The threshold is above the three probes a Jython home directory gets,
+ * so that the usual launch does not pay for the extra open.
+ *
+ * Only absolute paths are cached. The launcher does not create any of
+ * the files it probes, so nothing is invalidated during a launch.
+ * JLI_Launch calls ProbeCacheClear once discovery is done, before it
+ * loads the JVM, which closes the directory fds; a library host's next
+ * launch starts over.
+ */
+
+#define _GNU_SOURCE /* O_PATH */
+#include "java.h"
+#include "jycache.h"
+#include "jyprobe.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define probeSlots 256
+#define maxDirFds 16
+#define dirFdThreshold 4
+
+#ifndef O_PATH
+#define O_PATH O_RDONLY
+#endif
+
+enum probe_kind {
+	PROBE_STAT,
+	PROBE_ACCESS,
+	PROBE_REALPATH,
+	PROBE_DIR
+};
+
+typedef struct {
+	char *path;             /* NULL for a free slot */
+	unsigned long long hash;
+	int kind;
+	int mode;               /* PROBE_ACCESS */
+	int result;             /* 0 or -1, the fd or -1 for PROBE_DIR */
+	int err;
+	int probes;             /* PROBE_DIR: uncached probes in the directory */
+	struct stat st;         /* PROBE_STAT */
+	char *real;             /* PROBE_REALPATH */
+} ProbeEntry;
+
+static ProbeEntry probes[probeSlots];
+static int used = 0, dirFds = 0;
+static int hits = 0, misses = 0, shortcuts = 0;
+
+/*
+ * Returns the entry for path, which has a NULL path if it is not cached
+ * yet, or NULL if path is not cacheable or the table is full.
+ */
+static ProbeEntry *
+Lookup(int kind, int mode, const char *path)
+{
+	unsigned long long hash;
+	int i, slot;
+	if (path[0] != '/' || JLI_StrLen(path) >= PATH_MAX)
+		return NULL;
+	hash = jyHash(path) ^ ((unsigned long long) (kind*8 + mode) << 56);
+	slot = (int) (hash % probeSlots);
+	for (i = 0; i < probeSlots; ++i, slot = (slot+1) % probeSlots) {
+		ProbeEntry *entry = &probes[slot];
+		if (entry->path == NULL)
+			return used < probeSlots-1 ? entry : NULL;
+		if (entry->hash == hash && entry->kind == kind && entry->mode == mode
+				&& JLI_StrCmp(entry->path, path) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static void
+Insert(ProbeEntry *entry, int kind, int mode, const char *path)
+{
+	entry->path = JLI_StringDup(path);
+	entry->hash = jyHash(path) ^ ((unsigned long long) (kind*8 + mode) << 56);
+	entry->kind = kind;
+	entry->mode = mode;
+	entry->probes = 0;
+	entry->real = NULL;
+	++used;
+}
+
+/*
+ * Accounts for a probe of path. Returns an fd of its directory to probe
+ * *name relative to, -1 to probe the full path, or -2 if the directory
+ * is known not to exist.
+ */
+static int
+DirFor(const char *path, const char **name)
+{
+	char dir[PATH_MAX];
+	const char *sep = JLI_StrRChr(path, '/');
+	ProbeEntry *entry;
+	if (sep == NULL || sep == path || sep[1] == '\0')
+		return -1;
+	JLI_Snprintf(dir, sizeof(dir), "%.*s", (int) (sep-path), path);
+	entry = Lookup(PROBE_DIR, 0, dir);
+	if (entry == NULL)
+		return -1;
+	if (entry->path == NULL) {
+		Insert(entry, PROBE_DIR, 0, dir);
+		entry->result = -1;
+		entry->err = 0;
+	}
+	*name = sep+1;
+	if (entry->result >= 0)
+		return entry->result;
+	if (entry->err == ENOENT || entry->err == ENOTDIR)
+		return -2;
+	if (++entry->probes == dirFdThreshold && dirFds < maxDirFds) {
+		entry->result = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (entry->result >= 0) {
+			++dirFds;
+			return entry->result;
+		}
+		entry->err = errno;
+		if (entry->err == ENOENT || entry->err == ENOTDIR)
+			return -2;
+	}
+	return -1;
+}
+
+static int
+DoStat(const char *path, struct stat *st)
+{
+	const char *name;
+	int fd = DirFor(path, &name);
+	if (fd == -2) {
+		++shortcuts;
+		errno = ENOENT;
+		return -1;
+	}
+	return fd >= 0 ? fstatat(fd, name, st, 0) : stat(path, st);
+}
+
+static int
+DoAccess(const char *path, int mode)
+{
+	const char *name;
+	int fd = DirFor(path, &name);
+	if (fd == -2) {
+		++shortcuts;
+		errno = ENOENT;
+		return -1;
+	}
+	return fd >= 0 ? faccessat(fd, name, mode, 0) : access(path, mode);
+}
+
+int
+ProbeStat(const char *path, struct stat *st)
+{
+	ProbeEntry *entry = Lookup(PROBE_STAT, 0, path);
+	if (entry != NULL && entry->path != NULL) {
+		++hits;
+		if (entry->result == 0)
+			memcpy(st, &entry->st, sizeof(struct stat));
+		errno = entry->err;
+		return entry->result;
+	}
+	++misses;
+	if (entry == NULL)
+		return stat(path, st);
+	Insert(entry, PROBE_STAT, 0, path);
+	entry->result = DoStat(path, &entry->st);
+	entry->err = entry->result == 0 ? 0 : errno;
+	if (entry->result == 0)
+		memcpy(st, &entry->st, sizeof(struct stat));
+	errno = entry->err;
+	return entry->result;
+}
+
+jboolean
+ProbeExists(const char *path)
+{
+	struct stat st;
+	return ProbeStat(path, &st) == 0;
+}
+
+jboolean
+ProbeAccess(const char *path, int mode)
+{
+	ProbeEntry *entry;
+	if (mode == F_OK)
+		return ProbeExists(path);
+	entry = Lookup(PROBE_ACCESS, mode, path);
+	if (entry != NULL && entry->path != NULL) {
+		++hits;
+		return entry->result == 0;
+	}
+	++misses;
+	if (entry == NULL)
+		return access(path, mode) == 0;
+	Insert(entry, PROBE_ACCESS, mode, path);
+	entry->result = DoAccess(path, mode);
+	entry->err = entry->result == 0 ? 0 : errno;
+	return entry->result == 0;
+}
+
+char *
+ProbeRealpath(const char *path, char *resolved)
+{
+	ProbeEntry *entry = Lookup(PROBE_REALPATH, 0, path);
+	if (entry != NULL && entry->path != NULL) {
+		++hits;
+		if (entry->real == NULL) {
+			errno = entry->err;
+			return NULL;
+		}
+		return JLI_StrCpy(resolved, entry->real);
+	}
+	++misses;
+	if (entry == NULL)
+		return realpath(path, resolved);
+	Insert(entry, PROBE_REALPATH, 0, path);
+	if (realpath(path, resolved) != NULL) {
+		entry->real = JLI_StringDup(resolved);
+		entry->err = 0;
+		return resolved;
+	}
+	entry->err = errno;
+	return NULL;
+}
+
+void
+ProbeCacheClear()
+{
+	int i;
+	for (i = 0; i < probeSlots; ++i) {
+		ProbeEntry *entry = &probes[i];
+		if (entry->path == NULL)
+			continue;
+		if (entry->kind == PROBE_DIR && entry->result >= 0)
+			close(entry->result);
+		JLI_MemFree(entry->path);
+		if (entry->real != NULL)
+			JLI_MemFree(entry->real);
+		entry->path = NULL;
+	}
+	used = dirFds = 0;
+	hits = misses = shortcuts = 0;
+}
+
+void
+TraceProbeCache()
+{
+	JLI_TraceLauncher("Filesystem probes: %d done, %d cached, %d skipped for a "
+			"missing directory, %d directory fds\n",
+			misses - shortcuts, hits, shortcuts, dirFds);
+}
@@ -0,0 +1,30 @@
+/*
+ * jyprobe.h
+ *
+ * Per-launch cache of filesystem probes, see jyprobe.c.
+ */
+
+#ifndef JYPROBE_H_
+#define JYPROBE_H_
+
+#include <jni.h>
+#include <sys/stat.h>
+
+/* Like stat(2); results, including failures, are cached. */
+int ProbeStat(const char *path, struct stat *st);
+
+/* Like access(path, F_OK) == 0, answered from the stat cache. */
+jboolean ProbeExists(const char *path);
+
+/* Like access(path, mode) == 0 */
+jboolean ProbeAccess(const char *path, int mode);
+
+/* Like realpath(3) with a resolved buffer of PATH_MAX. */
+char *ProbeRealpath(const char *path, char *resolved);
+
+/* Forgets all probes, e.g. before a library host launches again. */
+void ProbeCacheClear();
+
+void TraceProbeCache();
+
+#endif /* JYPROBE_H_ */
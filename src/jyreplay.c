@@ -0,0 +1,332 @@
+/*
+ * jyreplay.c
+ *
+ * Capture and replay of launches (launcher options --record=<file> and
+ * --replay=<file> [count]).
+ *
+ * --record writes everything that determines a launch to a replay file:
+ * the command line, the environment variables the launcher and the JVM
+ * read, the working directory, whether stdin/stdout/stderr are ttys,
+ * and what came out of it, i.e. the Java runtime, the libjvm and the
+ * JVM options. The launch itself goes on as usual.
+ *
+ *   jython --replay=<file> [count]
+ *
+ * restores the recorded environment and working directory and runs the
+ * recorded command line count times (default 10) with this launcher,
+ * reporting the wall times. A first, untimed run records again, so that
+ * JVM options that come out differently on this host are listed.
+ *
+ * The file is line based, "<key> <value>", with backslash escapes for
+ * newlines and backslashes in values.
+ */
+
+#include "jython.h"
+#include "admission.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define recordOpt "--record="
+#define replayOpt "--replay="
+#define replayVersion 1
+#define defaultReplayCount 10
+
+/* everything in the environment that changes what a launch does */
+static const char* replayEnv[] = {
+	"JAVA_OPTS", "JYTHON_OPTS", "CLASSPATH", "JAVA_MEM", "JAVA_STACK",
+	"JAVA_HOME", "JYTHON_HOME", "JYTHON_JDK_POLICY", "JYTHON_JDK_MIN",
+	"JYTHON_LAUNCH_SLOTS", "JYTHON_LAUNCH_TIMEOUT",
+	"_JAVA_OPTIONS", "JAVA_TOOL_OPTIONS", "XDG_CACHE_HOME",
+	"PYTHONUNBUFFERED", /* decides whether stdout is buffered, see jystdout.c */
+	NULL
+};
+
+/* options that differ between any two launches */
+static const char* volatileOpts[] = {
+	"-Dsun.java.launcher.pid=", queueWaitOpt, NULL
+};
+
+/*
+ * getOPTS tokenizes JAVA_OPTS and JYTHON_OPTS in place, so the launch
+ * state is taken before that.
+ */
+static int snapArgc = 0;
+static char** snapArgv = NULL;
+static char* snapEnv[sizeof(replayEnv)/sizeof(char*)];
+static char snapCwd[PATH_MAX];
+static int snapTty[3];
+
+void replaySnapshot(int argc, char** argv) {
+	int i;
+	snapArgc = argc;
+	snapArgv = argv;
+	for (i = 0; replayEnv[i]; ++i) {
+		char* value = getenv(replayEnv[i]);
+		snapEnv[i] = value ? strdup(value) : NULL;
+	}
+	if (!getcwd(snapCwd, sizeof(snapCwd)))
+		snapCwd[0] = 0;
+	for (i = 0; i < 3; ++i)
+		snapTty[i] = isatty(i);
+}
+
+static void writeEscaped(FILE* fp, const char* value) {
+	for ( ; *value; ++value) {
+		if (*value == '\n') fputs("\\n", fp);
+		else if (*value == '\\') fputs("\\\\", fp);
+		else fputc(*value, fp);
+	}
+	fputc('\n', fp);
+}
+
+static void writeValue(FILE* fp, const char* key, const char* value) {
+	fprintf(fp, "%s ", key);
+	writeEscaped(fp, value);
+}
+
+static void unescape(char* value) {
+	char* dst = value;
+	for ( ; *value; ++value) {
+		if (*value == '\\' && value[1]) {
+			++value;
+			*dst++ = *value == 'n' ? '\n' : *value;
+		} else {
+			*dst++ = *value;
+		}
+	}
+	*dst = 0;
+}
+
+void recordLaunch(JySetup* setup, const char* jrepath, const char* jvmpath,
+		JavaVMOption* options, int numOptions) {
+	FILE* fp;
+	int i;
+	if (!setup->recordFile || !snapArgv)
+		return;
+	fp = fopen(setup->recordFile, "w");
+	if (!fp) {
+		fprintf(stderr, "Warning: cannot write replay file %s: %s\n",
+				setup->recordFile, strerror(errno));
+		return;
+	}
+	fprintf(fp, "# LiJy-launch replay file, run it with: jython --replay=<file> [count]\n");
+	fprintf(fp, "version %d\n", replayVersion);
+	writeValue(fp, "cwd", snapCwd);
+	fprintf(fp, "tty %d %d %d\n", snapTty[0], snapTty[1], snapTty[2]);
+	for (i = 0; replayEnv[i]; ++i) {
+		if (snapEnv[i]) {
+			fprintf(fp, "env %s=", replayEnv[i]);
+			writeEscaped(fp, snapEnv[i]);
+		} else {
+			fprintf(fp, "unset %s\n", replayEnv[i]);
+		}
+	}
+	for (i = 0; i < snapArgc; ++i) {
+		if (strncmp(snapArgv[i], recordOpt, sizeof(recordOpt)-1) != 0)
+			writeValue(fp, "arg", snapArgv[i]);
+	}
+	writeValue(fp, "jre", jrepath);
+	writeValue(fp, "jvm", jvmpath);
+	for (i = 0; i < numOptions; ++i)
+		writeValue(fp, "option", options[i].optionString);
+	fclose(fp);
+	JLI_TraceLauncher("recorded launch to %s\n", setup->recordFile);
+}
+
+typedef struct {
+	int count;
+	int max;
+	char** values;
+} ReplayList;
+
+static void listAdd(ReplayList* list, char* value) {
+	if (list->count == list->max) {
+		list->max = list->max ? 2*list->max : 16;
+		list->values = realloc(list->values, list->max*sizeof(char*));
+	}
+	list->values[list->count++] = value;
+}
+
+static jboolean listContains(ReplayList* list, const char* value) {
+	int i;
+	for (i = 0; i < list->count; ++i) {
+		if (strcmp(list->values[i], value) == 0)
+			return JNI_TRUE;
+	}
+	return JNI_FALSE;
+}
+
+static jboolean isVolatile(const char* option) {
+	int i;
+	for (i = 0; volatileOpts[i]; ++i) {
+		if (strncmp(option, volatileOpts[i], strlen(volatileOpts[i])) == 0)
+			return JNI_TRUE;
+	}
+	return JNI_FALSE;
+}
+
+/*
+ * Reads a replay file; env and unset lines are applied right away.
+ * Returns JNI_FALSE if the file cannot be read.
+ */
+static jboolean readReplay(const char* file, ReplayList* args, ReplayList* options,
+		char* cwd, int* tty) {
+	char line[PATH_MAX+4096];
+	char* value;
+	FILE* fp = fopen(file, "r");
+	if (!fp)
+		return JNI_FALSE;
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		if (line[0] == '#' || !(value = strchr(line, ' ')))
+			continue;
+		*value++ = 0;
+		if (strcmp(line, "tty") == 0) {
+			sscanf(value, "%d %d %d", &tty[0], &tty[1], &tty[2]);
+			continue;
+		}
+		unescape(value);
+		if (strcmp(line, "cwd") == 0) {
+			JLI_Snprintf(cwd, PATH_MAX, "%s", value);
+		} else if (strcmp(line, "env") == 0) {
+			char* eq = strchr(value, '=');
+			if (eq) {
+				*eq = 0;
+				setenv(value, eq+1, 1);
+			}
+		} else if (strcmp(line, "unset") == 0) {
+			unsetenv(value);
+		} else if (strcmp(line, "arg") == 0) {
+			listAdd(args, strdup(value));
+		} else if (strcmp(line, "option") == 0) {
+			listAdd(options, strdup(value));
+		} else if (strcmp(line, "jvm") == 0) {
+			/* compared like an option, so that a different libjvm is listed */
+			char* jvm = malloc(strlen(value)+sizeof("libjvm: "));
+			sprintf(jvm, "libjvm: %s", value);
+			listAdd(options, jvm);
+		}
+	}
+	fclose(fp);
+	return args->count > 0;
+}
+
+/*
+ * Runs the launcher with argv, returns the exit status and the wall time,
+ * or -1 (micros left alone) if it could not be run.
+ */
+static int runLaunch(char** argv, jboolean nullStdin, jlong* micros) {
+	int status;
+	jlong start = CounterGet();
+	pid_t pid = fork();
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_RDWR);
+		if (nullStdin)
+			dup2(devnull, 0);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0)
+		return -1;
+	*micros = Counter2Micros(CounterGet()-start);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+}
+
+static int compareMicros(const void* a, const void* b) {
+	jlong x = *(const jlong*) a, y = *(const jlong*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Lists JVM options that differ between the recording and this host. */
+static void compareOptions(ReplayList* recorded, const char* checkFile) {
+	ReplayList args = {0, 0, NULL}, current = {0, 0, NULL};
+	char cwd[PATH_MAX];
+	int tty[3], i, differences = 0;
+	if (!readReplay(checkFile, &args, &current, cwd, tty)) {
+		puts("The check run did not get to record its JVM options.");
+		return;
+	}
+	for (i = 0; i < recorded->count; ++i) {
+		if (!isVolatile(recorded->values[i]) && !listContains(&current, recorded->values[i])) {
+			if (!differences++) puts("JVM options differ from the recording:");
+			printf("  - %s\n", recorded->values[i]);
+		}
+	}
+	for (i = 0; i < current.count; ++i) {
+		if (!isVolatile(current.values[i]) && !listContains(recorded, current.values[i])) {
+			if (!differences++) puts("JVM options differ from the recording:");
+			printf("  + %s\n", current.values[i]);
+		}
+	}
+	if (!differences)
+		puts("JVM options match the recording.");
+}
+
+int replayLaunch(int argc, char** argv) {
+	ReplayList args = {0, 0, NULL}, options = {0, 0, NULL};
+	const char* file = argv[1]+sizeof(replayOpt)-1;
+	int count = argc > 2 ? atoi(argv[2]) : defaultReplayCount;
+	int tty[3] = {0, 0, 0}, i, failures = 0, timed = 0, status;
+	char cwd[PATH_MAX], checkFile[PATH_MAX], recordArg[PATH_MAX+sizeof(recordOpt)];
+	char** childArgv;
+	jlong* micros;
+	jlong total = 0;
+
+	cwd[0] = 0;
+	if (count < 1 || !readReplay(file, &args, &options, cwd, tty)) {
+		fprintf(stderr, "Error: cannot replay %s\n", file);
+		return 2;
+	}
+	if (cwd[0] && chdir(cwd) != 0)
+		fprintf(stderr, "Warning: cannot change to recorded directory %s\n", cwd);
+	if (tty[0] && !isatty(0))
+		fputs("Warning: the recorded launch had a tty as stdin, this one has not\n", stderr);
+	/* runLaunch writes stdout to /dev/null, see BufferStdout */
+	if (tty[1])
+		fputs("Warning: the recorded launch had a tty as stdout, replays write it to "
+				"/dev/null and may buffer it natively where the recording did not\n", stderr);
+
+	/* recorded argv[0] is only informational: replay with this launcher */
+	childArgv = malloc((args.count+2)*sizeof(char*));
+	childArgv[0] = (char*) SetExecname(argv[0]);
+	for (i = 1; i < args.count; ++i)
+		childArgv[i+1] = args.values[i];
+	childArgv[args.count+1] = NULL;
+
+	JLI_Snprintf(checkFile, sizeof(checkFile), "%s/lijy-replay-%d", getenv("TMPDIR") ?
+			getenv("TMPDIR") : "/tmp", (int) getpid());
+	JLI_Snprintf(recordArg, sizeof(recordArg), recordOpt "%s", checkFile);
+	childArgv[1] = recordArg;
+	printf("Replaying %s (%d runs) in %s\n", file, count, cwd);
+	runLaunch(childArgv, !tty[0], &total);
+	compareOptions(&options, checkFile);
+	unlink(checkFile);
+
+	/* drop the --record option for the timed runs */
+	childArgv[1] = childArgv[0];
+	micros = malloc(count*sizeof(jlong));
+	for (i = 0, total = 0; i < count; ++i) {
+		status = runLaunch(childArgv+1, !tty[0], &micros[timed]);
+		if (status != 0)
+			++failures;
+		/* runs that could not be started have no time */
+		if (status >= 0)
+			total += micros[timed++];
+	}
+	if (timed > 0) {
+		qsort(micros, timed, sizeof(jlong), compareMicros);
+		printf("wall time: min %.1f ms, median %.1f ms, mean %.1f ms, max %.1f ms\n",
+				micros[0]/1000.0, micros[timed/2]/1000.0, total/1000.0/timed,
+				micros[timed-1]/1000.0);
+	}
+	if (timed < count)
+		printf("%d of %d runs could not be started\n", count-timed, count);
+	if (failures)
+		printf("%d of %d runs exited with non-zero status\n", failures, count);
+	free(micros);
+	free(childArgv);
+	return failures ? 1 : 0;
+}
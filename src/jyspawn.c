@@ -0,0 +1,809 @@
+/*
+ * jyspawn.c
+ *
+ * Natives of lijy.NativeSpawn (see jynative.c): starting processes
+ * without java.lang.ProcessBuilder, which depending on the JDK forks
+ * the whole JVM or starts jspawnhelper for every process. Here the
+ * launcher vforks and execs the program itself, with the signal and
+ * descriptor setup of posix_spawn. With the launcher option
+ * --spawn-helper, a helper process forked before the JVM is created
+ * starts the processes instead, so the JVM never forks at all: requests
+ * go to it over a socket pair, descriptors with SCM_RIGHTS, and it
+ * reports each exit status through a pipe. lib/lijyspawn.py builds a
+ * subprocess-like Process on these.
+ *
+ *   int spawn(String[] argv, String[] env, String cwd, int[] fds)
+ *     Starts argv[0], searched on PATH if it has no slash, with env
+ *     ("NAME=value" strings, null: the launcher's environment) in cwd
+ *     (null: the launcher's). fds[i] is what the child gets as
+ *     descriptor i: INHERIT, PIPE, DEVNULL, STDOUT (what it gets as 1)
+ *     or a descriptor of the caller. For PIPE, fds[i] is replaced with
+ *     the caller's end, non-blocking and close-on-exec. Descriptors from
+ *     fds.length on are closed in the child. Returns the pid.
+ *   int waitFor(int pid, boolean block)
+ *     The exit code, -signal if a signal ended the process, RUNNING if
+ *     block is false and it has not ended yet.
+ *   void kill(int pid, int signal)
+ *   boolean helper()                   whether the helper runs
+ * Errors throw IOException, with "error=<errno>" as ProcessBuilder's.
+ */
+
+#define _GNU_SOURCE /* pipe2, MSG_CMSG_CLOEXEC */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define maxChildFds 32
+#define maxRequest (128*1024) /* larger requests are started directly */
+#define spawnInherit -1
+#define spawnPipe -2
+#define spawnDevNull -3
+#define spawnStdout -4
+#define spawnRunning ((jint) 0x80000000)
+
+extern char **environ;
+
+/* What a child is started with, descriptors resolved. */
+typedef struct {
+	const char *path;
+	char **argv;
+	char **envp;               /* NULL: environ */
+	const char *cwd;           /* NULL: unchanged */
+	int fds[maxChildFds];      /* -1: closed in the child */
+	int fdCount;
+} ChildSpec;
+
+/* The helper's wire format: a Request, then path, argv, env and cwd. */
+typedef struct {
+	int fdCount;
+	unsigned int fdMask;       /* bit i set: descriptor i is attached */
+	int argc;
+	int envc;                  /* -1: the helper's environment */
+	int hasCwd;
+	int length;                /* of the strings */
+} Request;
+
+typedef struct {
+	int pid;
+	int error;
+} Reply;
+
+/* Exit status pipes by pid: read ends in the JVM, write ends in the helper. */
+typedef struct {
+	pid_t pid;
+	int fd;
+} ExitPipe;
+
+static ExitPipe *exitPipes = NULL;
+static int exitPipeCount = 0;
+static int exitPipeCapacity = 0;
+
+static int helperSocket = -1;
+static pid_t helperPid = -1;
+static pthread_mutex_t helperLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+AddExitPipe(pid_t pid, int fd)
+{
+	if (exitPipeCount == exitPipeCapacity) {
+		exitPipeCapacity = exitPipeCapacity ? 2*exitPipeCapacity : 64;
+		exitPipes = JLI_MemRealloc(exitPipes, exitPipeCapacity*sizeof(ExitPipe));
+	}
+	exitPipes[exitPipeCount].pid = pid;
+	exitPipes[exitPipeCount++].fd = fd;
+}
+
+/* Returns the pipe of pid, -1 if there is none; take removes it. */
+static int
+FindExitPipe(pid_t pid, jboolean take)
+{
+	int i, fd;
+	for (i = 0; i < exitPipeCount; ++i) {
+		if (exitPipes[i].pid == pid) {
+			fd = exitPipes[i].fd;
+			if (take)
+				exitPipes[i] = exitPipes[--exitPipeCount];
+			return fd;
+		}
+	}
+	return -1;
+}
+
+static jint
+ReturnCode(int status)
+{
+	return WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/*
+ * close(2) without going through the launcher's close, which records
+ * file profiles (see jyprefetch.c): a vfork child shares the parent's
+ * memory and must only make plain system calls.
+ */
+#define RawClose(fd) syscall(SYS_close, (long) (fd))
+
+/*
+ * Starts a process as posix_spawn does: vfork with all signals blocked,
+ * and the child resets the handlers it would share with the parent
+ * before it unblocks them, so no handler of the JVM runs in the child.
+ * Returns the pid, or -1 with *error set if vfork or exec failed.
+ */
+static pid_t
+StartChild(const ChildSpec *spec, int *error)
+{
+	sigset_t all, old;
+	int high[maxChildFds];
+	volatile int childError = 0;
+	long openMax = sysconf(_SC_OPEN_MAX);
+	pid_t pid;
+	int status;
+
+	if (openMax < 0 || openMax > 65536)
+		openMax = 65536;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pid = vfork();
+	if (pid == 0) {
+		struct sigaction sa;
+		sigset_t none;
+		long i;
+		int sig;
+		for (sig = 1; sig < _NSIG; ++sig) {
+			if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+				sa.sa_handler = SIG_DFL;
+				sa.sa_flags = 0;
+				sigemptyset(&sa.sa_mask);
+				sigaction(sig, &sa, NULL);
+			}
+		}
+		/* out of the way first, so that e.g. fds {1, 0} swaps 0 and 1 */
+		for (i = 0; i < spec->fdCount; ++i) {
+			high[i] = -1;
+			if (spec->fds[i] >= 0 && (high[i] = fcntl(spec->fds[i], F_DUPFD_CLOEXEC, spec->fdCount)) < 0)
+				goto failed;
+		}
+		for (i = 0; i < spec->fdCount; ++i) {
+			if (high[i] < 0)
+				RawClose(i);
+			else if (dup2(high[i], i) < 0)
+				goto failed;
+		}
+		i = spec->fdCount;
+#ifdef SYS_close_range
+		if (syscall(SYS_close_range, (unsigned int) i, ~0U, 0) == 0)
+			i = openMax;
+#endif
+		for ( ; i < openMax; ++i)
+			RawClose(i);
+		if (spec->cwd != NULL && chdir(spec->cwd) != 0)
+			goto failed;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		execve(spec->path, spec->argv, spec->envp ? spec->envp : environ);
+	failed:
+		childError = errno;
+		_exit(127);
+	}
+	if (pid < 0)
+		*error = errno;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (pid > 0 && childError != 0) {
+		*error = childError;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		pid = -1;
+	}
+	return pid;
+}
+
+/* Sends one message with descriptors attached. */
+static jboolean
+SendWithFds(int sock, const void *data, size_t length, const int *fds, int fdCount)
+{
+	char control[CMSG_SPACE(maxChildFds*sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *) data;
+	iov.iov_len = length;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fdCount > 0) {
+		struct cmsghdr *cmsg;
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(fdCount*sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(fdCount*sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, fdCount*sizeof(int));
+	}
+	do {
+		n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	return n == (ssize_t) length;
+}
+
+/*
+ * Receives one message, the descriptors attached to it close-on-exec.
+ * Returns its length, 0 at EOF, -1 on errors.
+ */
+static ssize_t
+ReceiveWithFds(int sock, void *data, size_t length, int *fds, int *fdCount)
+{
+	char control[CMSG_SPACE(maxChildFds*sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = data;
+	iov.iov_len = length;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	*fdCount = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); n >= 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			int count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+			memcpy(fds + *fdCount, CMSG_DATA(cmsg), count*sizeof(int));
+			*fdCount += count;
+		}
+	}
+	return n;
+}
+
+/* Tells the JVM the exit statuses of the helper's children. */
+static void
+ReapChildren(int signals)
+{
+	struct signalfd_siginfo info;
+	int status, fd;
+	pid_t pid;
+	while (read(signals, &info, sizeof(info)) > 0)
+		;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if ((fd = FindExitPipe(pid, JNI_TRUE)) >= 0) {
+			jint code = ReturnCode(status);
+			if (write(fd, &code, sizeof(code)) < 0) {
+				/* the JVM closed the pipe, nobody waits */
+			}
+			close(fd);
+		}
+	}
+}
+
+/*
+ * Whether a request of n bytes is well formed: its counts fit what was
+ * received and its strings end within it.
+ */
+static jboolean
+ValidRequest(const Request *req, ssize_t n)
+{
+	const char *s = (const char *) (req + 1), *end = s + (n - (ssize_t) sizeof(Request));
+	int strings, i;
+	if (n < (ssize_t) sizeof(Request) || n != (ssize_t) sizeof(Request) + req->length
+			|| req->length <= 0 || end[-1] != 0
+			|| req->fdCount < 0 || req->fdCount > maxChildFds
+			|| req->argc < 0 || req->argc > req->length || req->envc < -1 || req->envc > req->length)
+		return JNI_FALSE;
+	strings = 1 + req->argc + (req->envc > 0 ? req->envc : 0) + (req->hasCwd ? 1 : 0);
+	for (i = 0; i < strings; ++i) {
+		if (s >= end || (s = memchr(s, 0, end - s)) == NULL)
+			return JNI_FALSE;
+		++s;
+	}
+	return JNI_TRUE;
+}
+
+/* Starts the child of one request; returns JNI_FALSE once the JVM is gone. */
+static jboolean
+ServeRequest(int sock, char *buffer)
+{
+	Request *req = (Request *) buffer;
+	ChildSpec spec;
+	Reply reply;
+	char **pointers, *s;
+	int fds[maxChildFds], fdCount, statusPipe[2], i, k;
+	ssize_t n = ReceiveWithFds(sock, buffer, sizeof(Request) + maxRequest, fds, &fdCount);
+
+	if (n <= 0)
+		return JNI_FALSE;
+	reply.pid = -1;
+	reply.error = EINVAL;
+	pointers = NULL;
+	if (ValidRequest(req, n)) {
+		/* argv and envp, each NULL terminated */
+		pointers = JLI_MemAlloc((req->argc + req->envc + 3) * sizeof(char *));
+		s = buffer + sizeof(Request);
+		spec.path = s;
+		s += JLI_StrLen(s) + 1;
+		spec.argv = pointers;
+		for (i = 0; i < req->argc; ++i, s += JLI_StrLen(s) + 1)
+			spec.argv[i] = s;
+		spec.argv[i] = NULL;
+		spec.envp = NULL;
+		if (req->envc >= 0) {
+			spec.envp = pointers + req->argc + 1;
+			for (i = 0; i < req->envc; ++i, s += JLI_StrLen(s) + 1)
+				spec.envp[i] = s;
+			spec.envp[i] = NULL;
+		}
+		spec.cwd = req->hasCwd ? s : NULL;
+		spec.fdCount = req->fdCount;
+		for (i = 0, k = 0; i < req->fdCount; ++i)
+			spec.fds[i] = (req->fdMask & (1u << i)) && k < fdCount ? fds[k++] : -1;
+		if (pipe2(statusPipe, O_CLOEXEC) != 0) {
+			reply.error = errno;
+		} else {
+			reply.pid = StartChild(&spec, &reply.error);
+			if (reply.pid > 0) {
+				reply.error = 0;
+				AddExitPipe(reply.pid, statusPipe[1]);
+			} else {
+				close(statusPipe[0]);
+				close(statusPipe[1]);
+			}
+		}
+	}
+	if (pointers != NULL)
+		JLI_MemFree(pointers);
+	for (i = 0; i < fdCount; ++i)
+		close(fds[i]);
+	if (reply.pid > 0) {
+		n = SendWithFds(sock, &reply, sizeof(reply), statusPipe, 1);
+		close(statusPipe[0]);
+	} else {
+		n = SendWithFds(sock, &reply, sizeof(reply), NULL, 0);
+	}
+	return n ? JNI_TRUE : JNI_FALSE;
+}
+
+static void
+HelperMain(int sock)
+{
+	sigset_t chld;
+	struct pollfd polled[2];
+	char *buffer = JLI_MemAlloc(sizeof(Request) + maxRequest);
+	int signals;
+
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, NULL);
+	signals = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+	polled[0].fd = sock;
+	polled[0].events = POLLIN;
+	polled[1].fd = signals;
+	polled[1].events = POLLIN;
+	for (;;) {
+		if (poll(polled, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (polled[1].revents)
+			ReapChildren(signals);
+		if (polled[0].revents && !ServeRequest(sock, buffer))
+			break;
+	}
+	_exit(0);
+}
+
+/* Ends the helper at exit: it leaves its loop at EOF on the socket. */
+static void
+StopSpawnHelper(void)
+{
+	int status;
+	pthread_mutex_lock(&helperLock);
+	if (helperSocket >= 0) {
+		close(helperSocket);
+		helperSocket = -1;
+	}
+	pthread_mutex_unlock(&helperLock);
+	while (waitpid(helperPid, &status, 0) < 0 && errno == EINTR)
+		;
+}
+
+void
+StartSpawnHelper(void)
+{
+	int sv[2], devNull;
+	long i, openMax;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+		JLI_TraceLauncher("spawn helper: socketpair: %s\n", strerror(errno));
+		return;
+	}
+	pid = fork();
+	if (pid == 0) {
+		/* hold none of the launcher's descriptors, e.g. its launch slot (admission.c) */
+		prctl(PR_SET_NAME, "jython-spawn", 0, 0, 0);
+		if (sv[1] != 3 && dup2(sv[1], 3) < 0)
+			_exit(1);
+		devNull = open("/dev/null", O_RDWR);
+		for (i = 0; i < 3 && devNull >= 0; ++i)
+			dup2(devNull, i);
+		i = 4;
+		openMax = sysconf(_SC_OPEN_MAX);
+		if (openMax < 0 || openMax > 65536)
+			openMax = 65536;
+#ifdef SYS_close_range
+		if (syscall(SYS_close_range, 4U, ~0U, 0) == 0)
+			i = openMax;
+#endif
+		for ( ; i < openMax; ++i)
+			RawClose(i);
+		HelperMain(3);
+	}
+	close(sv[1]);
+	if (pid < 0) {
+		JLI_TraceLauncher("spawn helper: fork: %s\n", strerror(errno));
+		close(sv[0]);
+		return;
+	}
+	helperSocket = sv[0];
+	helperPid = pid;
+	atexit(StopSpawnHelper);
+	JLI_TraceLauncher("spawn helper: pid %d\n", (int) pid);
+}
+
+/*
+ * Has the helper start spec. Returns the pid, -1 with *error set if the
+ * child could not be started, -2 if the helper is gone or the request
+ * too large for it.
+ */
+static pid_t
+HelperStart(const ChildSpec *spec, int argc, int envc, int *error)
+{
+	Request *req;
+	Reply reply;
+	char *buffer, *s;
+	int fds[maxChildFds], fdCount = 0, statusFd, received, i;
+	size_t length = JLI_StrLen(spec->path) + 1;
+	ssize_t n;
+
+	for (i = 0; i < argc; ++i)
+		length += JLI_StrLen(spec->argv[i]) + 1;
+	for (i = 0; i < envc; ++i)
+		length += JLI_StrLen(spec->envp[i]) + 1;
+	if (spec->cwd != NULL)
+		length += JLI_StrLen(spec->cwd) + 1;
+	if (length > maxRequest)
+		return -2;
+	buffer = JLI_MemAlloc(sizeof(Request) + length);
+	req = (Request *) buffer;
+	req->fdCount = spec->fdCount;
+	req->fdMask = 0;
+	req->argc = argc;
+	req->envc = spec->envp ? envc : -1;
+	req->hasCwd = spec->cwd != NULL;
+	req->length = (int) length;
+	for (i = 0; i < spec->fdCount; ++i) {
+		if (spec->fds[i] >= 0) {
+			req->fdMask |= 1u << i;
+			fds[fdCount++] = spec->fds[i];
+		}
+	}
+	s = buffer + sizeof(Request);
+	s = stpcpy(s, spec->path) + 1;
+	for (i = 0; i < argc; ++i)
+		s = stpcpy(s, spec->argv[i]) + 1;
+	for (i = 0; i < envc; ++i)
+		s = stpcpy(s, spec->envp[i]) + 1;
+	if (spec->cwd != NULL)
+		stpcpy(s, spec->cwd);
+
+	pthread_mutex_lock(&helperLock);
+	n = -1;
+	if (helperSocket >= 0 && SendWithFds(helperSocket, buffer, sizeof(Request) + length, fds, fdCount))
+		n = ReceiveWithFds(helperSocket, &reply, sizeof(reply), &statusFd, &received);
+	if (n != sizeof(reply)) {
+		if (helperSocket >= 0) {
+			JLI_TraceLauncher("spawn helper: gone, spawning directly\n");
+			close(helperSocket);
+			helperSocket = -1;
+		}
+		reply.pid = -2;
+	} else if (reply.pid > 0 && received == 1) {
+		AddExitPipe(reply.pid, statusFd);
+	} else {
+		*error = reply.error;
+		reply.pid = -1;
+	}
+	pthread_mutex_unlock(&helperLock);
+	JLI_MemFree(buffer);
+	return reply.pid;
+}
+
+static void
+ThrowSpawnError(JNIEnv *env, const char *what, const char *name, int error)
+{
+	char message[512];
+	JLI_Snprintf(message, sizeof(message), "%s \"%s\": error=%d, %s", what, name, error, strerror(error));
+	ThrowNative(env, "java/io/IOException", message);
+}
+
+/*
+ * Copies a String[] into one allocation: the NULL terminated pointer
+ * array, then the strings as UTF-8. Returns NULL and throws on errors.
+ */
+static char **
+CopyStrings(JNIEnv *env, jobjectArray array, int *count)
+{
+	jsize n = (*env)->GetArrayLength(env, array), i;
+	size_t length = (n + 1) * sizeof(char *);
+	char **result, *s;
+	for (i = 0; i < n; ++i) {
+		jstring str = (jstring) (*env)->GetObjectArrayElement(env, array, i);
+		if (str == NULL) {
+			ThrowNative(env, "java/lang/NullPointerException", "NativeSpawn: null string");
+			return NULL;
+		}
+		/* EncodeUtf8 takes at most 3 bytes per UTF-16 unit */
+		length += 3 * (size_t) (*env)->GetStringLength(env, str) + 1;
+		(*env)->DeleteLocalRef(env, str);
+	}
+	result = JLI_MemAlloc(length);
+	s = (char *) (result + n + 1);
+	for (i = 0; i < n; ++i) {
+		jstring str = (jstring) (*env)->GetObjectArrayElement(env, array, i);
+		char *chars = GetStringUtf8(env, str);
+		if (chars == NULL) {
+			ThrowNative(env, "java/lang/NullPointerException", "NativeSpawn: null string");
+			JLI_MemFree(result);
+			return NULL;
+		}
+		result[i] = s;
+		s = stpcpy(s, chars) + 1;
+		JLI_MemFree(chars);
+		(*env)->DeleteLocalRef(env, str);
+	}
+	result[n] = NULL;
+	*count = n;
+	return result;
+}
+
+/* Searches name on the PATH of envp, or of the launcher if envp is NULL. */
+static jboolean
+FindProgram(const char *name, char **envp, char *path, size_t size)
+{
+	const char *dirs = NULL, *end;
+	int i;
+	if (strchr(name, '/') != NULL) {
+		JLI_Snprintf(path, size, "%s", name);
+		return JNI_TRUE;
+	}
+	if (envp != NULL) {
+		for (i = 0; envp[i] != NULL; ++i) {
+			if (strncmp(envp[i], "PATH=", 5) == 0)
+				dirs = envp[i] + 5;
+		}
+	} else {
+		dirs = getenv("PATH");
+	}
+	if (dirs == NULL)
+		dirs = "/bin:/usr/bin";
+	for ( ; ; dirs = end + 1) {
+		end = strchr(dirs, ':');
+		if (end == NULL)
+			end = dirs + JLI_StrLen(dirs);
+		if (end == dirs)
+			JLI_Snprintf(path, size, "%s", name);
+		else
+			JLI_Snprintf(path, size, "%.*s/%s", (int) (end - dirs), dirs, name);
+		if (access(path, X_OK) == 0)
+			return JNI_TRUE;
+		if (*end == 0)
+			return JNI_FALSE;
+	}
+}
+
+static jint JNICALL
+NativeSpawn_spawn(JNIEnv *env, jclass cls, jobjectArray jargv, jobjectArray jenv, jstring jcwd, jintArray jfds)
+{
+	ChildSpec spec;
+	char **argv = NULL, **envp = NULL, path[PATH_MAX];
+	char *cwd = NULL;
+	jint requested[maxChildFds];
+	int parentEnds[maxChildFds], toClose[maxChildFds], closeCount = 0;
+	int argc = 0, envc = 0, error = 0, i;
+	pid_t pid = -1;
+	jsize fdCount;
+
+	if (jargv == NULL || (*env)->GetArrayLength(env, jargv) == 0 || jfds == NULL) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeSpawn: no program");
+		return -1;
+	}
+	fdCount = (*env)->GetArrayLength(env, jfds);
+	if (fdCount > maxChildFds) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeSpawn: too many descriptors");
+		return -1;
+	}
+	(*env)->GetIntArrayRegion(env, jfds, 0, fdCount, requested);
+	if ((argv = CopyStrings(env, jargv, &argc)) == NULL)
+		goto done;
+	if (jenv != NULL && (envp = CopyStrings(env, jenv, &envc)) == NULL)
+		goto done;
+	if (jcwd != NULL)
+		cwd = GetStringUtf8(env, jcwd);
+	if (!FindProgram(argv[0], envp, path, sizeof(path))) {
+		ThrowSpawnError(env, "Cannot run program", argv[0], ENOENT);
+		goto done;
+	}
+	spec.path = path;
+	spec.argv = argv;
+	spec.envp = envp;
+	spec.cwd = cwd;
+	spec.fdCount = fdCount;
+	for (i = 0; i < fdCount; ++i) {
+		int p[2];
+		parentEnds[i] = -1;
+		switch (requested[i]) {
+		case spawnInherit:
+			spec.fds[i] = fcntl(i, F_GETFD) < 0 ? -1 : i;
+			break;
+		case spawnPipe:
+			if (pipe2(p, O_CLOEXEC) != 0) {
+				error = errno;
+				break;
+			}
+			parentEnds[i] = i == 0 ? p[1] : p[0];
+			spec.fds[i] = toClose[closeCount++] = i == 0 ? p[0] : p[1];
+			fcntl(parentEnds[i], F_SETFL, O_NONBLOCK);
+			break;
+		case spawnDevNull:
+			if ((spec.fds[i] = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+				error = errno;
+			else
+				toClose[closeCount++] = spec.fds[i];
+			break;
+		case spawnStdout:
+			spec.fds[i] = i > 1 ? spec.fds[1] : -1;
+			break;
+		default:
+			spec.fds[i] = requested[i] >= 0 ? requested[i] : -1;
+		}
+		if (error != 0)
+			break;
+	}
+	if (error == 0) {
+		pid = helperSocket >= 0 ? HelperStart(&spec, argc, envc, &error) : -2;
+		if (pid == -2)
+			pid = StartChild(&spec, &error);
+	}
+	for (i = 0; i < closeCount; ++i)
+		close(toClose[i]);
+	for (i = 0; i < fdCount && pid < 0; ++i) {
+		if (parentEnds[i] >= 0)
+			close(parentEnds[i]);
+	}
+	if (pid < 0) {
+		ThrowSpawnError(env, "Cannot run program", argv[0], error);
+	} else {
+		for (i = 0; i < fdCount; ++i) {
+			if (parentEnds[i] >= 0)
+				requested[i] = parentEnds[i];
+		}
+		(*env)->SetIntArrayRegion(env, jfds, 0, fdCount, requested);
+	}
+done:
+	JLI_MemFree(cwd);
+	JLI_MemFree(envp);
+	JLI_MemFree(argv);
+	return (jint) pid;
+}
+
+static jint JNICALL
+NativeSpawn_waitFor(JNIEnv *env, jclass cls, jint pid, jboolean block)
+{
+	char name[16];
+	int fd, status;
+	jint code;
+	ssize_t n;
+
+	pthread_mutex_lock(&helperLock);
+	fd = FindExitPipe(pid, JNI_FALSE);
+	pthread_mutex_unlock(&helperLock);
+	if (fd >= 0) {
+		struct pollfd polled;
+		polled.fd = fd;
+		polled.events = POLLIN;
+		if (!block && poll(&polled, 1, 0) == 0)
+			return spawnRunning;
+		do {
+			n = read(fd, &code, sizeof(code));
+		} while (n < 0 && errno == EINTR);
+		pthread_mutex_lock(&helperLock);
+		if (FindExitPipe(pid, JNI_TRUE) == fd)
+			close(fd);
+		pthread_mutex_unlock(&helperLock);
+		if (n == sizeof(code))
+			return code;
+		JLI_Snprintf(name, sizeof(name), "%d", (int) pid);
+		ThrowSpawnError(env, "Lost the exit status of process", name, n < 0 ? errno : EPIPE);
+		return -1;
+	}
+	do {
+		n = waitpid(pid, &status, block ? 0 : WNOHANG);
+	} while (n < 0 && errno == EINTR);
+	if (n == 0)
+		return spawnRunning;
+	if (n < 0) {
+		JLI_Snprintf(name, sizeof(name), "%d", (int) pid);
+		ThrowSpawnError(env, "Cannot wait for process", name, errno);
+		return -1;
+	}
+	return ReturnCode(status);
+}
+
+static void JNICALL
+NativeSpawn_kill(JNIEnv *env, jclass cls, jint pid, jint sig)
+{
+	char name[16];
+	if (kill(pid, sig) != 0 && errno != ESRCH) {
+		JLI_Snprintf(name, sizeof(name), "%d", (int) pid);
+		ThrowSpawnError(env, "Cannot signal process", name, errno);
+	}
+}
+
+static jboolean JNICALL
+NativeSpawn_helper(JNIEnv *env, jclass cls)
+{
+	return helperSocket >= 0 ? JNI_TRUE : JNI_FALSE;
+}
+
+static const JNINativeMethod nativeSpawnMethods[] = {
+	{"spawn", "([Ljava/lang/String;[Ljava/lang/String;Ljava/lang/String;[I)I", (void *) NativeSpawn_spawn},
+	{"waitFor", "(IZ)I", (void *) NativeSpawn_waitFor},
+	{"kill", "(II)V", (void *) NativeSpawn_kill},
+	{"helper", "()Z", (void *) NativeSpawn_helper}
+};
+
+static const NativeConstant nativeSpawnConstants[] = {
+	{"INHERIT", spawnInherit},
+	{"PIPE", spawnPipe},
+	{"DEVNULL", spawnDevNull},
+	{"STDOUT", spawnStdout},
+	{"RUNNING", spawnRunning},
+	{"SIGTERM", SIGTERM},
+	{"SIGKILL", SIGKILL}
+};
+
+const NativeClass nativeSpawnClass = {
+	"lijy/NativeSpawn",
+	nativeSpawnMethods, sizeof(nativeSpawnMethods) / sizeof(nativeSpawnMethods[0]),
+	nativeSpawnConstants, sizeof(nativeSpawnConstants) / sizeof(nativeSpawnConstants[0])
+};
+
+#else
+
+void
+StartSpawnHelper(void)
+{
+}
+
+const NativeClass nativeSpawnClass = {"lijy/NativeSpawn", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
@@ -0,0 +1,209 @@
+/*
+ * jystdout.c
+ *
+ * Block buffering of stdout when it is no tty. Jython line-buffers
+ * sys.stdout regardless of where it goes and System.out flushes on
+ * every write, so a script printing many small lines into a pipe or a
+ * file makes a write system call per line. If the launcher finds that
+ * stdout is no tty (see parse_launcher_args) and Jython was not asked
+ * for unbuffered output (-u, PYTHONUNBUFFERED), JavaMain calls
+ * BufferStdout before Jython's main: it replaces System.out, which
+ * Jython's sys.stdout writes to, with a PrintStream without autoflush
+ * on lijy.NativeStdout, an OutputStream whose natives (see jynative.c)
+ * collect the output in a buffer of stdoutBufferSize bytes and write it
+ * when it is full. Terminals keep line buffering.
+ *
+ *   void write(int b), write(byte[] b, int off, int len)
+ *   void flush()     writes out the buffer, e.g. for sys.stdout.flush()
+ *   void close()     only flushes, descriptor 1 stays open
+ * Write errors throw IOException.
+ *
+ * The buffer is flushed at exit by an atexit handler, which runs on
+ * every exit the JVM takes: after DestroyJavaVM, on System.exit and on
+ * Runtime.halt (os._exit). Output written after that, e.g. by daemon
+ * threads, is lost, as it would be with a Java BufferedOutputStream.
+ */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define stdoutBufferSize (64*1024) /* a pipe's capacity */
+#define copyChunk 8192
+
+static char *buffer = NULL;
+static size_t buffered = 0;
+/*
+ * Only held in plain C: array contents are copied out before taking it,
+ * so a thread stopped by the JVM at exit never holds it.
+ */
+static pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Writes out the buffer with bufferLock held, returns 0 or errno. */
+static int
+FlushLocked(void)
+{
+	size_t done = 0;
+	int error = 0;
+	while (done < buffered) {
+		ssize_t n = write(1, buffer + done, buffered - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			break;
+		}
+		done += n;
+	}
+	buffered = 0; /* dropped on errors, so exit does not retry */
+	return error;
+}
+
+/* Appends len bytes, writing out each time the buffer is full. */
+static int
+Append(const char *bytes, size_t len)
+{
+	int error = 0;
+	pthread_mutex_lock(&bufferLock);
+	while (len > 0 && error == 0) {
+		size_t n = stdoutBufferSize - buffered;
+		if (n > len)
+			n = len;
+		memcpy(buffer + buffered, bytes, n);
+		buffered += n;
+		bytes += n;
+		len -= n;
+		if (buffered == stdoutBufferSize)
+			error = FlushLocked();
+	}
+	pthread_mutex_unlock(&bufferLock);
+	return error;
+}
+
+static void
+ThrowWriteError(JNIEnv *env, int error)
+{
+	char message[128];
+	JLI_Snprintf(message, sizeof(message), "cannot write stdout: %s", strerror(error));
+	ThrowNative(env, "java/io/IOException", message);
+}
+
+static void
+FlushAtExit(void)
+{
+	pthread_mutex_lock(&bufferLock);
+	FlushLocked();
+	pthread_mutex_unlock(&bufferLock);
+}
+
+static void JNICALL
+NativeStdout_write(JNIEnv *env, jobject self, jint b)
+{
+	char c = (char) b;
+	int error = Append(&c, 1);
+	if (error != 0)
+		ThrowWriteError(env, error);
+}
+
+static void JNICALL
+NativeStdout_writeBytes(JNIEnv *env, jobject self, jbyteArray bytes, jint off, jint len)
+{
+	char chunk[copyChunk];
+	int error = 0;
+	if (bytes == NULL) {
+		ThrowNative(env, "java/lang/NullPointerException", "bytes");
+		return;
+	}
+	if (off < 0 || len < 0 || off > (*env)->GetArrayLength(env, bytes) - len) {
+		ThrowNative(env, "java/lang/IndexOutOfBoundsException", "off, len");
+		return;
+	}
+	while (len > 0 && error == 0) {
+		jint n = len < copyChunk ? len : copyChunk;
+		(*env)->GetByteArrayRegion(env, bytes, off, n, (jbyte *) chunk);
+		error = Append(chunk, n);
+		off += n;
+		len -= n;
+	}
+	if (error != 0)
+		ThrowWriteError(env, error);
+}
+
+static void JNICALL
+NativeStdout_flush(JNIEnv *env, jobject self)
+{
+	int error;
+	pthread_mutex_lock(&bufferLock);
+	error = FlushLocked();
+	pthread_mutex_unlock(&bufferLock);
+	if (error != 0)
+		ThrowWriteError(env, error);
+}
+
+static const JNINativeMethod nativeStdoutMethods[] = {
+	{"write", "(I)V", (void *) NativeStdout_write},
+	{"write", "([BII)V", (void *) NativeStdout_writeBytes},
+	{"flush", "()V", (void *) NativeStdout_flush},
+	{"close", "()V", (void *) NativeStdout_flush}
+};
+
+const NativeClass nativeStdoutClass = {
+	"lijy/NativeStdout",
+	nativeStdoutMethods, sizeof(nativeStdoutMethods) / sizeof(nativeStdoutMethods[0]),
+	NULL, 0,
+	"java/io/OutputStream"
+};
+
+void
+BufferStdout(JNIEnv *env)
+{
+	jclass stdoutClass, printStreamClass = NULL, systemClass = NULL;
+	jmethodID init, setOut;
+	jobject out = NULL, printStream = NULL;
+
+	stdoutClass = (*env)->FindClass(env, nativeStdoutClass.className);
+	if (stdoutClass != NULL && (init = (*env)->GetMethodID(env, stdoutClass, "<init>", "()V")) != NULL)
+		out = (*env)->NewObject(env, stdoutClass, init);
+	if (out != NULL && (printStreamClass = (*env)->FindClass(env, "java/io/PrintStream")) != NULL
+			&& (init = (*env)->GetMethodID(env, printStreamClass, "<init>", "(Ljava/io/OutputStream;Z)V")) != NULL)
+		printStream = (*env)->NewObject(env, printStreamClass, init, out, JNI_FALSE);
+	if (printStream != NULL && (systemClass = (*env)->FindClass(env, "java/lang/System")) != NULL
+			&& (setOut = (*env)->GetStaticMethodID(env, systemClass, "setOut", "(Ljava/io/PrintStream;)V")) != NULL) {
+		if (buffer == NULL) {
+			buffer = JLI_MemAlloc(stdoutBufferSize);
+			atexit(FlushAtExit);
+		}
+		(*env)->CallStaticVoidMethod(env, systemClass, setOut, printStream);
+	}
+	if ((*env)->ExceptionCheck(env) || buffer == NULL) {
+		(*env)->ExceptionClear(env);
+		JLI_TraceLauncher("stdout: not buffered\n");
+	} else {
+		JLI_TraceLauncher("stdout: buffered, %d bytes\n", stdoutBufferSize);
+	}
+	if (stdoutClass != NULL)
+		(*env)->DeleteLocalRef(env, stdoutClass);
+	if (printStreamClass != NULL)
+		(*env)->DeleteLocalRef(env, printStreamClass);
+	if (systemClass != NULL)
+		(*env)->DeleteLocalRef(env, systemClass);
+	if (out != NULL)
+		(*env)->DeleteLocalRef(env, out);
+	if (printStream != NULL)
+		(*env)->DeleteLocalRef(env, printStream);
+}
+
+#else
+
+const NativeClass nativeStdoutClass = {"lijy/NativeStdout", NULL, 0, NULL, 0};
+
+void
+BufferStdout(JNIEnv *env)
+{
+}
+
+#endif /* __linux__ */
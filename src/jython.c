@@ -9,6 +9,8 @@
  */
 
 #include "jython.h"
+#include "jyagent.h"
+#include "jycache.h"
 
 #ifdef _WIN32
 #include <io.h>
@@ -96,7 +98,14 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 	result->help = JNI_FALSE;
 	result->print_requested = JNI_FALSE;
 	result->profile = JNI_FALSE;
+	result->profileClasses = JNI_FALSE;
+	result->profileFiles = JNI_FALSE;
+	result->trimClasspath = JNI_FALSE;
+	result->cdsArchive = JNI_FALSE;
+	result->importTime = JNI_FALSE;
 	result->tty = JNI_FALSE;
+	result->stdoutTty = JNI_FALSE;
+	result->unbuffered = getenv("PYTHONUNBUFFERED") != NULL;
 	result->pythonHomeInArgs = JNI_FALSE;
 	result->unameInArgs = JNI_FALSE;
 	result->executableInArgs = JNI_FALSE;
@@ -115,6 +124,18 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 	result->mem = NULL;
 	result->stack = NULL;
 	result->uname = NULL;
+	result->exceptionProfile = NULL;
+	result->classProfile = NULL;
+	result->fileProfile = NULL;
+	result->classList = NULL;
+	result->preloadList = NULL;
+	result->preloadLearned = JNI_FALSE;
+	result->recordFile = NULL;
+	result->pipe = NULL;
+	result->spawnHelper = JNI_FALSE;
+	result->bufferStdout = JNI_FALSE;
+	result->embedded = JNI_FALSE;
+	result->vm = NULL;
 	setString0(result, progName, args[0]);
 	int argOff = 1;
 	char* tmp[argc];
@@ -216,12 +237,59 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 		} else if (strcmp(args[i], "--boot") == 0) {
 			result->boot = JNI_TRUE;
 			argOff++;
+		} else if (strcmp(args[i], "--importtime") == 0) {
+			result->importTime = JNI_TRUE;
+			argOff++;
 		} else if (strcmp(args[i], "--jdb") == 0) {
 			result->jdb = JNI_TRUE;
 			argOff++;
 		} else if (strcmp(args[i], "--profile") == 0) {
 			result->profile = JNI_TRUE;
 			argOff++;
+		} else if (strcmp(args[i], "--profile-classes") == 0) {
+			result->profileClasses = JNI_TRUE;
+			argOff++;
+		} else if (strcmp(args[i], "--profile-files") == 0) {
+			result->profileFiles = JNI_TRUE;
+			argOff++;
+		} else if (strcmp(args[i], "--preload-classes") == 0) {
+			result->preloadLearned = JNI_TRUE;
+			argOff++;
+		} else if (strncmp(args[i], "--preload-classes=", 18) == 0) {
+			if (result->preloadList) free(result->preloadList);
+			result->preloadList = strdup(args[i]+18);
+			result->preloadLearned = JNI_FALSE;
+			argOff++;
+		} else if (strcmp(args[i], "--trim-classpath") == 0) {
+			result->trimClasspath = JNI_TRUE;
+			argOff++;
+		} else if (strcmp(args[i], "--cds-archive") == 0) {
+			result->cdsArchive = JNI_TRUE;
+			argOff++;
+		} else if (strcmp(args[i], "--exceptions") == 0) {
+			if (result->exceptionProfile) free(result->exceptionProfile);
+			result->exceptionProfile = strdup("");
+			argOff++;
+		} else if (strncmp(args[i], "--exceptions=", 13) == 0) {
+			if (result->exceptionProfile) free(result->exceptionProfile);
+			result->exceptionProfile = strdup(args[i]+13);
+			argOff++;
+		} else if (strcmp(args[i], "--pipe") == 0) {
+			if (i+1 < argc) {
+				++i;
+			} else {
+				bad_option("Argument expected for --pipe option");
+			}
+			if (result->pipe) free(result->pipe);
+			result->pipe = strdup(args[i]);
+			argOff += 2;
+		} else if (strcmp(args[i], "--spawn-helper") == 0) {
+			result->spawnHelper = JNI_TRUE;
+			argOff++;
+		} else if (strncmp(args[i], "--record=", 9) == 0) {
+			if (result->recordFile) free(result->recordFile);
+			result->recordFile = strdup(args[i]+9);
+			argOff++;
 		} else if (strncmp(args[i], "--", 2) == 0) {
 			//pass these args on to jython
 			result->jythonCount++;
@@ -233,6 +301,8 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 	}
 	//remaining argcount is argc-argOff, so add this to jythonCount
 	result->jythonCount += argc-argOff;
+	//--pipe runs its driver as -c, the remaining args are the input files
+	if (result->pipe) result->jythonCount += 2;
 	result->jython = malloc(result->jythonCount*sizeof(char*));
 //	result->propKeys = malloc(result->propCount*sizeof(char*));
 //	result->propValues = malloc(result->propCount*sizeof(char*));
@@ -277,10 +347,29 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 			jythonPos++;
 		}
 	}
+	if (result->pipe) {
+		setString0(result, jython[jythonPos], "-c");
+		result->jython[jythonPos+1] = pipeDriver(result->pipe);
+		jythonPos += 2;
+	}
 	for (; argOff < argc; ++argOff) {
+		//for --pipe these are input files only, "-" being stdin
+		if (result->pipe && args[argOff][0] == '-' && args[argOff][1] != 0)
+			bad_option("Options must come before the input files of --pipe\n");
 		setString0(result, jython[jythonPos], args[argOff]);
 		jythonPos++;
 	}
+	//Jython's own options end at the script, -c, -m, -jar, -- or -
+	for (i = 0; i < jythonPos; ++i) {
+		const char* arg = result->jython[i];
+		if (arg[0] != '-' || arg[1] == 0 || strcmp(arg, "-c") == 0 || strcmp(arg, "-m") == 0
+				|| strcmp(arg, "-jar") == 0 || strcmp(arg, "--") == 0)
+			break;
+		if (strcmp(arg, "-u") == 0)
+			result->unbuffered = JNI_TRUE;
+		else if (strcmp(arg, "-W") == 0 || strcmp(arg, "-Q") == 0)
+			++i; //skip the option's argument, as scriptKey does
+	}
 
 	if (!result->cp) {
 		char* tmp = getenv("CLASSPATH");
@@ -315,6 +404,13 @@ JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 		result->tty = isatty(fileno(stdin));
 #endif
 	}
+#ifdef _WIN32
+	result->stdoutTty = _isatty(_fileno(stdout));
+#else
+	result->stdoutTty = isatty(fileno(stdout));
+#endif
+	//terminals keep Jython's line buffering
+	result->bufferStdout = !result->stdoutTty && !result->unbuffered;
 	if (!result->mem) {
 		char* tmp = getenv("JAVA_MEM");
 		if (tmp) {
@@ -411,6 +507,20 @@ void freeSetup(JySetup* setup) {
 		free(setup->stack);
 	if (setup->uname)
 		free(setup->uname);
+	if (setup->exceptionProfile)
+		free(setup->exceptionProfile);
+	if (setup->classProfile)
+		free(setup->classProfile);
+	if (setup->fileProfile)
+		free(setup->fileProfile);
+	if (setup->classList)
+		free(setup->classList);
+	if (setup->preloadList)
+		free(setup->preloadList);
+	if (setup->recordFile)
+		free(setup->recordFile);
+	if (setup->pipe)
+		free(setup->pipe);
 	free(setup);
 }
 
@@ -425,6 +535,23 @@ void printSetup(JySetup* js) {
 	printBool(js, help);
 	printBool(js, print_requested);
 	printBool(js, profile);
+	printBool(js, profileClasses);
+	printBool(js, profileFiles);
+	printBool(js, trimClasspath);
+	printBool(js, cdsArchive);
+	printBool(js, importTime);
+	printBool(js, spawnHelper);
+	printBool(js, tty);
+	printBool(js, stdoutTty);
+	printBool(js, unbuffered);
+	printBool(js, bufferStdout);
+	printBool(js, embedded);
+	printf("exceptionProfile: %s\n", js->exceptionProfile ?
+			(js->exceptionProfile[0] ? js->exceptionProfile : "stderr") : "off");
+	printf("recordFile: %s\n", js->recordFile ? js->recordFile : "off");
+	printf("pipe: %s\n", js->pipe ? js->pipe : "off");
+	printf("preloadList: %s\n", js->preloadList ? js->preloadList :
+			(js->preloadLearned ? "learned" : "off"));
 	printf("classpath: %s\n", js->cp);
 	printf("mem: %s\n", js->mem);
 	printf("stack: %s\n", js->stack);
@@ -676,21 +803,47 @@ Jython launcher-specific options:\n\
 -Dname=value : pass name=value property to Java VM (e.g. -Dpython.path=/a/b/c)\n\
 -Jarg    : pass argument through to Java VM (e.g. -J-Xmx512m)\n\
 --boot   : speeds up launch performance by putting Jython jars on the boot classpath\n\
+--exceptions[=file]: report thrown/caught exceptions and estimated stack-capture\n\
+           cost per Python call site at exit (to file or stderr)\n\
+--profile-classes: record which classpath entries the script loads classes from;\n\
+           later runs of the script put these jars first on the classpath\n\
+--profile-files: record which files the script reads while it starts;\n\
+           later runs of the script prefetch them in the background\n\
+--preload-classes[=file]: load the classes listed in file (default: the ones\n\
+           recorded for the script by --profile-classes or by the first\n\
+           --preload-classes run) on background threads\n\
 --help   : this help message\n\
+--importtime: print self and cumulative time of each module import to stderr,\n\
+           like CPython's -X importtime\n\
 --jdb    : run under JDB java debugger\n\
+--pipe module:function: call function with batches of the lines of stdin, or of the\n\
+           files given as arguments (gzip'ed or not); the lines it returns go to stdout;\n\
+           all options go before the files\n\
 --print  : print the Java command with args for launching Jython instead of executing it\n\
+--record=file: write command line, environment and JVM options of this launch to file\n\
+--replay=file [count]: rerun a recorded launch count times (default 10) and time it\n\
+--spawn-helper: fork a small helper before the JVM that starts lijy.NativeSpawn's\n\
+           processes, so the JVM itself never forks\n\
 ";
 
 static char* usage_2 = "\
 --profile: run with the Java Interactive Profiler (http://jiprof.sf.net)\n\
+--trim-classpath: leave out javalib jars the script's class-load profile never used\n\
+--cds-archive: on JDK 19+, keep a dynamic CDS archive of Jython's classes in the\n\
+           launcher cache and start from it\n\
 --       : pass remaining arguments through to Jython\n\
 Jython launcher environment variables:\n\
 JAVA_MEM   : Java memory (sets via -Xmx)\n\
 JAVA_OPTS  : options to pass directly to Java\n\
 JAVA_STACK : Java stack size (sets via -Xss)\n\
-JAVA_HOME  : Java installation directory\n\
+JAVA_HOME  : Java installation directory; if unset, an installed JDK is chosen\n\
+JYTHON_JDK_POLICY: without JAVA_HOME, prefer the newest JDK (newest) or newest LTS (lts)\n\
+JYTHON_JDK_MIN   : without JAVA_HOME, minimal Java feature version, e.g. 11\n\
 JYTHON_HOME: Jython installation directory\n\
 JYTHON_OPTS: default command line arguments\n\
+JYTHON_LAUNCH_SLOTS  : max. number of launchers on this host creating their JVM at once;\n\
+           others queue (and wait while available memory is below -Xmx)\n\
+JYTHON_LAUNCH_TIMEOUT: max. seconds to queue before launching anyway (default 60)\n\
 ";
 
 void print_help()
@@ -792,25 +945,158 @@ void print_help()
 //
 //	return args, jython_opts
 
+/*
+ * Class-load profiles (see jyagent.c) are kept per script in the cache
+ * (see jycache.c). The key is the script's real path, or the -c command
+ * or -m module. Returns NULL for interactive sessions.
+ * Caller is responsible to call free on return value.
+ */
+char* scriptKey(JySetup* setup) {
+	int i;
+	char* script = NULL;
+	for (i = 0; i < setup->jythonCount && !script; ++i) {
+		char* arg = setup->jython[i];
+		if (strcmp(arg, "-c") == 0 || strcmp(arg, "-m") == 0) {
+			if (i+1 == setup->jythonCount) return NULL;
+			char* result = malloc(strlen(setup->jython[i+1])+4);
+			sprintf(result, "%s %s", arg, setup->jython[i+1]);
+			return result;
+		} else if (strcmp(arg, "-W") == 0 || strcmp(arg, "-Q") == 0) {
+			++i;
+		} else if (strcmp(arg, "--") == 0 || strcmp(arg, "-jar") == 0) {
+			if (i+1 < setup->jythonCount) script = setup->jython[i+1];
+			break;
+		} else if (strcmp(arg, "-") == 0) {
+			return NULL;
+		} else if (arg[0] != '-') {
+			script = arg;
+		}
+	}
+	if (!script) return NULL;
+	char path[PATH_MAX];
+	return strdup(realpath(script, path) ? path : script);
+}
+
 #define jylibdir "/javalib/*"
+
+typedef struct {
+	char* path;
+	long classes; //-1 if not in profile
+	int pos;
+} ProfiledJar;
+
+static int compareProfiledJars(const void* a, const void* b) {
+	const ProfiledJar* ja = a;
+	const ProfiledJar* jb = b;
+	//used jars by count, then unknown ones, then unused ones
+	int ga = ja->classes > 0 ? 0 : (ja->classes < 0 ? 1 : 2);
+	int gb = jb->classes > 0 ? 0 : (jb->classes < 0 ? 1 : 2);
+	if (ga != gb) return ga-gb;
+	if (ja->classes != jb->classes) return ja->classes > jb->classes ? -1 : 1;
+	return ja->pos-jb->pos;
+}
+
+/*
+ * Reads the script's class-load profile and returns the expanded javalib
+ * jars ordered hot-first. Jars the profile knows as unused are dropped
+ * if --trim-classpath was given. Jars that are not in the profile (e.g.
+ * added after profiling) keep their place after the used ones.
+ * Note that this assumes that javalib jars don't shadow each other.
+ * Returns NULL if there is no profile; then the wildcard is used as is.
+ * Caller is responsible to call free on return value.
+ */
+static char* orderedJavalib(JySetup* setup, char* jythonHome) {
+	if (!setup->classProfile) return NULL;
+	FILE* fp = fopen(setup->classProfile, "r");
+	if (!fp) return NULL;
+	char line[PATH_MAX+64];
+	int profileCount = 0, maxProfile = 0;
+	ProfiledJar* profile = NULL;
+	while (fgets(line, sizeof(line), fp)) {
+		long classes;
+		int off = 0;
+		if (line[0] == '#' || sscanf(line, "%ld %*f %n", &classes, &off) != 1
+				|| off == 0)
+			continue;
+		line[strcspn(line, "\n")] = 0;
+		if (profileCount == maxProfile) {
+			maxProfile = maxProfile ? 2*maxProfile : 32;
+			profile = realloc(profile, maxProfile*sizeof(ProfiledJar));
+		}
+		profile[profileCount].path = strdup(line+off);
+		profile[profileCount++].classes = classes;
+	}
+	fclose(fp);
+
+	int jhl = strlen(jythonHome);
+	char wildcard[jhl+sizeof(jylibdir)];
+	strcpy(wildcard, jythonHome);
+	strcpy(wildcard+jhl, jylibdir);
+	char* expanded = (char*) JLI_WildcardExpandClasspath(wildcard);
+	int count = 1, i, j;
+	char* p;
+	for (p = expanded; *p; ++p) if (*p == PATH_SEPARATOR) ++count;
+	ProfiledJar jars[count];
+	char sep[2] = {PATH_SEPARATOR, 0};
+	count = 0;
+	for (p = strtok(expanded, sep); p; p = strtok(NULL, sep)) {
+		jars[count].path = p;
+		jars[count].classes = -1;
+		jars[count].pos = count;
+		for (j = 0; j < profileCount; ++j) {
+			if (strcmp(profile[j].path, p) == 0) {
+				jars[count].classes = profile[j].classes;
+				break;
+			}
+		}
+		count++;
+	}
+	qsort(jars, count, sizeof(ProfiledJar), compareProfiledJars);
+	int len = 0, dropped = 0, used = 0;
+	for (i = 0; i < count; ++i) len += strlen(jars[i].path)+1;
+	char* result = malloc(len+1);
+	result[0] = 0;
+	for (i = 0; i < count; ++i) {
+		if (jars[i].classes == 0 && setup->trimClasspath) {
+			dropped++;
+			continue;
+		}
+		if (jars[i].classes > 0) used++;
+		if (result[0]) strcat(result, sep);
+		strcat(result, jars[i].path);
+	}
+	JLI_TraceLauncher("class-load profile %s: %d javalib jars, %d used, %d dropped\n",
+			setup->classProfile, count, used, dropped);
+	if (expanded != wildcard) JLI_MemFree(expanded);
+	for (j = 0; j < profileCount; ++j) free(profile[j].path);
+	free(profile);
+	return result;
+}
+
 void prepareClasspath(JySetup* setup, char* jythonHome,
 		char* jythonJar, jboolean boot, jboolean freeOld)
 {
-	int jhl = strlen(jythonHome);
+	char* ordered = orderedJavalib(setup, jythonHome);
+	int jhl = ordered ? 0 : strlen(jythonHome);
 	int jjr = strlen(jythonJar);
-	int jll = sizeof(jylibdir)-1;
+	int jll = ordered ? strlen(ordered) : sizeof(jylibdir)-1;
 	int arl = strlen(setup->cp);
 	char* cpNew = malloc((jjr+jhl+jll+(!boot ? arl+3 : 2))*sizeof(char));
 	//+3 for 2*separator + null-termination
 	char* cpOff = cpNew;
 	strcpy(cpOff, jythonJar);
 	cpOff += jjr;
-	cpOff[0] = PATH_SEPARATOR;
-	cpOff += 1;
-	strcpy(cpOff, jythonHome);
-	cpOff += jhl;
-	strcpy(cpOff, jylibdir);
-	cpOff += jll;
+	if (jll) {
+		cpOff[0] = PATH_SEPARATOR;
+		cpOff += 1;
+		if (ordered) {
+			strcpy(cpOff, ordered);
+		} else {
+			strcpy(cpOff, jythonHome);
+			strcpy(cpOff+jhl, jylibdir);
+		}
+		cpOff += jhl+jll;
+	}
 	if (!boot) {
 		cpOff[0] = PATH_SEPARATOR;
 		cpOff += 1;
@@ -818,6 +1104,7 @@ void prepareClasspath(JySetup* setup, char* jythonHome,
 		cpOff += arl;
 	}
 	cpOff[0] = 0;
+	if (ordered) free(ordered);
 	if (freeOld) free(setup->cp);
 	setup->cp = cpNew;
 }
@@ -853,6 +1140,46 @@ int prepareJdbClasspathLen(char* jrePath) {
 			+ strlen(jrePath) + sizeof(jreclasses)-2;
 }
 
+/*
+ * Builds the -agentlib option for the launcher-embedded agent (see jyagent.c)
+ * from the requested agent features. Returns NULL if no feature is requested.
+ * Caller is responsible to call free on return value.
+ */
+char* prepareAgentOption(JySetup* setup) {
+	jboolean classes = setup->profileClasses && setup->classProfile;
+	if (!setup->exceptionProfile && !classes && !setup->classList)
+		return NULL;
+	int len = sizeof(agentOptPre);
+	if (setup->exceptionProfile)
+		len += sizeof(agentExceptions) + 1 + strlen(setup->exceptionProfile);
+	if (classes)
+		len += sizeof(agentClasses) + 2 + strlen(setup->classProfile);
+	if (setup->classList)
+		len += sizeof(agentClassList) + 2 + strlen(setup->classList);
+	char* result = malloc(len*sizeof(char));
+	strcpy(result, agentOptPre);
+	if (setup->exceptionProfile) {
+		strcat(result, agentExceptions);
+		if (setup->exceptionProfile[0]) {
+			strcat(result, "=");
+			strcat(result, setup->exceptionProfile);
+		}
+	}
+	if (classes) {
+		if (setup->exceptionProfile) strcat(result, ",");
+		strcat(result, agentClasses);
+		strcat(result, "=");
+		strcat(result, setup->classProfile);
+	}
+	if (setup->classList) {
+		if (setup->exceptionProfile || classes) strcat(result, ",");
+		strcat(result, agentClassList);
+		strcat(result, "=");
+		strcat(result, setup->classList);
+	}
+	return result;
+}
+
 int Jython_Main(int argc, char ** argv,         /* main argc, argc */
         int jargc, const char** jargv,          /* java args */
         int appclassc, const char** appclassv,  /* app classpath */
@@ -872,6 +1199,10 @@ int Jython_Main(int argc, char ** argv,         /* main argc, argc */
 //	}
 //	puts("\n");
 	JySetup* setup;
+	if (argc > 1 && strncmp(argv[1], "--replay=", 9) == 0) {
+		return replayLaunch(argc, argv);
+	}
+	replaySnapshot(argc, argv);
 	{
 		int jargc = 0;
 		char** jargs = NULL;
@@ -883,6 +1214,34 @@ int Jython_Main(int argc, char ** argv,         /* main argc, argc */
 		if (jargs) free(jargs);
 		if (jyargs) free(jyargs);
 	}
+	if (setup->importTime && !setup->help && !prepareImportTime(setup)) {
+		fputs("Warning: --importtime needs a writable cache directory, "
+				"e.g. $HOME/.cache\n", stderr);
+	}
+	if (!setup->help) {
+		char* key = scriptKey(setup);
+		if (key) {
+			char path[PATH_MAX];
+			if (jyCachePath(path, sizeof(path), "classes", key,
+					setup->profileClasses)) {
+				setup->classProfile = strdup(path);
+			}
+			if (jyCachePath(path, sizeof(path), "files", key,
+					setup->profileFiles)) {
+				setup->fileProfile = strdup(path);
+			}
+			if (jyCachePath(path, sizeof(path), "classlist", key,
+					setup->profileClasses || setup->preloadLearned)) {
+				//--preload-classes records the list if there is none yet
+				if (setup->profileClasses
+						|| (setup->preloadLearned && access(path, R_OK) != 0))
+					setup->classList = strdup(path);
+				else if (setup->preloadLearned)
+					setup->preloadList = strdup(path);
+			}
+			free(key);
+		}
+	}
 	//printSetup(setup);
 //	if (setup->print_requested) {
 //		puts("Error: --print is currently not supported by LiJy-launch.");
@@ -906,7 +1265,7 @@ int Jython_Main(int argc, char ** argv,         /* main argc, argc */
 	//int result = JLI_Launch(argc-setup->argOff, argv+setup->argOff,
 	int result = JLI_Launch(setup->jythonCount, setup->jython,
 			//jargc, jargv,         /* java args */
-			setup->javaCount, setup->java,
+			setup->javaCount, (const char**) setup->java,
 			appclassc, appclassv, /* app classpath */
 			pname,                /* program name */
 			lname,                /* launcher name */
@@ -919,6 +1278,45 @@ int Jython_Main(int argc, char ** argv,         /* main argc, argc */
 	freeSetup(setup);
 	return result;
 }
+
+/*
+ * Entry point of the embedding library (see jylaunch.c). Takes launcher
+ * options like Jython_Main (argv[0] being the program name), but instead
+ * of running Jython stores the JVM of this process, set up for Jython,
+ * in *pvm. Returns 0 on success.
+ */
+int Jython_Embed(int argc, char ** argv, JavaVM** pvm)
+{
+	JySetup* setup;
+	{
+		int jargc = 0;
+		char** jargs = NULL;
+		int jyargc = 0;
+		char** jyargs = NULL;
+		getOPTS(&jargc, &jargs, "JAVA_OPTS");
+		getOPTS(&jyargc, &jyargs, "JYTHON_OPTS");
+		setup = parse_launcher_args(argc, argv, jargc, jargs, jyargc, jyargs);
+		if (jargs) free(jargs);
+		if (jyargs) free(jyargs);
+	}
+	setup->embedded = JNI_TRUE;
+	ResetLaunchState();
+	int result = JLI_Launch(setup->jythonCount, setup->jython,
+			setup->javaCount, (const char**) setup->java,
+			0, NULL,              /* app classpath */
+			"jython",             /* program name */
+			"jython",             /* launcher name */
+			JNI_FALSE,            /* JAVA_ARGS */
+			JNI_FALSE,            /* classpath wildcard */
+			JNI_FALSE,            /* windows-only javaw */
+			DEFAULT_POLICY,       /* ergnomics policy */
+			setup
+		);
+	*pvm = setup->vm;
+	freeSetup(setup);
+	return result;
+}
+
 //	if args.profile and not args.help:
 //		try:
 //			os.unlink("profile.txt")
@@ -20,11 +20,11 @@
 	if (dest->name) { \
 		free(dest->name); \
 	} \
-	dest->name = malloc(strlen(value)*sizeof(char)); \
+	dest->name = malloc((strlen(value)+1)*sizeof(char)); \
 	strcpy(dest->name, value)
 
 #define setString0(dest, name, value) \
-	dest->name = malloc(strlen(value)*sizeof(char)); \
+	dest->name = malloc((strlen(value)+1)*sizeof(char)); \
 	strcpy(dest->name, value)
 
 #define executableOpt "-Dpython.executable="
@@ -37,6 +37,7 @@
 #define defaultMem "-Xmx512m"
 #define defaultStack "-Xss1024k"
 #define defaultFile_encoding "-Dfile.encoding=UTF-8"
+#define jdbModulesOpt "--add-modules=jdk.jdi"
 
 #define checkProperty(checkSource, propertyDef, checkDest) \
 	if (strncmp(checkSource+2, propertyDef+2, sizeof(propertyDef)-3) == 0) { \
@@ -76,7 +77,14 @@ typedef struct {
 	jboolean help;
 	jboolean print_requested;
 	jboolean profile;
+	jboolean profileClasses;
+	jboolean profileFiles;
+	jboolean trimClasspath;
+	jboolean cdsArchive; //--cds-archive: dynamic CDS archive in the cache, see java.c
+	jboolean importTime;
 	jboolean tty;
+	jboolean stdoutTty;
+	jboolean unbuffered; //-u for Jython, or PYTHONUNBUFFERED set
 //Determine whether defaults for some certain
 //propertys should be set-up:
 	jboolean pythonHomeInArgs;
@@ -98,8 +106,21 @@ typedef struct {
 	char* stack;
 	char* progName;
 	char* uname;
+	char* exceptionProfile; //report file for --exceptions, "" for stderr
+	char* classProfile; //class-load profile of the script in the cache
+	char* fileProfile; //file profile of the script in the cache, see jyprefetch.c
+	char* classList; //learned class list of the script in the cache, see jypreload.c
+	char* preloadList; //class list to preload, NULL without --preload-classes
+	jboolean preloadLearned; //--preload-classes without a file: use classList
+	char* recordFile; //replay file for --record, see jyreplay.c
+	char* pipe; //module:function for --pipe, see jypipe.c
+	jboolean spawnHelper; //--spawn-helper, see jyspawn.c
+	jboolean bufferStdout; //stdout is no tty: buffer it natively, see jystdout.c
+	jboolean embedded; //prepare the JVM for a library host instead of running Jython
+	JavaVM* vm; //the JVM handed to the library host
 } JySetup;
 
+void getOPTS(int* argcDest, char*** argsDest, char* envOpts);
 JySetup* parse_launcher_args(int argc, char** args, int joptsc, char** jopts,
 		int jyoptsc, char** jyopts);
 void freeSetup(JySetup* setup);
@@ -112,6 +133,17 @@ void prepareClasspath(JySetup* setup, char* jythonHome,
 		char* jythonJar, jboolean boot, jboolean freeOld);
 void prepareJdbClasspath(char* jrePath, char* dest);
 int prepareJdbClasspathLen(char* jrePath);
+char* prepareAgentOption(JySetup* setup);
+char* scriptKey(JySetup* setup);
+jboolean prepareImportTime(JySetup* setup);
+void replaySnapshot(int argc, char** argv);
+void recordLaunch(JySetup* setup, const char* jrepath, const char* jvmpath,
+		JavaVMOption* options, int numOptions);
+int replayLaunch(int argc, char** argv);
+void startPrefetch(JySetup* setup);
+void stopFileProfile();
+char* pipeDriver(const char* spec);
+int Jython_Embed(int argc, char** argv, JavaVM** pvm);
 
 int
 JLI_Launch(int argc, char ** argv,              /* main argc, argc */
@@ -0,0 +1,334 @@
+/*
+ * jytokenize.c
+ *
+ * Natives of lijy.NativeTokenizer (see jynative.c): line and CSV
+ * splitting for scripts. Jython's csv module is pure Python, i.e. some
+ * interpreter dispatches per byte; here the bytes are scanned for line
+ * breaks, delimiters and quotes 64 at a time with SSE2 or, if the CPU
+ * has it, AVX2 (chosen at the first call), and Python only sees the
+ * offsets of the fields. lib/lijycsv.py turns them into rows.
+ *
+ * All methods take a ByteBuffer, direct (e.g. from NativeMap.map) or
+ * backed by an array, and absolute positions start and end in it.
+ *
+ *   int lines(buffer, start, end, int[] offsets)
+ *     Stores the positions of the '\n' in [start, end) in offsets, as
+ *     many as fit. Returns their number.
+ *
+ *   int fields(buffer, start, end, delimiter, quote, eof, int[] offsets)
+ *     Splits the CSV rows in [start, end). For each field, the position
+ *     of the delimiter after it is stored, or ~position of the '\n' that
+ *     ends the row. Delimiters and line breaks between quote characters
+ *     don't count (quote -1 for none); fields keep their quotes. Only
+ *     complete rows are returned, plus the last one without '\n' if eof.
+ *     Positions count the code points from start, i.e. they index the
+ *     string decode(buffer, start, stop) for valid UTF-8. Returns the
+ *     number n of offsets; offsets[n] is the byte position stop where
+ *     the next row starts, so offsets needs one spare element.
+ *
+ *   String decode(buffer, start, end)
+ *     Decodes UTF-8, invalid bytes become U+FFFD.
+ */
+
+#include "java.h"
+#include "jynative.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TOKENIZE_X86
+#include <immintrin.h>
+#endif
+
+#define blockSize 64
+
+/*
+ * Sets *special to the bits of the bytes of p[0..64) that equal one of
+ * c[0..3), *cont to those of UTF-8 continuation bytes.
+ */
+typedef void (*ScanBlock)(const unsigned char *p, const unsigned char *c,
+		unsigned long long *special, unsigned long long *cont);
+
+static ScanBlock scanBlock = NULL;
+
+#ifndef TOKENIZE_X86
+static void
+ScanScalar(const unsigned char *p, const unsigned char *c,
+		unsigned long long *special, unsigned long long *cont)
+{
+	int i;
+	*special = *cont = 0;
+	for (i = 0; i < blockSize; ++i) {
+		if (p[i] == c[0] || p[i] == c[1] || p[i] == c[2])
+			*special |= 1ULL << i;
+		if ((p[i] & 0xC0) == 0x80)
+			*cont |= 1ULL << i;
+	}
+}
+#else
+static void
+ScanSSE2(const unsigned char *p, const unsigned char *c,
+		unsigned long long *special, unsigned long long *cont)
+{
+	__m128i c0 = _mm_set1_epi8((char) c[0]), c1 = _mm_set1_epi8((char) c[1]);
+	__m128i c2 = _mm_set1_epi8((char) c[2]), lead = _mm_set1_epi8((char) 0xC0);
+	int i;
+	*special = *cont = 0;
+	for (i = 0; i < blockSize; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p+i));
+		__m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0),
+				_mm_cmpeq_epi8(v, c1)), _mm_cmpeq_epi8(v, c2));
+		/* signed: 0x80..0xBF are -128..-65, below 0xC0 = -64 */
+		__m128i k = _mm_cmplt_epi8(v, lead);
+		*special |= (unsigned long long) (unsigned) _mm_movemask_epi8(s) << i;
+		*cont |= (unsigned long long) (unsigned) _mm_movemask_epi8(k) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+ScanAVX2(const unsigned char *p, const unsigned char *c,
+		unsigned long long *special, unsigned long long *cont)
+{
+	__m256i c0 = _mm256_set1_epi8((char) c[0]), c1 = _mm256_set1_epi8((char) c[1]);
+	__m256i c2 = _mm256_set1_epi8((char) c[2]), lead = _mm256_set1_epi8((char) 0xC0);
+	int i;
+	*special = *cont = 0;
+	for (i = 0; i < blockSize; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p+i));
+		__m256i s = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, c0),
+				_mm256_cmpeq_epi8(v, c1)), _mm256_cmpeq_epi8(v, c2));
+		__m256i k = _mm256_cmpgt_epi8(lead, v);
+		*special |= (unsigned long long) (unsigned) _mm256_movemask_epi8(s) << i;
+		*cont |= (unsigned long long) (unsigned) _mm256_movemask_epi8(k) << i;
+	}
+}
+#endif
+
+static void
+ChooseScanner()
+{
+#ifdef TOKENIZE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scanBlock = ScanAVX2;
+		JLI_TraceLauncher("tokenizer: AVX2\n");
+	} else {
+		scanBlock = ScanSSE2;
+		JLI_TraceLauncher("tokenizer: SSE2\n");
+	}
+#else
+	scanBlock = ScanScalar;
+#endif
+}
+
+/* Scans p[0..n), n <= 64, zero padded when shorter. */
+static void
+Scan(const unsigned char *p, jint n, const unsigned char *c,
+		unsigned long long *special, unsigned long long *cont)
+{
+	if (n == blockSize) {
+		scanBlock(p, c, special, cont);
+	} else {
+		unsigned char block[blockSize];
+		unsigned long long valid = (1ULL << n) - 1;
+		memcpy(block, p, n);
+		memset(block+n, 0, blockSize-n);
+		scanBlock(block, c, special, cont);
+		*special &= valid;
+		*cont &= valid;
+	}
+}
+
+typedef struct {
+	const unsigned char *bytes;     /* index 0 of the buffer */
+	jbyteArray array;               /* of a heap buffer, else NULL */
+	void *critical;                 /* the array's elements */
+} BufferBytes;
+
+static void
+ReleaseBytes(JNIEnv *env, BufferBytes *b)
+{
+	if (b->critical != NULL)
+		(*env)->ReleasePrimitiveArrayCritical(env, b->array, b->critical, JNI_ABORT);
+	b->critical = NULL;
+}
+
+/*
+ * Gets the bytes of a buffer: direct, or the critical array of a heap
+ * buffer, to be released with ReleaseBytes. Returns JNI_FALSE with an
+ * exception pending if [start, end) is not inside the buffer.
+ */
+static jboolean
+GetBytes(JNIEnv *env, jobject buffer, jint start, jint end, BufferBytes *b)
+{
+	jlong capacity = -1;
+	b->bytes = NULL;
+	b->array = NULL;
+	b->critical = NULL;
+	if (buffer != NULL) {
+		b->bytes = (*env)->GetDirectBufferAddress(env, buffer);
+		capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+	}
+	if (b->bytes == NULL && buffer != NULL) {
+		jclass cls = (*env)->FindClass(env, "java/nio/ByteBuffer");
+		jmethodID getArray = (*env)->GetMethodID(env, cls, "array", "()[B");
+		jmethodID getOffset = (*env)->GetMethodID(env, cls, "arrayOffset", "()I");
+		jint offset = 0;
+		(*env)->DeleteLocalRef(env, cls);
+		b->array = (*env)->CallObjectMethod(env, buffer, getArray);
+		/* array() throws for a read-only heap buffer */
+		if (!(*env)->ExceptionCheck(env) && b->array != NULL)
+			offset = (*env)->CallIntMethod(env, buffer, getOffset);
+		if ((*env)->ExceptionCheck(env) || b->array == NULL) {
+			(*env)->ExceptionClear(env);
+			b->array = NULL;
+		} else {
+			capacity = (*env)->GetArrayLength(env, b->array) - offset;
+			b->critical = (*env)->GetPrimitiveArrayCritical(env, b->array, NULL);
+			if (b->critical == NULL)
+				return JNI_FALSE; /* OutOfMemoryError pending */
+			b->bytes = (unsigned char *) b->critical + offset;
+		}
+	}
+	if (b->bytes == NULL || start < 0 || start > end || end > capacity) {
+		ReleaseBytes(env, b);
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeTokenizer: no byte buffer with an accessible array, or bad range");
+		return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
+static jint JNICALL
+NativeTokenizer_lines(JNIEnv *env, jclass cls, jobject buffer, jint start, jint end, jintArray jOffsets)
+{
+	const unsigned char nl[3] = {'\n', '\n', '\n'};
+	const unsigned char *bytes;
+	BufferBytes b;
+	jint *offsets, cap, count = 0, pos;
+	if (jOffsets == NULL) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeTokenizer.lines: no offsets");
+		return 0;
+	}
+	if (scanBlock == NULL)
+		ChooseScanner();
+	cap = (*env)->GetArrayLength(env, jOffsets);
+	if (!GetBytes(env, buffer, start, end, &b))
+		return 0;
+	bytes = b.bytes;
+	offsets = (*env)->GetPrimitiveArrayCritical(env, jOffsets, NULL);
+	if (offsets == NULL) {
+		ReleaseBytes(env, &b);
+		return 0;
+	}
+	for (pos = start; pos < end && count < cap; pos += blockSize) {
+		unsigned long long special, cont;
+		Scan(bytes+pos, end-pos < blockSize ? end-pos : blockSize, nl, &special, &cont);
+		while (special && count < cap) {
+			offsets[count++] = pos + __builtin_ctzll(special);
+			special &= special-1;
+		}
+	}
+	(*env)->ReleasePrimitiveArrayCritical(env, jOffsets, offsets, 0);
+	ReleaseBytes(env, &b);
+	return count;
+}
+
+static jint JNICALL
+NativeTokenizer_fields(JNIEnv *env, jclass cls, jobject buffer, jint start, jint end,
+		jint delimiter, jint quote, jboolean eof, jintArray jOffsets)
+{
+	unsigned char chars[3];
+	const unsigned char *bytes;
+	BufferBytes b;
+	jint *offsets, cap, count = 0, rows = 0, rowEnd = start, pos, n, cp = 0;
+	jboolean quoted = JNI_FALSE;
+	if (delimiter <= 0 || delimiter > 127 || delimiter == '\n' || quote > 127
+			|| quote == 0 || quote == delimiter || quote == '\n') {
+		ThrowNative(env, "java/lang/IllegalArgumentException",
+				"NativeTokenizer.fields: delimiter and quote must be distinct ASCII characters");
+		return 0;
+	}
+	if (scanBlock == NULL)
+		ChooseScanner();
+	cap = jOffsets == NULL ? -1 : (*env)->GetArrayLength(env, jOffsets) - 1;
+	if (cap < 0) {
+		ThrowNative(env, "java/lang/IllegalArgumentException", "NativeTokenizer.fields: no offsets");
+		return 0;
+	}
+	if (!GetBytes(env, buffer, start, end, &b))
+		return 0;
+	bytes = b.bytes;
+	chars[0] = '\n';
+	chars[1] = (unsigned char) delimiter;
+	chars[2] = quote < 0 ? '\n' : (unsigned char) quote;
+	offsets = (*env)->GetPrimitiveArrayCritical(env, jOffsets, NULL);
+	if (offsets == NULL) {
+		ReleaseBytes(env, &b);
+		return 0;
+	}
+	for (pos = start; pos < end; pos += n) {
+		unsigned long long special, cont;
+		n = end-pos < blockSize ? end-pos : blockSize;
+		Scan(bytes+pos, n, chars, &special, &cont);
+		for (; special; special &= special-1) {
+			int i = __builtin_ctzll(special);
+			unsigned char c = bytes[pos+i];
+			if (c == quote) {
+				/* "" inside a quoted field toggles twice */
+				quoted = !quoted;
+				continue;
+			}
+			if (quoted)
+				continue;
+			if (count == cap)
+				goto full;
+			offsets[count] = cp + i - __builtin_popcountll(cont & ((1ULL << i) - 1));
+			if (c == '\n') {
+				offsets[count] = ~offsets[count];
+				rows = count+1;
+				rowEnd = pos+i+1;
+			}
+			++count;
+		}
+		cp += n - __builtin_popcountll(cont);
+	}
+	if (eof && rowEnd < end && count < cap) {
+		offsets[count++] = ~cp;
+		rows = count;
+		rowEnd = end;
+	}
+full:
+	offsets[rows] = rowEnd;
+	(*env)->ReleasePrimitiveArrayCritical(env, jOffsets, offsets, 0);
+	ReleaseBytes(env, &b);
+	return rows;
+}
+
+static jstring JNICALL
+NativeTokenizer_decode(JNIEnv *env, jclass cls, jobject buffer, jint start, jint end)
+{
+	BufferBytes b;
+	jchar *chars;
+	jsize n;
+	jstring result;
+	if (!GetBytes(env, buffer, start, end, &b))
+		return NULL;
+	chars = JLI_MemAlloc((end-start+1)*sizeof(jchar));
+	n = DecodeUtf8((const char *) b.bytes+start, end-start, chars);
+	ReleaseBytes(env, &b);
+	result = (*env)->NewString(env, chars, n);
+	JLI_MemFree(chars);
+	return result;
+}
+
+static const JNINativeMethod nativeTokenizerMethods[] = {
+	{"lines", "(Ljava/nio/ByteBuffer;II[I)I", (void *) NativeTokenizer_lines},
+	{"fields", "(Ljava/nio/ByteBuffer;IIIIZ[I)I", (void *) NativeTokenizer_fields},
+	{"decode", "(Ljava/nio/ByteBuffer;II)Ljava/lang/String;", (void *) NativeTokenizer_decode}
+};
+
+const NativeClass nativeTokenizerClass = {
+	"lijy/NativeTokenizer",
+	nativeTokenizerMethods, sizeof(nativeTokenizerMethods)/sizeof(nativeTokenizerMethods[0]),
+	NULL, 0
+};
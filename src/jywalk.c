@@ -0,0 +1,456 @@
+/*
+ * jywalk.c
+ *
+ * Natives of lijy.NativeWalk (see jynative.c): walking directory trees
+ * for os.walk-heavy scripts. Jython's os.walk lists each directory with
+ * java.io.File, one File object per entry, and stats every entry again
+ * to tell directories from files. Here walker threads read directories
+ * with getdents64 into a large buffer, classify entries by the d_type
+ * readdir reports (stat only for symbolic links and file systems that
+ * leave it DT_UNKNOWN), and share the pending directories, so
+ * independent subtrees are read in parallel. The caller takes the
+ * results in batches. lib/lijywalk.py offers this as os.walk.
+ *
+ *   long open(String top, int threads, boolean followLinks)
+ *     Starts threads walkers (0: one per processor, at most
+ *     maxWalkers) on the tree under top.
+ *   Object[] next(long walk, int maxEntries)
+ *     The next batch of directories, blocking until one is read: per
+ *     directory three elements, its path, String[] subdirectories and
+ *     String[] other entries, as os.walk yields them. A directory that
+ *     could not be read has null subdirectories and an Integer errno
+ *     instead of the entries. A batch holds about maxEntries names or
+ *     whatever is ready; null when the walk is complete.
+ *   void close(long walk)
+ *     Stops the walkers and frees the walk; every open needs a close.
+ * Directories come in no particular order: each as soon as it was read.
+ * As in os.walk, symbolic links to directories are listed as
+ * subdirectories but only walked with followLinks. top is passed as
+ * UTF-8, names are decoded from UTF-8 and undecodable bytes become
+ * U+FFFD.
+ */
+
+#define _GNU_SOURCE /* O_DIRECTORY, fstatat */
+
+#include "java.h"
+#include "jynative.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define maxWalkers 16
+#define direntBufferSize (64*1024)
+#define maxPendingResults (32*1024*1024) /* bytes the walkers may get ahead */
+
+/* as the kernel fills it for getdents64 */
+typedef struct {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} Dirent64;
+
+/* A directory read: its path, then the names of subdirectories, then the others. */
+typedef struct Record {
+	struct Record *next;
+	int error;                 /* errno if the directory could not be read */
+	int dirCount;
+	int fileCount;
+	size_t size;
+	char data[];
+} Record;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;       /* a directory is pending, or the walk ended */
+	pthread_cond_t ready;      /* a record is ready, or the walk ended */
+	pthread_cond_t space;      /* the records fit below maxPendingResults */
+	char **pending;            /* paths of the directories to read, a stack */
+	int pendingCount;
+	int pendingCapacity;
+	int busy;                  /* directories being read */
+	Record *head, *tail;
+	size_t resultBytes;
+	jboolean followLinks;
+	jboolean cancelled;
+	int threadCount;
+	pthread_t threads[maxWalkers];
+} Walk;
+
+/* A growable byte buffer. */
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Buffer;
+
+static void
+Append(Buffer *b, const char *s, size_t len)
+{
+	if (b->length + len > b->capacity) {
+		b->capacity = 2*b->capacity + len + 256;
+		b->data = JLI_MemRealloc(b->data, b->capacity);
+	}
+	memcpy(b->data + b->length, s, len);
+	b->length += len;
+}
+
+static void
+PushPending(Walk *w, char *path)
+{
+	if (w->pendingCount == w->pendingCapacity) {
+		w->pendingCapacity = w->pendingCapacity ? 2*w->pendingCapacity : 256;
+		w->pending = JLI_MemRealloc(w->pending, w->pendingCapacity * sizeof(char *));
+	}
+	w->pending[w->pendingCount++] = path;
+}
+
+/*
+ * Whether the entry is a directory, and whether to walk into it, with
+ * os.walk's rules: links to directories count, walked with followLinks.
+ */
+static void
+Classify(Walk *w, int dirfd, const Dirent64 *d, jboolean *isDir, jboolean *descend)
+{
+	struct stat st;
+	unsigned char type = d->d_type;
+	*isDir = *descend = JNI_FALSE;
+	if (type == DT_UNKNOWN) {
+		if (fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			return;
+		type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+	}
+	if (type == DT_DIR) {
+		*isDir = *descend = JNI_TRUE;
+	} else if (type == DT_LNK && fstatat(dirfd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+		*isDir = JNI_TRUE;
+		*descend = w->followLinks;
+	}
+}
+
+/*
+ * Reads the directory at path into a record; the subdirectories to walk
+ * go to *children as full paths.
+ */
+static Record *
+ReadDirectory(Walk *w, const char *path, char ***children, int *childCount)
+{
+	Buffer dirs = {NULL, 0, 0}, files = {NULL, 0, 0};
+	size_t pathLength = JLI_StrLen(path);
+	int capacity = 0, fd, error = 0, dirCount = 0, fileCount = 0;
+	char *entries;
+	Record *r;
+	long n;
+
+	*children = NULL;
+	*childCount = 0;
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		error = errno;
+	} else {
+		entries = JLI_MemAlloc(direntBufferSize);
+		while ((n = syscall(SYS_getdents64, fd, entries, direntBufferSize)) > 0) {
+			long off;
+			for (off = 0; off < n; ) {
+				Dirent64 *d = (Dirent64 *) (entries + off);
+				size_t len = JLI_StrLen(d->d_name);
+				jboolean isDir, descend;
+				off += d->d_reclen;
+				if (d->d_name[0] == '.' && (len == 1 || (len == 2 && d->d_name[1] == '.')))
+					continue;
+				Classify(w, fd, d, &isDir, &descend);
+				if (!isDir) {
+					Append(&files, d->d_name, len + 1);
+					++fileCount;
+					continue;
+				}
+				Append(&dirs, d->d_name, len + 1);
+				++dirCount;
+				if (descend) {
+					/* no second slash after a top of "/" */
+					size_t sep = pathLength > 0 && path[pathLength-1] == '/' ? 0 : 1;
+					char *child = JLI_MemAlloc(pathLength + sep + len + 1);
+					memcpy(child, path, pathLength);
+					child[pathLength] = '/';
+					memcpy(child + pathLength + sep, d->d_name, len + 1);
+					if (*childCount == capacity) {
+						capacity = capacity ? 2*capacity : 64;
+						*children = JLI_MemRealloc(*children, capacity * sizeof(char *));
+					}
+					(*children)[(*childCount)++] = child;
+				}
+			}
+		}
+		if (n < 0)
+			error = errno;
+		JLI_MemFree(entries);
+		close(fd);
+	}
+	r = JLI_MemAlloc(sizeof(Record) + pathLength + 1 + dirs.length + files.length);
+	r->next = NULL;
+	r->error = error;
+	r->size = pathLength + 1 + dirs.length + files.length;
+	r->dirCount = dirCount;
+	r->fileCount = fileCount;
+	memcpy(r->data, path, pathLength + 1);
+	if (dirs.length)
+		memcpy(r->data + pathLength + 1, dirs.data, dirs.length);
+	if (files.length)
+		memcpy(r->data + pathLength + 1 + dirs.length, files.data, files.length);
+	if (dirs.data)
+		JLI_MemFree(dirs.data);
+	if (files.data)
+		JLI_MemFree(files.data);
+	return r;
+}
+
+static void *
+Walker(void *arg)
+{
+	Walk *w = arg;
+	char **children;
+	int childCount, i;
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		char *path;
+		Record *r;
+		while (w->pendingCount == 0 && w->busy > 0 && !w->cancelled)
+			pthread_cond_wait(&w->work, &w->lock);
+		if (w->cancelled || w->pendingCount == 0)
+			break;
+		path = w->pending[--w->pendingCount];
+		w->busy++;
+		pthread_mutex_unlock(&w->lock);
+
+		r = ReadDirectory(w, path, &children, &childCount);
+		JLI_MemFree(path);
+
+		pthread_mutex_lock(&w->lock);
+		for (i = 0; i < childCount; ++i)
+			PushPending(w, children[i]);
+		if (children)
+			JLI_MemFree(children);
+		if (childCount > 1)
+			pthread_cond_broadcast(&w->work);
+		else if (childCount == 1)
+			pthread_cond_signal(&w->work);
+		if (w->tail)
+			w->tail->next = r;
+		else
+			w->head = r;
+		w->tail = r;
+		w->resultBytes += r->size;
+		pthread_cond_signal(&w->ready);
+		if (--w->busy == 0 && w->pendingCount == 0) {
+			pthread_cond_broadcast(&w->work);
+			pthread_cond_broadcast(&w->ready);
+		}
+		while (w->resultBytes > maxPendingResults && !w->cancelled)
+			pthread_cond_wait(&w->space, &w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void JNICALL NativeWalk_close(JNIEnv *env, jclass cls, jlong handle);
+
+static jlong JNICALL
+NativeWalk_open(JNIEnv *env, jclass cls, jstring top, jint threads, jboolean followLinks)
+{
+	char *p;
+	Walk *w;
+	int i;
+
+	if ((p = GetStringUtf8(env, top)) == NULL) {
+		ThrowNative(env, "java/lang/NullPointerException", "NativeWalk: no top directory");
+		return 0;
+	}
+	if (threads <= 0)
+		threads = (jint) sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	if (threads > maxWalkers)
+		threads = maxWalkers;
+	w = JLI_MemAlloc(sizeof(Walk));
+	memset(w, 0, sizeof(Walk));
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->work, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->space, NULL);
+	w->followLinks = followLinks;
+	PushPending(w, p);
+	pthread_mutex_lock(&w->lock);
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&w->threads[w->threadCount], NULL, Walker, w) == 0)
+			w->threadCount++;
+	}
+	pthread_mutex_unlock(&w->lock);
+	if (w->threadCount == 0) {
+		NativeWalk_close(env, cls, (jlong) (intptr_t) w);
+		ThrowNative(env, "java/io/IOException", "NativeWalk: cannot start walker threads");
+		return 0;
+	}
+	return (jlong) (intptr_t) w;
+}
+
+/* A String[] of the count names packed at *s, advancing *s past them. */
+static jobjectArray
+NameArray(JNIEnv *env, jclass stringClass, const char **s, int count)
+{
+	jobjectArray result = (*env)->NewObjectArray(env, count, stringClass, NULL);
+	int i;
+	for (i = 0; result != NULL && i < count; ++i) {
+		size_t len = JLI_StrLen(*s);
+		jstring name = NewStringUtf8(env, *s, len);
+		if (name == NULL)
+			return NULL;
+		(*env)->SetObjectArrayElement(env, result, i, name);
+		(*env)->DeleteLocalRef(env, name);
+		*s += len + 1;
+	}
+	return result;
+}
+
+/* Stores the three elements of r at batch[index]; JNI_FALSE with an exception pending. */
+static jboolean
+StoreRecord(JNIEnv *env, jobjectArray batch, jsize index, const Record *r, jclass stringClass)
+{
+	const char *s = r->data;
+	size_t len = JLI_StrLen(s);
+	jobject path, dirs, files;
+	path = NewStringUtf8(env, s, len);
+	if (path == NULL)
+		return JNI_FALSE;
+	(*env)->SetObjectArrayElement(env, batch, index, path);
+	(*env)->DeleteLocalRef(env, path);
+	s += len + 1;
+	if (r->error != 0) {
+		jclass integerClass = (*env)->FindClass(env, "java/lang/Integer");
+		jmethodID valueOf = integerClass == NULL ? NULL :
+				(*env)->GetStaticMethodID(env, integerClass, "valueOf", "(I)Ljava/lang/Integer;");
+		if (valueOf == NULL)
+			return JNI_FALSE;
+		files = (*env)->CallStaticObjectMethod(env, integerClass, valueOf, r->error);
+		(*env)->DeleteLocalRef(env, integerClass);
+		if (files == NULL)
+			return JNI_FALSE;
+		(*env)->SetObjectArrayElement(env, batch, index + 2, files);
+		(*env)->DeleteLocalRef(env, files);
+		return JNI_TRUE;
+	}
+	if ((dirs = NameArray(env, stringClass, &s, r->dirCount)) == NULL)
+		return JNI_FALSE;
+	(*env)->SetObjectArrayElement(env, batch, index + 1, dirs);
+	(*env)->DeleteLocalRef(env, dirs);
+	if ((files = NameArray(env, stringClass, &s, r->fileCount)) == NULL)
+		return JNI_FALSE;
+	(*env)->SetObjectArrayElement(env, batch, index + 2, files);
+	(*env)->DeleteLocalRef(env, files);
+	return JNI_TRUE;
+}
+
+static jobjectArray JNICALL
+NativeWalk_next(JNIEnv *env, jclass cls, jlong handle, jint maxEntries)
+{
+	Walk *w = (Walk *) (intptr_t) handle;
+	Record *taken, *r, *next;
+	jclass objectClass, stringClass;
+	jobjectArray batch = NULL;
+	int count = 0, entries = 0;
+	jsize index;
+
+	if (w == NULL) {
+		ThrowNative(env, "java/lang/NullPointerException", "NativeWalk: closed");
+		return NULL;
+	}
+	pthread_mutex_lock(&w->lock);
+	while (w->head == NULL && (w->pendingCount > 0 || w->busy > 0))
+		pthread_cond_wait(&w->ready, &w->lock);
+	/* take records up to maxEntries names, at least one */
+	taken = w->head;
+	for (r = w->head; r != NULL && (count == 0 || entries < maxEntries); r = r->next) {
+		++count;
+		entries += r->dirCount + r->fileCount + 1;
+		w->resultBytes -= r->size;
+		w->head = r->next;
+	}
+	if (w->head == NULL)
+		w->tail = NULL;
+	if (count > 0)
+		pthread_cond_broadcast(&w->space);
+	pthread_mutex_unlock(&w->lock);
+	if (count == 0)
+		return NULL;
+
+	objectClass = (*env)->FindClass(env, "java/lang/Object");
+	stringClass = (*env)->FindClass(env, "java/lang/String");
+	if (objectClass != NULL && stringClass != NULL)
+		batch = (*env)->NewObjectArray(env, 3*count, objectClass, NULL);
+	for (r = taken, index = 0; count > 0; --count, index += 3, r = next) {
+		next = r->next;
+		if (batch != NULL && !StoreRecord(env, batch, index, r, stringClass)) {
+			(*env)->DeleteLocalRef(env, batch);
+			batch = NULL;
+		}
+		JLI_MemFree(r);
+	}
+	if (objectClass != NULL)
+		(*env)->DeleteLocalRef(env, objectClass);
+	if (stringClass != NULL)
+		(*env)->DeleteLocalRef(env, stringClass);
+	return batch;
+}
+
+static void JNICALL
+NativeWalk_close(JNIEnv *env, jclass cls, jlong handle)
+{
+	Walk *w = (Walk *) (intptr_t) handle;
+	Record *r, *next;
+	int i;
+	if (w == NULL)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->cancelled = JNI_TRUE;
+	pthread_cond_broadcast(&w->work);
+	pthread_cond_broadcast(&w->space);
+	pthread_mutex_unlock(&w->lock);
+	for (i = 0; i < w->threadCount; ++i)
+		pthread_join(w->threads[i], NULL);
+	for (i = 0; i < w->pendingCount; ++i)
+		JLI_MemFree(w->pending[i]);
+	if (w->pending)
+		JLI_MemFree(w->pending);
+	for (r = w->head; r != NULL; r = next) {
+		next = r->next;
+		JLI_MemFree(r);
+	}
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->work);
+	pthread_cond_destroy(&w->ready);
+	pthread_cond_destroy(&w->space);
+	JLI_MemFree(w);
+}
+
+static const JNINativeMethod nativeWalkMethods[] = {
+	{"open", "(Ljava/lang/String;IZ)J", (void *) NativeWalk_open},
+	{"next", "(JI)[Ljava/lang/Object;", (void *) NativeWalk_next},
+	{"close", "(J)V", (void *) NativeWalk_close}
+};
+
+const NativeClass nativeWalkClass = {
+	"lijy/NativeWalk",
+	nativeWalkMethods, sizeof(nativeWalkMethods) / sizeof(nativeWalkMethods[0]),
+	NULL, 0
+};
+
+#else
+
+const NativeClass nativeWalkClass = {"lijy/NativeWalk", NULL, 0, NULL, 0};
+
+#endif /* __linux__ */
@@ -93,6 +93,7 @@
 #include "java.h"       /* Strictly for PATH_SEPARATOR/FILE_SEPARATOR */
 #include "jli_util.h"
 #include "wildcard.h"
+#include "jyprobe.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -107,7 +108,7 @@ exists(const char* filename)
 #ifdef _WIN32
     return _access(filename, 0) == 0;
 #else
-    return access(filename, F_OK) == 0;
+    return ProbeExists(filename);
 #endif
 }
 